@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Microbenchmark program main module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Time small functions on the per-message paths of the server.  Each
+ * benchmark is calibrated to run for a while per repetition, warmed up
+ * once and repeated.  Results are written to stdout as tab separated
+ * values in ns per operation to be compared between commits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "trace.h"
+#include "tool.h"
+#include "evl.h"
+#include "line.h"
+#include "msg.h"
+#include "cmd.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define BENCH_DEF_REPS  15      /* default number of repetitions */
+#define BENCH_DEF_MS    20      /* default ms per repetition */
+#define BENCH_MAX_REPS  1000    /* max number of repetitions */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* benchmark */
+typedef struct bench_strct {
+    const char *name;           /* name */
+    void (*run)(unsigned long long n); /* run n operations */
+    void (*setup)(void);        /* called before, NULL when none */
+    void (*teardown)(void);     /* called after, NULL when none */
+} bench_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static volatile unsigned long long sink; /* keeps results alive */
+static int stderr_fd = -1;      /* stderr while traces are discarded */
+static char dump_buf[64];       /* dumped by T_D() */
+static char line_chat[] = "hello, everyone in the lobby\r\n";
+static char line_quit[] = "quit\r\n";
+static char prefix[] = "[localhost] ";
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static void run_is_number(unsigned long long n);
+static void run_is_number_bad(unsigned long long n);
+static void run_timeval_sub(unsigned long long n);
+static void run_timeout_chk(unsigned long long n);
+static void run_tm(unsigned long long n);
+static void run_td(unsigned long long n);
+static void run_line_next(unsigned long long n);
+static void run_cmd_miss(unsigned long long n);
+static void run_cmd_hit(unsigned long long n);
+static void run_msg_chat(unsigned long long n);
+static void run_msg_stamp(unsigned long long n);
+static void trace_on(void);
+static void trace_off(void);
+static void bench_one(const bench_t *b, int reps, unsigned int ms);
+static int cmp_double(const void *a, const void *b);
+static void usage(void);
+
+/*------------------------------
+ * benchmarks
+ *------------------------------*/
+static const bench_t benches[] = {
+    { "is_number",          run_is_number,     NULL,     NULL      },
+    { "is_number_bad",      run_is_number_bad, NULL,     NULL      },
+    { "timeval_sub",        run_timeval_sub,   NULL,     NULL      },
+    { "timeout_chk",        run_timeout_chk,   NULL,     NULL      },
+    { "T_M_disabled",       run_tm,            NULL,     NULL      },
+    { "T_M_enabled",        run_tm,            trace_on, trace_off },
+    { "T_D_disabled",       run_td,            NULL,     NULL      },
+    { "T_D_enabled",        run_td,            trace_on, trace_off },
+    { "line_next",          run_line_next,     NULL,     NULL      },
+    { "cmd_lookup_miss",    run_cmd_miss,      NULL,     NULL      },
+    { "cmd_lookup_hit",     run_cmd_hit,       NULL,     NULL      },
+    { "msg_chat",           run_msg_chat,      NULL,     NULL      },
+    { "msg_chat_stamp",     run_msg_stamp,     NULL,     NULL      },
+    { NULL,                 NULL,              NULL,     NULL      },
+};
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int main(int argc, char *argv[])
+{
+    int ret;
+    int cnt;
+    int reps = BENCH_DEF_REPS;
+    unsigned int ms = BENCH_DEF_MS;
+    const char *filter = NULL;
+
+    /* set a default trace level to ERROR */
+    T_init(T_E);
+
+    for (;;)
+    {
+        ret = getopt(argc, argv, "f:hn:t:");
+
+        if (ret < 0)
+        {
+            break;
+        }
+        switch (ret)
+        {
+        case 'f':               /* name filter */
+            filter = optarg;
+            break;
+        case 'h':
+            usage();
+            return(0);
+        case 'n':               /* repetitions */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) <= 0 ||
+                strtol(optarg, NULL, 10) > BENCH_MAX_REPS)
+            {
+                T_M(T_E, 0xc0010100, "invalid number of repetitions: %s.\n", optarg);
+                return(1);
+            }
+            reps = (int)strtol(optarg, NULL, 10);
+            break;
+        case 't':               /* ms per repetition */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) <= 0)
+            {
+                T_M(T_E, 0xc0010200, "invalid time per repetition: %s.\n", optarg);
+                return(1);
+            }
+            ms = (unsigned int)strtol(optarg, NULL, 10);
+            break;
+        default:                /* invalid option */
+            usage();
+            return(1);
+        }
+    }
+    memset(dump_buf, 'x', sizeof(dump_buf));
+
+    printf("# name\treps\tops\tmin_ns\tmedian_ns\tmean_ns\tmax_ns\tstddev_ns\n");
+    for (cnt = 0; benches[cnt].name != NULL; cnt++)
+    {
+        if (filter == NULL || strstr(benches[cnt].name, filter) != NULL)
+        {
+            bench_one(&benches[cnt], reps, ms);
+        }
+    }
+
+    return(0);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static void run_is_number(unsigned long long n)
+{
+    static char num[] = "1234567";
+
+    for (; n > 0; n--)
+    {
+        sink += is_number(num);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_is_number_bad(unsigned long long n)
+{
+    static char num[] = "1234x67";
+
+    for (; n > 0; n--)
+    {
+        sink += is_number(num);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_timeval_sub(unsigned long long n)
+{
+    struct timeval x;
+    struct timeval y = { 1, 999999 };
+
+    for (; n > 0; n--)
+    {
+        x.tv_sec  = 10;
+        x.tv_usec = 1;
+        sink += timeval_sub(&x, &y);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_timeout_chk(unsigned long long n)
+{
+    struct timeval start;
+
+    timeout_start(&start);
+    for (; n > 0; n--)
+    {
+        sink += timeout_chk(&start, 1000000);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_tm(unsigned long long n)
+{
+    for (; n > 0; n--)
+    {
+        T_M(T_D2, 0x40020100, "send message to conns[%u]=%d: %s", (unsigned int)n, 7, line_chat);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_td(unsigned long long n)
+{
+    for (; n > 0; n--)
+    {
+        T_D(T_D2, 0x40030100, dump_buf, sizeof(dump_buf));
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_line_next(unsigned long long n)
+{
+    for (; n > 0; n--)
+    {
+        sink += line_next(line_chat, sizeof(line_chat) - 1);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_cmd_miss(unsigned long long n)
+{
+    size_t alen;
+    const char *arg;
+
+    /* chat messages stop at the first byte */
+    for (; n > 0; n--)
+    {
+        sink += cmd_maybe(line_chat) && cmd_lookup(line_chat, sizeof(line_chat) - 3, &arg, &alen);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_cmd_hit(unsigned long long n)
+{
+    size_t alen;
+    const char *arg;
+
+    for (; n > 0; n--)
+    {
+        sink += cmd_maybe(line_quit) && cmd_lookup(line_quit, sizeof(line_quit) - 3, &arg, &alen);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_msg_chat(unsigned long long n)
+{
+    msg_t *msg;
+
+    for (; n > 0; n--)
+    {
+        msg = msg_chat("", 0, prefix, sizeof(prefix) - 1, line_chat, sizeof(line_chat) - 1);
+        sink += msg->len;
+        msg_unref(msg);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void run_msg_stamp(unsigned long long n)
+{
+    msg_t *msg;
+    msg_t *alt;
+
+    for (; n > 0; n--)
+    {
+        msg = msg_chat("", 0, prefix, sizeof(prefix) - 1, line_chat, sizeof(line_chat) - 1);
+        msg->seq = n;
+        alt = msg_stamp(msg);
+        sink += alt->len;
+        msg_unref(alt);
+        msg_unref(msg);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void trace_on(void)
+{
+    int fd;
+
+    /* traces are written to /dev/null by the background writer */
+    fflush(stderr);
+    stderr_fd = dup(STDERR_FILENO);
+    fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0)
+    {
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    T_init(T_D2);
+    (void)T_start();
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void trace_off(void)
+{
+    T_stop();
+    T_init(T_E);
+    if (stderr_fd >= 0)
+    {
+        dup2(stderr_fd, STDERR_FILENO);
+        close(stderr_fd);
+        stderr_fd = -1;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void bench_one(const bench_t *b, int reps, unsigned int ms)
+{
+    int cnt;
+    unsigned long long n;
+    unsigned long long t;
+    unsigned long long goal = ms * 1000000ULL;
+    double ns[BENCH_MAX_REPS];
+    double sum = 0;
+    double var = 0;
+    double mean;
+
+    if (b->setup != NULL)
+    {
+        b->setup();
+    }
+
+    /* double operations until a repetition takes long enough */
+    for (n = 1; ; n *= 2)
+    {
+        t = evl_now();
+        b->run(n);
+        t = evl_now() - t;
+        if (t >= goal / 4)
+        {
+            break;
+        }
+    }
+    n = (t > 0)? (unsigned long long)((double)n * goal / t) : n;
+    if (n == 0)
+    {
+        n = 1;
+    }
+
+    /* warm up once, then measure */
+    b->run(n);
+    for (cnt = 0; cnt < reps; cnt++)
+    {
+        t = evl_now();
+        b->run(n);
+        t = evl_now() - t;
+        ns[cnt] = (double)t / n;
+        sum += ns[cnt];
+    }
+
+    if (b->teardown != NULL)
+    {
+        b->teardown();
+    }
+
+    mean = sum / reps;
+    for (cnt = 0; cnt < reps; cnt++)
+    {
+        var += (ns[cnt] - mean) * (ns[cnt] - mean);
+    }
+    var = (reps > 1)? var / (reps - 1) : 0.0;
+    qsort(ns, reps, sizeof(ns[0]), cmp_double);
+
+    printf("%s\t%d\t%llu\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\n", b->name, reps, n,
+           ns[0], (reps % 2)? ns[reps/2] : (ns[reps/2-1] + ns[reps/2]) / 2,
+           mean, ns[reps-1], sqrt(var));
+    fflush(stdout);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return((x > y) - (x < y));
+}
+
+/*----------------------------------------------------------------------*/
+static void usage(void)
+{
+    puts("Usage:");
+    puts("\tmicrobench [-h] [-f <filter>] [-n <reps>] [-t <ms>]");
+    puts("");
+    puts("Options:");
+    puts("\t-h show this help and exit");
+    puts("\t-f run benchmarks whose names include specified string");
+    printf("\t-n specify number of repetitions (default: %d)\n", BENCH_DEF_REPS);
+    printf("\t-t specify ms per repetition (default: %d)\n", BENCH_DEF_MS);
+    puts("");
+    puts("Output:");
+    puts("\tname, reps, ops per repetition and ns per op (min, median, mean, max, stddev)");
+    puts("\tseparated by tabs, one benchmark per line");
+
+    return;
+}
+
+/* end of main.c */
@@ -0,0 +1,809 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Chat server benchmark program main module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Open many client connections to a chat server, send messages at a
+ * fixed aggregate rate and measure the time until each connection
+ * receives each message.  Every connection stays in the lobby, so every
+ * message is delivered to every connection including the sender.
+ *
+ * Connections are divided among threads, each running its own event
+ * loop.  A message carries its send time, which is compared with
+ * CLOCK_MONOTONIC of the receiving thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "trace.h"
+#include "tool.h"
+#include "evl.h"
+#include "line.h"
+#include "../com.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define BENCH_DEF_CONNS     1000  /* default number of connections */
+#define BENCH_DEF_RATE      1000  /* default messages per second */
+#define BENCH_DEF_SIZE      64    /* default message size including CRLF */
+#define BENCH_DEF_DURATION  10    /* default seconds to send */
+#define BENCH_MIN_SIZE      32    /* room for the send time */
+#define BENCH_MAX_SIZE      4096  /* max message size */
+#define BENCH_MAX_LINE      (BENCH_MAX_SIZE + COM_MAX_NAME + 3) /* "[name] " and message */
+#define BENCH_MAX_THREADS   64    /* max number of threads */
+#define BENCH_CONNECTING    64    /* connects in flight per thread */
+#define BENCH_SETUP_TIMEOUT 60    /* seconds to wait for all connections */
+#define BENCH_PROBE_INTERVAL 100  /* ms between probes during setup */
+#define BENCH_DRAIN_TIME    1000  /* ms to wait for messages in flight */
+#define BENCH_TICK          1     /* ms between sends */
+#define BENCH_RBUF_SIZE     (64*1024) /* max bytes received at once */
+
+/* latency histogram: 16 linear buckets per power of 2 (error < 6.25 %) */
+#define BENCH_LAT_SUB       16
+#define BENCH_LAT_BUCKETS   (64 * BENCH_LAT_SUB)
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* benchmark phases */
+enum bench_phase
+{
+    BENCH_SETUP = 0,            /* connecting */
+    BENCH_RUN   = 1,            /* sending */
+    BENCH_DRAIN = 2,            /* waiting for messages in flight */
+    BENCH_STOP  = 3,            /* finished */
+};
+
+/* operation parameters */
+typedef struct opr_strct {
+    const char  *host;          /* server host */
+    char         port[128];     /* server port */
+    int          conns;         /* number of connections */
+    int          rate;          /* messages per second */
+    int          size;          /* message size including CRLF */
+    int          duration;      /* seconds to send */
+    int          threads;       /* number of threads */
+} opr_t;
+
+/* client connection */
+typedef struct bench_conn_strct {
+    int          fd;            /* socket, -1 when not opened */
+    int          connected;     /* connect completed */
+    int          ready;         /* received the first line */
+    unsigned int ilen;          /* length of the partial line */
+    unsigned int olen;          /* bytes left to send */
+    char        *ibuf;          /* partial line received */
+    char        *obuf;          /* message left to send */
+} bench_conn_t;
+
+/* thread */
+typedef struct bench_thr_strct {
+    int           id;           /* thread ID */
+    pthread_t     th;           /* thread */
+    evl_t        *evl;          /* event loop */
+    bench_conn_t *conn;         /* connections */
+    int           num;          /* number of connections */
+    int           opened;       /* number of connections opened */
+    int           connecting;   /* number of connects in flight */
+    int           next;         /* next connection to send */
+    long long     rate;         /* messages per second of this thread */
+    char         *rbuf;         /* receive buffer */
+    unsigned long long sent;    /* messages sent */
+    unsigned long long blocked; /* messages not sent for full buffers */
+    unsigned long long recvd;   /* messages received */
+    unsigned long long bytes;   /* bytes of messages received */
+    unsigned long long lat[BENCH_LAT_BUCKETS]; /* latency histogram */
+    atomic_int    ret;          /* result of the thread */
+} bench_thr_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static opr_t            opr;            /* operation parameters */
+static struct addrinfo *ai;             /* server address */
+static atomic_int       phase;          /* BENCH_* */
+static atomic_int       connected;      /* connections established */
+static atomic_int       ready;          /* connections receiving */
+static unsigned long long run_start;    /* time to start sending in ns */
+static __thread bench_thr_t *self;      /* running thread */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static int arg_handler(int argc, char *argv[]);
+static void *bench_thread(void *arg);
+static int bench_open(bench_thr_t *t);
+static int bench_io_cb(evl_t *evl, int fd, unsigned int events, void *arg);
+static int bench_recv(bench_thr_t *t, bench_conn_t *c);
+static void bench_line(bench_thr_t *t, bench_conn_t *c, const char *line, size_t len);
+static void bench_send(bench_thr_t *t, bench_conn_t *c, const char *buf, size_t len);
+static void bench_pace(bench_thr_t *t, unsigned long long now);
+static void bench_probe(bench_thr_t *t);
+static unsigned int lat_index(unsigned long long ns);
+static unsigned long long lat_value(unsigned int idx);
+static double lat_percentile(const unsigned long long *lat, unsigned long long num, double p);
+static void report(bench_thr_t *thr);
+static void usage(void);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int main(int argc, char *argv[])
+{
+    int ret;
+    int cnt;
+    int err = 0;
+    unsigned long long start;
+    unsigned long long setup_end;
+    bench_thr_t *thr;
+    struct addrinfo hints;
+    struct rlimit rl;
+
+    /* set a default trace level to ERROR */
+    T_init(T_E);
+
+    ret = arg_handler(argc, argv);
+    if (ret < 0)
+    {
+        return(1);
+    }
+
+    /* thousands of connections need thousands of descriptors */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(opr.host, opr.port, &hints, &ai);
+    if (ret != 0)
+    {
+        T_M(T_E, 0xc0010100, "cannot resolve %s:%s: %s.\n", opr.host, opr.port, gai_strerror(ret));
+        return(1);
+    }
+
+    thr = calloc(opr.threads, sizeof(*thr));
+    if (thr == NULL)
+    {
+        T_M(T_E, 0xc0010200, "cannot allocate threads.\n");
+        freeaddrinfo(ai);
+        return(1);
+    }
+
+    /* divide connections and rate among threads */
+    atomic_store(&phase, BENCH_SETUP);
+    start = evl_now();
+    for (cnt = 0; cnt < opr.threads; cnt++)
+    {
+        thr[cnt].id   = cnt;
+        thr[cnt].num  = opr.conns / opr.threads + (cnt < opr.conns % opr.threads);
+        thr[cnt].rate = opr.rate / opr.threads + (cnt < opr.rate % opr.threads);
+        ret = pthread_create(&thr[cnt].th, NULL, bench_thread, &thr[cnt]);
+        if (ret != 0)
+        {
+            T_M(T_E, 0xc0010300, "cannot create thread %d: %s.\n", cnt, strerror(ret));
+            atomic_store(&phase, BENCH_STOP);
+            opr.threads = cnt;
+            err = 1;
+            break;
+        }
+    }
+
+    /* wait for all connections to receive messages */
+    while (!err && atomic_load(&ready) < opr.conns)
+    {
+        for (cnt = 0; cnt < opr.threads && atomic_load(&thr[cnt].ret) == 0; cnt++)
+        {
+            ;
+        }
+        if (cnt < opr.threads || evl_now() - start > BENCH_SETUP_TIMEOUT * 1000000000ULL)
+        {
+            T_M(T_E, 0xc0010400, "only %d of %d connections are established.\n",
+                atomic_load(&ready), opr.conns);
+            err = 1;
+            break;
+        }
+        usleep(1000);
+    }
+    setup_end = evl_now();
+
+    if (!err)
+    {
+        printf("setup:     %d connections in %.3f s (%.1f conn/s)\n", opr.conns,
+               (setup_end - start) / 1e9, opr.conns / ((setup_end - start) / 1e9));
+        fflush(stdout);
+
+        /* send for the duration and wait for messages in flight */
+        run_start = evl_now();
+        atomic_store(&phase, BENCH_RUN);
+        sleep(opr.duration);
+        atomic_store(&phase, BENCH_DRAIN);
+        usleep(BENCH_DRAIN_TIME * 1000);
+    }
+    atomic_store(&phase, BENCH_STOP);
+
+    for (cnt = 0; cnt < opr.threads; cnt++)
+    {
+        pthread_join(thr[cnt].th, NULL);
+        if (atomic_load(&thr[cnt].ret) < 0)
+        {
+            err = 1;
+        }
+    }
+
+    if (!err)
+    {
+        report(thr);
+    }
+    free(thr);
+    freeaddrinfo(ai);
+
+    return(err);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static int arg_handler(int argc, char *argv[])
+{
+    int ret;
+
+    /* set default parameters */
+    opr.host     = "127.0.0.1";
+    snprintf(opr.port, sizeof(opr.port), "%d", COM_DEF_PORT);
+    opr.conns    = BENCH_DEF_CONNS;
+    opr.rate     = BENCH_DEF_RATE;
+    opr.size     = BENCH_DEF_SIZE;
+    opr.duration = BENCH_DEF_DURATION;
+    opr.threads  = 1;
+
+    for (;;)
+    {
+        ret = getopt(argc, argv, "c:d:hp:r:s:t:");
+
+        if (ret < 0)
+        {
+            break;
+        }
+        switch (ret)
+        {
+        case 'c':               /* number of connections */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) <= 0)
+            {
+                T_M(T_E, 0xc0020100, "invalid number of connections: %s.\n", optarg);
+                return(0xc0020100);
+            }
+            opr.conns = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'd':               /* duration */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) <= 0)
+            {
+                T_M(T_E, 0xc0020200, "invalid duration: %s.\n", optarg);
+                return(0xc0020200);
+            }
+            opr.duration = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        case 'p':               /* port name */
+            snprintf(opr.port, sizeof(opr.port), "%s", optarg);
+            break;
+        case 'r':               /* messages per second */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) <= 0)
+            {
+                T_M(T_E, 0xc0020300, "invalid rate: %s.\n", optarg);
+                return(0xc0020300);
+            }
+            opr.rate = (int)strtol(optarg, NULL, 10);
+            break;
+        case 's':               /* message size */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) < BENCH_MIN_SIZE ||
+                strtol(optarg, NULL, 10) > BENCH_MAX_SIZE)
+            {
+                T_M(T_E, 0xc0020400, "message size must be %d to %d: %s.\n",
+                    BENCH_MIN_SIZE, BENCH_MAX_SIZE, optarg);
+                return(0xc0020400);
+            }
+            opr.size = (int)strtol(optarg, NULL, 10);
+            break;
+        case 't':               /* number of threads */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) <= 0 ||
+                strtol(optarg, NULL, 10) > BENCH_MAX_THREADS)
+            {
+                T_M(T_E, 0xc0020500, "invalid number of threads: %s.\n", optarg);
+                return(0xc0020500);
+            }
+            opr.threads = (int)strtol(optarg, NULL, 10);
+            break;
+        default:                /* invalid option */
+            usage();
+            return(0xc00201ee);
+        }
+    }
+
+    switch (argc - optind)
+    {
+    case 0:
+        break;
+    case 1:
+        opr.host = argv[optind];
+        break;
+    default:
+        T_M(T_E, 0xc0020600, "invalid arguments.\n");
+        usage();
+        return(0xc0020600);
+    }
+    if (opr.threads > opr.conns)
+    {
+        opr.threads = opr.conns;
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void *bench_thread(void *arg)
+{
+    int ret = 0;
+    int cnt;
+    int ph;
+    bench_thr_t *t = arg;
+    unsigned long long last_probe = 0;
+    unsigned long long now;
+
+    self = t;
+    t->evl  = evl_create(EVL_DEF_BACKEND);
+    t->conn = calloc(t->num, sizeof(*t->conn));
+    t->rbuf = malloc(BENCH_MAX_LINE + BENCH_RBUF_SIZE);
+    if (t->evl == NULL || t->conn == NULL || t->rbuf == NULL)
+    {
+        T_M(T_E, 0xc0040100, "cannot initialize thread %d.\n", t->id);
+        ret = 0xc0040100;
+    }
+    for (cnt = 0; t->conn != NULL && cnt < t->num; cnt++)
+    {
+        t->conn[cnt].fd = -1;
+    }
+
+    while (ret >= 0 && (ph = atomic_load(&phase)) != BENCH_STOP)
+    {
+        /* keep connects in flight not to overflow the listen backlog */
+        while (t->opened < t->num && t->connecting < BENCH_CONNECTING && ret >= 0)
+        {
+            ret = bench_open(t);
+        }
+        if (ret < 0)
+        {
+            break;
+        }
+
+        ret = evl_wait(t->evl, BENCH_TICK);
+        now = evl_now();
+
+        /* connections are ready when they receive a probe */
+        if (ph == BENCH_SETUP && t->id == 0 && atomic_load(&connected) == opr.conns &&
+            now - last_probe > BENCH_PROBE_INTERVAL * 1000000ULL)
+        {
+            bench_probe(t);
+            last_probe = now;
+        }
+        if (ph == BENCH_RUN)
+        {
+            bench_pace(t, now);
+        }
+    }
+    atomic_store(&t->ret, (ret < 0)? ret : 0);
+
+    for (cnt = 0; t->conn != NULL && cnt < t->num; cnt++)
+    {
+        if (t->conn[cnt].fd >= 0)
+        {
+            close(t->conn[cnt].fd);
+        }
+        free(t->conn[cnt].ibuf);
+        free(t->conn[cnt].obuf);
+    }
+    free(t->conn);
+    free(t->rbuf);
+    if (t->evl != NULL)
+    {
+        evl_destroy(t->evl);
+    }
+
+    return(NULL);
+}
+
+/*----------------------------------------------------------------------*/
+static int bench_open(bench_thr_t *t)
+{
+    int ret;
+    bench_conn_t *c = &t->conn[t->opened];
+
+    c->ibuf = malloc(BENCH_MAX_LINE);
+    c->obuf = malloc(BENCH_MAX_SIZE);
+    if (c->ibuf == NULL || c->obuf == NULL)
+    {
+        T_M(T_E, 0xc0050100, "cannot allocate buffers.\n");
+        return(0xc0050100);
+    }
+
+    c->fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0)
+    {
+        T_M(T_E, 0xc0050200, "cannot create socket: %s.\n", strerror(errno));
+        return(0xc0050200);
+    }
+    ret = connect(c->fd, ai->ai_addr, ai->ai_addrlen);
+    if (ret < 0 && errno != EINPROGRESS)
+    {
+        T_M(T_E, 0xc0050300, "cannot connect: %s.\n", strerror(errno));
+        return(0xc0050300);
+    }
+
+    /* writable when connected */
+    ret = evl_add(t->evl, c->fd, EVL_OUT, bench_io_cb, c);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+    t->opened++;
+    t->connecting++;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int bench_io_cb(evl_t *evl, int fd, unsigned int events, void *arg)
+{
+    int err = 0;
+    ssize_t ret;
+    socklen_t len = sizeof(err);
+    bench_conn_t *c = arg;
+
+    if (!c->connected)
+    {
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+        {
+            T_M(T_E, 0xc0060100, "cannot connect: %s.\n", strerror(err));
+            return(0xc0060100);
+        }
+        c->connected = 1;
+        self->connecting--;
+        atomic_fetch_add(&connected, 1);
+        return(evl_mod(evl, fd, EVL_IN));
+    }
+
+    /* send the rest of a message */
+    if ((events & EVL_OUT) && c->olen > 0)
+    {
+        ret = send(fd, c->obuf, c->olen, MSG_NOSIGNAL);
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            T_M(T_E, 0xc0060200, "cannot send: %s.\n", strerror(errno));
+            return(0xc0060200);
+        }
+        if (ret > 0)
+        {
+            c->olen -= ret;
+            memmove(c->obuf, c->obuf + ret, c->olen);
+        }
+        if (c->olen == 0)
+        {
+            (void)evl_mod(evl, fd, EVL_IN);
+        }
+    }
+
+    if (events & EVL_IN)
+    {
+        return(bench_recv(self, c));
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int bench_recv(bench_thr_t *t, bench_conn_t *c)
+{
+    ssize_t ret;
+    size_t pos;
+    size_t len;
+    size_t line_len;
+
+    /* continue the partial line */
+    if (c->ilen > 0)
+    {
+        memcpy(t->rbuf, c->ibuf, c->ilen);
+    }
+
+    ret = recv(c->fd, t->rbuf + c->ilen, BENCH_RBUF_SIZE, 0);
+    if (ret < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            return(0);
+        }
+        T_M(T_E, 0xc0070100, "cannot recv: %s.\n", strerror(errno));
+        return(0xc0070100);
+    }
+    if (ret == 0)
+    {
+        T_M(T_E, 0xc0070200, "connection closed by server.\n");
+        return(0xc0070200);
+    }
+    len = ret + c->ilen;
+
+    for (pos = 0; pos < len; pos += line_len)
+    {
+        line_len = line_next(t->rbuf + pos, len - pos);
+        if (line_len == 0)
+        {
+            break;
+        }
+        bench_line(t, c, t->rbuf + pos, line_len);
+    }
+
+    /* keep the partial line, a line longer than any message is dropped */
+    c->ilen = (len - pos <= BENCH_MAX_LINE)? len - pos : 0;
+    memcpy(c->ibuf, t->rbuf + pos, c->ilen);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void bench_line(bench_thr_t *t, bench_conn_t *c, const char *line, size_t len)
+{
+    const char *p;
+    const char *end = line + len;
+    unsigned long long ts = 0;
+
+    /* stay connected to a server sending keepalive pings */
+    if (len == sizeof(COM_PING)-1 && memcmp(line, COM_PING, len) == 0)
+    {
+        bench_send(t, c, COM_PONG, sizeof(COM_PONG)-1);
+        return;
+    }
+
+    if (!c->ready)
+    {
+        c->ready = 1;
+        atomic_fetch_add(&ready, 1);
+    }
+
+    /* "[name] B<send time> ..." */
+    p = memchr(line, ']', len);
+    if (p == NULL || end - p < 4 || p[1] != ' ' || p[2] != 'B')
+    {
+        return;
+    }
+    for (p += 3; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        ts = ts * 10 + (*p - '0');
+    }
+
+    t->recvd++;
+    t->bytes += len;
+    t->lat[lat_index(evl_now() - ts)]++;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void bench_send(bench_thr_t *t, bench_conn_t *c, const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    /* a connection still sending the previous message skips this one */
+    if (!c->connected || c->olen > 0)
+    {
+        t->blocked++;
+        return;
+    }
+
+    ret = send(c->fd, buf, len, MSG_NOSIGNAL);
+    if (ret < 0)
+    {
+        t->blocked++;
+        return;
+    }
+    t->sent++;
+    if ((size_t)ret < len)
+    {
+        /* send the rest when writable */
+        c->olen = len - ret;
+        memcpy(c->obuf, buf + ret, c->olen);
+        (void)evl_mod(t->evl, c->fd, EVL_IN | EVL_OUT);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void bench_pace(bench_thr_t *t, unsigned long long now)
+{
+    int hlen;
+    unsigned long long due;
+    char buf[BENCH_MAX_SIZE];
+
+    /* messages due by now since the start */
+    due = (now - run_start) * t->rate / 1000000000ULL;
+    while (t->sent + t->blocked < due)
+    {
+        /* "B<send time> xxx...\r\n" */
+        hlen = snprintf(buf, sizeof(buf), "B%llu ", evl_now());
+        memset(buf + hlen, 'x', opr.size - 2 - hlen);
+        buf[opr.size-2] = '\r';
+        buf[opr.size-1] = '\n';
+
+        bench_send(t, &t->conn[t->next], buf, opr.size);
+        t->next = (t->next + 1) % t->num;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void bench_probe(bench_thr_t *t)
+{
+    int cnt;
+
+    for (cnt = 0; cnt < t->num; cnt++)
+    {
+        if (t->conn[cnt].connected && t->conn[cnt].olen == 0)
+        {
+            (void)send(t->conn[cnt].fd, "probe\r\n", 7, MSG_NOSIGNAL);
+            return;
+        }
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned int lat_index(unsigned long long ns)
+{
+    int msb;
+
+    if (ns < BENCH_LAT_SUB)
+    {
+        return((unsigned int)ns);
+    }
+
+    /* 4 bits below the most significant bit select a linear bucket */
+    msb = 63 - __builtin_clzll(ns);
+    return((msb - 3) * BENCH_LAT_SUB + ((ns >> (msb - 4)) & (BENCH_LAT_SUB - 1)));
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned long long lat_value(unsigned int idx)
+{
+    int msb;
+
+    if (idx < BENCH_LAT_SUB)
+    {
+        return(idx);
+    }
+
+    /* upper bound of the bucket */
+    msb = idx / BENCH_LAT_SUB + 3;
+    return(((BENCH_LAT_SUB + idx % BENCH_LAT_SUB + 1ULL) << (msb - 4)) - 1);
+}
+
+/*----------------------------------------------------------------------*/
+static double lat_percentile(const unsigned long long *lat, unsigned long long num, double p)
+{
+    unsigned int idx;
+    unsigned long long sum = 0;
+    unsigned long long rank = (unsigned long long)(num * p);
+
+    if (num == 0)
+    {
+        return(0.0);
+    }
+    if (rank >= num)
+    {
+        rank = num - 1;
+    }
+    for (idx = 0; idx < BENCH_LAT_BUCKETS; idx++)
+    {
+        sum += lat[idx];
+        if (sum > rank)
+        {
+            break;
+        }
+    }
+
+    return(lat_value(idx) / 1e3);
+}
+
+/*----------------------------------------------------------------------*/
+static void report(bench_thr_t *thr)
+{
+    int cnt;
+    unsigned int idx;
+    unsigned long long sent = 0;
+    unsigned long long blocked = 0;
+    unsigned long long recvd = 0;
+    unsigned long long bytes = 0;
+    unsigned long long expected;
+    static unsigned long long lat[BENCH_LAT_BUCKETS];
+
+    for (cnt = 0; cnt < opr.threads; cnt++)
+    {
+        sent    += thr[cnt].sent;
+        blocked += thr[cnt].blocked;
+        recvd   += thr[cnt].recvd;
+        bytes   += thr[cnt].bytes;
+        for (idx = 0; idx < BENCH_LAT_BUCKETS; idx++)
+        {
+            lat[idx] += thr[cnt].lat[idx];
+        }
+    }
+    for (idx = BENCH_LAT_BUCKETS; idx > 0 && lat[idx-1] == 0; idx--)
+    {
+        ;
+    }
+
+    /* every connection is a recipient of every message */
+    expected = sent * opr.conns;
+    printf("sent:      %llu messages of %d bytes (%.1f msg/s), %llu skipped on full buffers\n",
+           sent, opr.size, (double)sent / opr.duration, blocked);
+    printf("delivered: %llu of %llu (%.2f %%), %.1f msg/s, %.2f MB/s\n",
+           recvd, expected, (expected > 0)? 100.0 * recvd / expected : 0.0,
+           (double)recvd / opr.duration, bytes / 1e6 / opr.duration);
+    printf("latency:   p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n",
+           lat_percentile(lat, recvd, 0.50), lat_percentile(lat, recvd, 0.99),
+           lat_percentile(lat, recvd, 0.999), (idx > 0)? lat_value(idx-1) / 1e3 : 0.0);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void usage(void)
+{
+    puts("Usage:");
+    puts("\tchatbench [-h] [-c <conns>] [-d <seconds>] [-p <port_name>] [-r <rate>]");
+    puts("\t          [-s <size>] [-t <threads>] [<host>]");
+    puts("");
+    puts("Options:");
+    puts("\t-h show this help and exit");
+    printf("\t-c specify number of connections (default: %d)\n", BENCH_DEF_CONNS);
+    printf("\t-d specify seconds to send messages (default: %d)\n", BENCH_DEF_DURATION);
+    printf("\t-p specify port name or port number (default: %d)\n", COM_DEF_PORT);
+    printf("\t-r specify messages per second of all connections (default: %d)\n", BENCH_DEF_RATE);
+    printf("\t-s specify message size including CRLF (default: %d, %d to %d)\n",
+           BENCH_DEF_SIZE, BENCH_MIN_SIZE, BENCH_MAX_SIZE);
+    puts("\t-t specify number of threads (default: 1)");
+    puts("");
+    puts("Arguments:");
+    puts("\thost\tserver host (default: 127.0.0.1)");
+
+    return;
+}
+
+/* end of main.c */
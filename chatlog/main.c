@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Chat log dump program main module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Dump or follow chat log written by the server with -l option.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "trace.h"
+#include "tool.h"
+#include "seg.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define FOLLOW_INTERVAL 200     /* ms to wait for new records */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* operation parameters */
+typedef struct opr_strct {
+    const char  *dir;           /* log directory */
+    unsigned long long after;   /* dump records after this */
+    int          follow;        /* wait for new records */
+    int          count;         /* count records only */
+    int          raw;           /* write data as is */
+} opr_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static volatile sig_atomic_t stopped; /* stopped by user */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static int arg_handler(int argc, char *argv[], opr_t *opr);
+static int dump(opr_t *opr);
+static void dump_rec(opr_t *opr, const seg_rec_t *rec);
+static void usage(void);
+static void ctrl_c_trap(int signo);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int main(int argc, char *argv[])
+{
+    int ret;
+    opr_t opr;
+
+    /* set a default trace level to ERROR */
+    T_init(T_E);
+
+    memset(&opr, 0, sizeof(opr));
+    ret = arg_handler(argc, argv, &opr);
+    if (ret < 0)
+    {
+        return(1);
+    }
+
+    signal(SIGINT, ctrl_c_trap);
+    ret = dump(&opr);
+
+    return((ret < 0)? 1 : 0);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static int arg_handler(int argc, char *argv[], opr_t *opr)
+{
+    int ret;
+
+    for (;;)
+    {
+        ret = getopt(argc, argv, "cfhrs:");
+
+        if (ret < 0)
+        {
+            break;
+        }
+        switch (ret)
+        {
+        case 'c':               /* count only */
+            opr->count = 1;
+            break;
+        case 'f':               /* follow */
+            opr->follow = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        case 'r':               /* raw */
+            opr->raw = 1;
+            break;
+        case 's':               /* start after sequence number */
+            if (!is_number(optarg))
+            {
+                T_M(T_E, 0xc0010100, "invalid sequence number: %s.\n", optarg);
+                return(0xc0010100);
+            }
+            opr->after = strtoull(optarg, NULL, 10);
+            break;
+        default:                /* invalid option */
+            usage();
+            return(0xc00101ee);
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        T_M(T_E, 0xc0010200, "invalid arguments.\n");
+        usage();
+        return(0xc0010200);
+    }
+    opr->dir = argv[optind];
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int dump(opr_t *opr)
+{
+    int ret;
+    int num;
+    int cnt;
+    size_t off;
+    unsigned long long recs = 0;
+    unsigned long long bytes = 0;
+    unsigned long long *firsts;
+    double sec;
+    const seg_rec_t *rec;
+    seg_t seg;
+    struct timespec ts;
+    struct timespec te;
+
+    num = seg_list(opr->dir, &firsts);
+    while (num == 0 && opr->follow && !stopped)
+    {
+        /* wait for the first segment */
+        free(firsts);
+        usleep(FOLLOW_INTERVAL * 1000);
+        num = seg_list(opr->dir, &firsts);
+    }
+    if (num < 0)
+    {
+        return(num);
+    }
+
+    /* skip segments which end before the start */
+    for (cnt = 0; cnt + 1 < num && firsts[cnt+1] <= opr->after + 1; cnt++)
+    {
+        ;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    while (!stopped && cnt < num)
+    {
+        ret = seg_map(&seg, opr->dir, firsts[cnt]);
+        if (ret < 0)
+        {
+            free(firsts);
+            return(ret);
+        }
+
+        for (off = 0; !stopped; )
+        {
+            rec = seg_next(&seg, &off);
+            if (rec != NULL)
+            {
+                if (rec->seq > opr->after)
+                {
+                    recs++;
+                    bytes += rec->len;
+                    dump_rec(opr, rec);
+                }
+                continue;
+            }
+
+            /* end of this segment, go on to the next if any */
+            if (cnt + 1 < num || !opr->follow)
+            {
+                break;
+            }
+            fflush(stdout);
+            usleep(FOLLOW_INTERVAL * 1000);
+            free(firsts);
+            num = seg_list(opr->dir, &firsts);
+            if (num < 0)
+            {
+                seg_unmap(&seg);
+                return(num);
+            }
+        }
+        seg_unmap(&seg);
+        cnt++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &te);
+    free(firsts);
+
+    if (opr->count)
+    {
+        sec = (te.tv_sec - ts.tv_sec) + (te.tv_nsec - ts.tv_nsec) / 1e9;
+        printf("%llu messages, %llu bytes in %.3f s (%.1f MB/s)\n",
+               recs, bytes, sec, (sec > 0)? bytes / sec / 1e6 : 0.0);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void dump_rec(opr_t *opr, const seg_rec_t *rec)
+{
+    const char *data = seg_data(rec);
+    int len = (int)rec->len;
+
+    if (opr->count)
+    {
+        return;
+    }
+    if (opr->raw)
+    {
+        fwrite(data, 1, len, stdout);
+        return;
+    }
+
+    /* drop CRLF */
+    if (len >= 2 && data[len-2] == '\r' && data[len-1] == '\n')
+    {
+        len -= 2;
+    }
+    printf("#%llu", (unsigned long long)rec->seq);
+    if (rec->rlen > 0)
+    {
+        printf(" @%.*s", (int)rec->rlen, data + rec->len);
+    }
+    printf(" %.*s\n", len, data);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void usage(void)
+{
+    puts("Usage:");
+    puts("\tchatlog [-h] [-c] [-f] [-r] [-s <seq>] <log_dir>");
+    puts("");
+    puts("Options:");
+    puts("\t-h show this help and exit");
+    puts("\t-c count messages and show scan speed instead of dumping");
+    puts("\t-f wait for new messages after dumping the log");
+    puts("\t-r write messages as received by clients");
+    puts("\t-s dump messages after specified sequence number");
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void ctrl_c_trap(int signo)
+{
+    stopped = 1;
+
+    return;
+}
+
+/* end of main.c */
@@ -0,0 +1,712 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Client program main module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Chat client program.  Lines typed are sent to the server and messages
+ * from the server are shown.  One event loop waits for both stdin and the
+ * socket, and messages received in an iteration are written to the
+ * terminal at once to keep up with busy rooms.
+ *
+ * With -f, lines of a transcript file are sent instead of stdin as fast
+ * as the socket takes them or at a given rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "trace.h"
+#include "tool.h"
+#include "evl.h"
+#include "../com.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define CLI_IBUF_SIZE   4096        /* max length of a typed line */
+#define CLI_TBUF_SIZE   (64*1024)   /* terminal output written at once */
+#define CLI_OBUF_HIGH   (64*1024)   /* bytes queued before waiting for the socket */
+#define CLI_TICK        1           /* ms between scheduled lines */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* operation parameters */
+typedef struct opr_strct {
+    const char  *host;          /* server host */
+    char         port[128];     /* server port */
+    const char  *file;          /* transcript, NULL for stdin */
+    int          rate;          /* transcript lines per second, 0 for max */
+    int          quiet;         /* do not show messages */
+} opr_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static opr_t  opr;              /* operation parameters */
+static evl_t *evl;              /* event loop */
+static int    sock = -1;        /* connection to the server */
+static int    closed;           /* connection closed by the server */
+static int    quitting;         /* no more lines are sent */
+static int    eof;              /* end of input without quit words */
+static int    shut;             /* write side is shut down */
+static int    bol = 1;          /* received bytes are at beginning of line */
+
+/* lines to the server */
+static char  *obuf;             /* bytes to send */
+static size_t olen;             /* length of obuf */
+static size_t ocap;             /* size of obuf */
+
+/* typed line */
+static char   ibuf[CLI_IBUF_SIZE]; /* partial line */
+static size_t ilen;             /* length of ibuf */
+
+/* messages to the terminal */
+static char   tbuf[CLI_TBUF_SIZE]; /* bytes to write */
+static size_t tlen;             /* length of tbuf */
+
+/* transcript */
+static const char *tr;          /* mapped transcript */
+static size_t tr_len;           /* length of tr */
+static size_t tr_pos;           /* offset of the next line */
+static unsigned long long tr_lines; /* lines sent */
+static unsigned long long tr_start; /* time the replay started in ns */
+
+/* quit words of the server (cmd.def) */
+static const char *quit_msg[] = {
+#include "quit_tab.h"
+    NULL
+};
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static int arg_handler(int argc, char *argv[]);
+static int cli_connect(void);
+static int cli_map(void);
+static int cli_run(void);
+static int cli_stdin_cb(evl_t *evl, int fd, unsigned int events, void *arg);
+static int cli_sock_cb(evl_t *evl, int fd, unsigned int events, void *arg);
+static int cli_line(const char *line, size_t len);
+static int cli_send(const char *buf, size_t len);
+static int cli_flush_sock(void);
+static void cli_flush_tty(void);
+static int cli_replay(void);
+static void cli_shutdown(void);
+static void usage(void);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int main(int argc, char *argv[])
+{
+    int ret;
+    struct stat st;
+
+    /* set a default trace level to ERROR */
+    T_init(T_E);
+
+    ret = arg_handler(argc, argv);
+    if (ret < 0)
+    {
+        return(1);
+    }
+
+    if (opr.file != NULL)
+    {
+        ret = cli_map();
+        if (ret < 0)
+        {
+            return(1);
+        }
+    }
+
+    /* epoll cannot wait for regular files */
+    evl = evl_create((opr.file == NULL && fstat(STDIN_FILENO, &st) == 0 &&
+                      S_ISREG(st.st_mode))? EVL_SELECT : EVL_DEF_BACKEND);
+    if (evl == NULL)
+    {
+        return(1);
+    }
+
+    ret = cli_connect();
+    if (ret >= 0)
+    {
+        ret = cli_run();
+    }
+    cli_flush_tty();
+
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    evl_destroy(evl);
+    free(obuf);
+    if (tr != NULL)
+    {
+        munmap((void*)tr, tr_len);
+    }
+
+    return((ret < 0)? 1 : 0);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static int arg_handler(int argc, char *argv[])
+{
+    int ret;
+
+    /* set default parameters */
+    snprintf(opr.port, sizeof(opr.port), "%d", COM_DEF_PORT);
+
+    for (;;)
+    {
+        ret = getopt(argc, argv, "f:hp:qr:");
+
+        if (ret < 0)
+        {
+            break;
+        }
+        switch (ret)
+        {
+        case 'f':               /* transcript */
+            opr.file = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        case 'p':               /* port name */
+            snprintf(opr.port, sizeof(opr.port), "%s", optarg);
+            break;
+        case 'q':               /* quiet */
+            opr.quiet = 1;
+            break;
+        case 'r':               /* lines per second */
+            if (!is_number(optarg))
+            {
+                T_M(T_E, 0xc0010100, "invalid rate: %s.\n", optarg);
+                return(0xc0010100);
+            }
+            opr.rate = (int)strtol(optarg, NULL, 10);
+            break;
+        default:                /* invalid option */
+            usage();
+            return(0xc00101ee);
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        T_M(T_E, 0xc0010200, "invalid arguments.\n");
+        usage();
+        return(0xc0010200);
+    }
+    opr.host = argv[optind];
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int cli_connect(void)
+{
+    int ret;
+    struct addrinfo hints;
+    struct addrinfo *ai;
+    struct addrinfo *p;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(opr.host, opr.port, &hints, &ai);
+    if (ret != 0)
+    {
+        T_M(T_E, 0xc0020100, "cannot resolve %s:%s: %s.\n", opr.host, opr.port, gai_strerror(ret));
+        return(0xc0020100);
+    }
+
+    /* try addresses in order */
+    for (p = ai; p != NULL; p = p->ai_next)
+    {
+        sock = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+        if (sock < 0)
+        {
+            continue;
+        }
+        if (connect(sock, p->ai_addr, p->ai_addrlen) == 0)
+        {
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(ai);
+    if (sock < 0)
+    {
+        T_M(T_E, 0xc0020200, "cannot connect to %s:%s.\n", opr.host, opr.port);
+        return(0xc0020200);
+    }
+
+    /* a busy server must not block typing */
+    (void)fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    ret = evl_add(evl, sock, EVL_IN, cli_sock_cb, NULL);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+    if (opr.file == NULL)
+    {
+        ret = evl_add(evl, STDIN_FILENO, EVL_IN, cli_stdin_cb, NULL);
+    }
+
+    return(ret);
+}
+
+/*----------------------------------------------------------------------*/
+static int cli_map(void)
+{
+    int fd;
+    struct stat st;
+
+    fd = open(opr.file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        T_M(T_E, 0xc0030100, "cannot open %s: %s.\n", opr.file, strerror(errno));
+        return(0xc0030100);
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        T_M(T_E, 0xc0030200, "cannot stat %s: %s.\n", opr.file, strerror(errno));
+        close(fd);
+        return(0xc0030200);
+    }
+
+    tr_len = (size_t)st.st_size;
+    if (tr_len > 0)
+    {
+        tr = mmap(NULL, tr_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (tr == MAP_FAILED)
+        {
+            T_M(T_E, 0xc0030300, "cannot map %s: %s.\n", opr.file, strerror(errno));
+            tr = NULL;
+            close(fd);
+            return(0xc0030300);
+        }
+        (void)madvise((void*)tr, tr_len, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int cli_run(void)
+{
+    int ret = 0;
+    int timeout;
+
+    tr_start = evl_now();
+    while (!closed)
+    {
+        if (opr.file != NULL && !quitting)
+        {
+            ret = cli_replay();
+            if (ret < 0)
+            {
+                break;
+            }
+        }
+
+        /* no more lines, let the server close the connection */
+        if (eof && !shut && olen == 0)
+        {
+            cli_shutdown();
+        }
+
+        /* scheduled lines are checked every tick, others are sent when writable */
+        if (opr.file == NULL || quitting)
+        {
+            timeout = -1;
+        }
+        else if (opr.rate > 0)
+        {
+            timeout = CLI_TICK;
+        }
+        else
+        {
+            timeout = (olen < CLI_OBUF_HIGH)? 0 : -1;
+        }
+
+        ret = evl_wait(evl, timeout);
+        cli_flush_tty();
+        if (ret < 0)
+        {
+            break;
+        }
+    }
+
+    return((ret < 0)? ret : 0);
+}
+
+/*----------------------------------------------------------------------*/
+static int cli_stdin_cb(evl_t *evl, int fd, unsigned int events, void *arg)
+{
+    int ret;
+    ssize_t len;
+    size_t pos;
+    char *lf;
+
+    /* readable, so read() does not block */
+    len = read(fd, ibuf + ilen, sizeof(ibuf) - ilen);
+    if (len < 0)
+    {
+        if (errno == EINTR || errno == EAGAIN)
+        {
+            return(0);
+        }
+        T_M(T_E, 0xc0050100, "cannot read stdin: %s.\n", strerror(errno));
+        return(0xc0050100);
+    }
+    if (len == 0)
+    {
+        /* end of input, the server closes the connection */
+        (void)evl_del(evl, fd);
+        if (ilen > 0)
+        {
+            ret = cli_line(ibuf, ilen);
+            if (ret < 0)
+            {
+                return(ret);
+            }
+        }
+        eof      = !quitting;
+        quitting = 1;
+        return(0);
+    }
+    ilen += len;
+
+    /* send each line terminated by Enter */
+    pos = 0;
+    while (!quitting && (lf = memchr(ibuf + pos, '\n', ilen - pos)) != NULL)
+    {
+        ret = cli_line(ibuf + pos, lf - (ibuf + pos));
+        if (ret < 0)
+        {
+            return(ret);
+        }
+        pos = lf + 1 - ibuf;
+    }
+    if (quitting)
+    {
+        (void)evl_del(evl, fd);
+        return(0);
+    }
+
+    /* a line too long is sent as it is */
+    if (pos == 0 && ilen == sizeof(ibuf))
+    {
+        ret = cli_line(ibuf, ilen);
+        if (ret < 0)
+        {
+            return(ret);
+        }
+        pos = ilen;
+    }
+    ilen -= pos;
+    memmove(ibuf, ibuf + pos, ilen);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int cli_sock_cb(evl_t *evl, int fd, unsigned int events, void *arg)
+{
+    int ret;
+    ssize_t len;
+    size_t cnt;
+    size_t out;
+
+    if (events & EVL_OUT)
+    {
+        ret = cli_flush_sock();
+        if (ret < 0)
+        {
+            return(ret);
+        }
+    }
+    if (!(events & (EVL_IN | EVL_ERR)))
+    {
+        return(0);
+    }
+
+    /* receive until the terminal buffer is filled */
+    for (;;)
+    {
+        if (tlen == sizeof(tbuf))
+        {
+            cli_flush_tty();
+        }
+        len = recv(fd, tbuf + tlen, sizeof(tbuf) - tlen, 0);
+        if (len < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                break;
+            }
+            T_M(T_E, 0xc0060100, "cannot recv: %s.\n", strerror(errno));
+            return(0xc0060100);
+        }
+        if (len == 0)
+        {
+            if (!quitting)
+            {
+                T_M(T_W, 0x80060200, "connection closed by server.\n");
+            }
+            closed = 1;
+            break;
+        }
+
+        /* show CRLF as LF, answer keepalive pings without showing them */
+        for (cnt = tlen, out = tlen; cnt < tlen + len; cnt++)
+        {
+            if (bol && tlen + len - cnt >= sizeof(COM_PING)-1 &&
+                memcmp(tbuf + cnt, COM_PING, sizeof(COM_PING)-1) == 0)
+            {
+                ret = shut? 0 : cli_send(COM_PONG, sizeof(COM_PONG)-1);
+                if (ret < 0)
+                {
+                    return(ret);
+                }
+                cnt += sizeof(COM_PING)-2;
+                continue;
+            }
+            bol = (tbuf[cnt] == '\n');
+            if (tbuf[cnt] != '\r')
+            {
+                tbuf[out++] = tbuf[cnt];
+            }
+        }
+        tlen = out;
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int cli_line(const char *line, size_t len)
+{
+    int ret;
+    int cnt;
+
+    /* CR of CRLF is added below */
+    if (len > 0 && line[len-1] == '\r')
+    {
+        len--;
+    }
+
+    ret = cli_send(line, len);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+    ret = cli_send("\r\n", 2);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    /* the server says bye and closes the connection */
+    for (cnt = 0; quit_msg[cnt] != NULL; cnt++)
+    {
+        if (len == strlen(quit_msg[cnt]) && memcmp(line, quit_msg[cnt], len) == 0)
+        {
+            quitting = 1;
+            break;
+        }
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int cli_send(const char *buf, size_t len)
+{
+    size_t cap;
+    char *new_buf;
+
+    if (olen + len > ocap)
+    {
+        /* grow by doubling */
+        cap = (ocap > 0)? ocap : 4096;
+        while (cap < olen + len)
+        {
+            cap *= 2;
+        }
+        new_buf = realloc(obuf, cap);
+        if (new_buf == NULL)
+        {
+            T_M(T_E, 0xc0080100, "cannot allocate send buffer.\n");
+            return(0xc0080100);
+        }
+        obuf = new_buf;
+        ocap = cap;
+    }
+    memcpy(obuf + olen, buf, len);
+    olen += len;
+
+    /* the rest is sent when writable */
+    if (olen == len)
+    {
+        return(cli_flush_sock());
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int cli_flush_sock(void)
+{
+    ssize_t ret;
+
+    while (olen > 0)
+    {
+        ret = send(sock, obuf, olen, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return(evl_mod(evl, sock, EVL_IN | EVL_OUT));
+            }
+            T_M(T_E, 0xc0090100, "cannot send: %s.\n", strerror(errno));
+            return(0xc0090100);
+        }
+        olen -= ret;
+        memmove(obuf, obuf + ret, olen);
+    }
+
+    return(evl_mod(evl, sock, EVL_IN));
+}
+
+/*----------------------------------------------------------------------*/
+static void cli_flush_tty(void)
+{
+    ssize_t ret;
+    size_t off = 0;
+
+    if (opr.quiet)
+    {
+        tlen = 0;
+        return;
+    }
+
+    while (off < tlen)
+    {
+        ret = write(STDOUT_FILENO, tbuf + off, tlen - off);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        off += ret;
+    }
+    tlen = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int cli_replay(void)
+{
+    int ret;
+    size_t len;
+    const char *lf;
+    unsigned long long due = 0;
+
+    if (opr.rate > 0)
+    {
+        due = (evl_now() - tr_start) * opr.rate / 1000000000ULL;
+    }
+
+    /* lines due, or as many as queued below the high water mark */
+    while (tr_pos < tr_len && !quitting && olen < CLI_OBUF_HIGH &&
+           (opr.rate == 0 || tr_lines < due))
+    {
+        lf  = memchr(tr + tr_pos, '\n', tr_len - tr_pos);
+        len = (lf != NULL)? (size_t)(lf - (tr + tr_pos)) : tr_len - tr_pos;
+        ret = cli_line(tr + tr_pos, len);
+        if (ret < 0)
+        {
+            return(ret);
+        }
+        tr_pos += len + (lf != NULL);
+        tr_lines++;
+    }
+    if (tr_pos >= tr_len && !quitting)
+    {
+        quitting = 1;
+        eof      = 1;
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void cli_shutdown(void)
+{
+    /* the server closes the connection on the end of input */
+    if (!shut)
+    {
+        (void)shutdown(sock, SHUT_WR);
+        shut = 1;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void usage(void)
+{
+    puts("Usage:");
+    puts("\tchatclient [-h] [-p <port_name>] [-f <transcript> [-r <rate>] [-q]] <host>");
+    puts("");
+    puts("Options:");
+    puts("\t-h show this help and exit");
+    printf("\t-p specify port name or port number (default: %d)\n", COM_DEF_PORT);
+    puts("\t-f send lines of specified file instead of typed lines");
+    puts("\t-r send specified number of lines per second (default: 0 for max)");
+    puts("\t-q do not show messages from the server");
+    puts("");
+    puts("Lines bye, exit or quit disconnect from the server.");
+
+    return;
+}
+
+/* end of main.c */
@@ -0,0 +1,4 @@
+    "/quit",
+    "bye",
+    "exit",
+    "quit",
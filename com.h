@@ -27,6 +27,24 @@
  */
 #define COM_DEF_PORT    10023
 
+/**
+ * @def COM_MAX_NAME
+ * @brief Max length of client names put before messages as "[name] ".
+ */
+#define COM_MAX_NAME    128
+
+/**
+ * @def COM_PING
+ * @brief Keepalive line sent by the server to an idle client.
+ */
+#define COM_PING        "PING\r\n"
+
+/**
+ * @def COM_PONG
+ * @brief Answer to COM_PING, not shown to the others.
+ */
+#define COM_PONG        "PONG\r\n"
+
 /*======================================================================
  * typedefs, structures
  *======================================================================*/
@@ -0,0 +1,1186 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Event loop.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Readiness based event loop with epoll and select backends.
+ * The io_uring backend emulates readiness with one-shot poll requests
+ * and runs completion based operations besides.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <poll.h>
+#endif
+
+#include "trace.h"
+#include "evl.h"
+#include "uring.h"
+#include "tmr.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define EVL_INIT_ENT    64      /* initial size of the fd table */
+#define EVL_MAX_EVENTS  256     /* max events retrieved by one epoll_wait */
+#define EVL_URING_SQ    4096    /* io_uring submission queue entries */
+#define EVL_URING_BUFS  512     /* receive buffers provided to io_uring */
+#define EVL_POLL_TAG    (1ULL << 63) /* user_data of poll requests */
+#define EVL_PGEN_MASK   0x7fffffffU  /* poll generation in user_data */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* completion based operation kinds */
+enum evl_op_kind
+{
+    EVL_OP_ACCEPT = 0,          /* multishot accept */
+    EVL_OP_RECV   = 1,          /* multishot recv with provided buffers */
+    EVL_OP_SEND   = 2,          /* sendmsg */
+};
+
+/* completion based operation in flight */
+typedef struct evl_op_strct {
+    evl_op_cb_t  cb;            /* callback */
+    void        *arg;           /* callback argument */
+    const struct msghdr *mh;    /* message to send */
+    int          fd;            /* file descriptor */
+    unsigned char kind;         /* EVL_OP_* */
+    unsigned char cancelled;    /* evl_cancel() called */
+    unsigned char linked;       /* in the operation list of fd */
+    struct evl_op_strct *fprev; /* previous operation of fd */
+    struct evl_op_strct *fnext; /* next operation of fd */
+    struct evl_op_strct *prev;  /* previous operation in flight */
+    struct evl_op_strct *next;  /* next operation in flight, or free */
+} evl_op_t;
+
+/* registered file descriptor */
+typedef struct evl_ent_strct {
+    evl_cb_t     cb;            /* callback, NULL when not registered */
+    void        *arg;           /* callback argument */
+    unsigned int events;        /* watching events */
+    unsigned int gen;           /* registration generation */
+    unsigned int pgen;          /* poll generation (io_uring) */
+    unsigned int armed;         /* poll request in flight (io_uring) */
+    evl_op_t    *ops;           /* operations in flight (io_uring) */
+} evl_ent_t;
+
+struct evl_strct {
+    int        backend;         /* EVL_SELECT, EVL_EPOLL */
+    evl_ent_t *ent;             /* fd indexed table */
+    int        ent_num;         /* size of ent */
+
+    /* select backend */
+    fd_set     rfds;            /* watching read fds */
+    fd_set     wfds;            /* watching write fds */
+    int        max_fd;          /* max registered fd */
+
+    /* epoll backend */
+    int        epfd;            /* epoll fd */
+#ifdef __linux__
+    struct epoll_event evs[EVL_MAX_EVENTS]; /* ready events */
+#endif
+
+    /* io_uring backend */
+#ifdef URING_ENABLE
+    uring_t    ur;              /* io_uring */
+#endif
+    evl_op_t  *ops;             /* operations in flight */
+    evl_op_t  *op_free;         /* free operation records */
+    int        cur_fd;          /* fd in poll callback, -1 otherwise */
+    unsigned long long woken;   /* time the last wait returned in ns */
+    tmr_t     *tmr;             /* timer wheel */
+};
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static int evl_ent_reserve(evl_t *evl, int fd);
+static int evl_wait_select(evl_t *evl, int timeout);
+#ifdef __linux__
+static unsigned int evl_to_epoll(unsigned int events);
+static int evl_wait_epoll(evl_t *evl, int timeout);
+#endif
+#ifdef URING_ENABLE
+static int evl_poll_arm(evl_t *evl, int fd);
+static void evl_poll_disarm(evl_t *evl, int fd);
+static evl_op_t *evl_op_new(evl_t *evl, int fd, int kind, evl_op_cb_t cb, void *arg);
+static int evl_op_submit(evl_t *evl, evl_op_t *op);
+static void evl_op_free(evl_t *evl, evl_op_t *op);
+static int evl_op_restart(evl_op_t *op, int res);
+static int evl_wait_uring(evl_t *evl, int timeout);
+static int evl_dispatch_poll(evl_t *evl, struct io_uring_cqe *cqe);
+static int evl_dispatch_op(evl_t *evl, struct io_uring_cqe *cqe);
+#endif
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+evl_t *evl_create(int backend)
+{
+    evl_t *evl;
+
+    evl = calloc(1, sizeof(*evl));
+    if (evl == NULL)
+    {
+        T_M(T_E, 0x90010100, "cannot allocate event loop.\n");
+        return(NULL);
+    }
+    evl->backend = backend;
+    evl->epfd    = -1;
+    evl->max_fd  = -1;
+    evl->cur_fd  = -1;
+    FD_ZERO(&evl->rfds);
+    FD_ZERO(&evl->wfds);
+    evl->woken = evl_now();
+    evl->tmr   = tmr_create(evl->woken / 1000000);
+    if (evl->tmr == NULL)
+    {
+        free(evl);
+        return(NULL);
+    }
+
+    switch (backend)
+    {
+    case EVL_SELECT:
+        break;
+#ifdef __linux__
+    case EVL_EPOLL:
+        evl->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (evl->epfd < 0)
+        {
+            T_M(T_E, 0x90010200, "cannot create epoll: %s.\n", strerror(errno));
+            tmr_destroy(evl->tmr);
+            free(evl);
+            return(NULL);
+        }
+        break;
+#endif
+#ifdef URING_ENABLE
+    case EVL_URING:
+        if (uring_init(&evl->ur, EVL_URING_SQ) < 0)
+        {
+            tmr_destroy(evl->tmr);
+            free(evl);
+            return(NULL);
+        }
+        if (uring_buf_init(&evl->ur, EVL_URING_BUFS, EVL_RECV_SIZE) < 0)
+        {
+            uring_exit(&evl->ur);
+            tmr_destroy(evl->tmr);
+            free(evl);
+            return(NULL);
+        }
+        break;
+#endif
+    default:
+        T_M(T_E, 0x90010300, "unsupported backend: %d.\n", backend);
+        tmr_destroy(evl->tmr);
+        free(evl);
+        return(NULL);
+    }
+
+    if (evl_ent_reserve(evl, EVL_INIT_ENT-1) < 0)
+    {
+        evl_destroy(evl);
+        return(NULL);
+    }
+
+    T_M(T_D1, 0x10010400, "event loop created with backend %d.\n", backend);
+    return(evl);
+}
+
+/*----------------------------------------------------------------------*/
+void evl_destroy(evl_t *evl)
+{
+    evl_op_t *op;
+
+    if (evl == NULL)
+    {
+        return;
+    }
+
+    if (evl->epfd >= 0)
+    {
+        close(evl->epfd);
+    }
+#ifdef URING_ENABLE
+    if (evl->backend == EVL_URING)
+    {
+        /* the kernel drops requests with the ring */
+        uring_exit(&evl->ur);
+    }
+#endif
+
+    /* let owners release what they passed to operations */
+    while ((op = evl->ops) != NULL)
+    {
+        evl->ops = op->next;
+        (void)op->cb(evl, -ECANCELED, NULL, 0, op->arg);
+        free(op);
+    }
+    while ((op = evl->op_free) != NULL)
+    {
+        evl->op_free = op->next;
+        free(op);
+    }
+    tmr_destroy(evl->tmr);
+    free(evl->ent);
+    free(evl);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int evl_add(evl_t *evl, int fd, unsigned int events, evl_cb_t cb, void *arg)
+{
+    int ret;
+#ifdef __linux__
+    struct epoll_event ev;
+#endif
+
+    if (fd < 0 || cb == NULL)
+    {
+        T_M(T_E, 0x90030100, "invalid registration: fd=%d.\n", fd);
+        return(0x90030100);
+    }
+    if (evl->backend == EVL_SELECT && fd >= FD_SETSIZE)
+    {
+        T_M(T_E, 0x90030200, "fd=%d exceeds FD_SETSIZE.\n", fd);
+        return(0x90030200);
+    }
+
+    ret = evl_ent_reserve(evl, fd);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    switch (evl->backend)
+    {
+    case EVL_SELECT:
+        if (events & EVL_IN)
+        {
+            FD_SET(fd, &evl->rfds);
+        }
+        if (events & EVL_OUT)
+        {
+            FD_SET(fd, &evl->wfds);
+        }
+        if (fd > evl->max_fd)
+        {
+            evl->max_fd = fd;
+        }
+        break;
+#ifdef __linux__
+    case EVL_EPOLL:
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = evl_to_epoll(events);
+        ev.data.u64 = (unsigned long long)(evl->ent[fd].gen + 1) << 32 | (unsigned int)fd;
+        ret = epoll_ctl(evl->epfd, EPOLL_CTL_ADD, fd, &ev);
+        if (ret < 0)
+        {
+            T_M(T_E, 0x90030300, "cannot add fd=%d to epoll: %s.\n", fd, strerror(errno));
+            return(0x90030300);
+        }
+        break;
+#endif
+    }
+
+    evl->ent[fd].cb     = cb;
+    evl->ent[fd].arg    = arg;
+    evl->ent[fd].events = events;
+    evl->ent[fd].gen++;
+#ifdef URING_ENABLE
+    if (evl->backend == EVL_URING && events != 0)
+    {
+        ret = evl_poll_arm(evl, fd);
+        if (ret < 0)
+        {
+            evl->ent[fd].cb = NULL;
+            return(ret);
+        }
+    }
+#endif
+    T_M(T_D2, 0x10030400, "registered fd=%d events=%x.\n", fd, events);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int evl_mod(evl_t *evl, int fd, unsigned int events)
+{
+#ifdef __linux__
+    int ret;
+    struct epoll_event ev;
+#endif
+
+    if (fd < 0 || fd >= evl->ent_num || evl->ent[fd].cb == NULL)
+    {
+        T_M(T_E, 0x90040100, "fd=%d is not registered.\n", fd);
+        return(0x90040100);
+    }
+    if (evl->ent[fd].events == events)
+    {
+        /* nothing to change */
+        return(0);
+    }
+
+    switch (evl->backend)
+    {
+    case EVL_SELECT:
+        FD_CLR(fd, &evl->rfds);
+        FD_CLR(fd, &evl->wfds);
+        if (events & EVL_IN)
+        {
+            FD_SET(fd, &evl->rfds);
+        }
+        if (events & EVL_OUT)
+        {
+            FD_SET(fd, &evl->wfds);
+        }
+        break;
+#ifdef __linux__
+    case EVL_EPOLL:
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = evl_to_epoll(events);
+        ev.data.u64 = (unsigned long long)evl->ent[fd].gen << 32 | (unsigned int)fd;
+        ret = epoll_ctl(evl->epfd, EPOLL_CTL_MOD, fd, &ev);
+        if (ret < 0)
+        {
+            T_M(T_E, 0x90040200, "cannot modify fd=%d in epoll: %s.\n", fd, strerror(errno));
+            return(0x90040200);
+        }
+        break;
+#endif
+#ifdef URING_ENABLE
+    case EVL_URING:
+        /* a callback of fd re-arms the poll request on return */
+        evl_poll_disarm(evl, fd);
+        evl->ent[fd].events = events;
+        if (events != 0 && fd != evl->cur_fd)
+        {
+            return(evl_poll_arm(evl, fd));
+        }
+        break;
+#endif
+    }
+
+    evl->ent[fd].events = events;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int evl_del(evl_t *evl, int fd)
+{
+#ifdef __linux__
+    int ret;
+#endif
+
+    if (fd < 0 || fd >= evl->ent_num || evl->ent[fd].cb == NULL)
+    {
+        T_M(T_W, 0x90050100, "fd=%d is not registered.\n", fd);
+        return(0x90050100);
+    }
+
+    switch (evl->backend)
+    {
+    case EVL_SELECT:
+        FD_CLR(fd, &evl->rfds);
+        FD_CLR(fd, &evl->wfds);
+        break;
+#ifdef __linux__
+    case EVL_EPOLL:
+        ret = epoll_ctl(evl->epfd, EPOLL_CTL_DEL, fd, NULL);
+        if (ret < 0)
+        {
+            T_M(T_W, 0x90050200, "cannot delete fd=%d from epoll: %s.\n", fd, strerror(errno));
+        }
+        break;
+#endif
+#ifdef URING_ENABLE
+    case EVL_URING:
+        evl_poll_disarm(evl, fd);
+        break;
+#endif
+    }
+
+    /* generation is kept to discard pending events */
+    evl->ent[fd].cb     = NULL;
+    evl->ent[fd].arg    = NULL;
+    evl->ent[fd].events = 0;
+    while (evl->max_fd >= 0 && evl->ent[evl->max_fd].cb == NULL)
+    {
+        evl->max_fd--;
+    }
+    T_M(T_D2, 0x10050300, "unregistered fd=%d.\n", fd);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int evl_wait(evl_t *evl, int timeout)
+{
+    int ret;
+    int next;
+
+    /* wake up for the next timer */
+    next = tmr_next(evl->tmr);
+    if (next >= 0 && (timeout < 0 || next < timeout))
+    {
+        timeout = next;
+    }
+
+    switch (evl->backend)
+    {
+    case EVL_SELECT:
+        ret = evl_wait_select(evl, timeout);
+        break;
+#ifdef __linux__
+    case EVL_EPOLL:
+        ret = evl_wait_epoll(evl, timeout);
+        break;
+#endif
+#ifdef URING_ENABLE
+    case EVL_URING:
+        ret = evl_wait_uring(evl, timeout);
+        break;
+#endif
+    default:
+        return(0x90060100);
+    }
+
+    /* timers after events, which may have pushed them back */
+    (void)tmr_run(evl->tmr, evl->woken / 1000000);
+
+    return(ret);
+}
+
+/*----------------------------------------------------------------------*/
+unsigned long long evl_woken(evl_t *evl)
+{
+    return(evl->woken);
+}
+
+/*----------------------------------------------------------------------*/
+tmr_t *evl_tmr(evl_t *evl)
+{
+    return(evl->tmr);
+}
+
+/*----------------------------------------------------------------------*/
+unsigned long long evl_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return((unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*----------------------------------------------------------------------*/
+int evl_has_ops(evl_t *evl)
+{
+    return(evl->backend == EVL_URING);
+}
+
+/*----------------------------------------------------------------------*/
+int evl_accept(evl_t *evl, int fd, evl_op_cb_t cb, void *arg)
+{
+#ifdef URING_ENABLE
+    int ret;
+    evl_op_t *op;
+
+    if (evl->backend == EVL_URING)
+    {
+        op = evl_op_new(evl, fd, EVL_OP_ACCEPT, cb, arg);
+        if (op == NULL)
+        {
+            return(0x90090100);
+        }
+        ret = evl_op_submit(evl, op);
+        if (ret < 0)
+        {
+            evl_op_free(evl, op);
+        }
+        return(ret);
+    }
+#endif
+
+    T_M(T_E, 0x90090200, "accept operation is not supported.\n");
+    return(0x90090200);
+}
+
+/*----------------------------------------------------------------------*/
+int evl_recv(evl_t *evl, int fd, evl_op_cb_t cb, void *arg)
+{
+#ifdef URING_ENABLE
+    int ret;
+    evl_op_t *op;
+
+    if (evl->backend == EVL_URING)
+    {
+        op = evl_op_new(evl, fd, EVL_OP_RECV, cb, arg);
+        if (op == NULL)
+        {
+            return(0x900a0100);
+        }
+        ret = evl_op_submit(evl, op);
+        if (ret < 0)
+        {
+            evl_op_free(evl, op);
+        }
+        return(ret);
+    }
+#endif
+
+    T_M(T_E, 0x900a0200, "recv operation is not supported.\n");
+    return(0x900a0200);
+}
+
+/*----------------------------------------------------------------------*/
+int evl_sendmsg(evl_t *evl, int fd, const struct msghdr *mh, evl_op_cb_t cb, void *arg)
+{
+#ifdef URING_ENABLE
+    int ret;
+    evl_op_t *op;
+
+    if (evl->backend == EVL_URING)
+    {
+        op = evl_op_new(evl, fd, EVL_OP_SEND, cb, arg);
+        if (op == NULL)
+        {
+            return(0x900b0100);
+        }
+        op->mh = mh;
+        ret = evl_op_submit(evl, op);
+        if (ret < 0)
+        {
+            evl_op_free(evl, op);
+        }
+        return(ret);
+    }
+#endif
+
+    T_M(T_E, 0x900b0200, "sendmsg operation is not supported.\n");
+    return(0x900b0200);
+}
+
+/*----------------------------------------------------------------------*/
+int evl_cancel(evl_t *evl, int fd)
+{
+#ifdef URING_ENABLE
+    evl_op_t *op;
+    struct io_uring_sqe *sqe;
+
+    if (evl->backend != EVL_URING || fd < 0 || fd >= evl->ent_num)
+    {
+        return(0);
+    }
+
+    /* requests are cancelled by user_data, fd may be closed before submit */
+    while ((op = evl->ent[fd].ops) != NULL)
+    {
+        evl->ent[fd].ops = op->fnext;
+        op->linked    = 0;
+        op->cancelled = 1;
+
+        sqe = uring_sqe(&evl->ur);
+        if (sqe == NULL)
+        {
+            T_M(T_W, 0x900c0100, "cannot cancel operation of fd=%d.\n", fd);
+            continue;
+        }
+        sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+        sqe->fd        = -1;
+        sqe->addr      = (unsigned long long)(uintptr_t)op;
+        sqe->user_data = 0;
+    }
+    T_M(T_D2, 0x100c0200, "cancelled operations of fd=%d.\n", fd);
+#endif
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int evl_backend_parse(const char *name)
+{
+    if (strcmp(name, "select") == 0)
+    {
+        return(EVL_SELECT);
+    }
+#ifdef __linux__
+    if (strcmp(name, "epoll") == 0)
+    {
+        return(EVL_EPOLL);
+    }
+#endif
+#ifdef URING_ENABLE
+    if (strcmp(name, "uring") == 0)
+    {
+        return(EVL_URING);
+    }
+#endif
+
+    return(0x90070100);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static int evl_ent_reserve(evl_t *evl, int fd)
+{
+    int        num;
+    evl_ent_t *ent;
+
+    if (fd < evl->ent_num)
+    {
+        return(0);
+    }
+
+    /* grow table by doubling */
+    num = (evl->ent_num > 0)? evl->ent_num : EVL_INIT_ENT;
+    while (num <= fd)
+    {
+        num *= 2;
+    }
+
+    ent = realloc(evl->ent, sizeof(*ent) * num);
+    if (ent == NULL)
+    {
+        T_M(T_E, 0xd0010100, "cannot grow fd table to %d.\n", num);
+        return(0xd0010100);
+    }
+    memset(ent + evl->ent_num, 0, sizeof(*ent) * (num - evl->ent_num));
+    evl->ent     = ent;
+    evl->ent_num = num;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int evl_wait_select(evl_t *evl, int timeout)
+{
+    int    fd;
+    int    ret;
+    int    err = 0;
+    int    max_fd;
+    int    fdnum;
+    int    cnt = 0;
+    unsigned int events;
+    fd_set rfds;
+    fd_set wfds;
+    struct timeval tv;
+
+    rfds   = evl->rfds;
+    wfds   = evl->wfds;
+    max_fd = evl->max_fd;
+    if (timeout >= 0)
+    {
+        tv.tv_sec  = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+    }
+
+    fdnum = select(max_fd+1, &rfds, &wfds, NULL, (timeout >= 0)? &tv : NULL);
+    evl->woken = evl_now();
+    if (fdnum < 0)
+    {
+        if (errno == EINTR)
+        {
+            /* ignore signal interrupts */
+            T_M(T_D1, 0x500203f0, "select: signal interrupt.\n");
+            return(0);
+        }
+
+        T_M(T_E, 0xd0020400, "select error: %s.\n", strerror(errno));
+        return(0xd0020400);
+    }
+
+    for (fd = 0; fd <= max_fd && fdnum > 0; fd++)
+    {
+        events = 0;
+        if (FD_ISSET(fd, &rfds))
+        {
+            events |= EVL_IN;
+        }
+        if (FD_ISSET(fd, &wfds))
+        {
+            events |= EVL_OUT;
+        }
+        if (events == 0)
+        {
+            continue;
+        }
+        fdnum--;
+
+        /* skip fds unregistered by former callbacks */
+        events &= evl->ent[fd].events;
+        if (evl->ent[fd].cb == NULL || events == 0)
+        {
+            continue;
+        }
+
+        ret = evl->ent[fd].cb(evl, fd, events, evl->ent[fd].arg);
+        if (ret < 0 && err == 0)
+        {
+            err = ret;
+        }
+        cnt++;
+    }
+
+    return((err < 0)? err : cnt);
+}
+
+#ifdef __linux__
+/*----------------------------------------------------------------------*/
+static unsigned int evl_to_epoll(unsigned int events)
+{
+    unsigned int ep = 0;
+
+    if (events & EVL_IN)
+    {
+        ep |= EPOLLIN;
+    }
+    if (events & EVL_OUT)
+    {
+        ep |= EPOLLOUT;
+    }
+
+    return(ep);
+}
+
+/*----------------------------------------------------------------------*/
+static int evl_wait_epoll(evl_t *evl, int timeout)
+{
+    int i;
+    int fd;
+    int ret;
+    int err = 0;
+    int fdnum;
+    int cnt = 0;
+    unsigned int gen;
+    unsigned int events;
+
+    fdnum = epoll_wait(evl->epfd, evl->evs, EVL_MAX_EVENTS, timeout);
+    evl->woken = evl_now();
+    if (fdnum < 0)
+    {
+        if (errno == EINTR)
+        {
+            /* ignore signal interrupts */
+            T_M(T_D1, 0x500403f0, "epoll_wait: signal interrupt.\n");
+            return(0);
+        }
+
+        T_M(T_E, 0xd0040400, "epoll_wait error: %s.\n", strerror(errno));
+        return(0xd0040400);
+    }
+
+    for (i = 0; i < fdnum; i++)
+    {
+        fd  = (int)(evl->evs[i].data.u64 & 0xffffffff);
+        gen = (unsigned int)(evl->evs[i].data.u64 >> 32);
+
+        /* skip fds unregistered (or re-registered) by former callbacks */
+        if (evl->ent[fd].cb == NULL || evl->ent[fd].gen != gen)
+        {
+            continue;
+        }
+
+        events = 0;
+        if (evl->evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            /* let the reader find out hang up and errors */
+            events |= EVL_IN;
+        }
+        if (evl->evs[i].events & EPOLLOUT)
+        {
+            events |= EVL_OUT;
+        }
+        if (evl->evs[i].events & (EPOLLHUP | EPOLLERR))
+        {
+            events |= EVL_ERR;
+        }
+        events &= evl->ent[fd].events | EVL_ERR;
+        if (events == 0)
+        {
+            continue;
+        }
+
+        ret = evl->ent[fd].cb(evl, fd, events, evl->ent[fd].arg);
+        if (ret < 0 && err == 0)
+        {
+            err = ret;
+        }
+        cnt++;
+    }
+
+    return((err < 0)? err : cnt);
+}
+#endif
+
+#ifdef URING_ENABLE
+/*----------------------------------------------------------------------*/
+static int evl_poll_arm(evl_t *evl, int fd)
+{
+    unsigned int events = evl->ent[fd].events;
+    struct io_uring_sqe *sqe;
+
+    /* one-shot poll re-armed after each dispatch works level triggered */
+    sqe = uring_sqe(&evl->ur);
+    if (sqe == NULL)
+    {
+        T_M(T_E, 0xd0050100, "cannot poll fd=%d.\n", fd);
+        return(0xd0050100);
+    }
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = fd;
+    sqe->poll32_events = ((events & EVL_IN)? POLLIN : 0) | ((events & EVL_OUT)? POLLOUT : 0);
+    sqe->user_data     = EVL_POLL_TAG |
+        (unsigned long long)(evl->ent[fd].pgen & EVL_PGEN_MASK) << 32 | (unsigned int)fd;
+    evl->ent[fd].armed = 1;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void evl_poll_disarm(evl_t *evl, int fd)
+{
+    struct io_uring_sqe *sqe;
+
+    if (evl->ent[fd].armed)
+    {
+        sqe = uring_sqe(&evl->ur);
+        if (sqe != NULL)
+        {
+            sqe->opcode    = IORING_OP_POLL_REMOVE;
+            sqe->fd        = -1;
+            sqe->addr      = EVL_POLL_TAG |
+                (unsigned long long)(evl->ent[fd].pgen & EVL_PGEN_MASK) << 32 | (unsigned int)fd;
+            sqe->user_data = 0;
+        }
+        evl->ent[fd].armed = 0;
+    }
+
+    /* completion of the old request is discarded */
+    evl->ent[fd].pgen++;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static evl_op_t *evl_op_new(evl_t *evl, int fd, int kind, evl_op_cb_t cb, void *arg)
+{
+    evl_op_t *op;
+
+    if (fd < 0 || cb == NULL || evl_ent_reserve(evl, fd) < 0)
+    {
+        T_M(T_E, 0xd0070100, "invalid operation: fd=%d.\n", fd);
+        return(NULL);
+    }
+
+    op = evl->op_free;
+    if (op != NULL)
+    {
+        evl->op_free = op->next;
+    }
+    else
+    {
+        op = malloc(sizeof(*op));
+        if (op == NULL)
+        {
+            T_M(T_E, 0xd0070200, "cannot allocate operation.\n");
+            return(NULL);
+        }
+    }
+    memset(op, 0, sizeof(*op));
+    op->cb   = cb;
+    op->arg  = arg;
+    op->fd   = fd;
+    op->kind = kind;
+
+    /* link to operations of fd */
+    op->fnext = evl->ent[fd].ops;
+    if (op->fnext != NULL)
+    {
+        op->fnext->fprev = op;
+    }
+    evl->ent[fd].ops = op;
+    op->linked = 1;
+
+    /* link to operations in flight */
+    op->next = evl->ops;
+    if (op->next != NULL)
+    {
+        op->next->prev = op;
+    }
+    evl->ops = op;
+
+    return(op);
+}
+
+/*----------------------------------------------------------------------*/
+static int evl_op_submit(evl_t *evl, evl_op_t *op)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_sqe(&evl->ur);
+    if (sqe == NULL)
+    {
+        T_M(T_E, 0xd0080100, "cannot submit operation of fd=%d.\n", op->fd);
+        return(0xd0080100);
+    }
+    sqe->fd        = op->fd;
+    sqe->user_data = (unsigned long long)(uintptr_t)op;
+
+    switch (op->kind)
+    {
+    case EVL_OP_ACCEPT:
+        sqe->opcode       = IORING_OP_ACCEPT;
+        sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        break;
+    case EVL_OP_RECV:
+        sqe->opcode    = IORING_OP_RECV;
+        sqe->ioprio    = IORING_RECV_MULTISHOT;
+        sqe->flags     = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BGID;
+        break;
+    case EVL_OP_SEND:
+        sqe->opcode    = IORING_OP_SENDMSG;
+        sqe->addr      = (unsigned long long)(uintptr_t)op->mh;
+        sqe->len       = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        break;
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void evl_op_free(evl_t *evl, evl_op_t *op)
+{
+    if (op->linked)
+    {
+        if (op->fprev != NULL)
+        {
+            op->fprev->fnext = op->fnext;
+        }
+        else
+        {
+            evl->ent[op->fd].ops = op->fnext;
+        }
+        if (op->fnext != NULL)
+        {
+            op->fnext->fprev = op->fprev;
+        }
+    }
+
+    if (op->prev != NULL)
+    {
+        op->prev->next = op->next;
+    }
+    else
+    {
+        evl->ops = op->next;
+    }
+    if (op->next != NULL)
+    {
+        op->next->prev = op->prev;
+    }
+
+    op->next = evl->op_free;
+    evl->op_free = op;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int evl_op_restart(evl_op_t *op, int res)
+{
+    if (op->cancelled)
+    {
+        return(0);
+    }
+
+    /* the kernel stops multishot requests on some conditions */
+    switch (op->kind)
+    {
+    case EVL_OP_ACCEPT:
+        return(res >= 0 || res == -ENOBUFS || res == -ENOMEM || res == -EINTR ||
+               res == -EAGAIN || res == -ECONNABORTED || res == -EMFILE || res == -ENFILE);
+    case EVL_OP_RECV:
+        return(res > 0 || res == -ENOBUFS);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int evl_wait_uring(evl_t *evl, int timeout)
+{
+    int ret;
+    int err = 0;
+    int cnt = 0;
+    struct io_uring_cqe cqe;
+
+    /* submit requests queued since the last wait together */
+    ret = uring_enter(&evl->ur, 1, timeout);
+    evl->woken = evl_now();
+    if (ret < 0 && ret != -EINTR && ret != -ETIME && ret != -EBUSY && ret != -EAGAIN)
+    {
+        T_M(T_E, 0xd00b0100, "io_uring_enter error: %s.\n", strerror(-ret));
+        return(0xd00b0100);
+    }
+
+    while (uring_cqe(&evl->ur, &cqe))
+    {
+        if (cqe.user_data == 0)
+        {
+            /* cancel or poll remove */
+            continue;
+        }
+
+        if (cqe.user_data & EVL_POLL_TAG)
+        {
+            ret = evl_dispatch_poll(evl, &cqe);
+        }
+        else
+        {
+            ret = evl_dispatch_op(evl, &cqe);
+        }
+        if (ret < 0 && err == 0)
+        {
+            err = ret;
+        }
+        cnt++;
+    }
+
+    return((err < 0)? err : cnt);
+}
+
+/*----------------------------------------------------------------------*/
+static int evl_dispatch_poll(evl_t *evl, struct io_uring_cqe *cqe)
+{
+    int ret = 0;
+    int fd = (int)(cqe->user_data & 0xffffffff);
+    unsigned int pgen = (unsigned int)(cqe->user_data >> 32) & EVL_PGEN_MASK;
+    unsigned int events = 0;
+
+    /* skip fds unregistered (or modified) by former callbacks */
+    if (fd >= evl->ent_num || evl->ent[fd].cb == NULL ||
+        (evl->ent[fd].pgen & EVL_PGEN_MASK) != pgen)
+    {
+        return(0);
+    }
+    evl->ent[fd].armed = 0;
+
+    if (cqe->res < 0 || (cqe->res & (POLLIN | POLLHUP | POLLERR)))
+    {
+        /* let the reader find out hang up and errors */
+        events |= EVL_IN;
+    }
+    if (cqe->res > 0 && (cqe->res & POLLOUT))
+    {
+        events |= EVL_OUT;
+    }
+    if (cqe->res < 0 || (cqe->res & (POLLHUP | POLLERR)))
+    {
+        events |= EVL_ERR;
+    }
+    events &= evl->ent[fd].events | EVL_ERR;
+
+    if (events != 0)
+    {
+        evl->cur_fd = fd;
+        ret = evl->ent[fd].cb(evl, fd, events, evl->ent[fd].arg);
+        evl->cur_fd = -1;
+    }
+
+    if (evl->ent[fd].cb != NULL && !evl->ent[fd].armed && evl->ent[fd].events != 0)
+    {
+        if (evl_poll_arm(evl, fd) < 0 && ret == 0)
+        {
+            ret = 0xd00c0100;
+        }
+    }
+
+    return(ret);
+}
+
+/*----------------------------------------------------------------------*/
+static int evl_dispatch_op(evl_t *evl, struct io_uring_cqe *cqe)
+{
+    int ret = 0;
+    int more;
+    int restart = 0;
+    unsigned int bid = 0;
+    void *buf = NULL;
+    evl_op_t *op = (evl_op_t*)(uintptr_t)cqe->user_data;
+
+    more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    if (!more)
+    {
+        restart = evl_op_restart(op, cqe->res);
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        buf = uring_buf(&evl->ur, bid);
+    }
+
+    /* running out of buffers is not an event for the owner */
+    if (!(op->kind == EVL_OP_RECV && cqe->res == -ENOBUFS))
+    {
+        ret = op->cb(evl, cqe->res, buf, more || restart, op->arg);
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        uring_buf_put(&evl->ur, bid);
+    }
+    if (more)
+    {
+        return(ret);
+    }
+
+    if (restart)
+    {
+        if (!op->cancelled)
+        {
+            if (evl_op_submit(evl, op) == 0)
+            {
+                return(ret);
+            }
+            (void)op->cb(evl, -ECANCELED, NULL, 0, op->arg);
+            evl_op_free(evl, op);
+            return((ret < 0)? ret : 0xd00d0100);
+        }
+
+        /* cancelled by the callback, the owner waits for the final one */
+        (void)op->cb(evl, -ECANCELED, NULL, 0, op->arg);
+    }
+    evl_op_free(evl, op);
+
+    return(ret);
+}
+#endif
+
+/* end of evl.c */
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for the event loop.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * File descriptors are registered once with a callback and the loop
+ * dispatches only the descriptors which became ready.
+ * epoll is used on Linux, select is kept as a fallback backend.
+ * The io_uring backend also runs accept, recv and sendmsg as completion
+ * based operations.
+ * Each loop has a timer wheel run with the time taken once per wait.
+ */
+#ifndef __EVL_H
+#define __EVL_H
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include "tmr.h"
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @enum EVL_EV
+ * @brief Event flags.
+ */
+enum EVL_EV
+{
+    EVL_IN      = 0x01,         /**< readable */
+    EVL_OUT     = 0x02,         /**< writable */
+    EVL_ERR     = 0x04,         /**< error or hang up (output only) */
+};
+
+/**
+ * @enum EVL_BACKEND
+ * @brief Event loop backends.
+ */
+enum EVL_BACKEND
+{
+    EVL_SELECT  = 0,            /**< select(2) */
+    EVL_EPOLL   = 1,            /**< epoll(7) */
+    EVL_URING   = 2,            /**< io_uring(7) */
+};
+
+/**
+ * @def EVL_RECV_SIZE
+ * @brief Max bytes delivered by one evl_recv() completion.
+ */
+#define EVL_RECV_SIZE   (8*1024)
+
+/**
+ * @def EVL_DEF_BACKEND
+ * @brief Default backend.
+ */
+#ifdef __linux__
+#define EVL_DEF_BACKEND EVL_EPOLL
+#else
+#define EVL_DEF_BACKEND EVL_SELECT
+#endif
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @brief Event loop (opaque).
+ */
+typedef struct evl_strct evl_t;
+
+/**
+ * @brief       Event callback.
+ * @param[in] evl Event loop.
+ * @param[in] fd Ready file descriptor.
+ * @param[in] events Ready events (EVL_IN, EVL_OUT, EVL_ERR).
+ * @param[in] arg Argument given on registration.
+ * @return      Returns minus value to report an error to evl_wait().
+ */
+typedef int (*evl_cb_t)(evl_t *evl, int fd, unsigned int events, void *arg);
+
+/**
+ * @brief       Completion callback.
+ * @param[in] evl Event loop.
+ * @param[in] res Result of the operation: new fd, bytes received or sent,
+ *                minus errno on any error (-ECANCELED when cancelled).
+ * @param[in] buf Received bytes for evl_recv(), NULL otherwise.
+ *                Valid only during the callback.
+ * @param[in] more Non-zero when the operation completes again.
+ * @param[in] arg Argument given on submission.
+ * @return      Returns minus value to report an error to evl_wait().
+ */
+typedef int (*evl_op_cb_t)(evl_t *evl, int res, void *buf, int more, void *arg);
+
+struct msghdr;
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Create an event loop.
+ * @param[in] backend Backend to use (EVL_SELECT, EVL_EPOLL, EVL_URING).
+ * @return      Returns event loop, NULL on any error.
+ */
+evl_t *evl_create(int backend);
+
+/**
+ * @brief       Destroy an event loop.
+ * @param[in] evl Event loop.
+ *
+ * Registered file descriptors are not closed.
+ * Operations in flight are completed with -ECANCELED.
+ */
+void evl_destroy(evl_t *evl);
+
+/**
+ * @brief       Register a file descriptor.
+ * @param[in] evl Event loop.
+ * @param[in] fd File descriptor.
+ * @param[in] events Events to watch (EVL_IN, EVL_OUT).
+ * @param[in] cb Callback called when fd becomes ready.
+ * @param[in] arg Argument passed to cb.
+ * @return      Returns 0 on success, minus value on any error.
+ */
+int evl_add(evl_t *evl, int fd, unsigned int events, evl_cb_t cb, void *arg);
+
+/**
+ * @brief       Change events to watch.
+ * @param[in] evl Event loop.
+ * @param[in] fd Registered file descriptor.
+ * @param[in] events Events to watch (EVL_IN, EVL_OUT).
+ * @return      Returns 0 on success, minus value on any error.
+ */
+int evl_mod(evl_t *evl, int fd, unsigned int events);
+
+/**
+ * @brief       Unregister a file descriptor.
+ * @param[in] evl Event loop.
+ * @param[in] fd Registered file descriptor.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * This function must be called before closing fd.
+ * Pending events of fd in the current dispatch are discarded.
+ */
+int evl_del(evl_t *evl, int fd);
+
+/**
+ * @brief       Wait for events and dispatch them.
+ * @param[in] evl Event loop.
+ * @param[in] timeout Timeout in ms, -1 to wait forever.
+ * @return      Returns number of dispatched events, 0 on timeout or
+ *              signal interrupt.
+ *              Returns minus value on any error including errors
+ *              returned from callbacks.
+ */
+int evl_wait(evl_t *evl, int timeout);
+
+/**
+ * @brief       Get the time the last wait returned.
+ * @param[in] evl Event loop.
+ * @return      Returns monotonic time in ns taken by evl_now() right
+ *              after the last wait returned, before dispatching.
+ */
+unsigned long long evl_woken(evl_t *evl);
+
+/**
+ * @brief       Get the timer wheel of an event loop.
+ * @param[in] evl Event loop.
+ * @return      Returns timer wheel.
+ *
+ * evl_wait() wakes up for the timers and runs them after dispatching
+ * events with the time of evl_woken().
+ */
+tmr_t *evl_tmr(evl_t *evl);
+
+/**
+ * @brief       Get monotonic time.
+ * @return      Returns CLOCK_MONOTONIC time in ns.
+ */
+unsigned long long evl_now(void);
+
+/**
+ * @brief       Check if completion based operations are available.
+ * @param[in] evl Event loop.
+ * @return      Returns non-zero when evl_accept(), evl_recv() and
+ *              evl_sendmsg() are available.
+ */
+int evl_has_ops(evl_t *evl);
+
+/**
+ * @brief       Accept connections until cancelled.
+ * @param[in] evl Event loop.
+ * @param[in] fd Listening socket.
+ * @param[in] cb Callback called with each accepted socket.
+ * @param[in] arg Argument passed to cb.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Accepted sockets are blocking, they are only used with evl_recv()
+ * and evl_sendmsg().
+ */
+int evl_accept(evl_t *evl, int fd, evl_op_cb_t cb, void *arg);
+
+/**
+ * @brief       Receive until end of stream, an error or cancelled.
+ * @param[in] evl Event loop.
+ * @param[in] fd Socket.
+ * @param[in] cb Callback called with each EVL_RECV_SIZE bytes at most.
+ * @param[in] arg Argument passed to cb.
+ * @return      Returns 0 on success, minus value on any error.
+ */
+int evl_recv(evl_t *evl, int fd, evl_op_cb_t cb, void *arg);
+
+/**
+ * @brief       Send a message.
+ * @param[in] evl Event loop.
+ * @param[in] fd Socket.
+ * @param[in] mh Message to send, kept until the completion.
+ * @param[in] cb Callback called once with bytes sent.
+ * @param[in] arg Argument passed to cb.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Bytes sent may be less than the message on stream sockets.
+ */
+int evl_sendmsg(evl_t *evl, int fd, const struct msghdr *mh, evl_op_cb_t cb, void *arg);
+
+/**
+ * @brief       Cancel operations of a file descriptor.
+ * @param[in] evl Event loop.
+ * @param[in] fd File descriptor.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * fd may be closed right after this function.  Callbacks are still
+ * called until the final completion (more == 0).
+ */
+int evl_cancel(evl_t *evl, int fd);
+
+/**
+ * @brief       Convert backend name into backend.
+ * @param[in] name Backend name ("select", "epoll", "uring").
+ * @return      Returns backend, minus value when unknown.
+ */
+int evl_backend_parse(const char *name);
+
+#endif  /* #ifndef __EVL_H */
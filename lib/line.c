@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Line framing tools.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Find CRLF terminated lines in received streams.
+ */
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "line.h"
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static const char *line_find_lf(const char *buf, const char *end);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+size_t line_next(const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    const char *lf;
+
+    for (lf = buf; lf < end; lf++)
+    {
+        lf = line_find_lf(lf, end);
+        if (lf == NULL)
+        {
+            break;
+        }
+        if (lf > buf && *(lf-1) == '\r')
+        {
+            return((size_t)(lf - buf) + 1);
+        }
+    }
+
+    return(0);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static const char *line_find_lf(const char *buf, const char *end)
+{
+#ifdef __SSE2__
+    __m128i lf;
+    int     mask;
+
+    if (end - buf >= LINE_VEC_MIN)
+    {
+        /* compare 16 bytes at once */
+        lf = _mm_set1_epi8('\n');
+        while (end - buf >= 16)
+        {
+            mask = _mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)buf), lf));
+            if (mask != 0)
+            {
+                return(buf + __builtin_ctz(mask));
+            }
+            buf += 16;
+        }
+    }
+#endif
+
+    return(memchr(buf, '\n', end - buf));
+}
+
+/* end of line.c */
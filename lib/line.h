@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for line framing tools.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ */
+#ifndef __LINE_H
+#define __LINE_H
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def LINE_VEC_MIN
+ * @brief Min length of buffer searched with vector instructions.
+ */
+#define LINE_VEC_MIN    64
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Find the first CRLF terminated line.
+ * @param[in] buf Buffer to search.
+ * @param[in] len Length of buf.
+ * @return      Returns length of the first line including CRLF.
+ *              Returns 0 when buf has no CRLF.
+ *
+ * A bare LF is not an end of line.
+ */
+size_t line_next(const char *buf, size_t len);
+
+#endif  /* #ifndef __LINE_H */
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Segment log tools.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Segments are read through read-only shared mappings, so a scan runs
+ * at memory speed once the file is in the page cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "seg.h"
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static int seg_cmp(const void *a, const void *b);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int seg_list(const char *dir, unsigned long long **firsts)
+{
+    int num = 0;
+    int cap = 0;
+    size_t len;
+    char *end;
+    unsigned long long first;
+    unsigned long long *new_firsts;
+    DIR *d;
+    struct dirent *ent;
+
+    *firsts = NULL;
+    d = opendir(dir);
+    if (d == NULL)
+    {
+        T_M(T_E, 0x93010100, "cannot open %s: %s.\n", dir, strerror(errno));
+        return(0x93010100);
+    }
+
+    while ((ent = readdir(d)) != NULL)
+    {
+        /* "<first seq in hex>.seg" */
+        len = strlen(ent->d_name);
+        if (len <= strlen(SEG_SUFFIX) || strcmp(ent->d_name + len - strlen(SEG_SUFFIX), SEG_SUFFIX) != 0)
+        {
+            continue;
+        }
+        first = strtoull(ent->d_name, &end, 16);
+        if (end != ent->d_name + len - strlen(SEG_SUFFIX))
+        {
+            continue;
+        }
+
+        if (num == cap)
+        {
+            cap = (cap > 0)? cap * 2 : 16;
+            new_firsts = realloc(*firsts, sizeof(**firsts) * cap);
+            if (new_firsts == NULL)
+            {
+                T_M(T_E, 0x93010200, "cannot allocate segment list.\n");
+                closedir(d);
+                free(*firsts);
+                *firsts = NULL;
+                return(0x93010200);
+            }
+            *firsts = new_firsts;
+        }
+        (*firsts)[num++] = first;
+    }
+    closedir(d);
+
+    if (num > 0)
+    {
+        qsort(*firsts, num, sizeof(**firsts), seg_cmp);
+    }
+
+    return(num);
+}
+
+/*----------------------------------------------------------------------*/
+void seg_path(char *path, size_t size, const char *dir, unsigned long long first)
+{
+    snprintf(path, size, "%s/%016llx" SEG_SUFFIX, dir, first);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int seg_map(seg_t *seg, const char *dir, unsigned long long first)
+{
+    void *base;
+    char path[4096];
+    struct stat st;
+
+    seg_path(path, sizeof(path), dir, first);
+    seg->base  = NULL;
+    seg->first = first;
+    seg->fd    = open(path, O_RDONLY | O_CLOEXEC);
+    if (seg->fd < 0)
+    {
+        T_M(T_E, 0x93030100, "cannot open %s: %s.\n", path, strerror(errno));
+        return(0x93030100);
+    }
+    if (fstat(seg->fd, &st) < 0 || st.st_size == 0)
+    {
+        T_M(T_E, 0x93030200, "invalid segment %s.\n", path);
+        close(seg->fd);
+        seg->fd = -1;
+        return(0x93030200);
+    }
+    seg->size = (size_t)st.st_size;
+
+    base = mmap(NULL, seg->size, PROT_READ, MAP_SHARED, seg->fd, 0);
+    if (base == MAP_FAILED)
+    {
+        T_M(T_E, 0x93030300, "cannot map %s: %s.\n", path, strerror(errno));
+        close(seg->fd);
+        seg->fd = -1;
+        return(0x93030300);
+    }
+    (void)madvise(base, seg->size, MADV_SEQUENTIAL);
+    seg->base = base;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void seg_unmap(seg_t *seg)
+{
+    if (seg->base != NULL)
+    {
+        munmap((void*)seg->base, seg->size);
+        seg->base = NULL;
+    }
+    if (seg->fd >= 0)
+    {
+        close(seg->fd);
+        seg->fd = -1;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+const seg_rec_t *seg_next(const seg_t *seg, size_t *off)
+{
+    const seg_rec_t *rec;
+
+    if (*off + sizeof(*rec) > seg->size)
+    {
+        return(NULL);
+    }
+    rec = (const seg_rec_t*)(seg->base + *off);
+
+    /* zero filled part or a record torn by a crash */
+    if (rec->magic != SEG_MAGIC || *off + SEG_REC_SIZE(rec->len, rec->rlen) > seg->size ||
+        rec->sum != seg_sum(rec->seq, seg_data(rec), (size_t)rec->len + rec->rlen))
+    {
+        return(NULL);
+    }
+    *off += SEG_REC_SIZE(rec->len, rec->rlen);
+
+    return(rec);
+}
+
+/*----------------------------------------------------------------------*/
+uint32_t seg_sum(uint64_t seq, const char *data, size_t len)
+{
+    size_t cnt;
+    uint32_t sum = 2166136261U; /* FNV-1a */
+
+    for (cnt = 0; cnt < sizeof(seq); cnt++)
+    {
+        sum = (sum ^ (uint8_t)(seq >> (cnt * 8))) * 16777619U;
+    }
+    for (cnt = 0; cnt < len; cnt++)
+    {
+        sum = (sum ^ (uint8_t)data[cnt]) * 16777619U;
+    }
+
+    return(sum);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static int seg_cmp(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+
+    return((x > y) - (x < y));
+}
+
+/* end of seg.c */
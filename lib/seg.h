@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for segment log tools.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * A log is a directory of fixed size segment files named by a number
+ * above the sequence numbers of all records in older segments, which is
+ * usually the sequence number of the first record.  Records are appended
+ * to the last segment, and the unused part of a segment is zero filled.
+ */
+#ifndef __SEG_H
+#define __SEG_H
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+#include <stdint.h>
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def SEG_MAGIC
+ * @brief Magic number of a record.
+ */
+#define SEG_MAGIC       0x314c4843U
+
+/**
+ * @def SEG_SUFFIX
+ * @brief Suffix of segment file names.
+ */
+#define SEG_SUFFIX      ".seg"
+
+/**
+ * @def SEG_REC_SIZE
+ * @brief Bytes of a record including padding to 8 bytes.
+ */
+#define SEG_REC_SIZE(len, rlen) \
+    ((sizeof(seg_rec_t) + (size_t)(len) + (size_t)(rlen) + 7) & ~(size_t)7)
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @brief Record header followed by data and room name.
+ */
+typedef struct seg_rec_strct {
+    uint32_t magic;             /**< SEG_MAGIC */
+    uint32_t len;               /**< bytes of data */
+    uint64_t seq;               /**< sequence number */
+    uint32_t rlen;              /**< bytes of room name */
+    uint32_t sum;               /**< checksum of the record */
+} seg_rec_t;
+
+/**
+ * @brief Mapped segment.
+ */
+typedef struct seg_strct {
+    int          fd;            /**< segment file */
+    const char  *base;          /**< mapped file */
+    size_t       size;          /**< size of the file */
+    unsigned long long first;   /**< name of the segment */
+} seg_t;
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       List segments of a log.
+ * @param[in] dir Log directory.
+ * @param[out] firsts Names of segments in ascending order,
+ *              free() it after use.
+ * @return      Returns number of segments, minus value on any error.
+ */
+int seg_list(const char *dir, unsigned long long **firsts);
+
+/**
+ * @brief       Make path of a segment.
+ * @param[out] path Buffer to store the path.
+ * @param[in] size Size of path.
+ * @param[in] dir Log directory.
+ * @param[in] first Name of the segment.
+ */
+void seg_path(char *path, size_t size, const char *dir, unsigned long long first);
+
+/**
+ * @brief       Map a segment to read.
+ * @param[out] seg Mapped segment.
+ * @param[in] dir Log directory.
+ * @param[in] first Name of the segment.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Records appended later by a writer are visible through the mapping.
+ */
+int seg_map(seg_t *seg, const char *dir, unsigned long long first);
+
+/**
+ * @brief       Unmap a segment.
+ * @param[in,out] seg Mapped segment.
+ */
+void seg_unmap(seg_t *seg);
+
+/**
+ * @brief       Get a record and step to the next.
+ * @param[in] seg Mapped segment.
+ * @param[in,out] off Offset of the record, moved to the next record.
+ * @return      Returns record, NULL at the end of records.
+ *
+ * A torn record is the end of records.
+ */
+const seg_rec_t *seg_next(const seg_t *seg, size_t *off);
+
+/**
+ * @brief       Get data of a record.
+ * @param[in] rec Record.
+ * @return      Returns data followed by rec->rlen bytes of room name.
+ */
+static inline const char *seg_data(const seg_rec_t *rec)
+{
+    return((const char*)(rec + 1));
+}
+
+/**
+ * @brief       Calculate checksum of a record.
+ * @param[in] seq Sequence number.
+ * @param[in] data Data followed by room name.
+ * @param[in] len Bytes of data and room name.
+ * @return      Returns checksum.
+ */
+uint32_t seg_sum(uint64_t seq, const char *data, size_t len);
+
+#endif  /* #ifndef __SEG_H */
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Timer wheel.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Level n has 64 slots of 64^n ms.  A timer is put in the lowest level
+ * whose range covers its expiration, in the slot of its expiration.  When
+ * level 0 wraps around, the next slot of level 1 is spread over level 0,
+ * and so on (cascade).  A bitmap of non-empty slots per level finds the
+ * next thing to do without scanning slots.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "trace.h"
+#include "tmr.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define TMR_SLOTS       (1 << TMR_BITS)                 /* slots per level */
+#define TMR_MASK        (TMR_SLOTS - 1)                 /* slot index mask */
+#define TMR_SPAN        (1ULL << (TMR_BITS * TMR_LEVELS)) /* ms covered */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* timer wheel */
+struct tmr_strct {
+    unsigned long long now;     /* time of the last tick done in ms */
+    unsigned int num;           /* number of armed timers */
+    uint64_t     map[TMR_LEVELS]; /* non-empty slots */
+    tmr_ent_t    head[TMR_LEVELS * TMR_SLOTS]; /* slot lists (circular) */
+};
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static void tmr_insert(tmr_t *tmr, tmr_ent_t *ent);
+static void tmr_unlink(tmr_t *tmr, tmr_ent_t *ent);
+static void tmr_take(tmr_t *tmr, unsigned int slot, tmr_ent_t *list);
+static void tmr_cascade(tmr_t *tmr, int lvl, unsigned int idx);
+static int tmr_expire(tmr_t *tmr, unsigned int idx);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+tmr_t *tmr_create(unsigned long long now)
+{
+    int cnt;
+    tmr_t *tmr;
+
+    tmr = malloc(sizeof(*tmr));
+    if (tmr == NULL)
+    {
+        T_M(T_E, 0x95010100, "cannot allocate timer wheel.\n");
+        return(NULL);
+    }
+    tmr->now = now;
+    tmr->num = 0;
+    memset(tmr->map, 0, sizeof(tmr->map));
+    for (cnt = 0; cnt < TMR_LEVELS * TMR_SLOTS; cnt++)
+    {
+        tmr->head[cnt].next = &tmr->head[cnt];
+        tmr->head[cnt].prev = &tmr->head[cnt];
+    }
+
+    return(tmr);
+}
+
+/*----------------------------------------------------------------------*/
+void tmr_destroy(tmr_t *tmr)
+{
+    free(tmr);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+void tmr_init(tmr_ent_t *ent, tmr_cb_t cb, void *arg)
+{
+    ent->next   = NULL;
+    ent->prev   = NULL;
+    ent->expire = 0;
+    ent->slot   = 0;
+    ent->cb     = cb;
+    ent->arg    = arg;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+void tmr_arm(tmr_t *tmr, tmr_ent_t *ent, unsigned int ms)
+{
+    if (tmr_armed(ent))
+    {
+        tmr_unlink(tmr, ent);
+    }
+    else
+    {
+        tmr->num++;
+    }
+    /* the slot of now is done */
+    ent->expire = tmr->now + ((ms > 0)? ms : 1);
+    tmr_insert(tmr, ent);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+void tmr_cancel(tmr_t *tmr, tmr_ent_t *ent)
+{
+    if (tmr_armed(ent))
+    {
+        tmr_unlink(tmr, ent);
+        tmr->num--;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int tmr_next(tmr_t *tmr)
+{
+    int lvl;
+    int shift;
+    unsigned int pos;
+    uint64_t rot;
+    unsigned long long k;
+    unsigned long long t;
+    unsigned long long next = ULLONG_MAX;
+
+    if (tmr->num == 0)
+    {
+        return(-1);
+    }
+
+    for (lvl = 0; lvl < TMR_LEVELS; lvl++)
+    {
+        if (tmr->map[lvl] == 0)
+        {
+            continue;
+        }
+
+        /* first non-empty slot after the current one */
+        shift = TMR_BITS * lvl;
+        pos   = ((tmr->now >> shift) + 1) & TMR_MASK;
+        rot   = (pos == 0)? tmr->map[lvl] :
+                (tmr->map[lvl] >> pos) | (tmr->map[lvl] << (TMR_SLOTS - pos));
+        k     = __builtin_ctzll(rot) + 1;
+
+        /* expiration on level 0, cascade on the others */
+        t = (lvl == 0)? tmr->now + k : ((tmr->now >> shift) + k) << shift;
+        if (t < next)
+        {
+            next = t;
+        }
+    }
+
+    return((next - tmr->now > INT_MAX)? INT_MAX : (int)(next - tmr->now));
+}
+
+/*----------------------------------------------------------------------*/
+int tmr_run(tmr_t *tmr, unsigned long long now)
+{
+    int lvl;
+    int next;
+    int fired = 0;
+    unsigned long long t;
+
+    while (tmr->now < now)
+    {
+        /* skip ticks with nothing to do */
+        next = tmr_next(tmr);
+        if (next < 0)
+        {
+            tmr->now = now;
+            break;
+        }
+        if (next > 1)
+        {
+            tmr->now += (now - tmr->now < (unsigned long long)next - 1)?
+                        now - tmr->now : (unsigned long long)next - 1;
+            continue;
+        }
+
+        /* spread upper slots at boundaries from the top, then expire */
+        t = tmr->now + 1;
+        tmr->now = t;
+        for (lvl = 1; lvl < TMR_LEVELS && (t & ((1ULL << (TMR_BITS * lvl)) - 1)) == 0; lvl++)
+        {
+            ;
+        }
+        for (lvl--; lvl > 0; lvl--)
+        {
+            tmr_cascade(tmr, lvl, (t >> (TMR_BITS * lvl)) & TMR_MASK);
+        }
+        fired += tmr_expire(tmr, t & TMR_MASK);
+    }
+
+    return(fired);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static void tmr_insert(tmr_t *tmr, tmr_ent_t *ent)
+{
+    int lvl;
+    unsigned int idx;
+    unsigned long long delta;
+    tmr_ent_t *head;
+
+    /* too far ones expire at the last tick, cascaded ones may expire now */
+    if (ent->expire - tmr->now >= TMR_SPAN)
+    {
+        ent->expire = tmr->now + TMR_SPAN - 1;
+    }
+    delta = ent->expire - tmr->now;
+
+    for (lvl = 0; lvl < TMR_LEVELS - 1 && delta >= (1ULL << (TMR_BITS * (lvl + 1))); lvl++)
+    {
+        ;
+    }
+    idx  = (ent->expire >> (TMR_BITS * lvl)) & TMR_MASK;
+    head = &tmr->head[lvl * TMR_SLOTS + idx];
+
+    /* append to the slot */
+    ent->slot = lvl * TMR_SLOTS + idx;
+    ent->next = head;
+    ent->prev = head->prev;
+    head->prev->next = ent;
+    head->prev = ent;
+    tmr->map[lvl] |= 1ULL << idx;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void tmr_unlink(tmr_t *tmr, tmr_ent_t *ent)
+{
+    tmr_ent_t *head = &tmr->head[ent->slot];
+
+    ent->prev->next = ent->next;
+    ent->next->prev = ent->prev;
+    ent->next = NULL;
+    ent->prev = NULL;
+    if (head->next == head)
+    {
+        tmr->map[ent->slot / TMR_SLOTS] &= ~(1ULL << (ent->slot % TMR_SLOTS));
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void tmr_take(tmr_t *tmr, unsigned int slot, tmr_ent_t *list)
+{
+    tmr_ent_t *head = &tmr->head[slot];
+
+    /* move the whole slot to list, callbacks may change the slot */
+    if (head->next == head)
+    {
+        list->next = list;
+        list->prev = list;
+        return;
+    }
+    list->next = head->next;
+    list->prev = head->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    head->next = head;
+    head->prev = head;
+    tmr->map[slot / TMR_SLOTS] &= ~(1ULL << (slot % TMR_SLOTS));
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void tmr_cascade(tmr_t *tmr, int lvl, unsigned int idx)
+{
+    tmr_ent_t list;
+    tmr_ent_t *ent;
+
+    tmr_take(tmr, lvl * TMR_SLOTS + idx, &list);
+    while (list.next != &list)
+    {
+        ent = list.next;
+        list.next = ent->next;
+        ent->next->prev = &list;
+        tmr_insert(tmr, ent);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int tmr_expire(tmr_t *tmr, unsigned int idx)
+{
+    int fired = 0;
+    tmr_ent_t list;
+    tmr_ent_t *ent;
+
+    tmr_take(tmr, idx, &list);
+    while (list.next != &list)
+    {
+        ent = list.next;
+        list.next = ent->next;
+        ent->next->prev = &list;
+        ent->next = NULL;
+        ent->prev = NULL;
+        tmr->num--;
+        fired++;
+
+        /* the callback may arm or cancel any timer */
+        ent->cb(ent, ent->arg);
+    }
+
+    return(fired);
+}
+
+/* end of tmr.c */
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for timer wheel.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Hierarchical timing wheel with 1 ms ticks.  Timers are embedded in the
+ * objects they belong to and kept in doubly linked slot lists, so arming
+ * and cancelling take constant time however many timers are armed.
+ * Timers far in the future are kept in coarse slots and moved to finer
+ * ones as the time comes.
+ *
+ * The wheel does not read the clock.  The owner passes the time, usually
+ * taken once per event loop iteration.
+ */
+#ifndef __TMR_H
+#define __TMR_H
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stdint.h>
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def TMR_BITS
+ * @brief Bits of ticks per level (64 slots).
+ */
+#define TMR_BITS        6
+
+/**
+ * @def TMR_LEVELS
+ * @brief Number of levels.
+ *
+ * Timers up to 2^(TMR_BITS*TMR_LEVELS) ms (about 4.6 hours) ahead are
+ * kept, later ones expire at that time.
+ */
+#define TMR_LEVELS      4
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @brief Timer wheel (opaque).
+ */
+typedef struct tmr_strct tmr_t;
+
+struct tmr_ent_strct;
+
+/**
+ * @brief       Timer callback.
+ * @param[in] ent Expired timer, which may be armed again.
+ * @param[in] arg Argument given to tmr_init().
+ */
+typedef void (*tmr_cb_t)(struct tmr_ent_strct *ent, void *arg);
+
+/**
+ * @struct
+ *      timer.
+ */
+typedef struct tmr_ent_strct {
+    struct tmr_ent_strct *next; /**< next timer in the slot, NULL when not armed */
+    struct tmr_ent_strct *prev; /**< previous timer in the slot */
+    unsigned long long expire;  /**< expiration time in ms */
+    unsigned int slot;          /**< slot index */
+    tmr_cb_t     cb;            /**< callback */
+    void        *arg;           /**< argument to cb */
+} tmr_ent_t;
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Create a timer wheel.
+ * @param[in] now Current time in ms.
+ * @return      Returns timer wheel, NULL on any error.
+ */
+tmr_t *tmr_create(unsigned long long now);
+
+/**
+ * @brief       Destroy a timer wheel.
+ * @param[in] tmr Timer wheel.
+ *
+ * Armed timers are dropped without calling callbacks.
+ */
+void tmr_destroy(tmr_t *tmr);
+
+/**
+ * @brief       Initialize a timer.
+ * @param[out] ent Timer.
+ * @param[in] cb Callback called on expiration.
+ * @param[in] arg Argument to cb.
+ */
+void tmr_init(tmr_ent_t *ent, tmr_cb_t cb, void *arg);
+
+/**
+ * @brief       Arm a timer.
+ * @param[in,out] tmr Timer wheel.
+ * @param[in,out] ent Timer, re-armed when already armed.
+ * @param[in] ms Time to expiration from the time of the last tmr_run().
+ */
+void tmr_arm(tmr_t *tmr, tmr_ent_t *ent, unsigned int ms);
+
+/**
+ * @brief       Cancel a timer.
+ * @param[in,out] tmr Timer wheel.
+ * @param[in,out] ent Timer, nothing is done when not armed.
+ */
+void tmr_cancel(tmr_t *tmr, tmr_ent_t *ent);
+
+/**
+ * @brief       Check if a timer is armed.
+ * @param[in] ent Timer.
+ * @return      Returns non-zero when armed.
+ */
+static inline int tmr_armed(const tmr_ent_t *ent)
+{
+    return(ent->next != NULL);
+}
+
+/**
+ * @brief       Time to wait for the next expiration.
+ * @param[in] tmr Timer wheel.
+ * @return      Returns ms to wait, -1 when no timer is armed.
+ *
+ * The result may be earlier than the expiration when timers have to be
+ * moved to finer slots.
+ */
+int tmr_next(tmr_t *tmr);
+
+/**
+ * @brief       Advance time and call callbacks of expired timers.
+ * @param[in,out] tmr Timer wheel.
+ * @param[in] now Current time in ms.
+ * @return      Returns number of expired timers.
+ */
+int tmr_run(tmr_t *tmr, unsigned long long now);
+
+#endif  /* #ifndef __TMR_H */
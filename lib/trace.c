@@ -1,4 +1,4 @@
-/* 
+/*
  * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
  *
  * This software is released under the MIT License.
@@ -12,22 +12,164 @@
  *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
  *
  * Trace functions for debugging.
+ *
+ * Each thread owns a single producer ring.  A trace copies the format
+ * pointer and the raw arguments into the ring, and the writer formats
+ * entries of all rings in timestamp order and writes them in batches.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "trace.h"
 
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+#define T_WBUF_SIZE   (64*1024) /* bytes written at once by the writer */
+#define T_SPEC_MAX    32        /* max length of a conversion spec */
+#define T_DUMP_LINE   80        /* max length of a dump line */
+#define T_SIG_CACHE   256       /* formats cached by a thread */
+#define T_SIG_MAX     16        /* max arguments of a cached format */
+#define T_PREC_STAR   (-2)      /* precision given by '*' */
+#define T_REC_MAGIC   0x31524654 /* "TFR1" */
+#define T_REC_BUF     (64*1024) /* bytes written at once by a dump */
+
+/* entry flags */
+#define T_FLAG_DUMP   0x01      /* entry is a dump */
+#define T_FLAG_TRUNC  0x02      /* arguments are truncated */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* argument types */
+enum t_arg
+{
+    T_ARG_NONE,                 /* "%%" */
+    T_ARG_INT,
+    T_ARG_UINT,
+    T_ARG_DBL,
+    T_ARG_STR,
+    T_ARG_PTR,
+    T_ARG_BAD,                  /* unsupported conversion */
+    T_ARG_STAR,                 /* '*' */
+};
+
+/* length modifiers */
+enum t_lmod
+{
+    T_LM_NONE,
+    T_LM_HH,
+    T_LM_H,
+    T_LM_L,
+    T_LM_LL,
+    T_LM_Z,
+    T_LM_J,
+    T_LM_T,
+    T_LM_LD,
+};
+
+/* conversion spec */
+typedef struct t_spec_strct
+{
+    int  type;                  /* argument type */
+    int  lmod;                  /* length modifier */
+    int  nstar;                 /* number of '*' */
+    int  prec;                  /* precision, -1 if not specified */
+    int  prec_star;             /* precision is given by '*' */
+    char fmt[T_SPEC_MAX];       /* spec for the stored argument */
+} t_spec_t;
+
+/* trace entry */
+typedef struct t_ent_strct
+{
+    unsigned long long ts;      /* timestamp in ns */
+    const char    *format;      /* format, NULL for a dump */
+    unsigned int   seq;         /* trace sequence number */
+    unsigned char  lvl;         /* trace level */
+    unsigned char  flags;       /* T_FLAG_XXX */
+    unsigned short len;         /* bytes used in arg */
+    unsigned char  arg[T_ENT_SIZE - 24]; /* raw arguments */
+} t_ent_t;
+
+/* argument types of a format */
+typedef struct t_sig_strct
+{
+    const char    *format;      /* format */
+    unsigned char  num;         /* number of arguments */
+    unsigned char  trunc;       /* too many arguments */
+    unsigned char  arg[T_SIG_MAX]; /* type << 4 | length modifier */
+    short          prec[T_SIG_MAX]; /* precision of strings */
+} t_sig_t;
+
+/* per-thread ring */
+typedef struct t_ring_strct
+{
+    _Alignas(64) atomic_uint head; /* next entry to record */
+    _Alignas(64) atomic_uint tail; /* next entry to write */
+    atomic_uint    dropped;     /* entries dropped */
+    atomic_int     owned;       /* owned by a thread */
+    unsigned int   id;          /* ring ID shown in flight recorder dumps */
+    struct t_ring_strct *next;  /* next ring */
+    t_ent_t        ent[T_RING_SIZE];
+    _Alignas(64) atomic_uint rec_head; /* next flight recorder entry */
+    t_ent_t        rec[T_REC_SIZE]; /* flight recorder */
+    t_sig_t        sig[T_SIG_CACHE]; /* formats parsed by the owner */
+} t_ring_t;
+
+/* flight recorder dump file header */
+typedef struct t_rec_file_strct
+{
+    unsigned int   magic;       /* T_REC_MAGIC */
+    unsigned int   num;         /* number of records */
+} t_rec_file_t;
+
+/* flight recorder dump record, followed by format and arguments */
+typedef struct t_rec_hdr_strct
+{
+    unsigned long long ts;      /* timestamp in ns */
+    unsigned int   seq;         /* trace sequence number */
+    unsigned short id;          /* ring ID */
+    unsigned char  lvl;         /* trace level */
+    unsigned char  flags;       /* T_FLAG_XXX */
+    unsigned short flen;        /* length of format */
+    unsigned short len;         /* length of arguments */
+} t_rec_hdr_t;
+
+/* decoded flight recorder record */
+typedef struct t_rec_strct
+{
+    t_ent_t        ent;         /* trace entry */
+    unsigned int   id;          /* ring ID */
+    unsigned int   idx;         /* index in the dump */
+} t_rec_t;
+
 /*======================================================================
  * global variables
  *======================================================================*/
+int T_level;                            /* output trace level */
+int T_rec_level = -1;                   /* flight recorder level */
+int T_gate;                             /* max of the levels above */
+unsigned int T_off[64][8];              /* disabled functions of each file */
 
 /*------------------------------
  * private
  *------------------------------*/
-static int trace_level;
-static const char *msg_head[] = 
+static const char *msg_head[] =
 {
     "Error",
     "Warning",
@@ -35,87 +177,170 @@ static const char *msg_head[] =
     "Debug1",
     "Debug2"
 };
+static _Atomic(t_ring_t*) rings;        /* all rings */
+static __thread t_ring_t *my_ring;      /* ring of this thread */
+static atomic_int running;              /* writer is running */
+static atomic_int stopping;             /* writer is stopping */
+static atomic_ullong dropped_total;     /* traces dropped */
+static pthread_t writer;                /* writer thread */
+static pthread_key_t ring_key;          /* releases ring at thread exit */
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER; /* wakes writer */
+static char *wbuf;                      /* writer buffer */
+static size_t wlen;                     /* bytes in wbuf */
+static atomic_uint ring_ids;            /* IDs given to rings */
+static char rec_path[1024];             /* flight recorder dump file */
+static atomic_int rec_dumping;          /* flight recorder is being dumped */
+static char rec_buf[T_REC_BUF];         /* flight recorder dump buffer */
 
 /*======================================================================
  * prototype declarations for private functions
  *======================================================================*/
+static t_ring_t *t_ring_get(void);
+static t_ent_t *t_ring_reserve(t_ring_t *ring);
+static void t_ring_commit(t_ring_t *ring);
+static t_ent_t *t_rec_reserve(t_ring_t *ring);
+static void t_rec_commit(t_ring_t *ring);
+static void t_rec_signal(int signo);
+static int t_rec_cmp(const void *a, const void *b);
+static void t_fill(t_ent_t *ent, int trace_lvl, unsigned int seq, const char *format);
+static void t_pack_dump(t_ent_t *ent, const unsigned char *target, int length);
+static void t_ring_release(void *arg);
+static void t_ring_key_create(void);
+static unsigned long long t_now(void);
+static int t_filter_item(const char *item, size_t len);
+static const char *t_spec(const char *p, t_spec_t *spec);
+static void t_pack(t_ring_t *ring, t_ent_t *ent, const char *format, va_list ap);
+static void t_sig_parse(t_sig_t *sig, const char *format);
+static int t_put(t_ent_t *ent, const void *data, size_t len);
+static size_t t_format(const t_ent_t *ent, char *buf, size_t size);
+static int t_dump_line(char *buf, const unsigned char *data, int len, int addr);
+static void *t_writer(void *arg);
+static int t_drain(void);
+static void t_write(int fd, const char *buf, size_t len);
 
 /*======================================================================
  * functions
  *======================================================================*/
-void T_M(const int trace_lvl, const unsigned int seq, const char *format, ...)
+void T_msg(const int trace_lvl, const unsigned int seq, const char *format, ...)
 {
+    int len;
     va_list ap;
+    t_ring_t *ring = NULL;
+    t_ent_t *rec = NULL;
+    t_ent_t *ent;
+    char buf[T_MSG_MAX];
+
+    /* flight recorder keeps traces regardless of the output level */
+    if (trace_lvl <= T_rec_level && (ring = t_ring_get()) != NULL)
+    {
+        rec = t_rec_reserve(ring);
+        t_fill(rec, trace_lvl, seq, format);
+        va_start(ap, format);
+        t_pack(ring, rec, format, ap);
+        va_end(ap);
+        t_rec_commit(ring);
+    }
 
     /* do nothing if trace_lvl is greater than output trace level */
-    if (trace_lvl > trace_level)
+    if (trace_lvl > T_level)
+    {
+        return;
+    }
+
+    if (atomic_load_explicit(&running, memory_order_acquire) &&
+        (ring != NULL || (ring = t_ring_get()) != NULL))
     {
+        ent = t_ring_reserve(ring);
+        if (ent == NULL)
+        {
+            return;
+        }
+        if (rec != NULL)
+        {
+            memcpy(ent, rec, sizeof(*ent));
+        }
+        else
+        {
+            t_fill(ent, trace_lvl, seq, format);
+            va_start(ap, format);
+            t_pack(ring, ent, format, ap);
+            va_end(ap);
+        }
+        t_ring_commit(ring);
         return;
     }
 
-    fprintf(stderr, "%s:%08x ", msg_head[trace_lvl], (unsigned int)seq);
+    /* write at once */
+    len = snprintf(buf, sizeof(buf), "%s:%08x ", msg_head[trace_lvl], (unsigned int)seq);
     va_start(ap, format);
-    vfprintf(stderr, format, ap);
+    len += vsnprintf(buf + len, sizeof(buf) - len, format, ap);
     va_end(ap);
+    t_write(STDERR_FILENO, buf, (len < (int)sizeof(buf))? (size_t)len : sizeof(buf) - 1);
 
     return;
 }
 
 /*----------------------------------------------------------------------*/
-void T_D(const int trace_lvl, const unsigned int seq, const void *target, const int length)
+void T_dump(const int trace_lvl, const unsigned int seq, const void *target, const int length)
 {
-    unsigned char *print = (unsigned char*)target;
-    int   cnt = 0;
-    int   prt_cnt;
-    int   len = length;
+    const unsigned char *print = (const unsigned char*)target;
+    int   cnt;
+    int   len;
+    t_ring_t *ring = NULL;
+    t_ent_t *rec = NULL;
+    t_ent_t *ent;
+    char  buf[T_MSG_MAX];
+
+    /* flight recorder keeps traces regardless of the output level */
+    if (trace_lvl <= T_rec_level && (ring = t_ring_get()) != NULL)
+    {
+        rec = t_rec_reserve(ring);
+        t_fill(rec, trace_lvl, seq, NULL);
+        t_pack_dump(rec, print, length);
+        t_rec_commit(ring);
+    }
 
     /* do nothing if trace_lvl is greater than output trace level */
-    if (trace_lvl > trace_level)
+    if (trace_lvl > T_level)
     {
         return;
     }
 
-    fprintf(stderr, "%s:%08x\n", msg_head[trace_lvl], (unsigned int)seq);
-
-    while (len > 0)
+    if (atomic_load_explicit(&running, memory_order_acquire) &&
+        (ring != NULL || (ring = t_ring_get()) != NULL))
     {
-        /* print address */
-        fprintf(stderr, "%08X", cnt);
-        /* print binary */
-        for (prt_cnt = 0; prt_cnt < 16; prt_cnt++)
+        ent = t_ring_reserve(ring);
+        if (ent == NULL)
         {
-            if (prt_cnt % 8 == 0)
-            {
-                fprintf(stderr, " ");
-            }
-            if (len-prt_cnt <= 0)
-            {
-                fprintf(stderr, "   ");
-            } else {
-                fprintf(stderr, " %02X", *(print+prt_cnt));
-            }
+            return;
         }
-        /* print ascii */
-        fprintf(stderr, " |");
-        for (prt_cnt = 0; prt_cnt < 16; prt_cnt++)
+        if (rec != NULL)
         {
-            if ( (*print >= 0x20) && (*print <= 0x7E) )
-            {
-                fprintf(stderr, "%c", *print);
-            } else
-            {
-                fprintf(stderr, ".");
-            }
-            print++;
-            len--;
-            if (len <= 0)
-            {
-                break;
-            }
+            memcpy(ent, rec, sizeof(*ent));
+        }
+        else
+        {
+            t_fill(ent, trace_lvl, seq, NULL);
+            t_pack_dump(ent, print, length);
         }
-        fprintf(stderr, "|\n");
-        cnt += 16;
+        t_ring_commit(ring);
+        return;
+    }
+
+    /* write at once, flushing the buffer when it is full */
+    len = snprintf(buf, sizeof(buf), "%s:%08x\n", msg_head[trace_lvl], (unsigned int)seq);
+    for (cnt = 0; cnt < length; cnt += 16)
+    {
+        if (len + T_DUMP_LINE > (int)sizeof(buf))
+        {
+            t_write(STDERR_FILENO, buf, len);
+            len = 0;
+        }
+        len += t_dump_line(buf + len, print + cnt, length - cnt, cnt);
     }
+    t_write(STDERR_FILENO, buf, len);
 
     return;
 }
@@ -130,8 +355,1206 @@ int T_init(int trace_lvl)
         return(-1);
     }
 
-    trace_level = trace_lvl;
+    T_level = trace_lvl;
+    T_gate  = (T_level > T_rec_level)? T_level : T_rec_level;
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int T_start(void)
+{
+    static int registered = 0;
+    int ret;
+
+    if (atomic_load(&running))
+    {
+        return(0);
+    }
+
+    (void)pthread_once(&ring_once, t_ring_key_create);
+    wbuf = malloc(T_WBUF_SIZE);
+    if (wbuf == NULL)
+    {
+        T_M(T_E, 0x94010100, "cannot allocate trace buffer.\n");
+        return(0x94010100);
+    }
+    wlen = 0;
+
+    atomic_store(&stopping, 0);
+    atomic_store(&running, 1);
+    ret = pthread_create(&writer, NULL, t_writer, NULL);
+    if (ret != 0)
+    {
+        atomic_store(&running, 0);
+        free(wbuf);
+        wbuf = NULL;
+        T_M(T_E, 0x94010200, "cannot start trace writer: %s.\n", strerror(ret));
+        return(0x94010200);
+    }
+
+    /* write what is left at exit */
+    if (!registered)
+    {
+        (void)atexit(T_stop);
+        registered = 1;
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void T_stop(void)
+{
+    if (!atomic_load(&running))
+    {
+        return;
+    }
+
+    /* traces from now on are written at once */
+    atomic_store(&running, 0);
+    atomic_store(&stopping, 1);
+    (void)pthread_join(writer, NULL);
+
+    free(wbuf);
+    wbuf = NULL;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int T_rate(T_rate_t *rate, const int trace_lvl, const unsigned int seq)
+{
+    long start;
+    unsigned int suppressed;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    /* one of the threads starts a new interval */
+    start = atomic_load_explicit(&rate->start, memory_order_relaxed);
+    if (ts.tv_sec - start >= T_RATE_INTERVAL &&
+        atomic_compare_exchange_strong(&rate->start, &start, (long)ts.tv_sec))
+    {
+        atomic_store_explicit(&rate->num, 0, memory_order_relaxed);
+        suppressed = atomic_exchange_explicit(&rate->suppressed, 0, memory_order_relaxed);
+        if (suppressed > 0)
+        {
+            T_msg(trace_lvl, seq, "suppressed %u messages.\n", suppressed);
+        }
+    }
+
+    if (atomic_fetch_add_explicit(&rate->num, 1, memory_order_relaxed) < T_RATE_BURST)
+    {
+        return(1);
+    }
+    atomic_fetch_add_explicit(&rate->suppressed, 1, memory_order_relaxed);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int T_filter(const char *spec)
+{
+    const char *end;
+
+    for (; *spec != '\0'; spec = (*end == ',')? end + 1 : end)
+    {
+        end = strchr(spec, ',');
+        if (end == NULL)
+        {
+            end = spec + strlen(spec);
+        }
+        if (t_filter_item(spec, end - spec) < 0)
+        {
+            T_M(T_E, 0x94050100, "invalid trace filter: %.*s.\n", (int)(end - spec), spec);
+            return(-1);
+        }
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int T_record(int trace_lvl, const char *path)
+{
+    unsigned int cnt;
+    struct sigaction sa;
+    static const int fatal[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+    if (trace_lvl < T_E || trace_lvl > T_D2 || strlen(path) >= sizeof(rec_path))
+    {
+        T_M(T_E, 0x94080100, "invalid flight recorder level %d or path %s.\n", trace_lvl, path);
+        return(0x94080100);
+    }
+    strcpy(rec_path, path);
+
+    /* dump on SIGUSR2, and on fatal signals before the default action */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = t_rec_signal;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGUSR2, &sa, NULL) < 0)
+    {
+        T_M(T_E, 0x94080200, "cannot set SIGUSR2 handler: %s.\n", strerror(errno));
+        return(0x94080200);
+    }
+    sa.sa_flags = SA_RESETHAND;
+    for (cnt = 0; cnt < sizeof(fatal) / sizeof(fatal[0]); cnt++)
+    {
+        (void)sigaction(fatal[cnt], &sa, NULL);
+    }
+
+    T_rec_level = trace_lvl;
+    T_gate      = (T_level > T_rec_level)? T_level : T_rec_level;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int T_record_dump(void)
+{
+    int fd;
+    int busy = 0;
+    unsigned int idx;
+    unsigned int head;
+    size_t flen;
+    size_t len;
+    t_rec_file_t file;
+    t_rec_hdr_t hdr;
+    t_ent_t ent;
+    t_ring_t *ring;
+
+    /* only async-signal-safe calls below */
+    if (rec_path[0] == '\0' || !atomic_compare_exchange_strong(&rec_dumping, &busy, 1))
+    {
+        return(0x94090100);
+    }
+    fd = open(rec_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        atomic_store(&rec_dumping, 0);
+        return(0x94090200);
+    }
+
+    file.magic = T_REC_MAGIC;
+    file.num   = 0;
+    len = sizeof(file);
+    for (ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+        /* the entry at head may be being recorded */
+        head = atomic_load_explicit(&ring->rec_head, memory_order_acquire);
+        idx  = (head < T_REC_SIZE)? 0 : head - (T_REC_SIZE - 1);
+        for (; idx != head; idx++)
+        {
+            memcpy(&ent, &ring->rec[idx & (T_REC_SIZE - 1)], sizeof(ent));
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&ring->rec_head, memory_order_relaxed) - idx >= T_REC_SIZE)
+            {
+                /* overwritten while copying */
+                continue;
+            }
+
+            flen = (ent.format != NULL)? strnlen(ent.format, T_MSG_MAX) : 0;
+            if (len + sizeof(hdr) + flen + ent.len > sizeof(rec_buf))
+            {
+                t_write(fd, rec_buf, len);
+                len = 0;
+            }
+            hdr.ts    = ent.ts;
+            hdr.seq   = ent.seq;
+            hdr.id    = (unsigned short)ring->id;
+            hdr.lvl   = ent.lvl;
+            hdr.flags = ent.flags;
+            hdr.flen  = (unsigned short)flen;
+            hdr.len   = ent.len;
+            memcpy(rec_buf + len, &hdr, sizeof(hdr));
+            if (flen > 0)
+            {
+                memcpy(rec_buf + len + sizeof(hdr), ent.format, flen);
+            }
+            memcpy(rec_buf + len + sizeof(hdr) + flen, ent.arg, ent.len);
+            len += sizeof(hdr) + flen + ent.len;
+            file.num++;
+        }
+    }
+    t_write(fd, rec_buf, len);
+    (void)pwrite(fd, &file, sizeof(file), 0);
+    close(fd);
+    atomic_store(&rec_dumping, 0);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int T_decode(const char *path, int with_time)
+{
+    int fd;
+    unsigned int cnt;
+    size_t pos;
+    size_t flen;
+    ssize_t ret;
+    char *data = NULL;
+    char *fmt;
+    char *line = NULL;
+    char stamp[32];
+    time_t sec;
+    struct tm tm;
+    struct stat st;
+    t_rec_file_t file;
+    t_rec_hdr_t hdr;
+    t_rec_t *recs = NULL;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        T_M(T_E, 0x940a0100, "cannot open %s: %s.\n", path, strerror(errno));
+        return(0x940a0100);
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(file))
+    {
+        T_M(T_E, 0x940a0200, "invalid flight recorder dump %s.\n", path);
+        close(fd);
+        return(0x940a0200);
+    }
+
+    /* formats are copied after the data to be terminated */
+    data = malloc(st.st_size * 2);
+    line = malloc(T_MSG_MAX);
+    for (pos = 0; data != NULL && pos < (size_t)st.st_size; pos += ret)
+    {
+        ret = read(fd, data + pos, st.st_size - pos);
+        if (ret <= 0)
+        {
+            break;
+        }
+    }
+    close(fd);
+    if (data != NULL)
+    {
+        memcpy(&file, data, sizeof(file));
+    }
+    if (data == NULL || line == NULL || pos < (size_t)st.st_size || file.magic != T_REC_MAGIC)
+    {
+        T_M(T_E, 0x940a0300, "cannot read flight recorder dump %s.\n", path);
+        free(data);
+        free(line);
+        return(0x940a0300);
+    }
+
+    recs = calloc((file.num > 0)? file.num : 1, sizeof(*recs));
+    fmt  = data + st.st_size;
+    pos  = sizeof(file);
+    for (cnt = 0; recs != NULL && cnt < file.num; cnt++)
+    {
+        if (pos + sizeof(hdr) > (size_t)st.st_size)
+        {
+            break;
+        }
+        memcpy(&hdr, data + pos, sizeof(hdr));
+        pos += sizeof(hdr);
+        if (pos + hdr.flen + hdr.len > (size_t)st.st_size || hdr.len > sizeof(recs->ent.arg) ||
+            hdr.lvl > T_D2)
+        {
+            break;
+        }
+
+        recs[cnt].id        = hdr.id;
+        recs[cnt].idx       = cnt;
+        recs[cnt].ent.ts    = hdr.ts;
+        recs[cnt].ent.seq   = hdr.seq;
+        recs[cnt].ent.lvl   = hdr.lvl;
+        recs[cnt].ent.flags = hdr.flags;
+        recs[cnt].ent.len   = hdr.len;
+        recs[cnt].ent.format = NULL;
+        if (!(hdr.flags & T_FLAG_DUMP))
+        {
+            memcpy(fmt, data + pos, hdr.flen);
+            fmt[hdr.flen] = '\0';
+            recs[cnt].ent.format = fmt;
+            fmt += hdr.flen + 1;
+        }
+        pos += hdr.flen;
+        memcpy(recs[cnt].ent.arg, data + pos, hdr.len);
+        pos += hdr.len;
+    }
+    if (recs == NULL || cnt < file.num)
+    {
+        T_M(T_E, 0x940a0400, "broken flight recorder dump %s at %lu.\n", path, (unsigned long)pos);
+        free(recs);
+        free(data);
+        free(line);
+        return(0x940a0400);
+    }
+
+    /* threads recorded into their own rings */
+    qsort(recs, file.num, sizeof(*recs), t_rec_cmp);
+    for (cnt = 0; cnt < file.num; cnt++)
+    {
+        if (with_time)
+        {
+            sec = (time_t)(recs[cnt].ent.ts / 1000000000ULL);
+            localtime_r(&sec, &tm);
+            strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+            printf("%s.%06llu [%u] ", stamp, (recs[cnt].ent.ts % 1000000000ULL) / 1000, recs[cnt].id);
+        }
+        flen = t_format(&recs[cnt].ent, line, T_MSG_MAX);
+        fwrite(line, 1, flen, stdout);
+    }
+
+    free(recs);
+    free(data);
+    free(line);
+
     return(0);
 }
 
+/*----------------------------------------------------------------------*/
+unsigned long long T_dropped(void)
+{
+    unsigned long long total;
+    t_ring_t *ring;
+
+    total = atomic_load_explicit(&dropped_total, memory_order_relaxed);
+    for (ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+        total += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+
+    return(total);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static t_ring_t *t_ring_get(void)
+{
+    int owned;
+    t_ring_t *ring;
+
+    if (my_ring != NULL)
+    {
+        return(my_ring);
+    }
+    (void)pthread_once(&ring_once, t_ring_key_create);
+
+    /* take over a ring left by an exited thread */
+    for (ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+        owned = 0;
+        if (atomic_compare_exchange_strong(&ring->owned, &owned, 1))
+        {
+            break;
+        }
+    }
+
+    if (ring == NULL)
+    {
+        ring = aligned_alloc(_Alignof(t_ring_t), sizeof(*ring));
+        if (ring == NULL)
+        {
+            return(NULL);
+        }
+        memset(ring, 0, sizeof(*ring));
+        atomic_init(&ring->owned, 1);
+        ring->id = atomic_fetch_add(&ring_ids, 1);
+
+        ring->next = atomic_load(&rings);
+        while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+        {
+            ;
+        }
+    }
+
+    my_ring = ring;
+    (void)pthread_setspecific(ring_key, ring);
+
+    return(ring);
+}
+
+/*----------------------------------------------------------------------*/
+static t_ent_t *t_ring_reserve(t_ring_t *ring)
+{
+    unsigned int head;
+    unsigned int used;
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    used = head - atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (used >= T_RING_SIZE)
+    {
+        /* the writer cannot keep up */
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return(NULL);
+    }
+    if (used == T_RING_SIZE / 2)
+    {
+        /* do not let the writer sleep out the interval */
+        pthread_mutex_lock(&wake_mutex);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_mutex);
+    }
+
+    return(&ring->ent[head & (T_RING_SIZE - 1)]);
+}
+
+/*----------------------------------------------------------------------*/
+static void t_ring_commit(t_ring_t *ring)
+{
+    atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->head, memory_order_relaxed) + 1,
+                          memory_order_release);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static t_ent_t *t_rec_reserve(t_ring_t *ring)
+{
+    /* the oldest entry is overwritten */
+    return(&ring->rec[atomic_load_explicit(&ring->rec_head, memory_order_relaxed) & (T_REC_SIZE - 1)]);
+}
+
+/*----------------------------------------------------------------------*/
+static void t_rec_commit(t_ring_t *ring)
+{
+    atomic_store_explicit(&ring->rec_head, atomic_load_explicit(&ring->rec_head, memory_order_relaxed) + 1,
+                          memory_order_release);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void t_rec_signal(int signo)
+{
+    int err = errno;
+
+    (void)T_record_dump();
+    errno = err;
+
+    /* the default action was restored by SA_RESETHAND */
+    if (signo != SIGUSR2)
+    {
+        raise(signo);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int t_rec_cmp(const void *a, const void *b)
+{
+    const t_rec_t *x = (const t_rec_t*)a;
+    const t_rec_t *y = (const t_rec_t*)b;
+
+    if (x->ent.ts != y->ent.ts)
+    {
+        return((x->ent.ts > y->ent.ts) - (x->ent.ts < y->ent.ts));
+    }
+    return((x->idx > y->idx) - (x->idx < y->idx));
+}
+
+/*----------------------------------------------------------------------*/
+static void t_fill(t_ent_t *ent, int trace_lvl, unsigned int seq, const char *format)
+{
+    ent->ts     = t_now();
+    ent->format = format;
+    ent->seq    = seq;
+    ent->lvl    = (unsigned char)trace_lvl;
+    ent->flags  = (format == NULL)? T_FLAG_DUMP : 0;
+    ent->len    = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void t_pack_dump(t_ent_t *ent, const unsigned char *target, int length)
+{
+    int len;
+
+    /* original length followed by the copy */
+    len = (length > 0)? length : 0;
+    (void)t_put(ent, &len, sizeof(len));
+    if ((size_t)len > sizeof(ent->arg) - ent->len)
+    {
+        len = (int)(sizeof(ent->arg) - ent->len);
+        ent->flags |= T_FLAG_TRUNC;
+    }
+    (void)t_put(ent, target, len);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void t_ring_release(void *arg)
+{
+    t_ring_t *ring = (t_ring_t*)arg;
+
+    atomic_store(&ring->owned, 0);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void t_ring_key_create(void)
+{
+    (void)pthread_key_create(&ring_key, t_ring_release);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned long long t_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return((unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*----------------------------------------------------------------------*/
+static int t_filter_item(const char *item, size_t len)
+{
+    int cnt;
+    int file;
+    int func = -1;
+    int off;
+    char id[5];
+    char *end;
+
+    if (len < 2 || (item[0] != '+' && item[0] != '-'))
+    {
+        return(-1);
+    }
+    off = (item[0] == '-');
+
+    if (len == 2 && item[1] == '*')
+    {
+        memset(T_off, (off)? 0xff : 0, sizeof(T_off));
+        return(0);
+    }
+    if (len != 3 && len != 5)
+    {
+        return(-1);
+    }
+    memcpy(id, item + 1, len - 1);
+    id[len-1] = '\0';
+    file = (int)strtol(id, &end, 16);
+    if (*end != '\0' || !isxdigit((unsigned char)id[0]))
+    {
+        return(-1);
+    }
+    if (len == 5)
+    {
+        /* "FFGG" */
+        func = file & 0xff;
+        file >>= 8;
+    }
+    if (file > 0x3f)
+    {
+        return(-1);
+    }
+
+    if (func < 0)
+    {
+        for (cnt = 0; cnt < 8; cnt++)
+        {
+            T_off[file][cnt] = (off)? ~0U : 0;
+        }
+    }
+    else if (off)
+    {
+        T_off[file][func >> 5] |= 1U << (func & 0x1f);
+    }
+    else
+    {
+        T_off[file][func >> 5] &= ~(1U << (func & 0x1f));
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static const char *t_spec(const char *p, t_spec_t *spec)
+{
+    size_t n = 0;
+
+    /* p points next to '%' */
+    spec->type      = T_ARG_BAD;
+    spec->lmod      = T_LM_NONE;
+    spec->nstar     = 0;
+    spec->prec      = -1;
+    spec->prec_star = 0;
+    spec->fmt[n++]  = '%';
+
+    /* flags, width and precision are kept as is */
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL && n < T_SPEC_MAX - 4)
+    {
+        spec->fmt[n++] = *p++;
+    }
+    if (*p == '*')
+    {
+        spec->nstar++;
+        spec->fmt[n++] = *p++;
+    }
+    while (*p >= '0' && *p <= '9' && n < T_SPEC_MAX - 4)
+    {
+        spec->fmt[n++] = *p++;
+    }
+    if (*p == '.')
+    {
+        spec->fmt[n++] = *p++;
+        spec->prec = 0;
+        if (*p == '*')
+        {
+            spec->nstar++;
+            spec->prec_star = 1;
+            spec->fmt[n++]  = *p++;
+        }
+        while (*p >= '0' && *p <= '9' && n < T_SPEC_MAX - 4)
+        {
+            spec->prec = spec->prec * 10 + (*p - '0');
+            spec->fmt[n++] = *p++;
+        }
+    }
+
+    /* length modifier is dropped since arguments are stored widened */
+    switch (*p)
+    {
+    case 'h':
+        spec->lmod = (p[1] == 'h')? T_LM_HH : T_LM_H;
+        p += (p[1] == 'h')? 2 : 1;
+        break;
+    case 'l':
+        spec->lmod = (p[1] == 'l')? T_LM_LL : T_LM_L;
+        p += (p[1] == 'l')? 2 : 1;
+        break;
+    case 'z':
+        spec->lmod = T_LM_Z;
+        p++;
+        break;
+    case 'j':
+        spec->lmod = T_LM_J;
+        p++;
+        break;
+    case 't':
+        spec->lmod = T_LM_T;
+        p++;
+        break;
+    case 'L':
+        spec->lmod = T_LM_LD;
+        p++;
+        break;
+    }
+
+    switch (*p)
+    {
+    case '%':
+        spec->type = T_ARG_NONE;
+        break;
+    case 'd':
+    case 'i':
+        spec->type = T_ARG_INT;
+        spec->fmt[n++] = 'l';
+        spec->fmt[n++] = 'l';
+        break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        spec->type = T_ARG_UINT;
+        spec->fmt[n++] = 'l';
+        spec->fmt[n++] = 'l';
+        break;
+    case 'c':
+        spec->type = T_ARG_INT;
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec->type = T_ARG_DBL;
+        break;
+    case 's':
+        spec->type = T_ARG_STR;
+        break;
+    case 'p':
+        spec->type = T_ARG_PTR;
+        break;
+    default:
+        return(p);
+    }
+    spec->fmt[n++] = *p++;
+    spec->fmt[n]   = '\0';
+
+    return(p);
+}
+
+/*----------------------------------------------------------------------*/
+static void t_pack(t_ring_t *ring, t_ent_t *ent, const char *format, va_list ap)
+{
+    unsigned int cnt;
+    int  star;
+    int  prec = -1;
+    long long sval;
+    unsigned long long uval;
+    double dval;
+    void *pval;
+    const char *sptr;
+    unsigned short slen;
+    size_t max;
+    t_sig_t *sig;
+
+    /* formats are literals, so the parsed argument types are cached */
+    sig = &ring->sig[((uintptr_t)format >> 3) & (T_SIG_CACHE - 1)];
+    if (sig->format != format)
+    {
+        t_sig_parse(sig, format);
+    }
+    if (sig->trunc)
+    {
+        ent->flags |= T_FLAG_TRUNC;
+    }
+
+    for (cnt = 0; cnt < sig->num; cnt++)
+    {
+        switch (sig->arg[cnt] >> 4)
+        {
+        case T_ARG_STAR:
+            star = va_arg(ap, int);
+            if (t_put(ent, &star, sizeof(star)) < 0)
+            {
+                return;
+            }
+            prec = star;
+            break;
+        case T_ARG_INT:
+            switch (sig->arg[cnt] & 0x0f)
+            {
+            case T_LM_HH: sval = (signed char)va_arg(ap, int); break;
+            case T_LM_H:  sval = (short)va_arg(ap, int); break;
+            case T_LM_L:  sval = va_arg(ap, long); break;
+            case T_LM_LL: sval = va_arg(ap, long long); break;
+            case T_LM_Z:  sval = va_arg(ap, ssize_t); break;
+            case T_LM_J:  sval = va_arg(ap, intmax_t); break;
+            case T_LM_T:  sval = va_arg(ap, ptrdiff_t); break;
+            default:      sval = va_arg(ap, int); break;
+            }
+            if (t_put(ent, &sval, sizeof(sval)) < 0)
+            {
+                return;
+            }
+            break;
+        case T_ARG_UINT:
+            switch (sig->arg[cnt] & 0x0f)
+            {
+            case T_LM_HH: uval = (unsigned char)va_arg(ap, unsigned int); break;
+            case T_LM_H:  uval = (unsigned short)va_arg(ap, unsigned int); break;
+            case T_LM_L:  uval = va_arg(ap, unsigned long); break;
+            case T_LM_LL: uval = va_arg(ap, unsigned long long); break;
+            case T_LM_Z:  uval = va_arg(ap, size_t); break;
+            case T_LM_J:  uval = va_arg(ap, uintmax_t); break;
+            case T_LM_T:  uval = va_arg(ap, ptrdiff_t); break;
+            default:      uval = va_arg(ap, unsigned int); break;
+            }
+            if (t_put(ent, &uval, sizeof(uval)) < 0)
+            {
+                return;
+            }
+            break;
+        case T_ARG_DBL:
+            dval = ((sig->arg[cnt] & 0x0f) == T_LM_LD)? (double)va_arg(ap, long double) : va_arg(ap, double);
+            if (t_put(ent, &dval, sizeof(dval)) < 0)
+            {
+                return;
+            }
+            break;
+        case T_ARG_PTR:
+            pval = va_arg(ap, void*);
+            if (t_put(ent, &pval, sizeof(pval)) < 0)
+            {
+                return;
+            }
+            break;
+        case T_ARG_STR:
+            /* length followed by the string truncated to the entry */
+            sptr = va_arg(ap, const char*);
+            if (sptr == NULL)
+            {
+                sptr = "(null)";
+            }
+            if (sig->prec[cnt] != T_PREC_STAR)
+            {
+                prec = sig->prec[cnt];
+            }
+            if (ent->len + sizeof(slen) > sizeof(ent->arg))
+            {
+                ent->flags |= T_FLAG_TRUNC;
+                return;
+            }
+            max = sizeof(ent->arg) - ent->len - sizeof(slen);
+            if (prec >= 0 && (size_t)prec < max)
+            {
+                max = prec;
+            }
+            slen = (unsigned short)strnlen(sptr, max);
+            (void)t_put(ent, &slen, sizeof(slen));
+            (void)t_put(ent, sptr, slen);
+            if (slen == max && (prec < 0 || slen < prec) && sptr[slen] != '\0')
+            {
+                ent->flags |= T_FLAG_TRUNC;
+                return;
+            }
+            break;
+        }
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void t_sig_parse(t_sig_t *sig, const char *format)
+{
+    int cnt;
+    t_spec_t spec;
+
+    sig->format = format;
+    sig->num    = 0;
+    sig->trunc  = 0;
+    for (format = strchr(format, '%'); format != NULL; format = strchr(format, '%'))
+    {
+        format = t_spec(format + 1, &spec);
+        if (spec.type == T_ARG_NONE)
+        {
+            continue;
+        }
+        if (spec.type == T_ARG_BAD)
+        {
+            break;
+        }
+        if (sig->num + spec.nstar + 1 > T_SIG_MAX)
+        {
+            sig->trunc = 1;
+            break;
+        }
+
+        for (cnt = 0; cnt < spec.nstar; cnt++)
+        {
+            sig->arg[sig->num]  = T_ARG_STAR << 4;
+            sig->prec[sig->num] = -1;
+            sig->num++;
+        }
+        sig->arg[sig->num]  = (unsigned char)((spec.type << 4) | spec.lmod);
+        sig->prec[sig->num] = (short)((spec.prec_star)? T_PREC_STAR : spec.prec);
+        sig->num++;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int t_put(t_ent_t *ent, const void *data, size_t len)
+{
+    if (ent->len + len > sizeof(ent->arg))
+    {
+        ent->flags |= T_FLAG_TRUNC;
+        return(-1);
+    }
+    memcpy(ent->arg + ent->len, data, len);
+    ent->len += len;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static size_t t_format(const t_ent_t *ent, char *buf, size_t size)
+{
+    int  ret;
+    int  cnt;
+    int  star[2];
+    int  dump_len;
+    size_t len;
+    size_t pos = 0;
+    long long sval;
+    unsigned long long uval;
+    double dval;
+    void *pval;
+    unsigned short slen;
+    const char *p;
+    const char *next;
+    char str[sizeof(ent->arg) + 1];
+    t_spec_t spec;
+
+/* snprintf() with '*' arguments */
+#define T_PRINT(v)                                                      \
+    ((spec.nstar == 0)? snprintf(buf + len, size - len, spec.fmt, v) :  \
+     (spec.nstar == 1)? snprintf(buf + len, size - len, spec.fmt, star[0], v) : \
+     snprintf(buf + len, size - len, spec.fmt, star[0], star[1], v))
+
+    if (ent->flags & T_FLAG_DUMP)
+    {
+        len = snprintf(buf, size, "%s:%08x\n", msg_head[ent->lvl], ent->seq);
+        memcpy(&dump_len, ent->arg, sizeof(dump_len));
+        pos = sizeof(dump_len);
+        for (cnt = 0; pos + cnt < ent->len && len + T_DUMP_LINE < size; cnt += 16)
+        {
+            len += t_dump_line(buf + len, ent->arg + pos + cnt, ent->len - pos - cnt, cnt);
+        }
+        if (ent->flags & T_FLAG_TRUNC)
+        {
+            len += snprintf(buf + len, size - len, "(%d bytes more)\n", dump_len - (int)(ent->len - pos));
+        }
+        return((len < size)? len : size - 1);
+    }
+
+    len = snprintf(buf, size, "%s:%08x ", msg_head[ent->lvl], ent->seq);
+    for (p = ent->format; *p != '\0' && len < size - 1; p = next)
+    {
+        /* plain text up to the next conversion */
+        next = strchr(p, '%');
+        if (next == NULL)
+        {
+            next = p + strlen(p);
+        }
+        if (next > p)
+        {
+            ret = snprintf(buf + len, size - len, "%.*s", (int)(next - p), p);
+            len += ret;
+            continue;
+        }
+
+        next = t_spec(p + 1, &spec);
+        if (spec.type == T_ARG_NONE)
+        {
+            buf[len++] = '%';
+            buf[len]   = '\0';
+            continue;
+        }
+        if (spec.type == T_ARG_BAD)
+        {
+            break;
+        }
+
+        /* out of arguments */
+        for (cnt = 0; cnt < spec.nstar && pos + sizeof(star[0]) <= ent->len; cnt++)
+        {
+            memcpy(&star[cnt], ent->arg + pos, sizeof(star[0]));
+            pos += sizeof(star[0]);
+        }
+        if (cnt < spec.nstar || pos >= ent->len)
+        {
+            break;
+        }
+
+        ret = 0;
+        switch (spec.type)
+        {
+        case T_ARG_INT:
+            memcpy(&sval, ent->arg + pos, sizeof(sval));
+            pos += sizeof(sval);
+            ret = (spec.fmt[strlen(spec.fmt) - 1] == 'c')? T_PRINT((int)sval) : T_PRINT(sval);
+            break;
+        case T_ARG_UINT:
+            memcpy(&uval, ent->arg + pos, sizeof(uval));
+            pos += sizeof(uval);
+            ret = T_PRINT(uval);
+            break;
+        case T_ARG_DBL:
+            memcpy(&dval, ent->arg + pos, sizeof(dval));
+            pos += sizeof(dval);
+            ret = T_PRINT(dval);
+            break;
+        case T_ARG_PTR:
+            memcpy(&pval, ent->arg + pos, sizeof(pval));
+            pos += sizeof(pval);
+            ret = T_PRINT(pval);
+            break;
+        case T_ARG_STR:
+            memcpy(&slen, ent->arg + pos, sizeof(slen));
+            pos += sizeof(slen);
+            memcpy(str, ent->arg + pos, slen);
+            str[slen] = '\0';
+            pos += slen;
+            ret = T_PRINT(str);
+            break;
+        }
+        len += ret;
+    }
+#undef T_PRINT
+
+    if (len >= size)
+    {
+        len = size - 1;
+    }
+    if (*p != '\0')
+    {
+        /* arguments were truncated */
+        len += snprintf(buf + len, size - len, "...\n");
+        if (len >= size)
+        {
+            len = size - 1;
+        }
+    }
+
+    return(len);
+}
+
+/*----------------------------------------------------------------------*/
+static int t_dump_line(char *buf, const unsigned char *data, int len, int addr)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    int cnt;
+    int pos;
+
+    /* address, binary and ascii of 16 octets */
+    pos = sprintf(buf, "%08X", addr);
+    for (cnt = 0; cnt < 16; cnt++)
+    {
+        if (cnt % 8 == 0)
+        {
+            buf[pos++] = ' ';
+        }
+        buf[pos++] = ' ';
+        buf[pos++] = (cnt < len)? hex[data[cnt] >> 4] : ' ';
+        buf[pos++] = (cnt < len)? hex[data[cnt] & 0x0f] : ' ';
+    }
+    buf[pos++] = ' ';
+    buf[pos++] = '|';
+    for (cnt = 0; cnt < 16 && cnt < len; cnt++)
+    {
+        buf[pos++] = (data[cnt] >= 0x20 && data[cnt] <= 0x7e)? data[cnt] : '.';
+    }
+    buf[pos++] = '|';
+    buf[pos++] = '\n';
+    buf[pos]   = '\0';
+
+    return(pos);
+}
+
+/*----------------------------------------------------------------------*/
+static void *t_writer(void *arg)
+{
+    struct timespec ts;
+
+    for (;;)
+    {
+        if (t_drain() > 0)
+        {
+            continue;
+        }
+        if (atomic_load(&stopping))
+        {
+            break;
+        }
+
+        /* sleep until the interval passes or a ring gets half full */
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += T_WRITER_INTERVAL * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&wake_mutex);
+        (void)pthread_cond_timedwait(&wake_cond, &wake_mutex, &ts);
+        pthread_mutex_unlock(&wake_mutex);
+    }
+
+    /* traces recorded while stopping */
+    (void)t_drain();
+
+    return(NULL);
+}
+
+/*----------------------------------------------------------------------*/
+static int t_drain(void)
+{
+    int num = 0;
+    unsigned int tail;
+    unsigned int dropped = 0;
+    t_ring_t *ring;
+    t_ring_t *oldest;
+    const t_ent_t *ent;
+    const t_ent_t *oldest_ent;
+
+    for (;;)
+    {
+        /* merge rings in timestamp order */
+        oldest     = NULL;
+        oldest_ent = NULL;
+        for (ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+        {
+            tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+            {
+                continue;
+            }
+            ent = &ring->ent[tail & (T_RING_SIZE - 1)];
+            if (oldest_ent == NULL || ent->ts < oldest_ent->ts)
+            {
+                oldest     = ring;
+                oldest_ent = ent;
+            }
+        }
+        if (oldest == NULL)
+        {
+            break;
+        }
+
+        if (wlen + T_MSG_MAX > T_WBUF_SIZE)
+        {
+            t_write(STDERR_FILENO, wbuf, wlen);
+            wlen = 0;
+        }
+        wlen += t_format(oldest_ent, wbuf + wlen, T_MSG_MAX);
+        atomic_store_explicit(&oldest->tail, atomic_load_explicit(&oldest->tail, memory_order_relaxed) + 1,
+                              memory_order_release);
+        num++;
+    }
+
+    /* report drops once per batch */
+    for (ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+        dropped += atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+    }
+    if (dropped > 0)
+    {
+        atomic_fetch_add_explicit(&dropped_total, dropped, memory_order_relaxed);
+        wlen += snprintf(wbuf + wlen, T_WBUF_SIZE - wlen, "%s:%08x %u trace messages dropped.\n",
+                         msg_head[T_W], 0x54070100, dropped);
+    }
+
+    if (wlen > 0)
+    {
+        t_write(STDERR_FILENO, wbuf, wlen);
+        wlen = 0;
+    }
+
+    return(num);
+}
+
+/*----------------------------------------------------------------------*/
+static void t_write(int fd, const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0)
+    {
+        ret = write(fd, buf, len);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        buf += ret;
+        len -= ret;
+    }
+
+    return;
+}
+
 /* end of trace.c */
@@ -13,10 +13,19 @@
  *
  * This file provides tracer functions with distinguishable sequence number.
  * See inside the file to get examples of the sequence number usage.
+ *
+ * Once T_start() is called, traces are recorded into a per-thread ring
+ * and written by a background writer, so a tracing thread never waits
+ * for stderr.  Traces are dropped and counted when a ring is full.
  */
 #ifndef __TRACE_H
 #define __TRACE_H
 
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stdatomic.h>
+
 /*======================================================================
  * Trace seq usage:
  *
@@ -38,12 +47,63 @@
 /*======================================================================
  * constants, macros
  *======================================================================*/
+/**
+ * @def T_MAX_LEVEL
+ * @brief Max trace level compiled in.
+ *
+ * Traces above this level are removed at compile time.  Build with
+ * "make T_MAX_LEVEL=1" to leave only errors and warnings.
+ */
+#ifndef T_MAX_LEVEL
+#define T_MAX_LEVEL   T_D2
+#endif
+
+/**
+ * @def T_RATE_BURST
+ * @brief Number of messages a rate limited call site prints in an interval.
+ */
+#define T_RATE_BURST  10
+
+/**
+ * @def T_RATE_INTERVAL
+ * @brief Rate limiting interval in seconds.
+ */
+#define T_RATE_INTERVAL 1
+
 /**
  * @def T_MSG_MAX
  * @brief Max length of trace message.
  */
 #define T_MSG_MAX     2048    /* max length of trace message */
 
+/**
+ * @def T_RING_SIZE
+ * @brief Number of trace entries in a per-thread ring.  Must be a power of 2.
+ */
+#define T_RING_SIZE   1024
+
+/**
+ * @def T_ENT_SIZE
+ * @brief Size of a trace entry.
+ *
+ * Arguments of a trace are copied into the entry.  Strings and dumps
+ * longer than the entry are truncated.
+ */
+#define T_ENT_SIZE    256
+
+/**
+ * @def T_REC_SIZE
+ * @brief Number of traces a thread keeps in the flight recorder.  Must be
+ *        a power of 2.
+ */
+#define T_REC_SIZE    2048
+
+/**
+ * @def T_WRITER_INTERVAL
+ * @brief Interval in ms the writer waits for traces when rings are empty.
+ */
+#define T_WRITER_INTERVAL 10
+
 /**
  * @enum T_LVL
  * @brief Trace levels.  The upper is the higher.
@@ -57,6 +117,103 @@ enum T_LVL                    /* trace message levels */
     T_D2        = 4,
 };
 
+/**
+ * @def T_FILE
+ * @brief File ID of a trace sequence number.
+ */
+#define T_FILE(seq)   (((seq) >> 24) & 0x3f)
+
+/**
+ * @def T_FUNC
+ * @brief Function ID of a trace sequence number.
+ */
+#define T_FUNC(seq)   (((seq) >> 16) & 0xff)
+
+/**
+ * @def T_ON
+ * @brief Check if a trace is output or recorded.
+ *
+ * Errors are output regardless of the filter set by T_filter().
+ */
+#define T_ON(trace_lvl, seq)                                            \
+    ((trace_lvl) <= T_MAX_LEVEL && (trace_lvl) <= T_gate &&             \
+     ((trace_lvl) == T_E ||                                             \
+      !(T_off[T_FILE(seq)][T_FUNC(seq) >> 5] & (1U << (T_FUNC(seq) & 0x1f)))))
+
+/**
+ * @def T_M
+ * @brief Trace message.
+ * @param[in] trace_lvl Output trace level.
+ * @param[in] seq Trace sequence number.
+ * @param[in] ... Message print format like printf and its arguments.
+ *
+ * Arguments are not evaluated if the trace is not output.
+ */
+#define T_M(trace_lvl, seq, ...)                                        \
+    do                                                                  \
+    {                                                                   \
+        if (T_ON(trace_lvl, seq))                                       \
+        {                                                               \
+            T_msg((trace_lvl), (seq), __VA_ARGS__);                     \
+        }                                                               \
+    } while (0)
+
+/**
+ * @def T_MR
+ * @brief Rate limited trace message.
+ *
+ * Same as T_M() except that a call site prints at most T_RATE_BURST
+ * messages in T_RATE_INTERVAL.  Number of messages suppressed is printed
+ * when the call site prints again.
+ */
+#define T_MR(trace_lvl, seq, ...)                                       \
+    do                                                                  \
+    {                                                                   \
+        static T_rate_t T_rate_site;                                    \
+        if (T_ON(trace_lvl, seq) && T_rate(&T_rate_site, (trace_lvl), (seq))) \
+        {                                                               \
+            T_msg((trace_lvl), (seq), __VA_ARGS__);                     \
+        }                                                               \
+    } while (0)
+
+/**
+ * @def T_D
+ * @brief Trace variable dump.
+ * @param[in] trace_lvl Output trace level.
+ * @param[in] seq Trace sequence number.
+ * @param[in] target Pointer to the target variable to dump.
+ * @param[in] length Length to dump (in octet).
+ */
+#define T_D(trace_lvl, seq, target, length)                             \
+    do                                                                  \
+    {                                                                   \
+        if (T_ON(trace_lvl, seq))                                       \
+        {                                                               \
+            T_dump((trace_lvl), (seq), (target), (length));             \
+        }                                                               \
+    } while (0)
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @brief Rate limiting state of a call site.
+ */
+typedef struct T_rate_strct
+{
+    atomic_long  start;         /**< start of the interval in seconds */
+    atomic_uint  num;           /**< messages in the interval */
+    atomic_uint  suppressed;    /**< messages suppressed */
+} T_rate_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+extern int T_level;                     /**< output trace level */
+extern int T_rec_level;                 /**< flight recorder level, -1 if off */
+extern int T_gate;                      /**< max of the levels above */
+extern unsigned int T_off[64][8];       /**< disabled functions of each file */
+
 /*======================================================================
  * prototype declarations
  *======================================================================*/
@@ -66,11 +223,14 @@ enum T_LVL                    /* trace message levels */
  * @param[in] seq Trace sequence number.
  * @param[in] format Message print format like printf.
  *
- * This function prints trace message to stderr.
+ * This function prints trace message to stderr.  The message is recorded
+ * and written later by the writer if T_start() is called.
  * If the tracer is initialized to one trace level, the tracer will not
  * show messages with trace level less than the initialized level.
+ * Use T_M() instead to skip the call when the trace is not output.
  */
-void T_M(const int trace_lvl, const unsigned int seq, const char *format, ...);
+void T_msg(const int trace_lvl, const unsigned int seq, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
 
 /**
  * @brief       Trace variable dump.
@@ -79,11 +239,36 @@ void T_M(const int trace_lvl, const unsigned int seq, const char *format, ...);
  * @param[in] target Pointer to the target variable to dump.
  * @param[in] length Length to dump (in octet).
  *
- * This function dump variable in hexadecimal format.
+ * This function dump variable in hexadecimal format.  The variable is
+ * copied and dumped later by the writer if T_start() is called.
  * If the tracer is initialized to one trace level, the tracer will not
  * show dumps with trace level less than the initialized level.
+ * Use T_D() instead to skip the call when the trace is not output.
+ */
+void T_dump(const int trace_lvl, const unsigned int seq, const void *target, const int length);
+
+/**
+ * @brief       Check rate limit of a call site.
+ * @param[in,out] rate Rate limiting state of the call site.
+ * @param[in] trace_lvl Trace level of the call site.
+ * @param[in] seq Trace sequence number of the call site.
+ * @return      Returns 1 if the message is printed, 0 if suppressed.
+ *
+ * Prints number of messages suppressed in the last interval if any.
+ */
+int T_rate(T_rate_t *rate, const int trace_lvl, const unsigned int seq);
+
+/**
+ * @brief       Set trace filter.
+ * @param[in] spec Comma separated list of "+id" or "-id".
+ * @return      Returns 0 on success, -1 on invalid spec.
+ *
+ * "-id" disables and "+id" enables traces of the id, which is a file ID
+ * in 2 hex digits, a file ID followed by a function ID in 4 hex digits,
+ * or "*" for all.  Items are applied in order, so "-*,+02" outputs
+ * only traces of file 02.  Errors are not filtered.
  */
-void T_D(const int trace_lvl, const unsigned int seq, const void *target, const int length);
+int T_filter(const char *spec);
 
 /**
  * @brief       Tracer initialization.
@@ -93,4 +278,55 @@ void T_D(const int trace_lvl, const unsigned int seq, const void *target, const
  */
 int T_init(int trace_lvl);
 
+/**
+ * @brief       Start the background writer.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Traces are written synchronously until this function is called.
+ * Recorded traces are written at exit or by T_stop().
+ */
+int T_start(void);
+
+/**
+ * @brief       Write recorded traces and stop the background writer.
+ */
+void T_stop(void);
+
+/**
+ * @brief       Start the flight recorder.
+ * @param[in] trace_lvl Max trace level to record.
+ * @param[in] path Dump file.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Each thread keeps its last T_REC_SIZE traces up to trace_lvl in memory
+ * whatever the output level is.  The traces are dumped to path on SIGUSR2
+ * and on fatal signals.  Read the dump with T_decode().
+ */
+int T_record(int trace_lvl, const char *path);
+
+/**
+ * @brief       Dump the flight recorder.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * This function is async-signal-safe.
+ */
+int T_record_dump(void);
+
+/**
+ * @brief       Print a flight recorder dump to stdout.
+ * @param[in] path Dump file.
+ * @param[in] with_time Prefix time and thread of each trace.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Traces of all threads are printed in time order in the format of T_M().
+ */
+int T_decode(const char *path, int with_time);
+
+/**
+ * @brief       Number of traces dropped.
+ * @return      Returns the number of traces dropped since T_start() as
+ *              the writer could not keep up.
+ */
+unsigned long long T_dropped(void);
+
 #endif  /* #ifndef __TRACE_H */
@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      io_uring tools.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Set up io_uring(7) rings with io_uring_setup(2), io_uring_enter(2) and
+ * io_uring_register(2) called directly.
+ */
+
+#include "uring.h"
+
+#ifdef URING_ENABLE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+/* ring indices are shared with the kernel */
+#define URING_LOAD(p)           __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define URING_STORE(p, v)       __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static void uring_flush(uring_t *u);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int uring_init(uring_t *u, unsigned int entries)
+{
+    struct io_uring_params p;
+    unsigned char *sq;
+    unsigned char *cq;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    p.flags      = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL;
+    p.cq_entries = entries * 4;
+
+    u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0)
+    {
+        T_M(T_E, 0x92010100, "cannot set up io_uring: %s.\n", strerror(errno));
+        return(0x92010100);
+    }
+    u->features = p.features;
+
+    /* timeouts are passed with IORING_ENTER_EXT_ARG */
+    if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP))
+    {
+        T_M(T_E, 0x92010200, "io_uring of this kernel is too old.\n");
+        close(u->fd);
+        u->fd = -1;
+        return(0x92010200);
+    }
+
+    /* map rings */
+    u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_ring_sz > u->sq_ring_sz)
+        {
+            u->sq_ring_sz = u->cq_ring_sz;
+        }
+        u->cq_ring_sz = u->sq_ring_sz;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED)
+    {
+        u->sq_ring = NULL;
+        T_M(T_E, 0x92010300, "cannot map io_uring: %s.\n", strerror(errno));
+        uring_exit(u);
+        return(0x92010300);
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        u->cq_ring = u->sq_ring;
+    }
+    else
+    {
+        u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED)
+        {
+            u->cq_ring = NULL;
+            T_M(T_E, 0x92010400, "cannot map io_uring: %s.\n", strerror(errno));
+            uring_exit(u);
+            return(0x92010400);
+        }
+    }
+
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+        u->sqes = NULL;
+        T_M(T_E, 0x92010500, "cannot map io_uring: %s.\n", strerror(errno));
+        uring_exit(u);
+        return(0x92010500);
+    }
+
+    sq = u->sq_ring;
+    cq = u->cq_ring;
+    u->sq_head    = (unsigned int*)(sq + p.sq_off.head);
+    u->sq_tail    = (unsigned int*)(sq + p.sq_off.tail);
+    u->sq_array   = (unsigned int*)(sq + p.sq_off.array);
+    u->sq_mask    = *(unsigned int*)(sq + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->cq_head    = (unsigned int*)(cq + p.cq_off.head);
+    u->cq_tail    = (unsigned int*)(cq + p.cq_off.tail);
+    u->cq_mask    = *(unsigned int*)(cq + p.cq_off.ring_mask);
+    u->cqes       = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    u->sqe_head   = *u->sq_tail;
+    u->sqe_tail   = u->sqe_head;
+
+    T_M(T_D1, 0x12010600, "io_uring set up: sq=%u cq=%u.\n", p.sq_entries, p.cq_entries);
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void uring_exit(uring_t *u)
+{
+    if (u->br != NULL)
+    {
+        munmap(u->br, u->br_sz);
+        u->br = NULL;
+    }
+    free(u->bufs);
+    u->bufs = NULL;
+    if (u->sqes != NULL)
+    {
+        munmap(u->sqes, u->sqes_sz);
+        u->sqes = NULL;
+    }
+    if (u->cq_ring != NULL && u->cq_ring != u->sq_ring)
+    {
+        munmap(u->cq_ring, u->cq_ring_sz);
+    }
+    u->cq_ring = NULL;
+    if (u->sq_ring != NULL)
+    {
+        munmap(u->sq_ring, u->sq_ring_sz);
+        u->sq_ring = NULL;
+    }
+    if (u->fd >= 0)
+    {
+        close(u->fd);
+        u->fd = -1;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+struct io_uring_sqe *uring_sqe(uring_t *u)
+{
+    int ret;
+    struct io_uring_sqe *sqe;
+
+    if (u->sqe_tail - URING_LOAD(u->sq_head) >= u->sq_entries)
+    {
+        /* queue is full, let the kernel consume it */
+        ret = uring_enter(u, 0, 0);
+        if (ret < 0 || u->sqe_tail - URING_LOAD(u->sq_head) >= u->sq_entries)
+        {
+            T_M(T_W, 0x92030100, "io_uring submission queue is full.\n");
+            return(NULL);
+        }
+    }
+
+    sqe = &u->sqes[u->sqe_tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sqe_tail++;
+
+    return(sqe);
+}
+
+/*----------------------------------------------------------------------*/
+int uring_enter(uring_t *u, unsigned int wait_nr, int timeout)
+{
+    int ret;
+    unsigned int flags = 0;
+    unsigned int submit;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+
+    /* entries left by a failed enter are submitted again */
+    uring_flush(u);
+    submit = u->sqe_tail - URING_LOAD(u->sq_head);
+
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (wait_nr > 0)
+    {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeout >= 0)
+        {
+            ts.tv_sec  = timeout / 1000;
+            ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+            arg.ts = (unsigned long long)(uintptr_t)&ts;
+        }
+    }
+    else if (submit == 0)
+    {
+        /* nothing to do */
+        return(0);
+    }
+
+    ret = (int)syscall(__NR_io_uring_enter, u->fd, submit, wait_nr, flags,
+                       (flags & IORING_ENTER_EXT_ARG)? &arg : NULL,
+                       (flags & IORING_ENTER_EXT_ARG)? sizeof(arg) : 0);
+    if (ret < 0)
+    {
+        return(-errno);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int uring_cqe(uring_t *u, struct io_uring_cqe *cqe)
+{
+    unsigned int head = *u->cq_head;
+
+    if (head == URING_LOAD(u->cq_tail))
+    {
+        return(0);
+    }
+
+    *cqe = u->cqes[head & u->cq_mask];
+    URING_STORE(u->cq_head, head + 1);
+
+    return(1);
+}
+
+/*----------------------------------------------------------------------*/
+int uring_buf_init(uring_t *u, unsigned int num, unsigned int size)
+{
+    int ret;
+    unsigned int cnt;
+    struct io_uring_buf_reg reg;
+
+    u->br_sz = sizeof(struct io_uring_buf) * num;
+    u->br = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->br == MAP_FAILED)
+    {
+        u->br = NULL;
+        T_M(T_E, 0x92060100, "cannot map buffer ring: %s.\n", strerror(errno));
+        return(0x92060100);
+    }
+
+    u->bufs = malloc((size_t)num * size);
+    if (u->bufs == NULL)
+    {
+        T_M(T_E, 0x92060200, "cannot allocate %u buffers.\n", num);
+        return(0x92060200);
+    }
+    u->buf_num  = num;
+    u->buf_size = size;
+    u->br_tail  = 0;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (unsigned long long)(uintptr_t)u->br;
+    reg.ring_entries = num;
+    reg.bgid         = URING_BGID;
+    ret = (int)syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+    if (ret < 0)
+    {
+        T_M(T_E, 0x92060300, "cannot register buffer ring: %s.\n", strerror(errno));
+        return(0x92060300);
+    }
+
+    for (cnt = 0; cnt < num; cnt++)
+    {
+        uring_buf_put(u, cnt);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void uring_buf_put(uring_t *u, unsigned int bid)
+{
+    struct io_uring_buf *buf;
+
+    buf = &u->br->bufs[u->br_tail & (u->buf_num - 1)];
+    buf->addr = (unsigned long long)(uintptr_t)uring_buf(u, bid);
+    buf->len  = u->buf_size;
+    buf->bid  = (unsigned short)bid;
+    u->br_tail++;
+    URING_STORE(&u->br->tail, u->br_tail);
+
+    return;
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static void uring_flush(uring_t *u)
+{
+    /* publish filled entries in order */
+    for (; u->sqe_head != u->sqe_tail; u->sqe_head++)
+    {
+        u->sq_array[u->sqe_head & u->sq_mask] = u->sqe_head & u->sq_mask;
+    }
+    URING_STORE(u->sq_tail, u->sqe_tail);
+
+    return;
+}
+
+#endif  /* #ifdef URING_ENABLE */
+
+/* end of uring.c */
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for the io_uring tools.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Minimal io_uring(7) rings on raw system calls, liburing is not needed.
+ * Build with -DEVL_NO_URING to leave io_uring out.
+ */
+#ifndef __URING_H
+#define __URING_H
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#if defined(__linux__) && !defined(EVL_NO_URING)
+#define URING_ENABLE
+#include <stddef.h>
+#include <linux/io_uring.h>
+#endif
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def URING_BGID
+ * @brief Buffer group ID of the provided buffer ring.
+ */
+#define URING_BGID      0
+
+#ifdef URING_ENABLE
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @brief io_uring instance.
+ */
+typedef struct uring_strct {
+    int           fd;           /**< io_uring fd */
+    unsigned int  features;     /**< IORING_FEAT_* */
+
+    /* submission queue */
+    unsigned int *sq_head;      /**< consumed by the kernel */
+    unsigned int *sq_tail;      /**< published to the kernel */
+    unsigned int *sq_array;     /**< indices of sqes */
+    unsigned int  sq_mask;      /**< sq_entries - 1 */
+    unsigned int  sq_entries;   /**< number of entries */
+    unsigned int  sqe_head;     /**< first sqe not published */
+    unsigned int  sqe_tail;     /**< next sqe to fill */
+    struct io_uring_sqe *sqes;  /**< submission queue entries */
+
+    /* completion queue */
+    unsigned int *cq_head;      /**< consumed by us */
+    unsigned int *cq_tail;      /**< produced by the kernel */
+    unsigned int  cq_mask;      /**< cq_entries - 1 */
+    struct io_uring_cqe *cqes;  /**< completion queue entries */
+
+    /* mappings */
+    void         *sq_ring;      /**< mapped sq ring */
+    size_t        sq_ring_sz;   /**< size of sq_ring */
+    void         *cq_ring;      /**< mapped cq ring (may be sq_ring) */
+    size_t        cq_ring_sz;   /**< size of cq_ring */
+    size_t        sqes_sz;      /**< size of sqes */
+
+    /* provided buffer ring */
+    struct io_uring_buf_ring *br; /**< buffer ring, NULL when not used */
+    size_t        br_sz;        /**< size of br */
+    char         *bufs;         /**< buffers */
+    unsigned int  buf_num;      /**< number of buffers (power of 2) */
+    unsigned int  buf_size;     /**< size of each buffer */
+    unsigned short br_tail;     /**< next ring entry to fill */
+} uring_t;
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Set up io_uring.
+ * @param[out] u io_uring instance.
+ * @param[in] entries Number of submission queue entries.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * The completion queue is four times larger than the submission queue
+ * since multishot operations complete many times.
+ */
+int uring_init(uring_t *u, unsigned int entries);
+
+/**
+ * @brief       Tear down io_uring.
+ * @param[in,out] u io_uring instance.
+ *
+ * Operations in flight are dropped.
+ */
+void uring_exit(uring_t *u);
+
+/**
+ * @brief       Get a submission queue entry.
+ * @param[in,out] u io_uring instance.
+ * @return      Returns cleared entry, NULL on any error.
+ *
+ * Filled entries are submitted when the queue is full.
+ */
+struct io_uring_sqe *uring_sqe(uring_t *u);
+
+/**
+ * @brief       Submit filled entries and wait for completions.
+ * @param[in,out] u io_uring instance.
+ * @param[in] wait_nr Number of completions to wait for.
+ * @param[in] timeout Timeout in ms, -1 to wait forever.
+ * @return      Returns 0 on success, minus errno on any error.
+ */
+int uring_enter(uring_t *u, unsigned int wait_nr, int timeout);
+
+/**
+ * @brief       Get the next completion.
+ * @param[in,out] u io_uring instance.
+ * @param[out] cqe Copy of the completion.
+ * @return      Returns 1 when a completion is retrieved, 0 otherwise.
+ *
+ * The completion queue entry is released before returning.
+ */
+int uring_cqe(uring_t *u, struct io_uring_cqe *cqe);
+
+/**
+ * @brief       Register a provided buffer ring.
+ * @param[in,out] u io_uring instance.
+ * @param[in] num Number of buffers (power of 2).
+ * @param[in] size Size of each buffer.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Buffers are selected with buffer group URING_BGID.
+ */
+int uring_buf_init(uring_t *u, unsigned int num, unsigned int size);
+
+/**
+ * @brief       Get a provided buffer.
+ * @param[in] u io_uring instance.
+ * @param[in] bid Buffer ID taken from IORING_CQE_F_BUFFER completion.
+ * @return      Returns pointer to the buffer.
+ */
+static inline void *uring_buf(uring_t *u, unsigned int bid)
+{
+    return(u->bufs + (size_t)bid * u->buf_size);
+}
+
+/**
+ * @brief       Give a provided buffer back to the kernel.
+ * @param[in,out] u io_uring instance.
+ * @param[in] bid Buffer ID.
+ */
+void uring_buf_put(uring_t *u, unsigned int bid);
+
+#endif  /* #ifdef URING_ENABLE */
+
+#endif  /* #ifndef __URING_H */
@@ -0,0 +1,547 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Chat log module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Workers collect messages of an event loop iteration in a batch and pass
+ * it to the log thread.  The log thread writes all batches passed while it
+ * was writing the previous ones and calls fdatasync(2) once (group commit).
+ */
+
+#define _GNU_SOURCE             /* fdatasync() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "seg.h"
+#include "main.h"
+#include "msg.h"
+#include "hist.h"
+#include "clog.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define CLOG_BATCH_INIT 64      /* initial size of a batch */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* messages of a loop iteration */
+typedef struct clog_batch_strct {
+    struct clog_batch_strct *next; /* next batch */
+    unsigned int num;           /* number of messages */
+    unsigned int cap;           /* size of msg */
+    msg_t       *msg[];         /* messages */
+} clog_batch_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static const char     *dir;                  /* log directory, NULL when disabled */
+static pthread_t       th;                   /* log thread */
+static int             th_started;           /* log thread is running */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* lock of batches */
+static pthread_cond_t  cond = PTHREAD_COND_INITIALIZER;  /* batches passed */
+static clog_batch_t   *head;                 /* first batch to write */
+static clog_batch_t   *tail;                 /* last batch to write */
+static unsigned int    pending;              /* messages in batches */
+static int             stopping;             /* stop request */
+
+/* used only by the log thread */
+static int             seg_fd = -1;          /* segment to write */
+static size_t          seg_off;              /* offset to write */
+static unsigned long long seg_name;          /* name of the segment */
+static unsigned long long seg_top;           /* largest sequence number written */
+static char           *wbuf;                 /* write buffer */
+static size_t          wlen;                 /* bytes in wbuf */
+
+/* each worker has its own batch */
+static __thread clog_batch_t *batch;         /* messages of this iteration */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static void *clog_thread(void *arg);
+static void clog_write(clog_batch_t *list);
+static int clog_flush(void);
+static int clog_open(unsigned long long name, size_t off);
+static int clog_recover(unsigned long long *last);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int clog_init(opr_t *opr)
+{
+    int ret;
+    unsigned long long last = 0;
+
+    if (opr->log_dir[0] == '\0')
+    {
+        return(0);
+    }
+    dir = opr->log_dir;
+
+    wbuf = malloc(CLOG_WBUF_SIZE);
+    if (wbuf == NULL)
+    {
+        T_M(T_E, 0x89010100, "cannot allocate log buffer.\n");
+        return(0x89010100);
+    }
+
+    /* continue from the end of the last segment */
+    ret = clog_recover(&last);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+    hist_start(last);
+    T_M(T_I, 0x09010200, "chat log in %s, last message #%llu.\n", dir, last);
+
+    stopping = 0;
+    ret = pthread_create(&th, NULL, clog_thread, NULL);
+    if (ret != 0)
+    {
+        T_M(T_E, 0x89010300, "cannot create log thread: %s.\n", strerror(ret));
+        return(0x89010300);
+    }
+    th_started = 1;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void clog_deinit(opr_t *opr)
+{
+    if (th_started)
+    {
+        pthread_mutex_lock(&lock);
+        stopping = 1;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&lock);
+        pthread_join(th, NULL);
+        th_started = 0;
+    }
+
+    if (seg_fd >= 0)
+    {
+        close(seg_fd);
+        seg_fd = -1;
+    }
+    free(wbuf);
+    wbuf = NULL;
+    dir  = NULL;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+void clog_put(msg_t *msg)
+{
+    unsigned int cap;
+    clog_batch_t *new_batch;
+
+    if (dir == NULL)
+    {
+        return;
+    }
+
+    if (batch == NULL || batch->num == batch->cap)
+    {
+        cap = (batch != NULL)? batch->cap * 2 : CLOG_BATCH_INIT;
+        new_batch = realloc(batch, sizeof(*batch) + sizeof(batch->msg[0]) * cap);
+        if (new_batch == NULL)
+        {
+            T_MR(T_W, 0x89030100, "cannot log message #%llu.\n", msg->seq);
+            return;
+        }
+        if (batch == NULL)
+        {
+            new_batch->num = 0;
+        }
+        batch = new_batch;
+        batch->cap = cap;
+    }
+    batch->msg[batch->num++] = msg_ref(msg);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+void clog_commit(void)
+{
+    unsigned int cnt;
+    clog_batch_t *b = batch;
+
+    if (b == NULL)
+    {
+        return;
+    }
+    batch = NULL;
+
+    pthread_mutex_lock(&lock);
+    if (pending + b->num > CLOG_MAX_PENDING)
+    {
+        pthread_mutex_unlock(&lock);
+        T_M(T_W, 0x89040100, "log is too slow, %u messages are not logged.\n", b->num);
+        for (cnt = 0; cnt < b->num; cnt++)
+        {
+            msg_unref(b->msg[cnt]);
+        }
+        free(b);
+        return;
+    }
+    b->next = NULL;
+    if (tail == NULL)
+    {
+        head = b;
+    }
+    else
+    {
+        tail->next = b;
+    }
+    tail = b;
+    pending += b->num;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int clog_replay(unsigned int max, clog_cb_t cb, void *arg)
+{
+    int num;
+    int cnt;
+    int first;
+    unsigned int recs = 0;
+    unsigned int skip;
+    size_t off;
+    unsigned long long *firsts;
+    const seg_rec_t *rec;
+    seg_t seg;
+
+    if (dir == NULL || max == 0)
+    {
+        return(0);
+    }
+
+    num = seg_list(dir, &firsts);
+    if (num <= 0)
+    {
+        return(num);
+    }
+
+    /* count back from the last segment to find where to start */
+    for (first = num; first > 0 && recs < max; first--)
+    {
+        if (seg_map(&seg, dir, firsts[first-1]) < 0)
+        {
+            break;
+        }
+        for (off = 0; seg_next(&seg, &off) != NULL; recs++)
+        {
+            ;
+        }
+        seg_unmap(&seg);
+    }
+    skip = (recs > max)? recs - max : 0;
+
+    recs = 0;
+    for (cnt = first; cnt < num; cnt++)
+    {
+        if (seg_map(&seg, dir, firsts[cnt]) < 0)
+        {
+            continue;
+        }
+        for (off = 0; (rec = seg_next(&seg, &off)) != NULL; )
+        {
+            if (skip > 0)
+            {
+                skip--;
+                continue;
+            }
+            cb(rec->seq, seg_data(rec), rec->len, rec->rlen, arg);
+            recs++;
+        }
+        seg_unmap(&seg);
+    }
+    free(firsts);
+
+    return((int)recs);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static void *clog_thread(void *arg)
+{
+    int stop;
+    clog_batch_t *list;
+
+    for (;;)
+    {
+        /* take all batches passed so far */
+        pthread_mutex_lock(&lock);
+        while (head == NULL && !stopping)
+        {
+            pthread_cond_wait(&cond, &lock);
+        }
+        list = head;
+        head = NULL;
+        tail = NULL;
+        pending = 0;
+        stop = stopping;
+        pthread_mutex_unlock(&lock);
+
+        if (list == NULL && stop)
+        {
+            break;
+        }
+        clog_write(list);
+    }
+
+    return(NULL);
+}
+
+/*----------------------------------------------------------------------*/
+static void clog_write(clog_batch_t *list)
+{
+    unsigned int cnt;
+    unsigned int num = 0;
+    size_t size;
+    msg_t *msg;
+    seg_rec_t *rec;
+    clog_batch_t *b;
+
+    for (b = list; b != NULL; b = b->next)
+    {
+        for (cnt = 0; cnt < b->num; cnt++)
+        {
+            msg  = b->msg[cnt];
+            size = SEG_REC_SIZE(msg->len, msg->rlen);
+            if (size > CLOG_WBUF_SIZE)
+            {
+                T_M(T_W, 0xc9020100, "message #%llu is too long to log.\n", msg->seq);
+                continue;
+            }
+
+            /* start a new segment named above all messages written, as
+               messages from workers may come a little out of order */
+            if (seg_fd < 0 || seg_off + wlen + size > CLOG_SEG_SIZE)
+            {
+                if (clog_flush() < 0
+                    || clog_open(((seg_top > seg_name)? seg_top : seg_name) + 1, 0) < 0)
+                {
+                    continue;
+                }
+            }
+            if (wlen + size > CLOG_WBUF_SIZE && clog_flush() < 0)
+            {
+                continue;
+            }
+
+            /* header, data and room, zero padded */
+            rec = (seg_rec_t*)(wbuf + wlen);
+            rec->magic = SEG_MAGIC;
+            rec->len   = msg->len;
+            rec->seq   = msg->seq;
+            rec->rlen  = msg->rlen;
+            rec->sum   = seg_sum(msg->seq, msg->data, (size_t)msg->len + msg->rlen);
+            memcpy(rec + 1, msg->data, (size_t)msg->len + msg->rlen);
+            memset(wbuf + wlen + sizeof(*rec) + msg->len + msg->rlen, 0,
+                   size - sizeof(*rec) - msg->len - msg->rlen);
+            wlen += size;
+            num++;
+            if (msg->seq > seg_top)
+            {
+                seg_top = msg->seq;
+            }
+        }
+    }
+    (void)clog_flush();
+
+    /* one sync for all messages written */
+    if (seg_fd >= 0 && num > 0 && fdatasync(seg_fd) < 0)
+    {
+        T_M(T_E, 0xc9020200, "cannot sync log: %s.\n", strerror(errno));
+    }
+    T_M(T_D2, 0x49020300, "%u messages logged.\n", num);
+
+    while ((b = list) != NULL)
+    {
+        list = b->next;
+        for (cnt = 0; cnt < b->num; cnt++)
+        {
+            msg_unref(b->msg[cnt]);
+        }
+        free(b);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int clog_flush(void)
+{
+    ssize_t ret;
+    size_t done = 0;
+
+    while (done < wlen)
+    {
+        ret = pwrite(seg_fd, wbuf + done, wlen - done, seg_off + done);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            T_M(T_E, 0xc9030100, "cannot write log: %s.\n", strerror(errno));
+            wlen = 0;
+            return(0xc9030100);
+        }
+        done += ret;
+    }
+    seg_off += wlen;
+    wlen = 0;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int clog_open(unsigned long long name, size_t off)
+{
+    int ret;
+    int dfd;
+    char path[4096];
+
+    if (seg_fd >= 0)
+    {
+        if (fdatasync(seg_fd) < 0)
+        {
+            T_M(T_E, 0xc9040100, "cannot sync log: %s.\n", strerror(errno));
+        }
+        close(seg_fd);
+        seg_fd = -1;
+    }
+
+    /* never reuse a segment written before */
+    seg_path(path, sizeof(path), dir, name);
+    seg_fd = open(path, O_WRONLY | O_CLOEXEC | ((off == 0)? O_CREAT | O_EXCL : 0), 0644);
+    if (seg_fd < 0)
+    {
+        T_M(T_E, 0xc9040200, "cannot open %s: %s.\n", path, strerror(errno));
+        return(0xc9040200);
+    }
+
+    /* fixed size, unused part reads as zero */
+    ret = posix_fallocate(seg_fd, 0, CLOG_SEG_SIZE);
+    if (ret != 0 && ftruncate(seg_fd, CLOG_SEG_SIZE) < 0)
+    {
+        T_M(T_E, 0xc9040300, "cannot allocate %s: %s.\n", path, strerror(errno));
+        close(seg_fd);
+        seg_fd = -1;
+        return(0xc9040300);
+    }
+
+    /* make the new file name durable */
+    if (off == 0)
+    {
+        dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd >= 0)
+        {
+            (void)fsync(dfd);
+            close(dfd);
+        }
+        T_M(T_D1, 0x49040400, "new segment %s.\n", path);
+    }
+    seg_off  = off;
+    seg_name = name;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int clog_recover(unsigned long long *last)
+{
+    int num;
+    int cnt;
+    int ret = 0;
+    size_t off;
+    size_t end = 0;
+    unsigned long long top = 0;
+    unsigned long long *firsts;
+    const seg_rec_t *rec;
+    seg_t seg;
+
+    seg_name = 0;
+    num = seg_list(dir, &firsts);
+    if (num < 0)
+    {
+        return(num);
+    }
+
+    /* the largest record of the newest segment which has any */
+    for (cnt = num; cnt > 0 && top == 0; cnt--)
+    {
+        if (seg_map(&seg, dir, firsts[cnt-1]) < 0)
+        {
+            if (cnt == num)
+            {
+                /* do not overwrite what cannot be read */
+                T_M(T_E, 0xc9050100, "cannot recover the last segment.\n");
+                free(firsts);
+                return(0xc9050100);
+            }
+            continue;
+        }
+        for (off = 0; (rec = seg_next(&seg, &off)) != NULL; )
+        {
+            if (rec->seq > top)
+            {
+                top = rec->seq;
+            }
+        }
+        if (cnt == num)
+        {
+            end = off;
+        }
+        seg_unmap(&seg);
+    }
+
+    /* append to the last segment overwriting a torn record */
+    if (num > 0)
+    {
+        /* its name is above all records of the older segments */
+        if (firsts[num-1] > top + 1)
+        {
+            top = firsts[num-1] - 1;
+        }
+        ret = clog_open(firsts[num-1], end);
+    }
+    free(firsts);
+    *last   = top;
+    seg_top = top;
+
+    return(ret);
+}
+
+/* end of clog.c */
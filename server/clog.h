@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for chat log module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Chat messages are appended to segment files by a log thread.  Messages
+ * of one event loop iteration of all workers are made durable with one
+ * fdatasync(2), and workers never wait for the disk.
+ */
+#ifndef __CLOG_H_
+#define __CLOG_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+
+#include "main.h"
+#include "msg.h"
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def CLOG_SEG_SIZE
+ * @brief Size of a segment file.
+ */
+#define CLOG_SEG_SIZE   (64*1024*1024)
+
+/**
+ * @def CLOG_WBUF_SIZE
+ * @brief Bytes written to a segment at once.
+ */
+#define CLOG_WBUF_SIZE  (256*1024)
+
+/**
+ * @def CLOG_MAX_PENDING
+ * @brief Max number of messages waiting for the log thread.
+ *
+ * Messages beyond this are not logged when the disk cannot keep up.
+ */
+#define CLOG_MAX_PENDING (64*1024)
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @brief       Replay callback.
+ * @param[in] seq Sequence number.
+ * @param[in] data Message data followed by room name.
+ * @param[in] len Length of data.
+ * @param[in] rlen Length of room name.
+ * @param[in] arg Argument given to clog_replay().
+ */
+typedef void (*clog_cb_t)(unsigned long long seq, const char *data, size_t len,
+                          size_t rlen, void *arg);
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Chat log module init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Nothing is logged when opr->log_dir is empty.  Sequence numbers are
+ * continued from the last logged message.
+ */
+int clog_init(opr_t *opr);
+
+/**
+ * @brief       Chat log module de-init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ *
+ * Messages committed by workers are written before returning.
+ */
+void clog_deinit(opr_t *opr);
+
+/**
+ * @brief       Log a message.
+ * @param[in] msg Stamped chat message, a reference is taken.
+ *
+ * The message is passed to the log thread by clog_commit().
+ */
+void clog_put(msg_t *msg);
+
+/**
+ * @brief       Pass messages of this loop iteration to the log thread.
+ *
+ * Call this on each worker after each event loop iteration.
+ */
+void clog_commit(void);
+
+/**
+ * @brief       Replay the last messages in the log.
+ * @param[in] max Max number of messages.
+ * @param[in] cb Callback called for each message from the oldest.
+ * @param[in] arg Argument passed to cb.
+ * @return      Returns number of messages replayed, minus value on any error.
+ */
+int clog_replay(unsigned int max, clog_cb_t cb, void *arg);
+
+#endif  /* #ifndef __CLOG_H_ */
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Command module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Find the command of a line with the table generated from cmd.def.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+#include "cmd.h"
+#include "cmd_tab.h"
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int cmd_lookup(const char *line, size_t len, const char **arg, size_t *alen)
+{
+    size_t wlen;
+    const cmd_ent_t *ent;
+
+    /* word ends at the first space, longer ones are not commands */
+    for (wlen = 0; wlen < len && line[wlen] != ' '; wlen++)
+    {
+        if (wlen >= CMD_MAX_WORD)
+        {
+            return(CMD_NONE);
+        }
+    }
+
+    ent = &cmd_tab[cmd_hash(line, wlen, CMD_SEED) & CMD_MASK];
+    if (ent->word == NULL || ent->len != wlen || memcmp(ent->word, line, wlen) != 0)
+    {
+        return(CMD_NONE);
+    }
+
+    /* arguments follow the space */
+    *arg  = (wlen < len)? line + wlen + 1 : line + len;
+    *alen = (wlen < len)? len - wlen - 1 : 0;
+    if ((ent->args == CMD_ARGS_NONE && wlen < len) ||
+        (ent->args == CMD_ARGS_NEED && *alen == 0))
+    {
+        return(CMD_NONE);
+    }
+    T_M(T_D2, 0x4b010100, "command %u: %.*s\n", ent->cmd, (int)len, line);
+
+    return(ent->cmd);
+}
+
+/* end of cmd.c */
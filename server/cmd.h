@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for command module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Command words are listed in cmd.def.  cmdgen makes a perfect hash
+ * table of them at build time (cmd_tab.h), so a word is found with one
+ * hash and one comparison.  Lines whose first byte cannot start any
+ * word are chat messages without calling cmd_lookup().
+ */
+#ifndef __CMD_H_
+#define __CMD_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @enum CMD
+ * @brief Commands.
+ */
+enum CMD
+{
+    CMD_NONE    = 0,            /**< not a command, a chat message */
+    CMD_QUIT,                   /**< disconnect */
+    CMD_JOIN,                   /**< join a room */
+    CMD_PART,                   /**< leave the room */
+    CMD_SESSION,                /**< start a session */
+    CMD_RESUME,                 /**< resume a session */
+    CMD_WHO,                    /**< list names in the room */
+    CMD_NICK,                   /**< change name */
+    CMD_MSG,                    /**< direct message */
+};
+
+/**
+ * @enum CMD_ARGS
+ * @brief Arguments taken by a command word.
+ */
+enum CMD_ARGS
+{
+    CMD_ARGS_NONE = 0,          /**< no arguments */
+    CMD_ARGS_NEED = 1,          /**< one or more bytes after a space */
+};
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @struct
+ *      command table entry.
+ */
+typedef struct cmd_ent_strct {
+    const char   *word;         /**< command word, NULL when empty */
+    unsigned char len;          /**< length of word */
+    unsigned char cmd;          /**< CMD_* */
+    unsigned char args;         /**< CMD_ARGS_* */
+} cmd_ent_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+/**
+ * @brief Non-zero for bytes which start a command word.
+ */
+extern const unsigned char cmd_first[256];
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Hash of a command word.
+ * @param[in] word Word.
+ * @param[in] len Length of word.
+ * @param[in] seed Seed chosen by cmdgen.
+ * @return      Returns hash value.
+ */
+static inline unsigned int cmd_hash(const char *word, size_t len, unsigned int seed)
+{
+    size_t cnt;
+    unsigned int h = seed;
+
+    for (cnt = 0; cnt < len; cnt++)
+    {
+        h = (h ^ (unsigned char)word[cnt]) * 16777619U;
+    }
+
+    return(h ^ (h >> 15));
+}
+
+/**
+ * @brief       Check if a line may be a command.
+ * @param[in] line Line, one byte or more.
+ * @return      Returns non-zero when cmd_lookup() has to be called.
+ */
+static inline int cmd_maybe(const char *line)
+{
+    return(cmd_first[(unsigned char)line[0]]);
+}
+
+/**
+ * @brief       Find the command of a line.
+ * @param[in] line Line without CRLF.
+ * @param[in] len Length of line.
+ * @param[out] arg Arguments after the word and a space.
+ * @param[out] alen Length of arg.
+ * @return      Returns CMD_* of the line, CMD_NONE when the line is not
+ *              a command or arguments do not match the word.
+ */
+int cmd_lookup(const char *line, size_t len, const char **arg, size_t *alen);
+
+#endif  /* #ifndef __CMD_H_ */
@@ -0,0 +1,25 @@
+/* generated from cmd.def by cmdgen, do not edit */
+#define CMD_SEED        0x00000079U
+#define CMD_MASK        0xfU
+#define CMD_MAX_WORD    8
+
+static const cmd_ent_t cmd_tab[16] = {
+    [13] = { "/join", 5, CMD_JOIN, CMD_ARGS_NEED },
+    [7] = { "/part", 5, CMD_PART, CMD_ARGS_NONE },
+    [6] = { "/session", 8, CMD_SESSION, CMD_ARGS_NONE },
+    [0] = { "/resume", 7, CMD_RESUME, CMD_ARGS_NEED },
+    [12] = { "/quit", 5, CMD_QUIT, CMD_ARGS_NONE },
+    [9] = { "/who", 4, CMD_WHO, CMD_ARGS_NONE },
+    [5] = { "/nick", 5, CMD_NICK, CMD_ARGS_NEED },
+    [3] = { "/msg", 4, CMD_MSG, CMD_ARGS_NEED },
+    [1] = { "bye", 3, CMD_QUIT, CMD_ARGS_NONE },
+    [11] = { "exit", 4, CMD_QUIT, CMD_ARGS_NONE },
+    [14] = { "quit", 4, CMD_QUIT, CMD_ARGS_NONE },
+};
+
+const unsigned char cmd_first[256] = {
+    ['/'] = 1,
+    ['b'] = 1,
+    ['e'] = 1,
+    ['q'] = 1,
+};
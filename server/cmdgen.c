@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Command table generator.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Read command words from cmd.def and write a perfect hash table of them
+ * to stdout.  The smallest table is tried first and seeds of cmd_hash()
+ * are searched until no two words share a slot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "cmd.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define GEN_MAX_WORDS   64      /* max number of words */
+#define GEN_MAX_WORD    32      /* max length of a word including NUL */
+#define GEN_MAX_BITS    8       /* max bits of the table size */
+#define GEN_MAX_SEEDS   (1U << 20) /* seeds tried per table size */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* command word */
+typedef struct gen_word_strct {
+    char word[GEN_MAX_WORD];    /* word */
+    char cmd[GEN_MAX_WORD];     /* CMD_* */
+    char args[GEN_MAX_WORD];    /* none or need */
+} gen_word_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static gen_word_t words[GEN_MAX_WORDS]; /* words read */
+static int        num;                  /* number of words */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static int gen_read(const char *path);
+static int gen_try(int bits, unsigned int seed, int *slot);
+static void gen_write(int bits, unsigned int seed, const int *slot);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int main(int argc, char *argv[])
+{
+    int bits;
+    unsigned int seed;
+    int slot[GEN_MAX_WORDS];
+
+    /* set a default trace level to ERROR */
+    T_init(T_E);
+
+    if (argc != 2)
+    {
+        T_M(T_E, 0xc0010100, "usage: cmdgen <cmd.def>\n");
+        return(1);
+    }
+    if (gen_read(argv[1]) < 0)
+    {
+        return(1);
+    }
+
+    /* smallest table, then smallest seed */
+    for (bits = 1; bits <= GEN_MAX_BITS; bits++)
+    {
+        if ((1 << bits) < num)
+        {
+            continue;
+        }
+        for (seed = 1; seed < GEN_MAX_SEEDS; seed++)
+        {
+            if (gen_try(bits, seed, slot))
+            {
+                gen_write(bits, seed, slot);
+                return(0);
+            }
+        }
+    }
+
+    T_M(T_E, 0xc0010200, "no perfect hash found.\n");
+    return(1);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static int gen_read(const char *path)
+{
+    int cnt;
+    int ret;
+    FILE *fp;
+    char line[256];
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        T_M(T_E, 0xc0020100, "cannot open %s.\n", path);
+        return(0xc0020100);
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        if (num >= GEN_MAX_WORDS)
+        {
+            T_M(T_E, 0xc0020200, "too many words.\n");
+            fclose(fp);
+            return(0xc0020200);
+        }
+
+        ret = sscanf(line, "%31s %31s %31s", words[num].word, words[num].cmd, words[num].args);
+        if (ret != 3 || (strcmp(words[num].args, "none") != 0 &&
+                         strcmp(words[num].args, "need") != 0))
+        {
+            T_M(T_E, 0xc0020300, "invalid line: %s", line);
+            fclose(fp);
+            return(0xc0020300);
+        }
+        for (cnt = 0; cnt < num; cnt++)
+        {
+            if (strcmp(words[cnt].word, words[num].word) == 0)
+            {
+                T_M(T_E, 0xc0020400, "duplicated word: %s.\n", words[num].word);
+                fclose(fp);
+                return(0xc0020400);
+            }
+        }
+        num++;
+    }
+    fclose(fp);
+
+    if (num == 0)
+    {
+        T_M(T_E, 0xc0020500, "no words in %s.\n", path);
+        return(0xc0020500);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int gen_try(int bits, unsigned int seed, int *slot)
+{
+    int cnt;
+    unsigned char used[1 << GEN_MAX_BITS];
+
+    memset(used, 0, sizeof(used));
+    for (cnt = 0; cnt < num; cnt++)
+    {
+        slot[cnt] = cmd_hash(words[cnt].word, strlen(words[cnt].word), seed) & ((1U << bits) - 1);
+        if (used[slot[cnt]])
+        {
+            return(0);
+        }
+        used[slot[cnt]] = 1;
+    }
+
+    return(1);
+}
+
+/*----------------------------------------------------------------------*/
+static void gen_write(int bits, unsigned int seed, const int *slot)
+{
+    int cnt;
+    size_t len;
+    size_t max = 0;
+    unsigned char first[256];
+
+    memset(first, 0, sizeof(first));
+    for (cnt = 0; cnt < num; cnt++)
+    {
+        len = strlen(words[cnt].word);
+        if (len > max)
+        {
+            max = len;
+        }
+        first[(unsigned char)words[cnt].word[0]] = 1;
+    }
+
+    printf("/* generated from cmd.def by cmdgen, do not edit */\n");
+    printf("#define CMD_SEED        0x%08xU\n", seed);
+    printf("#define CMD_MASK        0x%xU\n", (1U << bits) - 1);
+    printf("#define CMD_MAX_WORD    %zu\n", max);
+    printf("\n");
+
+    printf("static const cmd_ent_t cmd_tab[%d] = {\n", 1 << bits);
+    for (cnt = 0; cnt < num; cnt++)
+    {
+        printf("    [%d] = { \"%s\", %zu, %s, %s },\n", slot[cnt], words[cnt].word,
+               strlen(words[cnt].word), words[cnt].cmd,
+               (strcmp(words[cnt].args, "need") == 0)? "CMD_ARGS_NEED" : "CMD_ARGS_NONE");
+    }
+    printf("};\n");
+    printf("\n");
+
+    printf("const unsigned char cmd_first[256] = {\n");
+    for (cnt = 0; cnt < 256; cnt++)
+    {
+        if (first[cnt])
+        {
+            printf("    ['%c'] = 1,\n", cnt);
+        }
+    }
+    printf("};\n");
+
+    return;
+}
+
+/* end of cmdgen.c */
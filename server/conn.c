@@ -14,72 +14,371 @@
  * Accept TCP connection and handle massages from/to each connection.
  */
 
+#define _GNU_SOURCE             /* accept4() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
-#include <netdb.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <stdint.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "trace.h"
+#include "evl.h"
+#include "tmr.h"
+#include "line.h"
+#include "../com.h"
 #include "main.h"
 #include "conn.h"
+#include "msg.h"
+#include "wrk.h"
+#include "rslv.h"
+#include "room.h"
+#include "hist.h"
+#include "sess.h"
+#include "clog.h"
+#include "metr.h"
+#include "cmd.h"
+#include "nick.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define CONN_NIL        ((unsigned int)-1) /* end of vacant list */
+#define CONN_ALIGN      64      /* cache line size, sizeof(conn_t) */
+
+/* completion argument of a connection (ID in lower 24 bits, 32-bit
+   generation above it, which does not wrap while a lookup waits) */
+#define CONN_KEY(id, gen)       ((void*)((uintptr_t)(gen) << 24 | (id)))
+#define CONN_KEY_ID(key)        ((unsigned int)((uintptr_t)(key) & 0xffffff))
+#define CONN_KEY_GEN(key)       ((unsigned int)((uintptr_t)(key) >> 24))
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* message pinned by a MSG_ZEROCOPY send */
+typedef struct conn_zc_rec_strct {
+    unsigned int id;            /* zerocopy send ID */
+    msg_t       *msg;           /* pinned message */
+} conn_zc_rec_t;
+
+/* messages pinned by MSG_ZEROCOPY sends */
+typedef struct conn_zc_strct {
+    unsigned int   seq;         /* ID of the next zerocopy send */
+    unsigned int   head;        /* first record */
+    unsigned int   num;         /* number of records */
+    unsigned int   cap;         /* size of rec (power of 2) */
+    conn_zc_rec_t *rec;         /* ring of records */
+} conn_zc_t;
+
+/* sendmsg in flight on a completion based event loop */
+typedef struct conn_sop_strct {
+    struct conn_sop_strct *next; /* next free record */
+    unsigned int  id;           /* connection ID */
+    unsigned int  num;          /* number of messages in iov */
+    unsigned int  orphan;       /* connection closed, messages are ours */
+    msg_t        *msg[CONN_MAX_IOV]; /* messages in iov */
+    struct iovec  iov[CONN_MAX_IOV]; /* bytes to send */
+    struct msghdr mh;           /* message header */
+} conn_sop_t;
+
+/* connection (fields used for each recipient in one cache line) */
+typedef struct conn_strct {
+    int          fd;            /* socket, -1 when vacant */
+    unsigned char state;        /* CONN_ST_* */
+    unsigned char dirty;        /* in the dirty list */
+    msg_t      **oq;            /* outbound queue (ring of messages) */
+    unsigned int ohead;         /* index of the first message in oq */
+    unsigned int onum;          /* number of queued messages */
+    unsigned int ocap;          /* size of oq (power of 2) */
+    unsigned int ooff;          /* bytes sent of the first message */
+    unsigned int obytes;        /* bytes queued */
+    unsigned int gen;           /* generation to detect reuse of entry */
+    unsigned long long sess;    /* session token, 0 when none */
+    unsigned long long gate;    /* long line being sent to us, 0 when none */
+    unsigned int dnum;          /* number of messages in dq */
+    unsigned int link;          /* index in live when used,
+                                   next vacant entry when vacant */
+} conn_t;
+
+/* the other fields of a connection (kept apart like names) */
+typedef struct conn_cold_strct {
+    char        *ibuf;          /* partial line received */
+    unsigned int ilen;          /* length of the partial line */
+    unsigned char iskip;        /* discarding a too long line */
+    unsigned char paused;       /* reading paused by the rate limit */
+    unsigned char noticed;      /* told that lines are dropped */
+    unsigned long long stream;  /* long line being relayed, 0 when none */
+    unsigned int slen;          /* bytes of the long line relayed */
+    msg_t      **dq;            /* messages waiting for the long line */
+    unsigned int dcap;          /* size of dq */
+    unsigned int dbytes;        /* bytes in dq */
+    conn_zc_t   *zc;            /* zerocopy state, NULL when disabled */
+    conn_sop_t  *sop;           /* sendmsg in flight, NULL when none */
+    tmr_ent_t   *tmr;           /* idle timer, NULL when not used
+                                   (not in cold, which moves on grow) */
+    unsigned long long rx_at;   /* time of the last receive in ns */
+    unsigned long long ping_at; /* time of the last ping in ns */
+    char        *hold;          /* bytes held while paused, NULL when none */
+    unsigned int hlen;          /* length of hold */
+    unsigned long long resume_at; /* time to resume reading in ns */
+    unsigned long long msg_tat; /* time the line bucket gets full in ns */
+    unsigned long long byte_tat; /* time the byte bucket gets full in ns */
+    unsigned long long resumed; /* seq seen before resuming the session */
+    unsigned long long rx_bytes; /* bytes received */
+    unsigned long long rx_msgs; /* lines received */
+    unsigned long long tx_bytes; /* bytes sent */
+    unsigned long long tx_msgs; /* messages sent */
+} conn_cold_t;
+
+/* name shown to the other clients (kept apart like host names) */
+typedef struct conn_prefix_strct {
+    const char  *nick;          /* interned nickname, NULL when none */
+    unsigned int len;           /* length of data */
+    char         data[CONN_MAX_NAME + 3]; /* "[name] " put before messages */
+} conn_prefix_t;
+
+/* recipients of a long line on this worker */
+typedef struct conn_stream_strct {
+    unsigned long long sid;     /* stream ID */
+    unsigned int  num;          /* number of recipients */
+    unsigned long long *key;    /* recipients (gen << 24 | id) */
+} conn_stream_t;
+
+/* members of a room on a worker for /who */
+typedef struct conn_who_part_strct {
+    unsigned int num;           /* number of members */
+    unsigned int listed;        /* number of names in text */
+    size_t       len;           /* length of text */
+    char        *text;          /* ", <name>" for each name listed */
+} conn_who_part_t;
+
+/* /who asked to all workers */
+typedef struct conn_who_strct {
+    atomic_int   left;          /* workers yet to answer */
+    size_t       rlen;          /* length of room */
+    char         room[ROOM_MAX_NAME]; /* room name */
+    conn_who_part_t part[WRK_MAX]; /* answer of each worker */
+} conn_who_t;
+
+/* connection states */
+enum conn_state
+{
+    CONN_ST_VACANT = 0,         /* not used */
+    CONN_ST_OPEN   = 1,         /* connection established */
+    CONN_ST_LINGER = 2,         /* close after the outbound queue is sent */
+    CONN_ST_CLOSE  = 3,         /* close on the next reap */
+};
 
 /*======================================================================
  * global variables
  *======================================================================*/
 
 /*------------------------------
- * private
+ * private (each worker has its own connections)
  *------------------------------*/
-static int  sock[CONN_MAX_SOCK]; /* accepted sockets */
-static char names[CONN_MAX_SOCK][CONN_MAX_NAME]; /* host names of accepted sockets */
-static char *quit_msg[] = {                      /* quit messages */
-    "bye\r\n",
-    "exit\r\n",
-    "quit\r\n",
-    NULL
-};
+static __thread evl_t *evl;              /* event loop */
+static __thread conn_t *conns;           /* connection table */
+static __thread conn_cold_t *cold;       /* the other fields of conns */
+static __thread char (*names)[CONN_MAX_NAME]; /* host names of connections */
+static __thread conn_prefix_t *prefix;   /* names shown to the others */
+static __thread unsigned int conn_num;   /* size of the connection table */
+static __thread unsigned int vacant;     /* head of vacant list */
+static __thread unsigned int *live;      /* dense array of live connection ids */
+static __thread unsigned int live_num;   /* number of live connections */
+static __thread unsigned int closing;    /* number of CONN_ST_CLOSE connections */
+static __thread char *rbuf;              /* receive buffer */
+static __thread unsigned int *dirty;     /* connections to flush */
+static __thread unsigned int dirty_num;  /* number of dirty connections */
+static __thread conn_sop_t *sop_free;    /* free sendmsg records */
+static __thread int use_ops;             /* completion based event loop */
+static __thread conn_stream_t *streams;  /* long lines being relayed */
+static __thread unsigned int stream_num; /* number of streams */
+static __thread unsigned int stream_cap; /* size of streams */
+static __thread unsigned long long stream_seq; /* last stream ID made here */
+static unsigned int max_msg;             /* max bytes of a line with CRLF */
+static int zerocopy;                     /* use MSG_ZEROCOPY */
+static unsigned long long idle_ns;       /* idle timeout, 0 when disabled */
+static unsigned long long keepalive_ns;  /* ping interval, 0 when disabled */
+static unsigned long long msg_ns;        /* ns per line, 0 when not limited */
+static unsigned long long msg_tol;       /* burst of lines in ns */
+static unsigned long long byte_ns;       /* ns per byte, 0 when not limited */
+static unsigned long long byte_tol;      /* burst of bytes in ns */
+static int rate_drop;                    /* drop lines instead of pausing */
 
 /*======================================================================
  * prototype declarations for private functions
  *======================================================================*/
-static int conn_find_vacant_sock(void);
-static int conn_recv(int sock_cnt, char *buf);
-static void conn_disconnect(int sock_cnt);
-static int conn_broadcast(char *client_name, char *msg);
-static int conn_recv_broadcast(int sock_cnt);
+static int conn_grow(void);
+static int conn_alloc(void);
+static int conn_open(int sock, struct sockaddr *addr, socklen_t addrlen);
+static void conn_named_cb(const char *name, void *arg);
+static void conn_prefix_set(unsigned int id, const char *name, size_t len);
+static void conn_timer_arm(unsigned int id);
+static void conn_timer_cb(tmr_ent_t *ent, void *arg);
+static int conn_recv(unsigned int id);
+static int conn_recv_cb(evl_t *evl, int res, void *buf, int more, void *arg);
+static int conn_input(unsigned int id, int len);
+static int conn_line(unsigned int id, const char *line, size_t len);
+static int conn_long_start(unsigned int id, size_t len);
+static void conn_long(unsigned int id, const char *buf, size_t len, int last);
+static void conn_long_end(unsigned int id);
+static void conn_relay(msg_t *msg);
+static unsigned long long conn_rate(unsigned int id, size_t len);
+static void conn_pause(unsigned int id, unsigned long long wait);
+static int conn_hold(unsigned int id, const char *buf, size_t len);
+static void conn_unpause(unsigned int id);
+static int conn_command(unsigned int id, const char *line, size_t len);
+static void conn_quit(unsigned int id);
+static void conn_join(unsigned int id, const char *arg, size_t len);
+static void conn_part(unsigned int id);
+static void conn_session(unsigned int id);
+static void conn_resume(unsigned int id, const char *arg, size_t len);
+static void conn_who(unsigned int id);
+static void conn_who_cb(void *arg);
+static void conn_nick(unsigned int id, const char *arg, size_t len);
+static void conn_msg(unsigned int id, const char *arg, size_t len);
+static void conn_reply(unsigned int id, const char *text);
+static void conn_disconnect(unsigned int id);
+static void conn_close_later(unsigned int id);
+static void conn_reap(void);
+static int conn_enqueue(unsigned int id, msg_t *msg, unsigned int off);
+static void conn_send(unsigned int id, msg_t *msg);
+static void conn_post(unsigned int id, msg_t *msg);
+static void conn_defer(unsigned int id, msg_t *msg);
+static void conn_undefer(unsigned int id);
+static unsigned int conn_gather(unsigned int id, struct iovec *iov, size_t *total);
+static void conn_sent(unsigned int id, size_t len);
+static void conn_flush(unsigned int id);
+static void conn_flush_op(unsigned int id);
+static int conn_sent_cb(evl_t *evl, int res, void *buf, int more, void *arg);
+static void conn_flush_dirty(void);
+static void conn_zc_pin(unsigned int id, unsigned int n, size_t sent);
+static void conn_zc_complete(unsigned int id);
+static void conn_zc_free(unsigned int id);
+static void conn_fanout(msg_t *msg);
+static void conn_fanout_piece(msg_t *msg);
+static int conn_broadcast(unsigned int id, const char *line, size_t len);
+static int conn_io_cb(evl_t *evl, int fd, unsigned int events, void *arg);
 
 /*======================================================================
  * functions
  *======================================================================*/
-int conn_init(opr_t *opr)
+int conn_init(opr_t *opr, evl_t *conn_evl)
 {
-    /* initialize sockets with -1 */
-    memset(sock, 0xFF, sizeof(sock));
+    int ret;
+
+    evl = conn_evl;
+    zerocopy = opr->zerocopy;
+    use_ops  = evl_has_ops(conn_evl);
+    sop_free = NULL;
+    if (use_ops && zerocopy)
+    {
+        T_M(T_I, 0x02010080, "MSG_ZEROCOPY is not used with completion based sends.\n");
+    }
+    if (opr->evl_backend == EVL_SELECT && zerocopy)
+    {
+        /* select does not tell that the error queue has completions */
+        T_M(T_E, 0x82010090, "MSG_ZEROCOPY cannot be used with select.\n");
+        return(0x82010090);
+    }
+    idle_ns      = opr->idle * 1000000000ULL;
+    keepalive_ns = opr->keepalive * 1000000000ULL;
 
-    /* initialize name */
-    memset(names, 0, sizeof(names));
+    /* a bucket lets burst units go at once, a line must fit in it */
+    msg_ns    = (opr->msg_rate > 0)? 1000000000ULL / opr->msg_rate : 0;
+    msg_tol   = msg_ns * opr->msg_burst;
+    byte_ns   = (opr->byte_rate > 0)? 1000000000ULL / opr->byte_rate : 0;
+    byte_tol  = byte_ns * ((opr->byte_burst > CONN_MAX_MSG)? opr->byte_burst : CONN_MAX_MSG);
+    rate_drop = opr->rate_drop;
+    max_msg   = (unsigned int)opr->max_msg;
 
-    return(0);
+    conns    = NULL;
+    cold     = NULL;
+    names    = NULL;
+    prefix   = NULL;
+    live     = NULL;
+    dirty    = NULL;
+    streams  = NULL;
+    stream_num = 0;
+    stream_cap = 0;
+    dirty_num = 0;
+    conn_num = 0;
+    live_num = 0;
+    closing  = 0;
+    vacant   = CONN_NIL;
+
+    /* a partial line is put in front of received bytes */
+    rbuf = malloc(CONN_MAX_MSG + CONN_RBUF_SIZE);
+    if (rbuf == NULL)
+    {
+        T_M(T_E, 0x82010100, "cannot allocate receive buffer.\n");
+        return(0x82010100);
+    }
+
+    ret = room_init();
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    ret = hist_init();
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    return(conn_grow());
 }
 
 /*----------------------------------------------------------------------*/
 void conn_deinit(opr_t *opr)
 {
-    int cnt;
+    conn_sop_t *sop;
 
     /* close all opening sockets */
-    for (cnt=0; cnt < CONN_MAX_SOCK; cnt++)
+    while (live_num > 0)
     {
-        if (sock[cnt] >= 0)
-        {
-            T_M(T_D1, 0x02030100, "closing socket: %d.\n", sock[cnt]);
-            close(sock[cnt]);
-            sock[cnt] = -1;
-        }
+        T_M(T_D1, 0x02020100, "closing socket: %d.\n", conns[live[0]].fd);
+        conn_disconnect(live[0]);
+    }
+
+    room_deinit();
+    hist_deinit();
+    free(conns);
+    free(cold);
+    free(names);
+    free(prefix);
+    free(live);
+    free(dirty);
+    dirty    = NULL;
+    while (stream_num > 0)
+    {
+        free(streams[--stream_num].key);
+    }
+    free(streams);
+    streams  = NULL;
+    stream_cap = 0;
+    msg_pool_drain();
+    free(rbuf);
+    rbuf     = NULL;
+    while (sop_free != NULL)
+    {
+        sop = sop_free;
+        sop_free = sop->next;
+        free(sop);
     }
+    conns    = NULL;
+    cold     = NULL;
+    names    = NULL;
+    prefix   = NULL;
+    live     = NULL;
+    conn_num = 0;
 
     return;
 }
@@ -87,228 +386,2351 @@ void conn_deinit(opr_t *opr)
 /*----------------------------------------------------------------------*/
 int conn_accept(int new_sock)
 {
-    int ret;
-    int cnt;
+    int sock;
     socklen_t caddrlen;         /* client address length */
-    struct sockaddr_in caddr;   /* client address structure */
-
-    ret = conn_find_vacant_sock();
-    if (ret < 0)
-    {
-        return(ret);
-    }
-    cnt = ret;
+    struct sockaddr_storage caddr; /* client address structure */
 
-    /* accept */
-    sock[cnt] = accept(new_sock, (struct sockaddr*)&caddr, &caddrlen);
-    if (sock[cnt] < 0)
+    /* accept, a slow client must not block the others */
+    caddrlen = sizeof(caddr);
+    sock = accept4(new_sock, (struct sockaddr*)&caddr, &caddrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (sock < 0)
     {
+        switch (errno)
+        {
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            /* backlog is drained */
+            return(1);
+        case EINTR:
+        case ECONNABORTED:
+        case EPROTO:
+            /* the client has gone, try the next one */
+            T_M(T_D1, 0x02030100, "accept aborted: %s.\n", strerror(errno));
+            return(0);
+        case EMFILE:
+        case ENFILE:
+        case ENOBUFS:
+        case ENOMEM:
+            /* leave the rest in the backlog until resources are freed */
+            T_MR(T_W, 0x82030300, "cannot accept: %s.\n", strerror(errno));
+            return(1);
+        default:
+            break;
+        }
         T_M(T_E, 0x82030200, "cannot accept: %s.\n", strerror(errno));
-        sock[cnt] = -1;
         return(0x82030200);
     }
 
-    /* retrieve host name */
-    ret = getnameinfo((struct sockaddr *)&caddr, caddrlen,
-                      names[cnt], sizeof(names[cnt]),
-                      NULL, 0, NI_NAMEREQD);
-    if (strlen(names[cnt]) == 0)
+    return(conn_open(sock, (struct sockaddr*)&caddr, caddrlen));
+}
+
+/*----------------------------------------------------------------------*/
+int conn_accepted(int sock)
+{
+    socklen_t caddrlen;
+    struct sockaddr_storage caddr;
+
+    caddrlen = sizeof(caddr);
+    if (getpeername(sock, (struct sockaddr*)&caddr, &caddrlen) < 0)
     {
-        /* use specific name when no name retrieved */
-        snprintf(names[cnt], sizeof(names[cnt]), "noname");
+        T_M(T_W, 0x82050100, "cannot get peer address: %s.\n", strerror(errno));
+        close(sock);
+        return(0);
     }
-    T_M(T_D1, 0x02030400, "connection established with %s.\n", names[cnt]);
 
-    return(0);
+    return(conn_open(sock, (struct sockaddr*)&caddr, caddrlen));
 }
 
 /*----------------------------------------------------------------------*/
-int conn_fd_set(fd_set *fds)
+int conn_deliver(msg_t *msg)
 {
-    int cnt;
-    int max_fd = 0;
+    conn_fanout(msg);
+
+    return(0);
+}
 
-    for (cnt = 0; cnt < CONN_MAX_SOCK; cnt++)
+/*----------------------------------------------------------------------*/
+int conn_deliver_to(unsigned int id, unsigned int gen, msg_t *msg)
+{
+    /* the connection may be closed (or reused) after the lookup */
+    if (id >= conn_num || conns[id].gen != gen)
     {
-        if (sock[cnt] >= 0)
-        {
-            FD_SET(sock[cnt], fds);
-            if (sock[cnt] > max_fd)
-            {
-                max_fd = sock[cnt];
-            }
-        }
+        return(0);
     }
 
-    return(max_fd);
+    conn_send(id, msg);
+
+    return(0);
 }
 
 /*----------------------------------------------------------------------*/
-int conn_fd_process(fd_set *fds)
+void conn_commit(void)
 {
-    int cnt;
-    int ret;
+    conn_flush_dirty();
+    conn_reap();
 
-    for (cnt = 0; cnt < CONN_MAX_SOCK; cnt++)
-    {
-        /* skip closed sockets */
-        if (sock[cnt] < 0)
-        {
-            continue;
-        }
+    return;
+}
 
-        /* check if there is message */
-        if (FD_ISSET(sock[cnt], fds))
-        {
-            T_M(T_D1, 0x020050400, "process a message from sock[%d]=%d.\n",
-                cnt, sock[cnt]);
-            /* receive a message and broadcast it */
-            ret = conn_recv_broadcast(cnt);
-            if (ret < 0)
-            {
-                return(ret);
-            }
-        }
+/*----------------------------------------------------------------------*/
+void conn_report(metr_buf_t *buf)
+{
+    unsigned int cnt;
+    unsigned int id;
+    char label[CONN_MAX_NAME + 64];
+
+    for (cnt = 0; cnt < live_num; cnt++)
+    {
+        id = live[cnt];
+        snprintf(label, sizeof(label), "{worker=\"%d\",conn=\"%u\",fd=\"%d\",host=\"%s\"}",
+                 wrk_self(), id, conns[id].fd, names[id]);
+        metr_printf(buf,
+                    "chat_conn_bytes_in%s %llu\n"
+                    "chat_conn_bytes_out%s %llu\n"
+                    "chat_conn_msgs_in%s %llu\n"
+                    "chat_conn_msgs_out%s %llu\n"
+                    "chat_conn_queued_bytes%s %u\n"
+                    "chat_conn_queued_msgs%s %u\n",
+                    label, cold[id].rx_bytes, label, cold[id].tx_bytes,
+                    label, cold[id].rx_msgs, label, cold[id].tx_msgs,
+                    label, conns[id].obytes, label, conns[id].onum);
     }
 
-    return(0);
+    return;
 }
 
 /*======================================================================
  * private functions
  *======================================================================*/
-static int conn_find_vacant_sock(void)
+static int conn_grow(void)
 {
-    int cnt;
+    unsigned int cnt;
+    unsigned int num;
+    conn_t *new_conns;
+    conn_cold_t *new_cold;
+    char (*new_names)[CONN_MAX_NAME];
+    conn_prefix_t *new_prefix;
+    unsigned int *new_live;
+
+    num = (conn_num > 0)? conn_num * 2 : CONN_INIT_SOCK;
+
+    /* an entry fills a cache line */
+    new_conns = aligned_alloc(CONN_ALIGN, sizeof(*conns) * num);
+    if (new_conns == NULL)
+    {
+        T_M(T_E, 0xc2010100, "cannot grow connection table to %u.\n", num);
+        return(0xc2010100);
+    }
+    if (conn_num > 0)
+    {
+        memcpy(new_conns, conns, sizeof(*conns) * conn_num);
+    }
+    free(conns);
+    conns = new_conns;
+
+    new_cold = realloc(cold, sizeof(*cold) * num);
+    if (new_cold == NULL)
+    {
+        T_M(T_E, 0xc2010180, "cannot grow connection table to %u.\n", num);
+        return(0xc2010180);
+    }
+    cold = new_cold;
+
+    new_names = realloc(names, sizeof(*names) * num);
+    if (new_names == NULL)
+    {
+        T_M(T_E, 0xc2010200, "cannot grow connection table to %u.\n", num);
+        return(0xc2010200);
+    }
+    names = new_names;
+
+    new_prefix = realloc(prefix, sizeof(*prefix) * num);
+    if (new_prefix == NULL)
+    {
+        T_M(T_E, 0xc2010280, "cannot grow connection table to %u.\n", num);
+        return(0xc2010280);
+    }
+    prefix = new_prefix;
+
+    new_live = realloc(live, sizeof(*live) * num);
+    if (new_live == NULL)
+    {
+        T_M(T_E, 0xc2010300, "cannot grow connection table to %u.\n", num);
+        return(0xc2010300);
+    }
+    live = new_live;
+
+    new_live = realloc(dirty, sizeof(*dirty) * num);
+    if (new_live == NULL)
+    {
+        T_M(T_E, 0xc2010380, "cannot grow connection table to %u.\n", num);
+        return(0xc2010380);
+    }
+    dirty = new_live;
+
+    /* chain new entries to the vacant list in ascending order */
+    memset(conns + conn_num, 0, sizeof(*conns) * (num - conn_num));
+    memset(cold + conn_num, 0, sizeof(*cold) * (num - conn_num));
+    memset(names + conn_num, 0, sizeof(*names) * (num - conn_num));
+    memset(prefix + conn_num, 0, sizeof(*prefix) * (num - conn_num));
+    for (cnt = num; cnt > conn_num; cnt--)
+    {
+        conns[cnt-1].fd    = -1;
+        conns[cnt-1].state = CONN_ST_VACANT;
+        conns[cnt-1].link  = vacant;
+        vacant = cnt-1;
+    }
+    T_M(T_D1, 0x42010400, "connection table grown to %u.\n", num);
+    conn_num = num;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_alloc(void)
+{
+    int ret;
+    unsigned int id;
 
-    T_D(T_D2, 0x42010100, sock, sizeof(sock));
-    for (cnt = 0; cnt < CONN_MAX_SOCK; cnt++)
+    if (vacant == CONN_NIL)
     {
-        if (sock[cnt] < 0)
+        ret = conn_grow();
+        if (ret < 0)
         {
-            T_M(T_D1, 0x42010200, "use connection sock[%d].\n");
-            return(cnt);
+            return(ret);
         }
     }
 
-    T_M(T_E, 0xc201e000, "no more space to save sockets.\n");
-    return(0xc201e000);
+    /* pop from the vacant list and push to the live array */
+    id = vacant;
+    vacant = conns[id].link;
+    conns[id].state = CONN_ST_OPEN;
+    conns[id].link  = live_num;
+    live[live_num++] = id;
+    T_M(T_D1, 0x42070200, "use connection conns[%u].\n", id);
+
+    return((int)id);
 }
 
 /*----------------------------------------------------------------------*/
-static int conn_recv(int sock_cnt, char *buf)
+static int conn_open(int sock, struct sockaddr *addr, socklen_t addrlen)
 {
     int ret;
+    unsigned int id;
 
-    ret = recv(sock[sock_cnt], buf, CONN_MAX_MSG-1, 0);
+    ret = conn_alloc();
     if (ret < 0)
     {
-        if (errno == EAGAIN)
+        close(sock);
+        return(ret);
+    }
+    id = (unsigned int)ret;
+    conns[id].fd = sock;
+    metr_add(METR_ACCEPTS, 1);
+
+    /* everyone starts in the lobby */
+    if (room_join(id, "", 0) < 0)
+    {
+        conn_disconnect(id);
+        return(0);
+    }
+
+    /* host name is looked up in background, noname until it is found */
+    ret = rslv_lookup(addr, addrlen, names[id], sizeof(names[id]),
+                      conn_named_cb, CONN_KEY(id, conns[id].gen));
+    if (ret <= 0 || strlen(names[id]) == 0)
+    {
+        /* use specific name when no name retrieved */
+        snprintf(names[id], sizeof(names[id]), "noname");
+    }
+    conn_prefix_set(id, names[id], strlen(names[id]));
+    T_M(T_D1, 0x42100100, "connection established with %s.\n", names[id]);
+
+    /* idle and rate limit timer, received bytes only update rx_at */
+    cold[id].rx_at   = evl_woken(evl);
+    cold[id].ping_at = cold[id].rx_at;
+    if (idle_ns > 0 || keepalive_ns > 0 || msg_ns > 0 || byte_ns > 0)
+    {
+        cold[id].tmr = malloc(sizeof(tmr_ent_t));
+        if (cold[id].tmr == NULL)
         {
-            /* timeout */
-            T_M(T_D1, 0x42020080, "timed out.\n");
+            T_M(T_W, 0xc2100400, "cannot allocate idle timer.\n");
+            conn_disconnect(id);
             return(0);
         }
+        tmr_init(cold[id].tmr, conn_timer_cb, CONN_KEY(id, conns[id].gen));
+        conn_timer_arm(id);
+    }
 
-        /* other error */
-        T_M(T_E, 0xc2020100, "cannot recv from sock[%d]=%d: %s.\n",
-            sock_cnt, sock[sock_cnt], strerror(errno));
-        return(0xc2020100);
+    if (use_ops)
+    {
+        /* the event loop receives until the connection is closed */
+        ret = evl_recv(evl, sock, conn_recv_cb, CONN_KEY(id, conns[id].gen));
+        if (ret < 0)
+        {
+            conn_disconnect(id);
+        }
+        return(0);
     }
-    if (ret == 0)
+
+    /* zerocopy is used only when the socket supports it */
+    if (zerocopy)
+    {
+        ret = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &ret, sizeof(ret)) == 0)
+        {
+            cold[id].zc = calloc(1, sizeof(conn_zc_t));
+        }
+        else
+        {
+            T_M(T_I, 0x42100300, "SO_ZEROCOPY not supported: %s.\n", strerror(errno));
+        }
+    }
+
+    /* register to the event loop */
+    ret = evl_add(evl, sock, EVL_IN, conn_io_cb, (void*)(uintptr_t)id);
+    if (ret < 0)
     {
-        T_M(T_W, 0xc2020200, "connection closed by remote host.\n");
-        conn_disconnect(sock_cnt);
+        close(sock);
+        conns[id].fd = -1;
+        conn_disconnect(id);
+        return(0);
     }
 
-    return(ret);
+    return(0);
 }
 
 /*----------------------------------------------------------------------*/
-static void conn_disconnect(int sock_cnt)
+static void conn_named_cb(const char *name, void *arg)
 {
-    close(sock[sock_cnt]);
-    sock[sock_cnt] = -1;
-    memset(names[sock_cnt], 0, sizeof(names[sock_cnt]));
+    unsigned int id = CONN_KEY_ID(arg);
+
+    /* the connection may be closed (or reused) during the lookup */
+    if (id >= conn_num || conns[id].gen != CONN_KEY_GEN(arg) ||
+        conns[id].state == CONN_ST_VACANT || strlen(name) == 0)
+    {
+        return;
+    }
+
+    snprintf(names[id], sizeof(names[id]), "%s", name);
+    T_M(T_D1, 0x42140100, "conns[%u]=%d is %s.\n", id, conns[id].fd, names[id]);
+
+    /* nickname is shown instead when set */
+    if (prefix[id].nick == NULL)
+    {
+        conn_prefix_set(id, names[id], strlen(names[id]));
+    }
 
     return;
 }
 
 /*----------------------------------------------------------------------*/
-static int conn_broadcast(char *client_name, char *msg)
+static void conn_prefix_set(unsigned int id, const char *name, size_t len)
 {
-    int cnt;
-    int ret;
-    char buf[CONN_MAX_MSG+CONN_MAX_NAME+3];
+    conn_prefix_t *p = &prefix[id];
 
-    /* clear send buffer */
-    memset(buf, 0, sizeof(buf));
+    /* made once here, copied as is into every chat message */
+    if (len > sizeof(p->data) - 3)
+    {
+        len = sizeof(p->data) - 3;
+    }
+    p->data[0] = '[';
+    memcpy(p->data + 1, name, len);
+    p->data[len+1] = ']';
+    p->data[len+2] = ' ';
+    p->len = (unsigned int)len + 3;
+
+    return;
+}
 
-    /* generate send message */
-    snprintf(buf, sizeof(buf), "[%s] %s", client_name, msg);
-    T_M(T_D1, 0x42040200, "send message: %s\n", buf);
+/*----------------------------------------------------------------------*/
+static void conn_timer_arm(unsigned int id)
+{
+    unsigned long long now = evl_woken(evl);
+    unsigned long long due = ULLONG_MAX;
+    unsigned long long last;
+    conn_cold_t *cc = &cold[id];
 
-    for (cnt=0; cnt < CONN_MAX_SOCK; cnt++)
+    if (cc->paused)
+    {
+        due = cc->resume_at;
+    }
+    if (idle_ns > 0 && cc->rx_at + idle_ns < due)
+    {
+        due = cc->rx_at + idle_ns;
+    }
+    if (keepalive_ns > 0)
     {
-        /* skip closed sockets */
-        if (sock[cnt] < 0)
+        last = (cc->ping_at > cc->rx_at)? cc->ping_at : cc->rx_at;
+        if (last + keepalive_ns < due)
         {
-            continue;
+            due = last + keepalive_ns;
         }
+    }
 
-        ret = send(sock[cnt], buf, strlen(buf), 0);
-        if (ret < 0)
-        {
-            T_M(T_W, 0xc2044100, "cannot send to sock[%d]=%d, %s.\n",
-                cnt, sock[cnt], names[cnt]);
-        }
+    if (due == ULLONG_MAX)
+    {
+        tmr_cancel(evl_tmr(evl), cc->tmr);
+        return;
     }
 
-    return(0);
+    /* ms from now, rounded up not to wake up too early */
+    tmr_arm(evl_tmr(evl), cc->tmr, (due > now)? (unsigned int)((due - now) / 1000000) + 1 : 0);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_timer_cb(tmr_ent_t *ent, void *arg)
+{
+    unsigned int id = CONN_KEY_ID(arg);
+    unsigned long long now = evl_woken(evl);
+    unsigned long long last;
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+
+    /* the timer is cancelled on disconnect, so the connection is alive */
+    if (cc->paused && now >= cc->resume_at)
+    {
+        conn_unpause(id);
+    }
+    if (idle_ns > 0 && now - cc->rx_at >= idle_ns)
+    {
+        T_MR(T_I, 0x02210100, "conns[%u]=%d idle for %llu ms, closing.\n",
+             id, c->fd, (now - cc->rx_at) / 1000000);
+        conn_close_later(id);
+        conn_reap();
+        return;
+    }
+
+    last = (cc->ping_at > cc->rx_at)? cc->ping_at : cc->rx_at;
+    if (keepalive_ns > 0 && now - last >= keepalive_ns && c->state == CONN_ST_OPEN)
+    {
+        T_M(T_D1, 0x42210200, "ping conns[%u]=%d.\n", id, c->fd);
+        cc->ping_at = now;
+        conn_reply(id, COM_PING);
+    }
+
+    /* armed before flushing, which may disconnect and free the timer */
+    conn_timer_arm(id);
+    conn_flush_dirty();
+    conn_reap();
+
+    return;
 }
 
 /*----------------------------------------------------------------------*/
-static int conn_recv_broadcast(int sock_cnt)
+static int conn_recv(unsigned int id)
 {
     int ret;
-    int cnt;
-    char *buffer = NULL;
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
 
-    /* receive message */
-    ret = conn_recv(sock_cnt, buffer);
-    if (ret <= 0)
+    /* continue the partial line */
+    if (cc->ilen > 0)
     {
-        return(ret);
+        memcpy(rbuf, cc->ibuf, cc->ilen);
     }
 
-    /* check if quit */
-    T_M(T_D2, 0x420501f0, "%p.\n", quit_msg[0]);
-    T_M(T_D2, 0x420501f1, "%s.\n", quit_msg[0]);
-    for (cnt = 0; quit_msg[cnt] != NULL; cnt++)
+    ret = recv(c->fd, rbuf + cc->ilen, CONN_RBUF_SIZE, 0);
+    if (ret < 0)
     {
-        T_D(T_D2, 0x42050200, quit_msg[cnt], strlen(quit_msg[cnt])+1);
-        T_D(T_D2, 0x42050210, buffer, CONN_MAX_MSG);
-        ret = strcmp(quit_msg[cnt], buffer);
-        if (ret == 0)
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
         {
-            /* send bye bye  */
-            sprintf(buffer, "Bye!\r\n");
-            (void)send(sock[sock_cnt], buffer, strlen(buffer), 0);
-
-            /* disconnect */
-            conn_disconnect(sock_cnt);
+            /* nothing to read now */
+            T_M(T_D1, 0x42020080, "no data.\n");
             return(0);
         }
+
+        /* other error */
+        T_MR(T_W, 0xc2020100, "cannot recv from conns[%u]=%d: %s.\n",
+            id, c->fd, strerror(errno));
+        conn_close_later(id);
+        return(0);
+    }
+    if (ret == 0)
+    {
+        T_MR(T_W, 0xc2020200, "connection closed by remote host.\n");
+        conn_close_later(id);
+        return(0);
     }
 
-    /* broadcast message */
-    ret = conn_broadcast(names[sock_cnt], buffer);
-    if (ret < 0)
+    cc->rx_at = evl_woken(evl);
+    cc->rx_bytes += ret;
+    metr_add(METR_BYTES_IN, ret);
+    ret += cc->ilen;
+    cc->ilen = 0;
+
+    return(ret);
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_recv_cb(evl_t *evl, int res, void *buf, int more, void *arg)
+{
+    int ret = 0;
+    unsigned int id = CONN_KEY_ID(arg);
+    conn_t *c;
+    conn_cold_t *cc;
+
+    /* skip completions of closed connections */
+    if (id >= conn_num || conns[id].gen != CONN_KEY_GEN(arg) ||
+        conns[id].state != CONN_ST_OPEN)
     {
-        return(ret);
+        return(0);
     }
+    c  = &conns[id];
+    cc = &cold[id];
 
-    return(0);
+    if (res > 0 && cc->paused)
+    {
+        /* the ring keeps receiving, bytes wait behind the held ones */
+        cc->rx_at = evl_woken(evl);
+        cc->rx_bytes += res;
+        metr_add(METR_BYTES_IN, res);
+        (void)conn_hold(id, buf, res);
+    }
+    else if (res > 0)
+    {
+        /* continue the partial line (EVL_RECV_SIZE <= CONN_RBUF_SIZE) */
+        if (cc->ilen > 0)
+        {
+            memcpy(rbuf, cc->ibuf, cc->ilen);
+        }
+        memcpy(rbuf + cc->ilen, buf, res);
+        cc->rx_at = evl_woken(evl);
+        cc->rx_bytes += res;
+        metr_add(METR_BYTES_IN, res);
+        res += cc->ilen;
+        cc->ilen = 0;
+
+        T_M(T_D1, 0x42110100, "process a message from conns[%u]=%d.\n", id, c->fd);
+        ret = conn_input(id, res);
+    }
+    else if (res == 0)
+    {
+        T_MR(T_W, 0xc2110200, "connection closed by remote host.\n");
+    }
+    else
+    {
+        T_MR(T_W, 0xc2110300, "cannot recv from conns[%u]=%d: %s.\n",
+            id, c->fd, strerror(-res));
+    }
+    if (!more)
+    {
+        /* no more bytes come */
+        conn_close_later(id);
+    }
+
+    conn_flush_dirty();
+    conn_reap();
+
+    return(ret);
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_disconnect(unsigned int id)
+{
+    unsigned int idx;
+    unsigned int skip = 0;
+    size_t rlen;
+    const char *room;
+
+    /* recipients wait for the end of our long line */
+    if (cold[id].stream != 0)
+    {
+        conn_long_end(id);
+    }
+
+    if (conns[id].fd >= 0)
+    {
+        if (use_ops)
+        {
+            (void)evl_cancel(evl, conns[id].fd);
+        }
+        else
+        {
+            (void)evl_del(evl, conns[id].fd);
+        }
+        close(conns[id].fd);
+    }
+    memset(names[id], 0, sizeof(names[id]));
+    if (prefix[id].nick != NULL)
+    {
+        nick_release(prefix[id].nick);
+        prefix[id].nick = NULL;
+    }
+    prefix[id].len = 0;
+    if (cold[id].tmr != NULL)
+    {
+        tmr_cancel(evl_tmr(evl), cold[id].tmr);
+        free(cold[id].tmr);
+        cold[id].tmr = NULL;
+    }
+    if (conns[id].sess != 0)
+    {
+        /* keep the session to be resumed */
+        room = room_name(id, &rlen);
+        sess_detach(conns[id].sess, (room != NULL)? room : "", rlen);
+        conns[id].sess = 0;
+    }
+    room_leave(id);
+    if (conns[id].state == CONN_ST_CLOSE)
+    {
+        closing--;
+    }
+    free(cold[id].ibuf);
+    cold[id].ibuf  = NULL;
+    cold[id].ilen  = 0;
+    cold[id].iskip = 0;
+    while (conns[id].dnum > 0)
+    {
+        msg_unref(cold[id].dq[--conns[id].dnum]);
+    }
+    free(cold[id].dq);
+    cold[id].dq     = NULL;
+    cold[id].dcap   = 0;
+    cold[id].dbytes = 0;
+    conns[id].gate   = 0;
+    free(cold[id].hold);
+    cold[id].hold    = NULL;
+    cold[id].hlen    = 0;
+    cold[id].paused  = 0;
+    cold[id].noticed = 0;
+    cold[id].msg_tat  = 0;
+    cold[id].byte_tat = 0;
+    cold[id].resumed  = 0;
+    if (cold[id].sop != NULL)
+    {
+        /* messages in flight are released on the completion */
+        cold[id].sop->orphan = 1;
+        skip = cold[id].sop->num;
+        cold[id].sop = NULL;
+    }
+    metr_add(METR_QUEUED_MSGS, -(long long)conns[id].onum);
+    while (conns[id].onum > 0)
+    {
+        if (skip > 0)
+        {
+            skip--;
+        }
+        else
+        {
+            msg_unref(conns[id].oq[conns[id].ohead]);
+        }
+        conns[id].ohead = (conns[id].ohead + 1) & (conns[id].ocap - 1);
+        conns[id].onum--;
+    }
+    metr_add(METR_CLOSES, 1);
+    metr_add(METR_QUEUED, -(long long)conns[id].obytes);
+    free(conns[id].oq);
+    conn_zc_free(id);
+    conns[id].dirty  = 0;
+    conns[id].oq     = NULL;
+    conns[id].ohead  = 0;
+    conns[id].ocap   = 0;
+    conns[id].ooff   = 0;
+    conns[id].obytes = 0;
+    cold[id].rx_bytes = 0;
+    cold[id].rx_msgs  = 0;
+    cold[id].tx_bytes = 0;
+    cold[id].tx_msgs  = 0;
+    conns[id].gen++;
+
+    /* remove from the live array by moving the last one into the hole */
+    idx = conns[id].link;
+    live_num--;
+    live[idx] = live[live_num];
+    conns[live[idx]].link = idx;
+
+    /* push to the vacant list */
+    conns[id].fd    = -1;
+    conns[id].state = CONN_ST_VACANT;
+    conns[id].link  = vacant;
+    vacant = id;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_close_later(unsigned int id)
+{
+    /* connections are closed in conn_reap() not to break iterations */
+    if (conns[id].state != CONN_ST_CLOSE)
+    {
+        conns[id].state = CONN_ST_CLOSE;
+        closing++;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_reap(void)
+{
+    unsigned int cnt;
+
+    /* iterate backward since disconnect moves the last one into the hole */
+    for (cnt = live_num; cnt > 0 && closing > 0; cnt--)
+    {
+        if (conns[live[cnt-1]].state == CONN_ST_CLOSE)
+        {
+            T_M(T_D1, 0x420a0100, "closing conns[%u]=%d.\n",
+                live[cnt-1], conns[live[cnt-1]].fd);
+            conn_disconnect(live[cnt-1]);
+        }
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_enqueue(unsigned int id, msg_t *msg, unsigned int off)
+{
+    conn_t *c = &conns[id];
+    unsigned int cnt;
+    unsigned int cap;
+    msg_t **oq;
+
+    if ((size_t)c->obytes + (msg->len - off) > CONN_MAX_OUTQ)
+    {
+        T_MR(T_W, 0xc20b0100, "outbound queue of conns[%u]=%d overflowed.\n", id, c->fd);
+        return(0xc20b0100);
+    }
+
+    if (c->onum == c->ocap)
+    {
+        /* grow ring by doubling and unwrap it */
+        cap = (c->ocap > 0)? c->ocap * 2 : CONN_INIT_OUTQ;
+        oq = malloc(sizeof(*oq) * cap);
+        if (oq == NULL)
+        {
+            T_M(T_W, 0xc20b0200, "cannot grow outbound queue to %u.\n", cap);
+            return(0xc20b0200);
+        }
+        for (cnt = 0; cnt < c->onum; cnt++)
+        {
+            oq[cnt] = c->oq[(c->ohead + cnt) & (c->ocap - 1)];
+        }
+        free(c->oq);
+        c->oq    = oq;
+        c->ocap  = cap;
+        c->ohead = 0;
+    }
+
+    if (c->onum == 0)
+    {
+        c->ooff = off;
+    }
+    c->oq[(c->ohead + c->onum) & (c->ocap - 1)] = msg_ref(msg);
+    c->onum++;
+    c->obytes += msg->len - off;
+    metr_add(METR_QUEUED, msg->len - off);
+    metr_add(METR_QUEUED_MSGS, 1);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_send(unsigned int id, msg_t *msg)
+{
+    conn_t *c = &conns[id];
+
+    if (c->state != CONN_ST_OPEN)
+    {
+        return;
+    }
+
+    /* the others wait until the long line being sent to us ends */
+    if ((c->gate != 0 || c->dnum > 0) && msg->sid != c->gate)
+    {
+        conn_defer(id, msg);
+        return;
+    }
+
+    conn_post(id, msg);
+    if (c->gate == 0 && c->dnum > 0)
+    {
+        conn_undefer(id);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_post(unsigned int id, msg_t *msg)
+{
+    conn_t *c = &conns[id];
+
+    if (conn_enqueue(id, msg, 0) < 0)
+    {
+        conn_close_later(id);
+        return;
+    }
+    metr_add(METR_MSGS_OUT, 1);
+
+    /* pieces of a long line are not interleaved with the others */
+    if ((msg->part & (MSG_FIRST | MSG_LAST)) == MSG_FIRST)
+    {
+        c->gate = msg->sid;
+    }
+    else if ((msg->part & MSG_LAST) && c->gate == msg->sid)
+    {
+        c->gate = 0;
+    }
+
+    /* flush at the end of this wakeup to send all messages at once,
+       unless the connection is already waiting for writability */
+    if (c->onum == 1 && !c->dirty)
+    {
+        c->dirty = 1;
+        dirty[dirty_num++] = id;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_defer(unsigned int id, msg_t *msg)
+{
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+    unsigned int cap;
+    msg_t **dq;
+
+    /* counted with the outbound queue not to wait forever */
+    if ((size_t)c->obytes + cc->dbytes + msg->len > CONN_MAX_OUTQ)
+    {
+        T_MR(T_W, 0xc2290100, "outbound queue of conns[%u]=%d overflowed.\n", id, c->fd);
+        conn_close_later(id);
+        return;
+    }
+
+    if (c->dnum == cc->dcap)
+    {
+        cap = (cc->dcap > 0)? cc->dcap * 2 : CONN_INIT_OUTQ;
+        dq = realloc(cc->dq, sizeof(*dq) * cap);
+        if (dq == NULL)
+        {
+            T_M(T_W, 0xc2290200, "cannot grow deferred queue to %u.\n", cap);
+            conn_close_later(id);
+            return;
+        }
+        cc->dq   = dq;
+        cc->dcap = cap;
+    }
+    cc->dq[c->dnum++] = msg_ref(msg);
+    cc->dbytes += msg->len;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_undefer(unsigned int id)
+{
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+    unsigned int cnt = 0;
+    unsigned long long gate;
+    msg_t *msg;
+
+    /* in order, but only pieces of a long line once it starts */
+    while (cnt < c->dnum && c->state == CONN_ST_OPEN)
+    {
+        msg = cc->dq[cnt];
+        if (c->gate != 0 && msg->sid != c->gate)
+        {
+            cnt++;
+            continue;
+        }
+
+        c->dnum--;
+        memmove(&cc->dq[cnt], &cc->dq[cnt+1], sizeof(*cc->dq) * (c->dnum - cnt));
+        cc->dbytes -= msg->len;
+        gate = c->gate;
+        conn_post(id, msg);
+        msg_unref(msg);
+
+        /* the long line ended, the skipped ones go next */
+        if (gate != 0 && c->gate == 0)
+        {
+            cnt = 0;
+        }
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned int conn_gather(unsigned int id, struct iovec *iov, size_t *total)
+{
+    conn_t *c = &conns[id];
+    msg_t *msg;
+    unsigned int cnt;
+    unsigned int num;
+
+    num    = (c->onum < CONN_MAX_IOV)? c->onum : CONN_MAX_IOV;
+    *total = 0;
+    for (cnt = 0; cnt < num; cnt++)
+    {
+        msg = c->oq[(c->ohead + cnt) & (c->ocap - 1)];
+        iov[cnt].iov_base = msg->data + ((cnt == 0)? c->ooff : 0);
+        iov[cnt].iov_len  = msg->len  - ((cnt == 0)? c->ooff : 0);
+        *total += iov[cnt].iov_len;
+    }
+
+    return(num);
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_sent(unsigned int id, size_t len)
+{
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+    msg_t *msg;
+
+    /* release sent messages */
+    c->obytes -= len;
+    cc->tx_bytes += len;
+    metr_add(METR_BYTES_OUT, len);
+    metr_add(METR_QUEUED, -(long long)len);
+    while (len > 0)
+    {
+        msg = c->oq[c->ohead];
+        if (len < msg->len - c->ooff)
+        {
+            c->ooff += len;
+            break;
+        }
+        len -= msg->len - c->ooff;
+        msg_unref(msg);
+        c->ohead = (c->ohead + 1) & (c->ocap - 1);
+        c->onum--;
+        c->ooff = 0;
+        cc->tx_msgs++;
+        metr_add(METR_QUEUED_MSGS, -1);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_flush(unsigned int id)
+{
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+    ssize_t ret;
+    size_t total;
+    unsigned int num;
+    int flags;
+    struct iovec iov[CONN_MAX_IOV];
+    struct msghdr mh;
+
+    if (use_ops)
+    {
+        conn_flush_op(id);
+        return;
+    }
+
+    while (c->onum > 0)
+    {
+        /* gather queued messages */
+        num = conn_gather(id, iov, &total);
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov    = iov;
+        mh.msg_iovlen = num;
+
+        flags = MSG_NOSIGNAL;
+        if (cc->zc != NULL && total >= CONN_ZC_MIN)
+        {
+            flags |= MSG_ZEROCOPY;
+        }
+
+        ret = sendmsg(c->fd, &mh, flags);
+        if (ret < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+        {
+            /* out of pinned memory, copy instead */
+            flags &= ~MSG_ZEROCOPY;
+            ret = sendmsg(c->fd, &mh, flags);
+        }
+        if (ret < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                /* wait for next writability */
+                break;
+            }
+            T_MR(T_W, 0xc20d0100, "cannot send to conns[%u]=%d, %s: %s.\n",
+                id, c->fd, names[id], strerror(errno));
+            conn_close_later(id);
+            return;
+        }
+        if (flags & MSG_ZEROCOPY)
+        {
+            /* keep messages until the kernel completes sending them */
+            conn_zc_pin(id, num, (size_t)ret);
+        }
+
+        conn_sent(id, (size_t)ret);
+        if ((size_t)ret < total)
+        {
+            /* socket buffer is full */
+            break;
+        }
+    }
+
+    if (c->onum == 0 && c->state == CONN_ST_LINGER)
+    {
+        conn_close_later(id);
+        return;
+    }
+
+    /* watch writability only while messages are queued */
+    (void)evl_mod(evl, c->fd, ((c->state == CONN_ST_OPEN && !cc->paused)? EVL_IN : 0) |
+                  ((c->onum > 0)? EVL_OUT : 0));
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_flush_op(unsigned int id)
+{
+    int ret;
+    size_t total;
+    unsigned int cnt;
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+    conn_sop_t *sop;
+
+    /* one sendmsg at a time keeps the order, the completion sends the rest */
+    if (cc->sop != NULL)
+    {
+        return;
+    }
+    if (c->onum == 0)
+    {
+        if (c->state == CONN_ST_LINGER)
+        {
+            conn_close_later(id);
+        }
+        return;
+    }
+
+    sop = sop_free;
+    if (sop != NULL)
+    {
+        sop_free = sop->next;
+    }
+    else
+    {
+        sop = malloc(sizeof(*sop));
+        if (sop == NULL)
+        {
+            T_M(T_W, 0xc2120100, "cannot allocate send request.\n");
+            conn_close_later(id);
+            return;
+        }
+    }
+
+    /* messages stay in the outbound queue until the completion */
+    sop->id     = id;
+    sop->orphan = 0;
+    sop->num    = conn_gather(id, sop->iov, &total);
+    for (cnt = 0; cnt < sop->num; cnt++)
+    {
+        sop->msg[cnt] = c->oq[(c->ohead + cnt) & (c->ocap - 1)];
+    }
+    memset(&sop->mh, 0, sizeof(sop->mh));
+    sop->mh.msg_iov    = sop->iov;
+    sop->mh.msg_iovlen = sop->num;
+
+    ret = evl_sendmsg(evl, c->fd, &sop->mh, conn_sent_cb, sop);
+    if (ret < 0)
+    {
+        sop->next = sop_free;
+        sop_free  = sop;
+        conn_close_later(id);
+        return;
+    }
+    cc->sop = sop;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_sent_cb(evl_t *evl, int res, void *buf, int more, void *arg)
+{
+    conn_sop_t *sop = arg;
+    unsigned int id = sop->id;
+    unsigned int cnt;
+
+    if (sop->orphan)
+    {
+        /* the connection has gone, release the messages it left */
+        for (cnt = 0; cnt < sop->num; cnt++)
+        {
+            msg_unref(sop->msg[cnt]);
+        }
+        free(sop);
+        return(0);
+    }
+    cold[id].sop = NULL;
+    sop->next = sop_free;
+    sop_free  = sop;
+
+    if (res < 0)
+    {
+        T_MR(T_W, 0xc2130100, "cannot send to conns[%u]=%d, %s: %s.\n",
+            id, conns[id].fd, names[id], strerror(-res));
+        conn_close_later(id);
+    }
+    else
+    {
+        conn_sent(id, (size_t)res);
+        if (conns[id].state == CONN_ST_OPEN || conns[id].state == CONN_ST_LINGER)
+        {
+            conn_flush_op(id);
+        }
+    }
+
+    conn_flush_dirty();
+    conn_reap();
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_flush_dirty(void)
+{
+    unsigned int cnt;
+    unsigned int id;
+
+    for (cnt = 0; cnt < dirty_num; cnt++)
+    {
+        id = dirty[cnt];
+        conns[id].dirty = 0;
+        if (conns[id].state == CONN_ST_OPEN || conns[id].state == CONN_ST_LINGER)
+        {
+            conn_flush(id);
+        }
+    }
+    dirty_num = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_zc_pin(unsigned int id, unsigned int n, size_t sent)
+{
+    conn_zc_t *zc = cold[id].zc;
+    unsigned int cnt;
+    unsigned int idx;
+    unsigned int cap;
+    msg_t *msg;
+    size_t len;
+    conn_zc_rec_t *rec;
+
+    for (cnt = 0; cnt < n && sent > 0; cnt++)
+    {
+        msg = conns[id].oq[(conns[id].ohead + cnt) & (conns[id].ocap - 1)];
+        len = msg->len - ((cnt == 0)? conns[id].ooff : 0);
+        sent = (sent > len)? sent - len : 0;
+
+        if (zc->num == zc->cap)
+        {
+            /* grow ring by doubling and unwrap it */
+            cap = (zc->cap > 0)? zc->cap * 2 : CONN_INIT_OUTQ;
+            rec = malloc(sizeof(*zc->rec) * cap);
+            if (rec == NULL)
+            {
+                /* cannot keep it, the peer may see a modified buffer */
+                T_M(T_W, 0xc20f0100, "cannot pin zerocopy message.\n");
+                continue;
+            }
+            for (idx = 0; idx < zc->num; idx++)
+            {
+                rec[idx] = zc->rec[(zc->head + idx) & (zc->cap - 1)];
+            }
+            free(zc->rec);
+            zc->rec  = rec;
+            zc->cap  = cap;
+            zc->head = 0;
+        }
+        idx = (zc->head + zc->num) & (zc->cap - 1);
+        zc->rec[idx].id  = zc->seq;
+        zc->rec[idx].msg = msg_ref(msg);
+        zc->num++;
+    }
+
+    /* each successful zerocopy send has its own ID */
+    zc->seq++;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_zc_complete(unsigned int id)
+{
+    conn_zc_t *zc = cold[id].zc;
+    struct msghdr mh;
+    struct cmsghdr *cm;
+    struct sock_extended_err *ee;
+    char ctrl[CMSG_SPACE(sizeof(*ee) + sizeof(struct sockaddr_in6))];
+
+    for (;;)
+    {
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_control    = ctrl;
+        mh.msg_controllen = sizeof(ctrl);
+        if (recvmsg(conns[id].fd, &mh, MSG_ERRQUEUE) < 0)
+        {
+            /* no more notifications */
+            break;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm))
+        {
+            if (!((cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+            ee = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            /* sends ee_info..ee_data completed, release their messages */
+            while (zc->num > 0 && (int)(ee->ee_data - zc->rec[zc->head].id) >= 0)
+            {
+                msg_unref(zc->rec[zc->head].msg);
+                zc->head = (zc->head + 1) & (zc->cap - 1);
+                zc->num--;
+            }
+        }
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_zc_free(unsigned int id)
+{
+    conn_zc_t *zc = cold[id].zc;
+
+    if (zc == NULL)
+    {
+        return;
+    }
+
+    while (zc->num > 0)
+    {
+        msg_unref(zc->rec[zc->head].msg);
+        zc->head = (zc->head + 1) & (zc->cap - 1);
+        zc->num--;
+    }
+    free(zc->rec);
+    free(zc);
+    cold[id].zc = NULL;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_fanout(msg_t *msg)
+{
+    unsigned int cnt;
+    unsigned int num;
+    const unsigned int *mem;
+    msg_t *alt = NULL;
+
+    if (msg->sid != 0)
+    {
+        conn_fanout_piece(msg);
+        return;
+    }
+    if (msg->seq != 0)
+    {
+        hist_put(msg);
+    }
+
+    /* only members of the room on this worker */
+    mem = room_members(msg_room(msg), msg->rlen, &num);
+    for (cnt=0; cnt < num; cnt++)
+    {
+        if (conns[mem[cnt]].sess == 0)
+        {
+            conn_send(mem[cnt], msg);
+            continue;
+        }
+
+        /* seen on another worker ahead of this one before resuming */
+        if (msg->seq <= cold[mem[cnt]].resumed)
+        {
+            continue;
+        }
+
+        /* clients with sessions get stamped one to know where to resume */
+        if (alt == NULL && msg->seq != 0)
+        {
+            alt = msg_stamp(msg);
+        }
+        conn_send(mem[cnt], (alt != NULL)? alt : msg);
+    }
+    if (alt != NULL)
+    {
+        msg_unref(alt);
+    }
+
+    /* the last worker measures the latency */
+    if (msg->ingress != 0 &&
+        atomic_fetch_sub_explicit(&msg->pending, 1, memory_order_acq_rel) == 1)
+    {
+        metr_hist(METR_FANOUT, evl_now() - msg->ingress);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_fanout_piece(msg_t *msg)
+{
+    unsigned int cnt;
+    unsigned int num;
+    unsigned int id;
+    unsigned int idx;
+    const unsigned int *mem;
+    conn_stream_t *st;
+
+    /* the first piece goes to the room, the others follow it */
+    if (msg->part & MSG_FIRST)
+    {
+        mem = room_members(msg_room(msg), msg->rlen, &num);
+        if (num == 0 || (msg->part & MSG_LAST))
+        {
+            for (cnt = 0; cnt < num; cnt++)
+            {
+                conn_send(mem[cnt], msg);
+            }
+            return;
+        }
+
+        if (stream_num == stream_cap)
+        {
+            st = realloc(streams, sizeof(*streams) * ((stream_cap > 0)? stream_cap * 2 : 4));
+            if (st == NULL)
+            {
+                T_M(T_W, 0xc22d0100, "cannot relay a long line.\n");
+                return;
+            }
+            streams = st;
+            stream_cap = (stream_cap > 0)? stream_cap * 2 : 4;
+        }
+        st = &streams[stream_num];
+        st->key = malloc(sizeof(*st->key) * num);
+        if (st->key == NULL)
+        {
+            T_M(T_W, 0xc22d0200, "cannot relay a long line.\n");
+            return;
+        }
+        st->sid = msg->sid;
+        st->num = num;
+        for (cnt = 0; cnt < num; cnt++)
+        {
+            st->key[cnt] = (unsigned long long)conns[mem[cnt]].gen << 24 | mem[cnt];
+        }
+        stream_num++;
+
+        for (cnt = 0; cnt < num; cnt++)
+        {
+            conn_send(mem[cnt], msg);
+        }
+        return;
+    }
+
+    /* a few long lines at once, found by a linear search */
+    for (idx = 0; idx < stream_num && streams[idx].sid != msg->sid; idx++)
+    {
+        ;
+    }
+    if (idx == stream_num)
+    {
+        return;
+    }
+    st = &streams[idx];
+    for (cnt = 0; cnt < st->num; cnt++)
+    {
+        id = st->key[cnt] & 0xffffff;
+        if (id < conn_num && conns[id].gen == (unsigned int)(st->key[cnt] >> 24))
+        {
+            conn_send(id, msg);
+        }
+    }
+
+    if (msg->part & MSG_LAST)
+    {
+        free(st->key);
+        streams[idx] = streams[--stream_num];
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_broadcast(unsigned int id, const char *line, size_t len)
+{
+    msg_t *msg;
+    size_t rlen;
+    const char *room;
+
+    room = room_name(id, &rlen);
+    if (room == NULL)
+    {
+        return(0);
+    }
+
+    /* generate send message once for all recipients */
+    msg = msg_chat(room, rlen, prefix[id].data, prefix[id].len, line, len);
+    if (msg == NULL)
+    {
+        return(0);
+    }
+
+    /* the bytes arrived when the event loop woke up */
+    msg->ingress = evl_woken(evl);
+    atomic_init(&msg->pending, wrk_num());
+    T_M(T_D1, 0x42040200, "send message: %.*s\n", (int)msg->len, msg->data);
+
+    /* stamp, send to connections of this worker and pass to the others */
+    if (wrk_publish(msg) >= 0)
+    {
+        clog_put(msg);
+    }
+
+    msg_unref(msg);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_input(unsigned int id, int len)
+{
+    int ret;
+    int pos;
+    int end;
+    size_t line_len;
+    unsigned long long now;
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+
+    /* process all complete lines in rbuf */
+    for (pos = 0; pos < len && c->state == CONN_ST_OPEN; pos += line_len)
+    {
+        line_len = line_next(rbuf + pos, len - pos);
+        if (line_len == 0)
+        {
+            break;
+        }
+
+        if (cc->stream != 0)
+        {
+            /* the end of the long line being relayed */
+            conn_long(id, rbuf + pos, line_len, 1);
+            continue;
+        }
+        if (!cc->iskip && line_len > CONN_MAX_MSG-1 && max_msg > CONN_MAX_MSG-1)
+        {
+            ret = conn_long_start(id, line_len);
+            if (ret > 0)
+            {
+                return(conn_hold(id, rbuf + pos, len - pos));
+            }
+            if (!cc->iskip)
+            {
+                conn_long(id, rbuf + pos, line_len, 1);
+            }
+            cc->iskip = 0;
+            continue;
+        }
+        if (cc->iskip || line_len > CONN_MAX_MSG-1)
+        {
+            T_MR(T_W, 0xc2050100, "discard too long line from conns[%u]=%d.\n", id, c->fd);
+            cc->iskip = 0;
+            continue;
+        }
+
+        ret = conn_line(id, rbuf + pos, line_len);
+        if (ret < 0)
+        {
+            return(ret);
+        }
+        if (ret > 0)
+        {
+            /* paused by the rate limit, the line is tried again later */
+            return(conn_hold(id, rbuf + pos, len - pos));
+        }
+    }
+    if (c->state != CONN_ST_OPEN || pos >= len)
+    {
+        return(0);
+    }
+
+    /* relay the partial long line, keep CR which may start CRLF */
+    if (cc->stream != 0 ||
+        (!cc->iskip && len - pos > CONN_MAX_MSG-1 && max_msg > CONN_MAX_MSG-1))
+    {
+        end = (rbuf[len-1] == '\r')? len-1 : len;
+        ret = (cc->stream != 0)? 0 : conn_long_start(id, end - pos);
+        if (ret > 0)
+        {
+            return(conn_hold(id, rbuf + pos, len - pos));
+        }
+        if (!cc->iskip && end > pos)
+        {
+            conn_long(id, rbuf + pos, end - pos, 0);
+        }
+        pos = end;
+
+        /* slow down the client sending faster than the byte rate, the ring
+           keeps receiving while paused so the debt waits for the next line */
+        now = evl_woken(evl);
+        if (cc->stream != 0 && byte_ns > 0 && !rate_drop && !use_ops &&
+            cc->byte_tat > now + byte_tol)
+        {
+            conn_pause(id, cc->byte_tat - now - byte_tol);
+            return(conn_hold(id, rbuf + pos, len - pos));
+        }
+        if (pos == len || c->state != CONN_ST_OPEN)
+        {
+            return(0);
+        }
+    }
+
+    /* keep the partial line for the next receive */
+    if (len - pos > CONN_MAX_MSG-1)
+    {
+        /* discard until the next CRLF, keep CR which may start CRLF */
+        cc->iskip = 1;
+        pos = (rbuf[len-1] == '\r')? len-1 : len;
+        if (pos == len)
+        {
+            return(0);
+        }
+    }
+    if (cc->ibuf == NULL)
+    {
+        cc->ibuf = malloc(CONN_MAX_MSG);
+        if (cc->ibuf == NULL)
+        {
+            T_M(T_W, 0xc2050200, "cannot allocate input buffer.\n");
+            conn_close_later(id);
+            return(0);
+        }
+    }
+    cc->ilen = len - pos;
+    memcpy(cc->ibuf, rbuf + pos, cc->ilen);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_line(unsigned int id, const char *line, size_t len)
+{
+    int ret;
+    unsigned long long wait;
+
+    /* rate limit before anything is done for the line */
+    if (msg_ns > 0 || byte_ns > 0)
+    {
+        wait = conn_rate(id, len);
+        if (wait > 0 && !rate_drop)
+        {
+            conn_pause(id, wait);
+            return(1);
+        }
+        if (wait > 0)
+        {
+            metr_add(METR_RATE_DROPS, 1);
+            if (!cold[id].noticed)
+            {
+                cold[id].noticed = 1;
+                conn_reply(id, "Too many messages, dropped.\r\n");
+            }
+            return(0);
+        }
+        cold[id].noticed = 0;
+    }
+
+    cold[id].rx_msgs++;
+    metr_add(METR_MSGS_IN, 1);
+
+    /* answer to keepalive ping */
+    if (len == sizeof(COM_PONG)-1 && memcmp(line, COM_PONG, len) == 0)
+    {
+        return(0);
+    }
+
+    /* commands, the first byte tells most chat messages apart */
+    T_D(T_D2, 0x420e0210, line, len);
+    if (cmd_maybe(line) && conn_command(id, line, len))
+    {
+        return(0);
+    }
+
+    /* broadcast message to the room */
+    ret = conn_broadcast(id, line, len);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_long_start(unsigned int id, size_t len)
+{
+    unsigned long long wait;
+
+    /* a long line is charged like the others when it starts */
+    if (msg_ns > 0 || byte_ns > 0)
+    {
+        wait = conn_rate(id, len);
+        if (wait > 0 && !rate_drop)
+        {
+            conn_pause(id, wait);
+            return(1);
+        }
+        if (wait > 0)
+        {
+            metr_add(METR_RATE_DROPS, 1);
+            if (!cold[id].noticed)
+            {
+                cold[id].noticed = 1;
+                conn_reply(id, "Too many messages, dropped.\r\n");
+            }
+            cold[id].iskip = 1;
+            return(0);
+        }
+        cold[id].noticed = 0;
+    }
+
+    cold[id].rx_msgs++;
+    metr_add(METR_MSGS_IN, 1);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_long(unsigned int id, const char *buf, size_t len, int last)
+{
+    size_t n;
+    size_t pos;
+    size_t rlen;
+    const char *room;
+    unsigned long long now;
+    msg_t *msg;
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+
+    /* the rest of the line is charged as debt, paid before the next line */
+    if (cc->stream != 0 && byte_ns > 0)
+    {
+        now = evl_woken(evl);
+        cc->byte_tat = ((cc->byte_tat > now)? cc->byte_tat : now) + byte_ns * len;
+    }
+
+    if (cc->slen + len > max_msg)
+    {
+        T_MR(T_W, 0xc22b0100, "discard too long line from conns[%u]=%d.\n", id, c->fd);
+        if (cc->stream != 0)
+        {
+            conn_long_end(id);
+        }
+        cc->iskip = !last;
+        return;
+    }
+
+    pos = 0;
+    if (cc->stream == 0)
+    {
+        /* commands are short, and long lines are not kept in history */
+        room = room_name(id, &rlen);
+        if (room == NULL || buf[0] == '/')
+        {
+            cc->iskip = !last;
+            return;
+        }
+
+        n   = (len < MSG_CHUNK)? len : MSG_CHUNK;
+        msg = msg_chat(room, rlen, prefix[id].data, prefix[id].len, buf, n);
+        if (msg == NULL)
+        {
+            cc->iskip = !last;
+            return;
+        }
+        msg->sid  = ((unsigned long long)(wrk_self() + 1) << 48) | ++stream_seq;
+        msg->part = MSG_FIRST | ((last && n == len)? MSG_LAST : 0);
+        T_M(T_D1, 0x422b0200, "relay long line %llx from conns[%u]=%d.\n", msg->sid, id, c->fd);
+        cc->stream = msg->sid;
+        conn_relay(msg);
+        pos = n;
+    }
+    cc->slen += len;
+
+    /* the other pieces follow in chunks */
+    for ( ; pos < len; pos += n)
+    {
+        n   = (len - pos < MSG_CHUNK)? len - pos : MSG_CHUNK;
+        msg = msg_piece(cc->stream, (last && pos + n == len)? MSG_LAST : 0, buf + pos, n);
+        if (msg == NULL)
+        {
+            /* receivers wait for the last piece, give up the client */
+            conn_close_later(id);
+            return;
+        }
+        conn_relay(msg);
+    }
+
+    if (last)
+    {
+        cc->stream = 0;
+        cc->slen   = 0;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_long_end(unsigned int id)
+{
+    msg_t *msg;
+    conn_cold_t *cc = &cold[id];
+
+    /* cut the line short so that receivers go on */
+    msg = msg_piece(cc->stream, MSG_LAST, "\r\n", 2);
+    if (msg == NULL)
+    {
+        T_M(T_W, 0xc22c0100, "cannot end long line %llx.\n", cc->stream);
+    }
+    else
+    {
+        conn_relay(msg);
+    }
+    cc->stream = 0;
+    cc->slen   = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_relay(msg_t *msg)
+{
+    /* send to connections of this worker */
+    conn_fanout(msg);
+
+    /* pass to the other workers */
+    if (wrk_num() > 1)
+    {
+        (void)wrk_broadcast(msg);
+    }
+
+    msg_unref(msg);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned long long conn_rate(unsigned int id, size_t len)
+{
+    unsigned long long now = evl_woken(evl);
+    unsigned long long msg_tat = 0;
+    unsigned long long byte_tat = 0;
+    unsigned long long wait = 0;
+    conn_cold_t *cc = &cold[id];
+
+    /* a bucket is full when tat <= now, tat - now is the debt (GCRA) */
+    if (msg_ns > 0)
+    {
+        msg_tat = ((cc->msg_tat > now)? cc->msg_tat : now) + msg_ns;
+        if (msg_tat - now > msg_tol)
+        {
+            wait = msg_tat - now - msg_tol;
+        }
+    }
+    if (byte_ns > 0)
+    {
+        byte_tat = ((cc->byte_tat > now)? cc->byte_tat : now) + byte_ns * len;
+        if (byte_tat - now > byte_tol && byte_tat - now - byte_tol > wait)
+        {
+            wait = byte_tat - now - byte_tol;
+        }
+    }
+
+    /* charged only when the line goes */
+    if (wait == 0)
+    {
+        cc->msg_tat  = msg_tat;
+        cc->byte_tat = byte_tat;
+    }
+
+    return(wait);
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_pause(unsigned int id, unsigned long long wait)
+{
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+
+    T_M(T_D1, 0x42220100, "pause conns[%u]=%d for %llu us.\n", id, c->fd, wait / 1000);
+    metr_add(METR_RATE_PAUSES, 1);
+    cc->paused    = 1;
+    cc->resume_at = evl_woken(evl) + wait;
+    if (!use_ops)
+    {
+        /* unread bytes stay in the socket and the client is slowed down */
+        (void)evl_mod(evl, c->fd, (c->onum > 0)? EVL_OUT : 0);
+    }
+    conn_timer_arm(id);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_hold(unsigned int id, const char *buf, size_t len)
+{
+    char *hold;
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+
+    if (cc->hlen + len > CONN_MAX_HOLD)
+    {
+        T_MR(T_W, 0xc2230200, "conns[%u]=%d sent too much while paused.\n", id, c->fd);
+        conn_close_later(id);
+        return(0);
+    }
+
+    /* only the bytes held, many clients may be paused at once */
+    hold = realloc(cc->hold, cc->hlen + len);
+    if (hold == NULL)
+    {
+        T_M(T_W, 0xc2230100, "cannot allocate hold buffer.\n");
+        conn_close_later(id);
+        return(0);
+    }
+    cc->hold = hold;
+    memcpy(cc->hold + cc->hlen, buf, len);
+    cc->hlen += len;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_unpause(unsigned int id)
+{
+    unsigned int len;
+    conn_t *c = &conns[id];
+    conn_cold_t *cc = &cold[id];
+
+    T_M(T_D1, 0x42240100, "resume conns[%u]=%d.\n", id, c->fd);
+    cc->paused = 0;
+    len = cc->hlen;
+    cc->hlen = 0;
+    memcpy(rbuf, cc->hold, len);
+    free(cc->hold);
+    cc->hold = NULL;
+    if (c->state == CONN_ST_OPEN && conn_input(id, len) < 0)
+    {
+        conn_close_later(id);
+        return;
+    }
+    if (!cc->paused && !use_ops && c->state == CONN_ST_OPEN)
+    {
+        (void)evl_mod(evl, c->fd, EVL_IN | ((c->onum > 0)? EVL_OUT : 0));
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_command(unsigned int id, const char *line, size_t len)
+{
+    size_t alen;
+    const char *arg;
+
+    /* line ends with CRLF */
+    switch (cmd_lookup(line, len - 2, &arg, &alen))
+    {
+    case CMD_QUIT:
+        conn_quit(id);
+        break;
+    case CMD_JOIN:
+        conn_join(id, arg, alen);
+        break;
+    case CMD_PART:
+        conn_part(id);
+        break;
+    case CMD_SESSION:
+        conn_session(id);
+        break;
+    case CMD_RESUME:
+        conn_resume(id, arg, alen);
+        break;
+    case CMD_WHO:
+        conn_who(id);
+        break;
+    case CMD_NICK:
+        conn_nick(id, arg, alen);
+        break;
+    case CMD_MSG:
+        conn_msg(id, arg, alen);
+        break;
+    default:
+        /* not a command, just a chat message */
+        return(0);
+    }
+
+    return(1);
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_quit(unsigned int id)
+{
+    /* send bye bye and disconnect after sent */
+    conn_reply(id, "Bye!\r\n");
+    if (conns[id].state == CONN_ST_OPEN)
+    {
+        /* stop reading, closed after flushed */
+        conns[id].state = CONN_ST_LINGER;
+        if (conns[id].onum == 0)
+        {
+            conn_close_later(id);
+        }
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_join(unsigned int id, const char *arg, size_t len)
+{
+    size_t cnt;
+    char text[ROOM_MAX_NAME + 32];
+
+    /* room names are printable without spaces */
+    for (cnt = 0; cnt < len; cnt++)
+    {
+        if (arg[cnt] <= ' ' || arg[cnt] > '~')
+        {
+            break;
+        }
+    }
+    if (cnt < len || len >= ROOM_MAX_NAME)
+    {
+        conn_reply(id, "Invalid room name.\r\n");
+        return;
+    }
+
+    if (room_join(id, arg, len) < 0)
+    {
+        conn_reply(id, "Cannot join the room.\r\n");
+        return;
+    }
+    T_M(T_D1, 0x42250100, "conns[%u]=%d joined %.*s.\n", id, conns[id].fd, (int)len, arg);
+    snprintf(text, sizeof(text), "Joined room %.*s.\r\n", (int)len, arg);
+    conn_reply(id, text);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_part(unsigned int id)
+{
+    size_t rlen;
+    const char *room;
+    char text[ROOM_MAX_NAME + 32];
+
+    room = room_name(id, &rlen);
+    if (room == NULL || rlen == 0)
+    {
+        conn_reply(id, "Not in a room.\r\n");
+        return;
+    }
+    snprintf(text, sizeof(text), "Left room %s.\r\n", room);
+    if (room_part(id) < 0)
+    {
+        conn_reply(id, "Cannot leave the room.\r\n");
+        return;
+    }
+    conn_reply(id, text);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_session(unsigned int id)
+{
+    char text[64];
+
+    if (conns[id].sess == 0 && sess_create(&conns[id].sess) < 0)
+    {
+        conns[id].sess = 0;
+        conn_reply(id, "Cannot create a session.\r\n");
+        return;
+    }
+    snprintf(text, sizeof(text), "Session %016llx %llu\r\n", conns[id].sess, hist_last());
+    conn_reply(id, text);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_resume(unsigned int id, const char *arg, size_t len)
+{
+    int lost;
+    unsigned int num;
+    unsigned long long token;
+    unsigned long long seq;
+    char *end;
+    char buf[64];
+    char room[ROOM_MAX_NAME];
+    msg_t *msg;
+
+    /* "<token> <last seq>" */
+    if (len >= sizeof(buf))
+    {
+        conn_reply(id, "Invalid session.\r\n");
+        return;
+    }
+    memcpy(buf, arg, len);
+    buf[len] = '\0';
+    token = strtoull(buf, &end, 16);
+    if (*end != ' ')
+    {
+        conn_reply(id, "Invalid session.\r\n");
+        return;
+    }
+    seq = strtoull(end + 1, &end, 10);
+    if (*end != '\0')
+    {
+        conn_reply(id, "Invalid session.\r\n");
+        return;
+    }
+
+    if (conns[id].sess != 0)
+    {
+        conn_reply(id, "Already in a session.\r\n");
+        return;
+    }
+    if (token == 0 || sess_attach(token, room, sizeof(room)) < 0)
+    {
+        conn_reply(id, "No such session.\r\n");
+        return;
+    }
+    conns[id].sess = token;
+    cold[id].resumed = seq;
+    (void)room_join(id, room, strlen(room));
+    T_M(T_D1, 0x42170100, "conns[%u]=%d resumed %016llx after #%llu.\n",
+        id, conns[id].fd, token, seq);
+
+    /* missed messages follow the reply in one write */
+    msg = hist_replay(room, strlen(room), seq, &num, &lost);
+    snprintf(buf, sizeof(buf), "Resumed %u%s\r\n", num, lost? " lost" : "");
+    conn_reply(id, buf);
+    if (msg != NULL)
+    {
+        conn_send(id, msg);
+        msg_unref(msg);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_who(unsigned int id)
+{
+    int n;
+    int cnt;
+    unsigned int num = 0;
+    unsigned int listed = 0;
+    unsigned int take;
+    unsigned int sep;
+    size_t rlen;
+    size_t pos;
+    size_t cap;
+    size_t end;
+    size_t skip;
+    const char *room;
+    conn_who_t *who;
+    conn_who_part_t *part;
+    msg_t *msg;
+
+    room = room_name(id, &rlen);
+    if (room == NULL)
+    {
+        conn_reply(id, "Not in a room.\r\n");
+        return;
+    }
+
+    /* members on the other workers as well */
+    who = calloc(1, sizeof(*who));
+    if (who == NULL)
+    {
+        return;
+    }
+    memcpy(who->room, room, rlen);
+    who->rlen = rlen;
+    atomic_init(&who->left, wrk_num());
+    for (cnt = 0; cnt < wrk_num(); cnt++)
+    {
+        if (cnt != wrk_self() && wrk_call(cnt, conn_who_cb, who) < 0)
+        {
+            atomic_fetch_sub(&who->left, 1);
+        }
+    }
+    conn_who_cb(who);
+    while (atomic_load(&who->left) > 0)
+    {
+        if (wrk_poll() < 0)
+        {
+            /* stopping, a worker may still answer */
+            return;
+        }
+    }
+
+    /* "Members of <room> (<num>): <name>, ... and <n> more.\r\n" */
+    cap = ROOM_MAX_NAME + 64 + (size_t)CONN_MAX_WHO * (CONN_MAX_NAME + 2);
+    msg = msg_new(NULL, cap);
+    for (cnt = 0; cnt < wrk_num(); cnt++)
+    {
+        num += who->part[cnt].num;
+    }
+    if (msg != NULL)
+    {
+        n = snprintf(msg->data, cap, "Members of %s (%u):", (rlen > 0)? room : "lobby", num);
+        pos = (size_t)n;
+        for (cnt = 0; cnt < wrk_num() && listed < CONN_MAX_WHO; cnt++)
+        {
+            /* up to the ", " of the first name not listed */
+            part = &who->part[cnt];
+            take = CONN_MAX_WHO - listed;
+            for (end = 0, sep = 0; end < part->len; end++)
+            {
+                if (part->text[end] == ',' && sep++ == take)
+                {
+                    break;
+                }
+            }
+            skip = (listed == 0 && end > 0)? 1 : 0;
+            memcpy(msg->data + pos, part->text + skip, end - skip);
+            pos    += end - skip;
+            listed += (sep > take)? take : sep;
+        }
+        if (num > listed)
+        {
+            n = snprintf(msg->data + pos, cap - pos, " and %u more", num - listed);
+            pos += (size_t)n;
+        }
+        n = snprintf(msg->data + pos, cap - pos, ".\r\n");
+        msg->len = (unsigned int)(pos + n);
+        conn_send(id, msg);
+        msg_unref(msg);
+    }
+
+    for (cnt = 0; cnt < wrk_num(); cnt++)
+    {
+        free(who->part[cnt].text);
+    }
+    free(who);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_who_cb(void *arg)
+{
+    int n;
+    unsigned int cnt;
+    unsigned int num;
+    size_t cap;
+    const unsigned int *member;
+    conn_who_t *who = arg;
+    conn_who_part_t *part = &who->part[wrk_self()];
+
+    member = room_members(who->room, who->rlen, &num);
+    part->num = num;
+
+    /* up to the names listed in total */
+    cap = (size_t)((num < CONN_MAX_WHO)? num : CONN_MAX_WHO) * (CONN_MAX_NAME + 2) + 1;
+    part->text = malloc(cap);
+    for (cnt = 0; part->text != NULL && cnt < num && cnt < CONN_MAX_WHO; cnt++)
+    {
+        n = snprintf(part->text + part->len, cap - part->len, ", %.*s",
+                     (int)prefix[member[cnt]].len - 3, prefix[member[cnt]].data + 1);
+        part->len += (size_t)n;
+        part->listed++;
+    }
+
+    /* the asking worker reads the answer after this */
+    atomic_fetch_sub_explicit(&who->left, 1, memory_order_release);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_nick(unsigned int id, const char *arg, size_t len)
+{
+    int ret;
+    const char *nick;
+    nick_owner_t owner;
+    char text[NICK_MAX + 32];
+
+    if (!nick_valid(arg, len))
+    {
+        conn_reply(id, "Invalid nick.\r\n");
+        return;
+    }
+
+    /* nicknames are unique over all workers */
+    owner.wrk = wrk_self();
+    owner.id  = id;
+    owner.gen = conns[id].gen;
+    ret = nick_claim(arg, len, &owner, &nick);
+    if (ret != 0)
+    {
+        conn_reply(id, (ret > 0)? "Nick is taken.\r\n" : "Cannot set the nick.\r\n");
+        return;
+    }
+    if (prefix[id].nick != NULL && prefix[id].nick != nick)
+    {
+        nick_release(prefix[id].nick);
+    }
+
+    /* the name looked up from the address no longer overrides it */
+    prefix[id].nick = nick;
+    conn_prefix_set(id, nick, len);
+    T_M(T_D1, 0x42270100, "conns[%u]=%d is now %s.\n", id, conns[id].fd, nick);
+    snprintf(text, sizeof(text), "Nick is %s.\r\n", nick);
+    conn_reply(id, text);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_msg(unsigned int id, const char *arg, size_t len)
+{
+    int ret = 0;
+    size_t nlen;
+    size_t tlen;
+    const char *sp;
+    nick_owner_t to;
+    msg_t *msg;
+
+    /* "<nick> <text>" */
+    sp = memchr(arg, ' ', len);
+    nlen = (sp != NULL)? (size_t)(sp - arg) : len;
+    if (nlen == 0 || nlen + 1 >= len)
+    {
+        conn_reply(id, "Usage: /msg <nick> <text>\r\n");
+        return;
+    }
+    tlen = len - nlen - 1;
+
+    if (nick_find(arg, nlen, &to) < 0)
+    {
+        conn_reply(id, "No such nick.\r\n");
+        return;
+    }
+
+    /* "[name] (private) text" */
+    msg = msg_new(NULL, prefix[id].len + 10 + tlen + 2);
+    if (msg == NULL)
+    {
+        return;
+    }
+    memcpy(msg->data, prefix[id].data, prefix[id].len);
+    memcpy(msg->data + prefix[id].len, "(private) ", 10);
+    memcpy(msg->data + prefix[id].len + 10, sp + 1, tlen);
+    memcpy(msg->data + prefix[id].len + 10 + tlen, "\r\n", 2);
+    T_M(T_D1, 0x42280100, "conns[%u]=%d to conns[%u] of worker %d: %.*s",
+        id, conns[id].fd, to.id, to.wrk, (int)msg->len, msg->data);
+
+    /* the holder is found at once wherever it is */
+    if (to.wrk != wrk_self())
+    {
+        ret = wrk_send(to.wrk, to.id, to.gen, msg);
+    }
+    else if (to.id < conn_num && conns[to.id].gen == to.gen && to.id != id)
+    {
+        conn_send(to.id, msg);
+    }
+    if (ret == 0)
+    {
+        conn_send(id, msg);
+    }
+    msg_unref(msg);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void conn_reply(unsigned int id, const char *text)
+{
+    msg_t *msg;
+
+    msg = msg_new(text, strlen(text));
+    if (msg != NULL)
+    {
+        conn_send(id, msg);
+        msg_unref(msg);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int conn_io_cb(evl_t *evl, int fd, unsigned int events, void *arg)
+{
+    int ret = 0;
+    unsigned int id = (unsigned int)(uintptr_t)arg;
+
+    /* release messages of completed zerocopy sends */
+    if (cold[id].zc != NULL && cold[id].zc->num > 0)
+    {
+        conn_zc_complete(id);
+    }
+
+    /* hang up while not waiting for anything, paused for example */
+    if ((events & EVL_ERR) && !(events & (EVL_IN | EVL_OUT)))
+    {
+        T_M(T_D1, 0x42060500, "conns[%u]=%d hung up.\n", id, fd);
+        conn_close_later(id);
+    }
+
+    /* send queued messages */
+    if (events & EVL_OUT)
+    {
+        conn_flush(id);
+    }
+
+    /* receive a message and broadcast it */
+    if ((events & EVL_IN) && conns[id].state == CONN_ST_OPEN && !cold[id].paused)
+    {
+        T_M(T_D1, 0x42060400, "process a message from conns[%u]=%d.\n", id, fd);
+        ret = conn_recv(id);
+        if (ret > 0)
+        {
+            ret = conn_input(id, ret);
+        }
+    }
+
+    conn_flush_dirty();
+    conn_reap();
+
+    return(ret);
 }
 
 /* end of conn.c */
@@ -17,29 +17,93 @@
 /*======================================================================
  * includes
  *======================================================================*/
+#include "evl.h"
 #include "main.h"
+#include "msg.h"
+#include "metr.h"
+#include "../com.h"
 
 /*======================================================================
  * constants, macros
  *======================================================================*/
 /**
- * @def CONN_MAX_SOCK
- * @brief Max number of connections.
+ * @def CONN_INIT_SOCK
+ * @brief Initial size of the connection table.
+ *
+ * The table is doubled whenever it runs out of vacant entries.
  */
-#define CONN_MAX_SOCK   8
+#define CONN_INIT_SOCK  64
 
 /**
  * @def CONN_MAX_NAME
  * @brief Max length of client names.
  */
-#define CONN_MAX_NAME   128
+#define CONN_MAX_NAME   COM_MAX_NAME
+
+/**
+ * @def CONN_MAX_WHO
+ * @brief Max number of names listed by /who.
+ */
+#define CONN_MAX_WHO    100
 
 /**
  * @def CONN_MAX_MSG
- * @brief Max length of a message.
+ * @brief Max length of a message including CRLF and terminating NUL.
  */
 #define CONN_MAX_MSG    128
 
+/**
+ * @def CONN_MAX_LONG
+ * @brief Max length of a line set by -L including CRLF.
+ *
+ * Lines longer than CONN_MAX_MSG-1 bytes are relayed in pieces of
+ * MSG_CHUNK bytes as they arrive, without buffering the whole line.
+ */
+#define CONN_MAX_LONG   (64*1024*1024)
+
+/**
+ * @def CONN_RBUF_SIZE
+ * @brief Max bytes received at once.
+ */
+#define CONN_RBUF_SIZE  (64*1024)
+
+/**
+ * @def CONN_INIT_OUTQ
+ * @brief Initial number of messages in an outbound queue (power of 2).
+ */
+#define CONN_INIT_OUTQ  16
+
+/**
+ * @def CONN_MAX_OUTQ
+ * @brief Max bytes queued for a connection.
+ *
+ * A client which cannot keep up with this is disconnected.
+ */
+#define CONN_MAX_OUTQ   (1024*1024)
+
+/**
+ * @def CONN_MAX_HOLD
+ * @brief Max bytes held while reading is paused by the rate limit.
+ *
+ * select and epoll stop reading, so this is reached only with io_uring,
+ * which keeps receiving.  A client sending more is disconnected.
+ */
+#define CONN_MAX_HOLD   (CONN_MAX_MSG + CONN_RBUF_SIZE)
+
+/**
+ * @def CONN_MAX_IOV
+ * @brief Max number of queued messages sent by one sendmsg.
+ */
+#define CONN_MAX_IOV    64
+
+/**
+ * @def CONN_ZC_MIN
+ * @brief Min bytes of a send to use MSG_ZEROCOPY.
+ *
+ * Smaller sends are cheaper to copy than to pin.
+ */
+#define CONN_ZC_MIN     (16*1024)
+
 /*======================================================================
  * typedefs, structures
  *======================================================================*/
@@ -51,12 +115,14 @@
 /**
  * @brief      Connection management module init.
  * @param[in,out] opr Operation parameters.
+ * @param[in] evl Event loop to register accepted sockets.
  * @return      Returns 0 on success.
  *              Returns minus value on any error.
  *
  * This function initializes connection management module.
+ * Connections are kept per thread, so call this on each worker thread.
  */
-int conn_init(opr_t *opr);
+int conn_init(opr_t *opr, evl_t *evl);
 
 /**
  * @brief       Connection management de-init.
@@ -69,21 +135,54 @@ void conn_deinit(opr_t *opr);
 /**
  * @brief       Accept from new socket.
  * @param[in] new_sock Listening socket to be accepted.
+ * @return      Returns 0 when a connection is taken or aborted by the client,
+ *              1 when no more connection can be accepted now,
+ *              minus value on any error.
  *
- * This function closes connection management module.
+ * This function accepts a connection and registers it to the event loop.
+ * new_sock must be non-blocking.
  */
 int conn_accept(int new_sock);
 
 /**
- * @brief       Set file descriptors to be observed.
- * @param[in,out] fds Pointer to file descriptor set for select.
+ * @brief       Take a socket accepted by the event loop.
+ * @param[in] sock Accepted socket.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * This function is used with completion based event loops, the event
+ * loop receives from and sends to sock.
+ */
+int conn_accepted(int sock);
+
+/**
+ * @brief       Deliver message to all connections of the calling worker.
+ * @param[in] msg Message to send, referenced by the outbound queues.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Messages are sent by conn_commit() or at the end of the current event.
+ */
+int conn_deliver(msg_t *msg);
+
+/**
+ * @brief       Deliver message to a connection of the calling worker.
+ * @param[in] id Connection ID.
+ * @param[in] gen Generation of the connection.
+ * @param[in] msg Message to send, referenced by the outbound queue.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * msg is dropped when the connection has been closed or reused.
+ */
+int conn_deliver_to(unsigned int id, unsigned int gen, msg_t *msg);
+
+/**
+ * @brief       Send messages delivered and close connections to be closed.
  */
-int conn_fd_set(fd_set *fds);
+void conn_commit(void);
 
 /**
- * @brief       Chcek file descriptors and process connections.
- * @param[in] fds Pointer to file descriptor set.
+ * @brief       Report connections of the calling worker.
+ * @param[in,out] buf Buffer to append a line per connection and counter.
  */
-int conn_fd_process(fd_set *fds);
+void conn_report(metr_buf_t *buf);
 
 #endif  /* #ifndef __CONN_H_ */
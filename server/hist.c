@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Message history module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Every worker delivers every message, so each worker keeps its own ring
+ * without locks.  A client resuming on a worker gets the messages the
+ * worker has delivered, and the rest are delivered to it as usual.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+#include "msg.h"
+#include "clog.h"
+#include "hist.h"
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static atomic_ullong seq_last;           /* last sequence number given */
+static __thread msg_t **ring;            /* delivered messages */
+static __thread unsigned int head;       /* index of the oldest message */
+static __thread unsigned int num;        /* number of messages */
+static __thread unsigned long long dropped; /* max sequence number dropped */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static void hist_load_cb(unsigned long long seq, const char *data, size_t len,
+                         size_t rlen, void *arg);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int hist_init(void)
+{
+    ring = calloc(HIST_SIZE, sizeof(*ring));
+    if (ring == NULL)
+    {
+        T_M(T_E, 0x87010100, "cannot allocate history.\n");
+        return(0x87010100);
+    }
+    head    = 0;
+    num     = 0;
+    dropped = 0;
+
+    /* messages before restart */
+    (void)clog_replay(HIST_SIZE, hist_load_cb, NULL);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void hist_deinit(void)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    for (; num > 0; num--)
+    {
+        msg_unref(ring[head]);
+        head = (head + 1) & (HIST_SIZE - 1);
+    }
+    free(ring);
+    ring = NULL;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+unsigned long long hist_stamp(void)
+{
+    return(atomic_fetch_add_explicit(&seq_last, 1, memory_order_relaxed) + 1);
+}
+
+/*----------------------------------------------------------------------*/
+void hist_start(unsigned long long seq)
+{
+    atomic_store(&seq_last, seq);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+unsigned long long hist_last(void)
+{
+    return(atomic_load_explicit(&seq_last, memory_order_relaxed));
+}
+
+/*----------------------------------------------------------------------*/
+void hist_put(msg_t *msg)
+{
+    if (num == HIST_SIZE)
+    {
+        /* drop the oldest */
+        if (ring[head]->seq > dropped)
+        {
+            dropped = ring[head]->seq;
+        }
+        msg_unref(ring[head]);
+        head = (head + 1) & (HIST_SIZE - 1);
+        num--;
+    }
+
+    ring[(head + num) & (HIST_SIZE - 1)] = msg_ref(msg);
+    num++;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+msg_t *hist_replay(const char *room, size_t rlen, unsigned long long seq,
+                   unsigned int *replay_num, int *lost)
+{
+    unsigned int cnt;
+    size_t total = 0;
+    int hlen;
+    char stamp[24];
+    msg_t *m;
+    msg_t *msg;
+
+    *replay_num = 0;
+    *lost       = (dropped > seq);
+
+    /* size of messages to replay */
+    for (cnt = 0; cnt < num; cnt++)
+    {
+        m = ring[(head + cnt) & (HIST_SIZE - 1)];
+        if (m->seq > seq && m->rlen == rlen && memcmp(msg_room(m), room, rlen) == 0)
+        {
+            total += snprintf(stamp, sizeof(stamp), "#%llu ", m->seq) + m->len;
+            (*replay_num)++;
+        }
+    }
+    if (*replay_num == 0)
+    {
+        return(NULL);
+    }
+
+    /* stamp and concatenate to be sent at once */
+    msg = msg_new(NULL, total);
+    if (msg == NULL)
+    {
+        *replay_num = 0;
+        return(NULL);
+    }
+    total = 0;
+    for (cnt = 0; cnt < num; cnt++)
+    {
+        m = ring[(head + cnt) & (HIST_SIZE - 1)];
+        if (m->seq > seq && m->rlen == rlen && memcmp(msg_room(m), room, rlen) == 0)
+        {
+            hlen = snprintf(stamp, sizeof(stamp), "#%llu ", m->seq);
+            memcpy(msg->data + total, stamp, hlen);
+            memcpy(msg->data + total + hlen, m->data, m->len);
+            total += hlen + m->len;
+        }
+    }
+    T_M(T_D1, 0x07050100, "replay %u messages after #%llu.\n", *replay_num, seq);
+
+    return(msg);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static void hist_load_cb(unsigned long long seq, const char *data, size_t len,
+                         size_t rlen, void *arg)
+{
+    unsigned int cnt;
+    msg_t *msg;
+
+    msg = msg_new(data, len + rlen);
+    if (msg == NULL)
+    {
+        return;
+    }
+    msg->len  = (unsigned int)len;
+    msg->rlen = (unsigned int)rlen;
+    msg->seq  = seq;
+    hist_put(msg);
+    msg_unref(msg);
+
+    /* the log is nearly in order of seq, move it back to its place */
+    for (cnt = num - 1; cnt > 0 && ring[(head + cnt - 1) & (HIST_SIZE - 1)]->seq > seq; cnt--)
+    {
+        ring[(head + cnt) & (HIST_SIZE - 1)] = ring[(head + cnt - 1) & (HIST_SIZE - 1)];
+        ring[(head + cnt - 1) & (HIST_SIZE - 1)] = msg;
+    }
+
+    return;
+}
+
+/* end of hist.c */
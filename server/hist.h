@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for message history module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Chat messages are stamped with sequence numbers unique to the server.
+ * Each worker keeps the recent messages it has delivered in a ring to
+ * replay them to resuming clients.  Workers deliver messages in the order
+ * of sequence numbers (see wrk_publish()), so the ring is in that order.
+ */
+#ifndef __HIST_H_
+#define __HIST_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+
+#include "msg.h"
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def HIST_SIZE
+ * @brief Number of messages kept by each worker (power of 2).
+ */
+#define HIST_SIZE       1024
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       History module init.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * The ring is filled with the last messages in the chat log.
+ * Call this on each worker thread.
+ */
+int hist_init(void);
+
+/**
+ * @brief       History module de-init.
+ */
+void hist_deinit(void);
+
+/**
+ * @brief       Get the next sequence number.
+ * @return      Returns sequence number, starting at 1.
+ *
+ * Sequence numbers increase in the order of calls by any worker.
+ */
+unsigned long long hist_stamp(void);
+
+/**
+ * @brief       Continue sequence numbers.
+ * @param[in] seq Last sequence number used before.
+ *
+ * Call this before workers start.
+ */
+void hist_start(unsigned long long seq);
+
+/**
+ * @brief       Get the last sequence number given.
+ * @return      Returns sequence number, 0 when none is given.
+ */
+unsigned long long hist_last(void);
+
+/**
+ * @brief       Keep a delivered message.
+ * @param[in] msg Message with seq, a reference is taken.
+ *
+ * The oldest message is dropped when the ring is full.
+ */
+void hist_put(msg_t *msg);
+
+/**
+ * @brief       Collect messages to replay.
+ * @param[in] room Room name.
+ * @param[in] rlen Length of room.
+ * @param[in] seq Last sequence number seen by the client.
+ * @param[out] num Number of messages collected.
+ * @param[out] lost Set to 1 when messages after seq may have been dropped.
+ * @return      Returns one message holding all messages of the room after
+ *              seq stamped with "#seq " in delivered order, NULL when none
+ *              or on any error.
+ */
+msg_t *hist_replay(const char *room, size_t rlen, unsigned long long seq,
+                   unsigned int *num, int *lost);
+
+#endif  /* #ifndef __HIST_H_ */
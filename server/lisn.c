@@ -21,13 +21,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <errno.h>
-#include <sys/select.h>
 
 #include "trace.h"
+#include "evl.h"
 #include "main.h"
 #include "lisn.h"
 #include "conn.h"
+#include "wrk.h"
 
 /*======================================================================
  * global variables
@@ -36,11 +39,14 @@
 /*------------------------------
  * private
  *------------------------------*/
-static int sock[LISN_MAX_SOCK]; /* listen sockets */
+static int sock[WRK_MAX][LISN_MAX_SOCK]; /* listen sockets of each worker */
 
 /*======================================================================
  * prototype declarations for private functions
  *======================================================================*/
+static int lisn_open(opr_t *opr, struct addrinfo *res, int wrk_id);
+static int lisn_accept_cb(evl_t *evl, int fd, unsigned int events, void *arg);
+static int lisn_accepted_cb(evl_t *evl, int res, void *buf, int more, void *arg);
 
 /*======================================================================
  * functions
@@ -56,16 +62,20 @@ int lisn_init(opr_t *opr)
 /*----------------------------------------------------------------------*/
 void lisn_deinit(opr_t *opr)
 {
+    int wrk;
     int cnt;
 
     /* close all opening sockets */
-    for (cnt=0; cnt < LISN_MAX_SOCK; cnt++)
+    for (wrk=0; wrk < WRK_MAX; wrk++)
     {
-        if (sock[cnt] >= 0)
+        for (cnt=0; cnt < LISN_MAX_SOCK; cnt++)
         {
-            T_M(T_D1, 0x01020100, "closing socket: %d.\n", sock[cnt]);
-            close(sock[cnt]);
-            sock[cnt] = -1;
+            if (sock[wrk][cnt] >= 0)
+            {
+                T_M(T_D1, 0x01020100, "closing socket: %d.\n", sock[wrk][cnt]);
+                close(sock[wrk][cnt]);
+                sock[wrk][cnt] = -1;
+            }
         }
     }
 
@@ -76,11 +86,10 @@ void lisn_deinit(opr_t *opr)
 int lisn_start_listen(opr_t *opr)
 {
     int ret;
-    int sock_cnt;
+    int wrk;
     /* address info structures */
     struct addrinfo  hints;     /* for hinting */
     struct addrinfo *res;       /* pointer to results */
-    struct addrinfo *res_cnt;   /* pointer for results handling */
 
     /*------------------------------
      * retrieve address information
@@ -98,116 +107,196 @@ int lisn_start_listen(opr_t *opr)
     }
 
     /*------------------------------
-     * bind listen for all addresses
+     * bind listen for all addresses on each worker
      *------------------------------*/
+    for (wrk = 0; wrk < opr->threads && wrk < WRK_MAX; wrk++)
+    {
+        ret = lisn_open(opr, res, wrk);
+        if (ret <= 0)
+        {
+            /* no listen succeeded */
+            T_M(T_E, 0x8103f000, "cannot listen on any interface.\n");
+            freeaddrinfo(res);
+            return(0x8103f000);
+        }
+    }
+
+    freeaddrinfo(res);
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int lisn_attach(evl_t *evl, int wrk_id)
+{
+    int cnt;
+    int ret;
+
+    for (cnt = 0; cnt < LISN_MAX_SOCK; cnt++)
+    {
+        if (sock[wrk_id][cnt] < 0)
+        {
+            continue;
+        }
+
+        if (evl_has_ops(evl))
+        {
+            /* the event loop accepts connections by itself */
+            ret = evl_accept(evl, sock[wrk_id][cnt], lisn_accepted_cb, NULL);
+        }
+        else
+        {
+            ret = evl_add(evl, sock[wrk_id][cnt], EVL_IN, lisn_accept_cb, NULL);
+        }
+        if (ret < 0)
+        {
+            return(ret);
+        }
+    }
+
+    return(0);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static int lisn_open(opr_t *opr, struct addrinfo *res, int wrk_id)
+{
+    int ret;
+    int sock_cnt;
+    int on = 1;
+    int *wsock = sock[wrk_id];
+    struct addrinfo *res_cnt;   /* pointer for results handling */
+
     sock_cnt = 0;
-    for (res_cnt = res; res && sock_cnt < LISN_MAX_SOCK; res = res->ai_next)
+    for (res_cnt = res; res_cnt && sock_cnt < LISN_MAX_SOCK; res_cnt = res_cnt->ai_next)
     {
         /* create socket */
-        ret = socket(res->ai_family, res_cnt->ai_socktype, res_cnt->ai_protocol);
+        /* non-blocking to drain the backlog in a loop */
+        ret = socket(res_cnt->ai_family, res_cnt->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                     res_cnt->ai_protocol);
         if (ret < 0)
         {
             /* ignore when error */
-            T_M(T_D1, 0x01030300, "cannot create socket: %s.\n", strerror(errno));
+            T_M(T_D1, 0x41010300, "cannot create socket: %s.\n", strerror(errno));
             continue;
         }
-        sock[sock_cnt] = ret;
-        T_M(T_D2, 0x01030380, "created socket sock[%d]=%d.\n", sock_cnt, sock[sock_cnt]);
+        wsock[sock_cnt] = ret;
+        T_M(T_D2, 0x41010380, "created socket sock[%d][%d]=%d.\n",
+            wrk_id, sock_cnt, wsock[sock_cnt]);
+
+        /* allow restart while old connections are in TIME_WAIT */
+        (void)setsockopt(wsock[sock_cnt], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        /* IPv6 sockets do not take IPv4 connections to avoid conflicts */
+        if (res_cnt->ai_family == AF_INET6)
+        {
+            (void)setsockopt(wsock[sock_cnt], IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+        }
+
+        /* workers share the port and the kernel distributes connections */
+        if (opr->threads > 1)
+        {
+            ret = setsockopt(wsock[sock_cnt], SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+            if (ret < 0)
+            {
+                T_M(T_E, 0xc1010390, "cannot set SO_REUSEPORT: %s.\n", strerror(errno));
+                close(wsock[sock_cnt]);
+                wsock[sock_cnt] = -1;
+                continue;
+            }
+        }
 
         /* bind */
-        ret = bind(sock[sock_cnt], res_cnt->ai_addr, res_cnt->ai_addrlen);
+        ret = bind(wsock[sock_cnt], res_cnt->ai_addr, res_cnt->ai_addrlen);
         if (ret < 0)
         {
             /* ignore when error */
-            T_M(T_D1, 0x81030400, "cannot bind for sock[%d]=%d: %s.\n",
-                sock_cnt, sock[sock_cnt], strerror(errno));
-            close(sock[sock_cnt]);
-            sock[sock_cnt] = -1;
+            T_M(T_D1, 0xc1010400, "cannot bind for sock[%d][%d]=%d: %s.\n",
+                wrk_id, sock_cnt, wsock[sock_cnt], strerror(errno));
+            close(wsock[sock_cnt]);
+            wsock[sock_cnt] = -1;
             continue;
         }
-        T_M(T_D2, 0x01030480, "bind sock[%d]=%d.\n", sock_cnt, sock[sock_cnt]);
+        T_M(T_D2, 0x41010480, "bind sock[%d][%d]=%d.\n", wrk_id, sock_cnt, wsock[sock_cnt]);
+
+        /* wake up only when the first data arrives */
+        if (opr->defer_accept > 0)
+        {
+            ret = setsockopt(wsock[sock_cnt], IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                             &opr->defer_accept, sizeof(opr->defer_accept));
+            if (ret < 0)
+            {
+                T_M(T_W, 0xc1010410, "cannot set TCP_DEFER_ACCEPT: %s.\n", strerror(errno));
+            }
+        }
+
+        /* let returning clients send data in SYN */
+        if (opr->fastopen > 0)
+        {
+            ret = setsockopt(wsock[sock_cnt], IPPROTO_TCP, TCP_FASTOPEN,
+                             &opr->fastopen, sizeof(opr->fastopen));
+            if (ret < 0)
+            {
+                T_M(T_W, 0xc1010420, "cannot set TCP_FASTOPEN: %s.\n", strerror(errno));
+            }
+        }
 
         /* listen */
-        ret = listen(sock[sock_cnt], 8);
+        ret = listen(wsock[sock_cnt], opr->backlog);
         if (ret < 0)
         {
             /* ignore when error */
-            T_M(T_D1, 0x81030500, "cannot listen on sock[%d]=%d: %s.\n",
-                sock_cnt, sock[sock_cnt], strerror(errno));
-            close(sock[sock_cnt]);
-            sock[sock_cnt] = -1;
+            T_M(T_D1, 0xc1010500, "cannot listen on sock[%d][%d]=%d: %s.\n",
+                wrk_id, sock_cnt, wsock[sock_cnt], strerror(errno));
+            close(wsock[sock_cnt]);
+            wsock[sock_cnt] = -1;
             continue;
         }
-        T_M(T_D2, 0x01030480, "listen sock[%d]=%d.\n", sock_cnt, sock[sock_cnt]);
+        T_M(T_D2, 0x41010580, "listen sock[%d][%d]=%d.\n", wrk_id, sock_cnt, wsock[sock_cnt]);
         sock_cnt++;
     }
 
-    if (sock_cnt <= 0)
-    {
-        /* no listen succeeded */
-        T_M(T_E, 0x8103f000, "cannot listen on any interface.\n");
-        freeaddrinfo(res);
-        return(0x8103f000);
-    }
-
-    freeaddrinfo(res);
-    return(0);
+    return(sock_cnt);
 }
 
 /*----------------------------------------------------------------------*/
-int lisn_fd_set(fd_set *fds)
+static int lisn_accept_cb(evl_t *evl, int fd, unsigned int events, void *arg)
 {
     int cnt;
-    int max_fd = 0;
+    int ret = 0;
 
-    for (cnt = 0; cnt < LISN_MAX_SOCK; cnt++)
+    /* accept connections until the backlog is drained or budget runs out */
+    for (cnt = 0; cnt < LISN_ACCEPT_BUDGET; cnt++)
     {
-        if (sock[cnt] >= 0)
+        ret = conn_accept(fd);
+        if (ret != 0)
         {
-            FD_SET(sock[cnt], fds);
-            if (sock[cnt] > max_fd)
-            {
-                max_fd = sock[cnt];
-            }
+            break;
         }
     }
+    T_M(T_D2, 0x41020100, "accepted %d connections.\n", cnt);
 
-    return(max_fd);
+    return((ret < 0)? ret : 0);
 }
 
 /*----------------------------------------------------------------------*/
-int lisn_fd_process(fd_set *fds)
+static int lisn_accepted_cb(evl_t *evl, int res, void *buf, int more, void *arg)
 {
-    int cnt;
-    int ret;
-
-    for (cnt = 0; cnt < LISN_MAX_SOCK; cnt++)
+    if (res >= 0)
     {
-        /* skip closed sockets */
-        if (sock[cnt] < 0)
-        {
-            continue;
-        }
+        return(conn_accepted(res));
+    }
 
-        /* check if there is a connection request */
-        if (FD_ISSET(sock[cnt], fds))
+    if (res != -ECANCELED)
+    {
+        T_MR(T_W, 0xc1030100, "cannot accept: %s.\n", strerror(-res));
+        if (!more)
         {
-            /* accept connection */
-            ret = conn_accept(sock[cnt]);
-            if (ret < 0)
-            {
-                return(ret);
-            }
+            T_M(T_E, 0xc1030200, "stopped accepting connections.\n");
         }
     }
 
     return(0);
 }
 
-/*======================================================================
- * private functions
- *======================================================================*/
-
-/*----------------------------------------------------------------------*/
-
 /* end of lisn.c */
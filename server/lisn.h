@@ -17,7 +17,9 @@
 /*======================================================================
  * includes
  *======================================================================*/
-#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "evl.h"
 #include "main.h"
 
 /*======================================================================
@@ -29,6 +31,22 @@
  */
 #define LISN_MAX_SOCK   4
 
+/**
+ * @def LISN_DEF_BACKLOG
+ * @brief Default length of the pending connection queue.
+ *
+ * The kernel caps this with net.core.somaxconn.
+ */
+#define LISN_DEF_BACKLOG SOMAXCONN
+
+/**
+ * @def LISN_ACCEPT_BUDGET
+ * @brief Max number of connections accepted per wakeup.
+ *
+ * The rest are accepted on the next wakeup not to starve clients.
+ */
+#define LISN_ACCEPT_BUDGET 64
+
 /*======================================================================
  * typedefs, structures
  *======================================================================*/
@@ -58,19 +76,25 @@ void lisn_deinit(opr_t *opr);
 /**
  * @brief       Start listening.
  * @param[in] opr Pointer to the operation parameters.
+ * @return      Returns 0 on success.
+ *              Returns minus value on any error.
+ *
+ * This function opens listening sockets for each of opr->threads workers.
+ * The sockets share the port with SO_REUSEPORT when there are two or
+ * more workers.
  */
 int lisn_start_listen(opr_t *opr);
 
 /**
- * @brief       Set file descriptors to be observed.
- * @param[in,out] fds Pointer to file descriptor set for select.
- */
-int lisn_fd_set(fd_set *fds);
-
-/**
- * @brief       Chcek file descriptors and process connections.
- * @param[in] fds Pointer to file descriptor set.
+ * @brief       Register listening sockets of a worker.
+ * @param[in] evl Event loop of the worker.
+ * @param[in] wrk_id Worker ID.
+ * @return      Returns 0 on success.
+ *              Returns minus value on any error.
+ *
+ * Connection requests are accepted by the connection management module
+ * running on the worker.
  */
-int lisn_fd_process(fd_set *fds);
+int lisn_attach(evl_t *evl, int wrk_id);
 
 #endif  /* #ifndef __LISN_H_ */
@@ -18,15 +18,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/select.h>
 #include <errno.h>
 
 #include "trace.h"
 #include "tool.h"
+#include "evl.h"
 #include "../com.h"
 #include "main.h"
 #include "lisn.h"
+#include "rslv.h"
+#include "sess.h"
+#include "nick.h"
+#include "clog.h"
+#include "metr.h"
 #include "conn.h"
+#include "wrk.h"
 
 /*======================================================================
  * global variables
@@ -41,6 +47,7 @@ static int status;             /* status flags */
  * prototype declarations for private functions
  *======================================================================*/
 static int arg_handler(int argc, char *argv[], opr_t *opr);
+static int rate_parse(const char *arg, int *rate, int *burst);
 static int global_init(opr_t *opr);
 static void global_deinit(opr_t *opr);
 static void usage(void);
@@ -53,8 +60,7 @@ int main(int argc, char *argv[])
 {
     opr_t opr;                  /* operation parameters */
     int   ret;                  /* return value handler */
-    int    fdnum;               /* number of changed file descriptors */
-    fd_set readfds;             /* descriptor set for select */
+    char  path[64];             /* flight recorder dump file */
 
     status = STAT_INIT;
 
@@ -71,6 +77,17 @@ int main(int argc, char *argv[])
         return(0x80010010);
     }
 
+    /* traces are written at once if the writer cannot be started */
+    (void)T_start();
+
+    /* keep recent traces to dump on SIGUSR2 or crash */
+    snprintf(path, sizeof(path), "chatserv.%d.trc", (int)getpid());
+    ret = T_record(opr.rec_level, path);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
     ret = global_init(&opr);
     if (ret < 0)
     {
@@ -91,48 +108,11 @@ int main(int argc, char *argv[])
         return(ret);
     }
 
-    while (!(status & STAT_FIN) && !(status & STAT_ERR))
+    /* run workers until stopped */
+    ret = wrk_run(&opr);
+    if (ret < 0)
     {
-        FD_ZERO(&readfds);      /* initialize fd set */
-
-        /* set listening sockets */
-        ret = lisn_fd_set(&readfds);
-        /* set connection sockets */
-        fdnum = conn_fd_set(&readfds);
-        /* set max of file descriptors */
-        ret = (fdnum > ret)? fdnum : ret;
-
-        fdnum = select(ret+1, &readfds, NULL, NULL, NULL);
-        if (fdnum < 0)
-        {
-            if (errno == EINTR)
-            {
-                /* ignore signal interrupts */
-                T_M(T_D1, 0x800103f0, "select: signal interrupt.\n");
-                continue;
-            }
-
-            T_M(T_E, 0x80010400, "select error: %s.\n", strerror(errno));
-            status |= STAT_ERR;
-            continue;
-        }
-        if (fdnum == 0)
-        {
-            /* there is no change */
-            continue;
-        }
-
-        ret = lisn_fd_process(&readfds);
-        if (ret < 0)
-        {
-            status |= STAT_ERR;
-        }
-
-        ret = conn_fd_process(&readfds);
-        if (ret < 0)
-        {
-            status |= STAT_ERR;
-        }
+        status |= STAT_ERR;
     }
 
     /*----------------------------------------------------------------------*/
@@ -153,13 +133,18 @@ static int arg_handler(int argc, char *argv[], opr_t *opr)
 
     /* set default parameters */
     snprintf(opr->port, sizeof(opr->port), "%d", COM_DEF_PORT);
+    opr->evl_backend = EVL_DEF_BACKEND;
+    opr->threads     = 1;
+    opr->backlog     = LISN_DEF_BACKLOG;
+    opr->rec_level   = T_D2;
+    opr->max_msg     = CONN_MAX_MSG-1;
 
     /*------------------------------
      * handling options
      *------------------------------*/
     for (;;)
     {
-        ret = getopt(argc, argv, "hd:p:");
+        ret = getopt(argc, argv, "a:b:B:f:hd:De:i:k:l:L:m:p:r:R:t:T:z");
 
         if (ret < 0)
         {
@@ -167,6 +152,40 @@ static int arg_handler(int argc, char *argv[], opr_t *opr)
         }
         switch (ret)
         {
+        case 'a':               /* TCP_DEFER_ACCEPT timeout */
+            if (!is_number(optarg))
+            {
+                T_M(T_E, 0xc0010800, "invalid defer accept timeout: %s.\n", optarg);
+                return(0xc0010800);
+            }
+            opr->defer_accept = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'b':               /* listen backlog */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) <= 0)
+            {
+                T_M(T_E, 0xc0010600, "invalid backlog: %s.\n", optarg);
+                return(0xc0010600);
+            }
+            opr->backlog = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'B':               /* byte rate limit */
+            if (rate_parse(optarg, &opr->byte_rate, &opr->byte_burst) < 0)
+            {
+                T_M(T_E, 0xc0011000, "invalid byte rate: %s.\n", optarg);
+                return(0xc0011000);
+            }
+            break;
+        case 'D':               /* drop lines over the rate limit */
+            opr->rate_drop = 1;
+            break;
+        case 'f':               /* TCP_FASTOPEN queue length */
+            if (!is_number(optarg))
+            {
+                T_M(T_E, 0xc0010900, "invalid fast open queue length: %s.\n", optarg);
+                return(0xc0010900);
+            }
+            opr->fastopen = (int)strtol(optarg, NULL, 10);
+            break;
         case 'h':
             usage();
             T_M(T_D2, 0x400100ff, "exit with showing help.\n");
@@ -184,17 +203,99 @@ static int arg_handler(int argc, char *argv[], opr_t *opr)
                 T_init(T_E);
             }
             break;
+        case 'e':               /* event loop backend */
+            ret = evl_backend_parse(optarg);
+            if (ret < 0)
+            {
+                T_M(T_E, 0xc0010300, "invalid event loop backend: %s.\n", optarg);
+                return(0xc0010300);
+            }
+            opr->evl_backend = ret;
+            break;
+        case 'i':               /* idle timeout */
+            if (!is_number(optarg))
+            {
+                T_M(T_E, 0xc0010e00, "invalid idle timeout: %s.\n", optarg);
+                return(0xc0010e00);
+            }
+            opr->idle = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'k':               /* keepalive interval */
+            if (!is_number(optarg))
+            {
+                T_M(T_E, 0xc0010f00, "invalid keepalive interval: %s.\n", optarg);
+                return(0xc0010f00);
+            }
+            opr->keepalive = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'l':               /* chat log directory */
+            if (strlen(optarg) >= sizeof(opr->log_dir))
+            {
+                T_M(T_E, 0xc0010a00, "too long log directory: %s.\n", optarg);
+                return(0xc0010a00);
+            }
+            strcpy(opr->log_dir, optarg);
+            break;
+        case 'L':               /* max line length */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) < CONN_MAX_MSG-1 ||
+                strtol(optarg, NULL, 10) > CONN_MAX_LONG)
+            {
+                T_M(T_E, 0xc0011200, "invalid max line length: %s.\n", optarg);
+                return(0xc0011200);
+            }
+            opr->max_msg = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'm':               /* admin socket */
+            if (strlen(optarg) >= sizeof(opr->metr_path))
+            {
+                T_M(T_E, 0xc0010d00, "too long admin socket path: %s.\n", optarg);
+                return(0xc0010d00);
+            }
+            strcpy(opr->metr_path, optarg);
+            break;
         case 'p':               /* port name */
             strncpy(opr->port, optarg, sizeof(opr->port)-1);
             T_M(T_I, 0x40010290, "port changed to %s.\n", opr->port);
             break;
+        case 'r':               /* flight recorder level */
+            if (!is_number(optarg) || strtol(optarg, NULL, 10) > T_D2)
+            {
+                T_M(T_E, 0xc0010c00, "invalid flight recorder level: %s.\n", optarg);
+                return(0xc0010c00);
+            }
+            opr->rec_level = (unsigned int)strtol(optarg, NULL, 10);
+            break;
+        case 'R':               /* line rate limit */
+            if (rate_parse(optarg, &opr->msg_rate, &opr->msg_burst) < 0)
+            {
+                T_M(T_E, 0xc0011100, "invalid line rate: %s.\n", optarg);
+                return(0xc0011100);
+            }
+            break;
+        case 't':               /* number of worker threads */
+            if (!is_number(optarg))
+            {
+                T_M(T_E, 0xc0010400, "invalid number of threads: %s.\n", optarg);
+                return(0xc0010400);
+            }
+            opr->threads = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'T':               /* trace filter */
+            if (T_filter(optarg) < 0)
+            {
+                return(0xc0010b00);
+            }
+            break;
+        case 'z':               /* zerocopy send */
+            opr->zerocopy = 1;
+            break;
         case '?':               /* invalid option */
-            T_M(T_E, 0xc00101ee, "invalid option.\n", optopt);
+            T_M(T_E, 0xc00101ee, "invalid option: %c.\n", optopt);
             usage();
             return(0xc00101ee);
             break;
         default:                /* no route to here */
-            T_M(T_E, 0xc00101ff, "invalid option.\n", optopt);
+            T_M(T_E, 0xc00101ff, "invalid option: %c.\n", optopt);
             usage();
             return(0xc00101ff);
             break;
@@ -218,6 +319,36 @@ static int arg_handler(int argc, char *argv[], opr_t *opr)
     return(0);
 }
 
+/*----------------------------------------------------------------------*/
+static int rate_parse(const char *arg, int *rate, int *burst)
+{
+    char *end;
+    long val;
+
+    /* <rate>[:<burst>], burst defaults to one second of rate */
+    val = strtol(arg, &end, 10);
+    if (end == arg || val <= 0 || val > 1000000000 || (*end != '\0' && *end != ':'))
+    {
+        return(-1);
+    }
+    *rate  = (int)val;
+    *burst = (int)val;
+    if (*end == '\0')
+    {
+        return(0);
+    }
+
+    arg = end + 1;
+    val = strtol(arg, &end, 10);
+    if (end == arg || val <= 0 || val > 1000000000 || *end != '\0')
+    {
+        return(-1);
+    }
+    *burst = (int)val;
+
+    return(0);
+}
+
 /*----------------------------------------------------------------------*/
 static int global_init(opr_t *opr)
 {
@@ -240,8 +371,43 @@ static int global_init(opr_t *opr)
         return(ret);
     }
 
-    /* connection management module */
-    ret = conn_init(opr);
+    /* reverse DNS resolver */
+    ret = rslv_init(opr);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    /* sessions shared by workers */
+    ret = sess_init(opr);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    /* nicknames shared by workers */
+    ret = nick_init(opr);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    /* chat log, before workers load history from it */
+    ret = clog_init(opr);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    /* workers (each worker initializes connection management module) */
+    ret = wrk_init(opr);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    /* metrics of workers */
+    ret = metr_init(opr);
     if (ret < 0)
     {
         return(ret);
@@ -253,8 +419,23 @@ static int global_init(opr_t *opr)
 /*----------------------------------------------------------------------*/
 static void global_deinit(opr_t *opr)
 {
-    /* connection management module */
-    conn_deinit(opr);
+    /* metrics, before workers to be woken up */
+    metr_deinit(opr);
+
+    /* workers */
+    wrk_deinit(opr);
+
+    /* chat log, after workers committed all messages */
+    clog_deinit(opr);
+
+    /* nicknames, after workers released them */
+    nick_deinit(opr);
+
+    /* sessions */
+    sess_deinit(opr);
+
+    /* reverse DNS resolver */
+    rslv_deinit(opr);
 
     /* TCP listening module */
     lisn_deinit(opr);
@@ -266,17 +447,46 @@ static void global_deinit(opr_t *opr)
 static void usage(void)
 {
     puts("Usage:");
-    puts("\tchatserv [-h] [-d <debug_level>] [-p <port_name>]");
+    puts("\tchatserv [-h] [-a <seconds>] [-b <backlog>] [-B <rate>[:<burst>]]");
+    puts("\t         [-d <debug_level>] [-D] [-e <backend>] [-f <qlen>] [-i <seconds>]");
+    puts("\t         [-k <seconds>] [-l <log_dir>] [-L <bytes>] [-m <socket>]");
+    puts("\t         [-p <port_name>] [-r <rec_level>] [-R <rate>[:<burst>]] [-t <threads>]");
+    puts("\t         [-T <filter>] [-z]");
     puts("");
     puts("Options:");
     puts("\t-h show this help and exit");
+    puts("\t-a wake up on new connections only after data arrives (TCP_DEFER_ACCEPT)");
+    printf("\t-b specify listen backlog (default: %d)\n", LISN_DEF_BACKLOG);
+    puts("\t-B limit bytes per second from each client (burst defaults to rate)");
     puts("\t-d specify debug message level");
     printf("\t\t%d\tERROR (default)\n", T_E);
     printf("\t\t%d\tWARNING\n", T_W);
     printf("\t\t%d\tINFO\n", T_I);
     printf("\t\t%d\tDEBUG1\n", T_D1);
     printf("\t\t%d\tDEBUG2\n", T_D2);
+    puts("\t-D drop lines over the rate limit with a notice instead of pausing reads");
+    puts("\t-e specify event loop backend");
+    puts("\t\tepoll\t(default on Linux)");
+    puts("\t\tselect");
+    puts("\t\turing\t(io_uring: accept, recv and send complete in the kernel)");
+    puts("\t-f enable TCP fast open with specified pending queue length");
+    puts("\t-i close connections which send nothing for specified seconds");
+    puts("\t-k send PING to connections which send nothing for specified seconds");
+    puts("\t\tclients answer PONG, which is not sent to the others");
+    puts("\t-l append chat messages to segment files in specified directory");
+    printf("\t-L specify max bytes of a line including CRLF (default: %d, max: %d)\n",
+           CONN_MAX_MSG-1, CONN_MAX_LONG);
+    puts("\t\tlonger lines than the default are relayed in pieces as they arrive");
+    puts("\t-m serve metrics in plain text on specified Unix socket");
     printf("\t-p specify port name or port number (default: %d)\n", COM_DEF_PORT);
+    printf("\t-r specify debug message level kept in memory (default: %d)\n", T_D2);
+    puts("\t\tdumped to chatserv.<pid>.trc on SIGUSR2 or crash, read it with tracedec");
+    puts("\t-R limit lines per second from each client (burst defaults to rate)");
+    printf("\t-t specify number of worker threads (default: 1, max: %d)\n", WRK_MAX);
+    puts("\t-T enable or disable traces by file or function ID");
+    puts("\t\t(ex) -T -*,+02 shows traces of conn.c only, -T -0203 hides conn_accept()");
+    printf("\t-z send batches of %d bytes or more with MSG_ZEROCOPY\n", CONN_ZC_MIN);
+    puts("\t\tnot available with select, which misses the completions");
 
     return;
 }
@@ -289,6 +499,7 @@ static void ctrl_c_trap(int signo)
     write(STDOUT_FILENO, msg, strlen(msg));
 
     status |= STAT_FIN;
+    wrk_stop();
 
     return;
 }
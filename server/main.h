@@ -48,7 +48,24 @@ typedef struct opr_strct {
     struct sigaction sa;        /**< @brief Signal handler */
 
     unsigned int trace_level;   /**< tracer output level */
+    unsigned int rec_level;     /**< flight recorder level */
     char port[128];             /**< listen port name */
+    int evl_backend;            /**< event loop backend */
+    int threads;                /**< number of worker threads */
+    int zerocopy;               /**< send large batches with MSG_ZEROCOPY */
+    int backlog;                /**< length of the pending connection queue */
+    int defer_accept;           /**< TCP_DEFER_ACCEPT timeout in seconds, 0 to disable */
+    int fastopen;               /**< TCP_FASTOPEN queue length, 0 to disable */
+    char log_dir[1024];         /**< chat log directory, empty to disable */
+    char metr_path[108];        /**< admin socket path, empty to disable */
+    int idle;                   /**< idle timeout in seconds, 0 to disable */
+    int keepalive;              /**< keepalive ping interval in seconds, 0 to disable */
+    int msg_rate;               /**< lines per second from a client, 0 to disable */
+    int msg_burst;              /**< lines sent at once over msg_rate */
+    int byte_rate;              /**< bytes per second from a client, 0 to disable */
+    int byte_burst;             /**< bytes sent at once over byte_rate */
+    int rate_drop;              /**< drop lines over the rate instead of pausing reads */
+    int max_msg;                /**< max bytes of a line including CRLF */
 } opr_t;
 
 #endif  /* #ifndef __MAIN_H_ */
@@ -0,0 +1,458 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Metrics module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Counters and histograms are summed up when read, so readers may see a
+ * worker in the middle of an iteration but never slow it down.  Connections
+ * are owned by workers, so the admin thread asks each worker to report them
+ * through its inbound eventfd and waits for a while.
+ */
+
+#define _GNU_SOURCE             /* accept4() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "trace.h"
+#include "main.h"
+#include "wrk.h"
+#include "metr.h"
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * public
+ *------------------------------*/
+__thread metr_t *metr_self;
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static metr_t         *metrs;                /* metrics of workers */
+static int             metrs_num;            /* number of workers */
+static int             lfd = -1;             /* admin socket */
+static const char     *path;                 /* path of admin socket */
+static pthread_t       th;                   /* admin thread */
+static int             th_started;           /* admin thread is running */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* lock of reports */
+static pthread_cond_t  cond = PTHREAD_COND_INITIALIZER;  /* report passed */
+
+/* counter names */
+static const char *const cnt_names[METR_COUNTERS] = {
+    "chat_accepts_total",
+    "chat_closes_total",
+    "chat_bytes_in_total",
+    "chat_bytes_out_total",
+    "chat_msgs_in_total",
+    "chat_msgs_out_total",
+    "chat_queued_bytes",
+    "chat_queued_msgs",
+    "chat_rate_pauses_total",
+    "chat_rate_drops_total",
+};
+
+/* histogram names */
+static const char *const hist_names[METR_HISTS] = {
+    "chat_fanout_ns",
+    "chat_loop_ns",
+};
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static void *metr_thread(void *arg);
+static void metr_collect(metr_buf_t *buf);
+static void metr_collect_conns(metr_buf_t *buf);
+static void metr_write(int fd, const char *buf, size_t len);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int metr_init(opr_t *opr)
+{
+    int ret;
+    struct sockaddr_un addr;
+
+    metrs = calloc(opr->threads, sizeof(*metrs));
+    if (metrs == NULL)
+    {
+        T_M(T_E, 0x8a010100, "cannot allocate metrics.\n");
+        return(0x8a010100);
+    }
+    metrs_num = opr->threads;
+
+    if (strlen(opr->metr_path) == 0)
+    {
+        return(0);
+    }
+
+    lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0)
+    {
+        T_M(T_E, 0x8a010300, "cannot create admin socket: %s.\n", strerror(errno));
+        return(0x8a010300);
+    }
+
+    /* a socket left by a crashed server is replaced */
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, opr->metr_path);
+    (void)unlink(opr->metr_path);
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 8) < 0)
+    {
+        T_M(T_E, 0x8a010400, "cannot listen on %s: %s.\n", opr->metr_path, strerror(errno));
+        return(0x8a010400);
+    }
+    path = opr->metr_path;
+
+    ret = pthread_create(&th, NULL, metr_thread, NULL);
+    if (ret != 0)
+    {
+        T_M(T_E, 0x8a010500, "cannot create admin thread: %s.\n", strerror(ret));
+        return(0x8a010500);
+    }
+    th_started = 1;
+    T_M(T_D1, 0x0a010600, "metrics served on %s.\n", path);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void metr_deinit(opr_t *opr)
+{
+    if (lfd >= 0)
+    {
+        /* wake up accept() */
+        (void)shutdown(lfd, SHUT_RDWR);
+        if (th_started)
+        {
+            pthread_join(th, NULL);
+            th_started = 0;
+        }
+        close(lfd);
+        lfd = -1;
+    }
+    if (path != NULL)
+    {
+        (void)unlink(path);
+        path = NULL;
+    }
+
+    free(metrs);
+    metrs     = NULL;
+    metrs_num = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+void metr_attach(int id)
+{
+    metr_self = (id >= 0 && id < metrs_num)? &metrs[id] : NULL;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+void metr_hist(int idx, unsigned long long ns)
+{
+    int n;
+    metr_hist_t *h;
+
+    if (metr_self == NULL)
+    {
+        return;
+    }
+    h = &metr_self->hist[idx];
+
+    /* bucket by number of bits */
+    n = (ns == 0)? 0 : 64 - __builtin_clzll(ns);
+    if (n >= METR_HIST_BUCKETS)
+    {
+        n = METR_HIST_BUCKETS - 1;
+    }
+
+    /* the worker is the only writer */
+    atomic_store_explicit(&h->bucket[n],
+                          atomic_load_explicit(&h->bucket[n], memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&h->sum,
+                          atomic_load_explicit(&h->sum, memory_order_relaxed) + ns,
+                          memory_order_relaxed);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+void metr_publish(metr_buf_t *buf)
+{
+    pthread_mutex_lock(&lock);
+    if (atomic_load(&metr_self->want))
+    {
+        metr_self->report = buf->buf;
+        atomic_store(&metr_self->want, 0);
+        pthread_cond_broadcast(&cond);
+        buf->buf = NULL;
+    }
+    pthread_mutex_unlock(&lock);
+
+    /* the admin thread has given up */
+    free(buf->buf);
+    buf->buf = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+void metr_printf(metr_buf_t *buf, const char *fmt, ...)
+{
+    int len;
+    size_t cap;
+    char *new_buf;
+    va_list ap;
+
+    for (;;)
+    {
+        va_start(ap, fmt);
+        len = vsnprintf((buf->buf != NULL)? buf->buf + buf->len : NULL,
+                        buf->cap - buf->len, fmt, ap);
+        va_end(ap);
+        if (len < 0)
+        {
+            return;
+        }
+        if ((size_t)len < buf->cap - buf->len)
+        {
+            break;
+        }
+
+        /* grow by doubling */
+        cap = (buf->cap > 0)? buf->cap * 2 : 4096;
+        while (cap - buf->len <= (size_t)len)
+        {
+            cap *= 2;
+        }
+        new_buf = realloc(buf->buf, cap);
+        if (new_buf == NULL)
+        {
+            return;
+        }
+        buf->buf = new_buf;
+        buf->cap = cap;
+    }
+    buf->len += len;
+
+    return;
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static void *metr_thread(void *arg)
+{
+    int fd;
+    metr_buf_t buf;
+
+    for (;;)
+    {
+        fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            /* shut down by metr_deinit() */
+            break;
+        }
+
+        memset(&buf, 0, sizeof(buf));
+        metr_collect(&buf);
+        metr_collect_conns(&buf);
+        metr_write(fd, buf.buf, buf.len);
+        free(buf.buf);
+        close(fd);
+    }
+    T_M(T_D2, 0x4a070100, "admin thread finished.\n");
+
+    return(NULL);
+}
+
+/*----------------------------------------------------------------------*/
+static void metr_collect(metr_buf_t *buf)
+{
+    int idx;
+    int cnt;
+    int n;
+    int top;
+    unsigned long long sum;
+    unsigned long long num;
+    unsigned long long val[METR_HIST_BUCKETS];
+
+    /* counters in total, then by worker */
+    for (idx = 0; idx < METR_COUNTERS; idx++)
+    {
+        sum = 0;
+        for (cnt = 0; cnt < metrs_num; cnt++)
+        {
+            sum += atomic_load_explicit(&metrs[cnt].cnt[idx], memory_order_relaxed);
+        }
+        metr_printf(buf, "%s %llu\n", cnt_names[idx], sum);
+        for (cnt = 0; cnt < metrs_num; cnt++)
+        {
+            metr_printf(buf, "%s{worker=\"%d\"} %llu\n", cnt_names[idx], cnt,
+                        atomic_load_explicit(&metrs[cnt].cnt[idx], memory_order_relaxed));
+        }
+    }
+
+    /* histograms of all workers with cumulative buckets */
+    for (idx = 0; idx < METR_HISTS; idx++)
+    {
+        memset(val, 0, sizeof(val));
+        sum = 0;
+        for (cnt = 0; cnt < metrs_num; cnt++)
+        {
+            for (n = 0; n < METR_HIST_BUCKETS; n++)
+            {
+                val[n] += atomic_load_explicit(&metrs[cnt].hist[idx].bucket[n],
+                                               memory_order_relaxed);
+            }
+            sum += atomic_load_explicit(&metrs[cnt].hist[idx].sum, memory_order_relaxed);
+        }
+        /* buckets above the largest value are left to +Inf */
+        for (top = METR_HIST_BUCKETS - 1; top > 0 && val[top] == 0; top--)
+        {
+            ;
+        }
+        num = 0;
+        for (n = 0; n <= top && n < METR_HIST_BUCKETS - 1; n++)
+        {
+            num += val[n];
+            metr_printf(buf, "%s_bucket{le=\"%llu\"} %llu\n", hist_names[idx],
+                        (1ULL << n) - 1, num);
+        }
+        for (; n < METR_HIST_BUCKETS; n++)
+        {
+            num += val[n];
+        }
+        metr_printf(buf, "%s_bucket{le=\"+Inf\"} %llu\n", hist_names[idx], num);
+        metr_printf(buf, "%s_sum %llu\n", hist_names[idx], sum);
+        metr_printf(buf, "%s_count %llu\n", hist_names[idx], num);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void metr_collect_conns(metr_buf_t *buf)
+{
+    int cnt;
+    int ret = 0;
+    int waiting;
+    struct timespec ts;
+
+    /* ask all workers at once */
+    pthread_mutex_lock(&lock);
+    for (cnt = 0; cnt < metrs_num; cnt++)
+    {
+        metrs[cnt].report = NULL;
+        atomic_store(&metrs[cnt].want, 1);
+    }
+    pthread_mutex_unlock(&lock);
+    for (cnt = 0; cnt < metrs_num; cnt++)
+    {
+        wrk_wake(cnt);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += METR_REPORT_TIMEOUT / 1000;
+    ts.tv_nsec += (METR_REPORT_TIMEOUT % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&lock);
+    for (;;)
+    {
+        waiting = 0;
+        for (cnt = 0; cnt < metrs_num; cnt++)
+        {
+            waiting += atomic_load(&metrs[cnt].want);
+        }
+        if (waiting == 0 || ret != 0)
+        {
+            break;
+        }
+        ret = pthread_cond_timedwait(&cond, &lock, &ts);
+    }
+
+    /* late reports are discarded by the workers */
+    for (cnt = 0; cnt < metrs_num; cnt++)
+    {
+        if (atomic_load(&metrs[cnt].want))
+        {
+            T_MR(T_W, 0x8a090100, "worker %d did not report connections.\n", cnt);
+            atomic_store(&metrs[cnt].want, 0);
+        }
+        if (metrs[cnt].report != NULL)
+        {
+            metr_printf(buf, "%s", metrs[cnt].report);
+            free(metrs[cnt].report);
+            metrs[cnt].report = NULL;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void metr_write(int fd, const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0)
+    {
+        /* the reader may have gone */
+        ret = send(fd, buf, len, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            T_M(T_W, 0x8a0a0100, "cannot write metrics: %s.\n", strerror(errno));
+            return;
+        }
+        buf += ret;
+        len -= ret;
+    }
+
+    return;
+}
+
+/* end of metr.c */
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for metrics module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Each worker counts into its own counters and histograms, which only the
+ * worker writes, so updates take neither locks nor atomic read-modify-write.
+ * An admin thread sums them up and writes them in plain text to whoever
+ * connects to a local Unix socket.
+ */
+#ifndef __METR_H_
+#define __METR_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "main.h"
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def METR_HIST_BUCKETS
+ * @brief Number of histogram buckets.
+ *
+ * Bucket n counts values of n bits, that is from 2^(n-1) to 2^n - 1 ns.
+ * The last bucket also counts larger values.
+ */
+#define METR_HIST_BUCKETS 40
+
+/**
+ * @def METR_REPORT_TIMEOUT
+ * @brief Milliseconds to wait for workers to report their connections.
+ */
+#define METR_REPORT_TIMEOUT 1000
+
+/**
+ * @enum
+ *      counters.
+ */
+enum metr_counter
+{
+    METR_ACCEPTS   = 0,         /**< accepted connections */
+    METR_CLOSES,                /**< closed connections */
+    METR_BYTES_IN,              /**< bytes received */
+    METR_BYTES_OUT,             /**< bytes sent */
+    METR_MSGS_IN,               /**< lines received */
+    METR_MSGS_OUT,              /**< messages queued to clients */
+    METR_QUEUED,                /**< bytes in outbound queues (gauge) */
+    METR_QUEUED_MSGS,           /**< messages in outbound queues (gauge) */
+    METR_RATE_PAUSES,           /**< reads paused by the rate limit */
+    METR_RATE_DROPS,            /**< lines dropped by the rate limit */
+    METR_COUNTERS,              /**< number of counters */
+};
+
+/**
+ * @enum
+ *      histograms.
+ */
+enum metr_hist
+{
+    METR_FANOUT    = 0,         /**< receive to queued for the last recipient */
+    METR_LOOP,                  /**< event loop iteration excluding wait */
+    METR_HISTS,                 /**< number of histograms */
+};
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @struct
+ *      histogram in ns.
+ */
+typedef struct metr_hist_strct {
+    atomic_ullong bucket[METR_HIST_BUCKETS]; /**< counts of values */
+    atomic_ullong sum;          /**< sum of values */
+} metr_hist_t;
+
+/**
+ * @struct
+ *      metrics of a worker.
+ */
+typedef struct metr_strct {
+    _Alignas(64)
+    atomic_ullong cnt[METR_COUNTERS]; /**< counters */
+    metr_hist_t   hist[METR_HISTS];   /**< histograms */
+    atomic_int    want;         /**< report of connections requested */
+    char         *report;       /**< report of connections, NULL when none */
+} metr_t;
+
+/**
+ * @struct
+ *      growing text buffer.
+ */
+typedef struct metr_buf_strct {
+    char  *buf;                 /**< text, NULL until something is written */
+    size_t len;                 /**< length of text */
+    size_t cap;                 /**< size of buf */
+} metr_buf_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+/** metrics of the calling worker, NULL when not attached */
+extern __thread metr_t *metr_self;
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Metrics module init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * The admin socket is created at opr->metr_path unless it is empty.
+ */
+int metr_init(opr_t *opr);
+
+/**
+ * @brief       Metrics module de-init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ */
+void metr_deinit(opr_t *opr);
+
+/**
+ * @brief       Attach metrics of a worker to the calling thread.
+ * @param[in] id Worker ID.
+ */
+void metr_attach(int id);
+
+/**
+ * @brief       Add to a counter of the calling worker.
+ * @param[in] idx Counter (METR_*).
+ * @param[in] n Value to add, may be minus for gauges.
+ */
+static inline void metr_add(int idx, long long n)
+{
+    atomic_ullong *p;
+
+    if (metr_self == NULL)
+    {
+        return;
+    }
+    p = &metr_self->cnt[idx];
+
+    /* the worker is the only writer */
+    atomic_store_explicit(p, atomic_load_explicit(p, memory_order_relaxed) +
+                          (unsigned long long)n, memory_order_relaxed);
+
+    return;
+}
+
+/**
+ * @brief       Put a value to a histogram of the calling worker.
+ * @param[in] idx Histogram (METR_FANOUT or METR_LOOP).
+ * @param[in] ns Value in ns.
+ */
+void metr_hist(int idx, unsigned long long ns);
+
+/**
+ * @brief       Check if a report of connections is requested.
+ * @return      Returns non-zero when requested.
+ *
+ * Call this on each worker when it is woken up by wrk_wake().
+ */
+static inline int metr_wanted(void)
+{
+    return(metr_self != NULL &&
+           atomic_load_explicit(&metr_self->want, memory_order_acquire));
+}
+
+/**
+ * @brief       Pass a report of connections to the admin thread.
+ * @param[in,out] buf Report, taken over by this function.
+ */
+void metr_publish(metr_buf_t *buf);
+
+/**
+ * @brief       Append formatted text.
+ * @param[in,out] buf Buffer.
+ * @param[in] fmt Format string of printf(3).
+ *
+ * Nothing is appended when the buffer cannot be grown.
+ */
+void metr_printf(metr_buf_t *buf, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif  /* #ifndef __METR_H_ */
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Message module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Reference counted immutable messages.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "msg.h"
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static __thread msg_t *pool;            /* free pieces linked by next */
+static __thread unsigned int pool_num;  /* number of free pieces */
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+msg_t *msg_new(const char *data, size_t len)
+{
+    msg_t *msg;
+
+    msg = malloc(sizeof(*msg) + len);
+    if (msg == NULL)
+    {
+        T_MR(T_W, 0x84010100, "cannot allocate message of %lu bytes.\n", (unsigned long)len);
+        return(NULL);
+    }
+    atomic_init(&msg->ref, 1);
+    msg->len  = (unsigned int)len;
+    msg->rlen = 0;
+    msg->seq  = 0;
+    msg->next = NULL;
+    msg->ingress = 0;
+    atomic_init(&msg->pending, 0);
+    msg->sid    = 0;
+    msg->part   = 0;
+    msg->pooled = 0;
+    if (data != NULL)
+    {
+        memcpy(msg->data, data, len);
+    }
+
+    return(msg);
+}
+
+/*----------------------------------------------------------------------*/
+msg_t *msg_chat(const char *room, size_t rlen, const char *prefix, size_t plen,
+                const char *text, size_t len)
+{
+    msg_t *msg;
+
+    msg = msg_new(NULL, plen + len + rlen);
+    if (msg == NULL)
+    {
+        return(NULL);
+    }
+
+    /* room name follows data to be routed by the other workers */
+    msg->len  = (unsigned int)(plen + len);
+    msg->rlen = (unsigned int)rlen;
+    memcpy(msg->data + msg->len, room, rlen);
+
+    /* "[name] text" */
+    memcpy(msg->data, prefix, plen);
+    memcpy(msg->data + plen, text, len);
+
+    return(msg);
+}
+
+/*----------------------------------------------------------------------*/
+msg_t *msg_piece(unsigned long long sid, unsigned int part, const char *text, size_t len)
+{
+    msg_t *msg;
+
+    if (pool != NULL)
+    {
+        msg  = pool;
+        pool = msg->next;
+        pool_num--;
+    }
+    else
+    {
+        msg = malloc(sizeof(*msg) + MSG_CHUNK);
+        if (msg == NULL)
+        {
+            T_MR(T_W, 0x84050100, "cannot allocate piece of a message.\n");
+            return(NULL);
+        }
+    }
+    atomic_init(&msg->ref, 1);
+    msg->len  = (unsigned int)len;
+    msg->rlen = 0;
+    msg->seq  = 0;
+    msg->next = NULL;
+    msg->ingress = 0;
+    atomic_init(&msg->pending, 0);
+    msg->sid    = sid;
+    msg->part   = (unsigned char)part;
+    msg->pooled = 1;
+    memcpy(msg->data, text, len);
+
+    return(msg);
+}
+
+/*----------------------------------------------------------------------*/
+void msg_pool_drain(void)
+{
+    msg_t *msg;
+
+    while (pool != NULL)
+    {
+        msg  = pool;
+        pool = msg->next;
+        free(msg);
+    }
+    pool_num = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+msg_t *msg_stamp(const msg_t *msg)
+{
+    int hlen;
+    msg_t *alt;
+    char head[24];
+
+    hlen = snprintf(head, sizeof(head), "#%llu ", msg->seq);
+    alt  = msg_new(NULL, hlen + msg->len + msg->rlen);
+    if (alt == NULL)
+    {
+        return(NULL);
+    }
+
+    /* "#seq " data room */
+    memcpy(alt->data, head, hlen);
+    memcpy(alt->data + hlen, msg->data, msg->len + msg->rlen);
+    alt->len  = hlen + msg->len;
+    alt->rlen = msg->rlen;
+    alt->seq  = msg->seq;
+
+    return(alt);
+}
+
+/*----------------------------------------------------------------------*/
+void msg_unref(msg_t *msg)
+{
+    if (atomic_fetch_sub_explicit(&msg->ref, 1, memory_order_acq_rel) == 1)
+    {
+        /* pieces go back to the pool of the releasing thread */
+        if (msg->pooled && pool_num < MSG_POOL_MAX)
+        {
+            msg->next = pool;
+            pool = msg;
+            pool_num++;
+            return;
+        }
+        free(msg);
+    }
+
+    return;
+}
+
+/* end of msg.c */
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for message module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * A message is formatted once and shared by outbound queues of all
+ * recipients with a reference counter.  The message is immutable after
+ * it is queued and freed when the last reference is released.
+ *
+ * A line longer than a message is relayed as pieces of one stream.
+ * The first piece carries the name and the room, the others only text,
+ * and the last one ends with CRLF.  Pieces are taken from a per-thread
+ * pool of MSG_CHUNK bytes, so a long line costs memory only while its
+ * pieces are queued.
+ */
+#ifndef __MSG_H_
+#define __MSG_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def MSG_CHUNK
+ * @brief Max bytes of text in a piece of a long line.
+ */
+#define MSG_CHUNK       (16*1024)
+
+/**
+ * @def MSG_POOL_MAX
+ * @brief Max number of free pieces kept by a thread.
+ */
+#define MSG_POOL_MAX    64
+
+/**
+ * @enum MSG_PART
+ * @brief Position of a piece in a stream.
+ */
+enum MSG_PART
+{
+    MSG_FIRST = 0x01,           /**< first piece, with name and room */
+    MSG_LAST  = 0x02,           /**< last piece, ends with CRLF */
+};
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @struct
+ *      shared message.
+ */
+typedef struct msg_strct {
+    atomic_uint  ref;           /**< reference counter */
+    unsigned int len;           /**< length of data */
+    unsigned int rlen;          /**< length of room name stored after data */
+    unsigned long long seq;     /**< sequence number, 0 when not stamped */
+    struct msg_strct *next;     /**< next free piece in the pool */
+    unsigned long long ingress; /**< time received in ns, 0 when not measured */
+    atomic_int   pending;       /**< workers yet to fan out the message */
+    unsigned long long sid;     /**< stream of a piece, 0 for a whole message */
+    unsigned char part;         /**< MSG_PART of a piece */
+    unsigned char pooled;       /**< taken from the pool of pieces */
+    char         data[];        /**< message */
+} msg_t;
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Create a message.
+ * @param[in] data Message data.
+ * @param[in] len Length of data.
+ * @return      Returns message with one reference, NULL on any error.
+ */
+msg_t *msg_new(const char *data, size_t len);
+
+/**
+ * @brief       Create a chat message "[name] text" to a room.
+ * @param[in] room Room name.
+ * @param[in] rlen Length of room, 0 for the lobby.
+ * @param[in] prefix "[name] " of the client.
+ * @param[in] plen Length of prefix.
+ * @param[in] text Text including CRLF.
+ * @param[in] len Length of text.
+ * @return      Returns message with one reference, NULL on any error.
+ */
+msg_t *msg_chat(const char *room, size_t rlen, const char *prefix, size_t plen,
+                const char *text, size_t len);
+
+/**
+ * @brief       Create a piece of a long line.
+ * @param[in] sid Stream ID.
+ * @param[in] part MSG_PART of the piece.
+ * @param[in] text Text.
+ * @param[in] len Length of text, MSG_CHUNK at most.
+ * @return      Returns message with one reference, NULL on any error.
+ */
+msg_t *msg_piece(unsigned long long sid, unsigned int part, const char *text, size_t len);
+
+/**
+ * @brief       Free pieces pooled by the calling thread.
+ */
+void msg_pool_drain(void);
+
+/**
+ * @brief       Make a copy of a message stamped with its sequence number.
+ * @param[in] msg Message with msg->seq.
+ * @return      Returns message with one reference, NULL on any error.
+ *
+ * The copy is prefixed with "#seq " to be sent to clients with sessions.
+ * It is made only when such a client receives msg.
+ */
+msg_t *msg_stamp(const msg_t *msg);
+
+/**
+ * @brief       Get the room of a message.
+ * @param[in] msg Message.
+ * @return      Returns room name of msg->rlen bytes, not NUL terminated.
+ */
+static inline const char *msg_room(const msg_t *msg)
+{
+    return(msg->data + msg->len);
+}
+
+/**
+ * @brief       Add a reference.
+ * @param[in] msg Message.
+ * @return      Returns msg.
+ */
+static inline msg_t *msg_ref(msg_t *msg)
+{
+    atomic_fetch_add_explicit(&msg->ref, 1, memory_order_relaxed);
+    return(msg);
+}
+
+/**
+ * @brief       Release a reference.
+ * @param[in] msg Message, freed when this is the last reference.
+ */
+void msg_unref(msg_t *msg);
+
+#endif  /* #ifndef __MSG_H_ */
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Nickname module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Nicknames are shared by all workers in a hash table under a lock.
+ * They are touched only by /nick, /msg and disconnections.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "main.h"
+#include "nick.h"
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* registered nickname */
+typedef struct nick_ent_strct {
+    struct nick_ent_strct *hnext; /* next entry in the hash chain */
+    nick_owner_t owner;         /* connection holding the name */
+    unsigned int hash;          /* hash of name */
+    unsigned int len;           /* length of name */
+    char         name[];        /* interned name, NUL terminated */
+} nick_ent_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* lock of nicknames */
+static nick_ent_t    **buckets;                 /* heads of hash chains */
+static unsigned int    bucket_num;              /* number of buckets (power of 2) */
+static unsigned int    nick_num;                /* number of nicknames */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static unsigned int nick_hash(const char *name, size_t len);
+static nick_ent_t **nick_link(const char *name, size_t len, unsigned int hash);
+static void nick_grow(void);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int nick_init(opr_t *opr)
+{
+    buckets = calloc(NICK_INIT_BUCKETS, sizeof(*buckets));
+    if (buckets == NULL)
+    {
+        T_M(T_E, 0x8c010100, "cannot allocate nicknames.\n");
+        return(0x8c010100);
+    }
+    bucket_num = NICK_INIT_BUCKETS;
+    nick_num   = 0;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void nick_deinit(opr_t *opr)
+{
+    unsigned int cnt;
+    nick_ent_t *ent;
+
+    if (buckets == NULL)
+    {
+        return;
+    }
+
+    /* connections release theirs on close, left ones are freed here */
+    for (cnt = 0; cnt < bucket_num; cnt++)
+    {
+        while ((ent = buckets[cnt]) != NULL)
+        {
+            buckets[cnt] = ent->hnext;
+            free(ent);
+        }
+    }
+    free(buckets);
+    buckets    = NULL;
+    bucket_num = 0;
+    nick_num   = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int nick_valid(const char *name, size_t len)
+{
+    size_t cnt;
+
+    if (len == 0 || len >= NICK_MAX)
+    {
+        return(0);
+    }
+    for (cnt = 0; cnt < len; cnt++)
+    {
+        if (!isalnum((unsigned char)name[cnt]) && name[cnt] != '_' && name[cnt] != '-')
+        {
+            return(0);
+        }
+    }
+
+    return(1);
+}
+
+/*----------------------------------------------------------------------*/
+int nick_claim(const char *name, size_t len, const nick_owner_t *owner, const char **nick)
+{
+    unsigned int hash;
+    nick_ent_t **link;
+    nick_ent_t *ent;
+
+    hash = nick_hash(name, len);
+
+    pthread_mutex_lock(&lock);
+    link = nick_link(name, len, hash);
+    if (*link != NULL)
+    {
+        ent = *link;
+        if (ent->owner.wrk != owner->wrk || ent->owner.id != owner->id ||
+            ent->owner.gen != owner->gen)
+        {
+            pthread_mutex_unlock(&lock);
+            return(1);
+        }
+
+        /* already held by the caller */
+        pthread_mutex_unlock(&lock);
+        *nick = ent->name;
+        return(0);
+    }
+
+    ent = malloc(sizeof(*ent) + len + 1);
+    if (ent == NULL)
+    {
+        pthread_mutex_unlock(&lock);
+        T_M(T_W, 0x8c040100, "cannot allocate nickname.\n");
+        return(0x8c040100);
+    }
+    ent->owner = *owner;
+    ent->hash  = hash;
+    ent->len   = (unsigned int)len;
+    memcpy(ent->name, name, len);
+    ent->name[len] = '\0';
+    ent->hnext = NULL;
+    *link = ent;
+    nick_num++;
+    if (nick_num > bucket_num)
+    {
+        nick_grow();
+    }
+    pthread_mutex_unlock(&lock);
+    T_M(T_D1, 0x0c040200, "%s is held by conns[%u] of worker %d.\n",
+        ent->name, owner->id, owner->wrk);
+
+    *nick = ent->name;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void nick_release(const char *nick)
+{
+    size_t len;
+    nick_ent_t **link;
+    nick_ent_t *ent;
+
+    len = strlen(nick);
+
+    pthread_mutex_lock(&lock);
+    link = nick_link(nick, len, nick_hash(nick, len));
+    ent  = *link;
+    if (ent != NULL && ent->name == nick)
+    {
+        *link = ent->hnext;
+        nick_num--;
+        free(ent);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int nick_find(const char *name, size_t len, nick_owner_t *owner)
+{
+    nick_ent_t **link;
+
+    pthread_mutex_lock(&lock);
+    link = nick_link(name, len, nick_hash(name, len));
+    if (*link == NULL)
+    {
+        pthread_mutex_unlock(&lock);
+        return(0x8c060100);
+    }
+    *owner = (*link)->owner;
+    pthread_mutex_unlock(&lock);
+
+    return(0);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static unsigned int nick_hash(const char *name, size_t len)
+{
+    size_t cnt;
+    unsigned int hash = 2166136261U; /* FNV-1a */
+
+    for (cnt = 0; cnt < len; cnt++)
+    {
+        hash = (hash ^ (unsigned char)name[cnt]) * 16777619U;
+    }
+
+    return(hash);
+}
+
+/*----------------------------------------------------------------------*/
+static nick_ent_t **nick_link(const char *name, size_t len, unsigned int hash)
+{
+    nick_ent_t **link;
+
+    /* returns the link to the entry, or the end of the chain */
+    for (link = &buckets[hash & (bucket_num - 1)]; *link != NULL; link = &(*link)->hnext)
+    {
+        if ((*link)->hash == hash && (*link)->len == len && memcmp((*link)->name, name, len) == 0)
+        {
+            break;
+        }
+    }
+
+    return(link);
+}
+
+/*----------------------------------------------------------------------*/
+static void nick_grow(void)
+{
+    unsigned int cnt;
+    unsigned int num = bucket_num * 2;
+    nick_ent_t **new_buckets;
+    nick_ent_t *ent;
+
+    new_buckets = calloc(num, sizeof(*new_buckets));
+    if (new_buckets == NULL)
+    {
+        /* longer chains still work */
+        T_M(T_W, 0x8c090100, "cannot grow nicknames to %u buckets.\n", num);
+        return;
+    }
+
+    for (cnt = 0; cnt < bucket_num; cnt++)
+    {
+        while ((ent = buckets[cnt]) != NULL)
+        {
+            buckets[cnt] = ent->hnext;
+            ent->hnext = new_buckets[ent->hash & (num - 1)];
+            new_buckets[ent->hash & (num - 1)] = ent;
+        }
+    }
+    free(buckets);
+    buckets    = new_buckets;
+    bucket_num = num;
+
+    return;
+}
+
+/* end of nick.c */
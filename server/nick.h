@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for nickname module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Nicknames are unique over all workers.  Each name is stored once in
+ * the registry and connections keep the interned pointer until they
+ * release it.
+ */
+#ifndef __NICK_H_
+#define __NICK_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+
+#include "main.h"
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def NICK_MAX
+ * @brief Max length of nicknames including terminating NUL.
+ */
+#define NICK_MAX        32
+
+/**
+ * @def NICK_INIT_BUCKETS
+ * @brief Initial number of hash buckets (power of 2).
+ *
+ * The buckets are doubled when nicknames outnumber them.
+ */
+#define NICK_INIT_BUCKETS 256
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @struct
+ *      connection holding a nickname.
+ */
+typedef struct nick_owner_strct {
+    int           wrk;          /**< worker ID */
+    unsigned int  id;           /**< connection ID in the worker */
+    unsigned int  gen;          /**< generation of the connection */
+} nick_owner_t;
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Nickname module init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ * @return      Returns 0 on success, minus value on any error.
+ */
+int nick_init(opr_t *opr);
+
+/**
+ * @brief       Nickname module de-init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ */
+void nick_deinit(opr_t *opr);
+
+/**
+ * @brief       Check if a name can be a nickname.
+ * @param[in] name Name.
+ * @param[in] len Length of name.
+ * @return      Returns 1 when name is 1 to NICK_MAX-1 letters, digits,
+ *              '_' and '-'.  Returns 0 otherwise.
+ */
+int nick_valid(const char *name, size_t len);
+
+/**
+ * @brief       Register a nickname.
+ * @param[in] name Nickname.
+ * @param[in] len Length of name.
+ * @param[in] owner Connection to hold the nickname.
+ * @param[out] nick Interned nickname, valid until nick_release().
+ * @return      Returns 0 on success, 1 when another connection holds the
+ *              nickname.  Returns minus value on any error.
+ */
+int nick_claim(const char *name, size_t len, const nick_owner_t *owner, const char **nick);
+
+/**
+ * @brief       Release a nickname.
+ * @param[in] nick Interned nickname returned by nick_claim().
+ */
+void nick_release(const char *nick);
+
+/**
+ * @brief       Find the connection holding a nickname.
+ * @param[in] name Nickname.
+ * @param[in] len Length of name.
+ * @param[out] owner Connection holding the nickname.
+ * @return      Returns 0 on success, minus value when nobody holds it.
+ */
+int nick_find(const char *name, size_t len, nick_owner_t *owner);
+
+#endif  /* #ifndef __NICK_H_ */
@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Chat room module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Rooms are found by name with a hash map and keep their members in a
+ * dense array, so a message is passed only to the members of its room.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "room.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define ROOM_NIL        ((unsigned int)-1) /* end of lists, not in a room */
+#define ROOM_LOBBY      0                  /* index of the lobby */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* room */
+typedef struct room_strct {
+    unsigned int  next;         /* next room in the hash chain,
+                                   next free room when free */
+    unsigned int  used;         /* in use */
+    unsigned int *mem;          /* dense array of member connection IDs */
+    unsigned int  num;          /* number of members */
+    unsigned int  cap;          /* size of mem */
+    unsigned int  nlen;         /* length of name */
+    char          name[ROOM_MAX_NAME]; /* room name */
+} room_t;
+
+/* room of a connection */
+typedef struct room_memb_strct {
+    unsigned int room;          /* room index, ROOM_NIL when not in a room */
+    unsigned int pos;           /* index in mem of the room */
+} room_memb_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private (each worker has its own rooms)
+ *------------------------------*/
+static __thread room_t *rooms;           /* room table */
+static __thread unsigned int *buckets;   /* heads of hash chains */
+static __thread unsigned int room_cap;   /* size of rooms and buckets (power of 2) */
+static __thread unsigned int room_vacant; /* head of free room list */
+static __thread room_memb_t *memb;       /* rooms of connections */
+static __thread unsigned int memb_num;   /* size of memb */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static unsigned int room_hash(const char *name, size_t len);
+static unsigned int room_find(const char *name, size_t len);
+static unsigned int room_create(const char *name, size_t len);
+static void room_free(unsigned int idx);
+static int room_grow(void);
+static int room_add(unsigned int idx, unsigned int id);
+static void room_remove(unsigned int idx, unsigned int pos);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int room_init(void)
+{
+    rooms       = NULL;
+    buckets     = NULL;
+    room_cap    = 0;
+    room_vacant = ROOM_NIL;
+    memb        = NULL;
+    memb_num    = 0;
+
+    if (room_grow() < 0)
+    {
+        return(0x86010100);
+    }
+
+    /* the lobby is the first room and never freed */
+    if (room_create("", 0) != ROOM_LOBBY)
+    {
+        T_M(T_E, 0x86010200, "cannot create the lobby.\n");
+        return(0x86010200);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void room_deinit(void)
+{
+    unsigned int cnt;
+
+    for (cnt = 0; cnt < room_cap; cnt++)
+    {
+        free(rooms[cnt].mem);
+    }
+    free(rooms);
+    free(buckets);
+    free(memb);
+    rooms    = NULL;
+    buckets  = NULL;
+    memb     = NULL;
+    room_cap = 0;
+    memb_num = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int room_join(unsigned int id, const char *name, size_t len)
+{
+    int ret;
+    unsigned int idx;
+    unsigned int num;
+    room_memb_t old;
+    room_memb_t *new_memb;
+
+    if (len >= ROOM_MAX_NAME)
+    {
+        T_M(T_W, 0x86030100, "too long room name: %.*s.\n", (int)len, name);
+        return(0x86030100);
+    }
+
+    if (id >= memb_num)
+    {
+        /* connection table has grown */
+        num = (memb_num > 0)? memb_num : ROOM_INIT_MEMB;
+        while (num <= id)
+        {
+            num *= 2;
+        }
+        new_memb = realloc(memb, sizeof(*memb) * num);
+        if (new_memb == NULL)
+        {
+            T_M(T_W, 0x86030200, "cannot grow member table to %u.\n", num);
+            return(0x86030200);
+        }
+        memb = new_memb;
+        for (; memb_num < num; memb_num++)
+        {
+            memb[memb_num].room = ROOM_NIL;
+        }
+    }
+
+    idx = room_find(name, len);
+    if (idx != ROOM_NIL && idx == memb[id].room)
+    {
+        /* already there */
+        return(0);
+    }
+    if (idx == ROOM_NIL)
+    {
+        idx = room_create(name, len);
+        if (idx == ROOM_NIL)
+        {
+            return(0x86030300);
+        }
+        T_M(T_D1, 0x06030380, "room %.*s created.\n", (int)len, name);
+    }
+
+    /* stay in the current room when the new one cannot take us */
+    old = memb[id];
+    ret = room_add(idx, id);
+    if (ret < 0)
+    {
+        if (rooms[idx].num == 0 && idx != ROOM_LOBBY)
+        {
+            room_free(idx);
+        }
+        return(ret);
+    }
+    room_remove(old.room, old.pos);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int room_part(unsigned int id)
+{
+    return(room_join(id, "", 0));
+}
+
+/*----------------------------------------------------------------------*/
+void room_leave(unsigned int id)
+{
+    if (id < memb_num)
+    {
+        room_remove(memb[id].room, memb[id].pos);
+        memb[id].room = ROOM_NIL;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+const char *room_name(unsigned int id, size_t *len)
+{
+    room_t *r;
+
+    if (id >= memb_num || memb[id].room == ROOM_NIL)
+    {
+        *len = 0;
+        return(NULL);
+    }
+
+    r = &rooms[memb[id].room];
+    *len = r->nlen;
+
+    return(r->name);
+}
+
+/*----------------------------------------------------------------------*/
+const unsigned int *room_members(const char *name, size_t len, unsigned int *num)
+{
+    unsigned int idx;
+
+    idx = room_find(name, len);
+    if (idx == ROOM_NIL)
+    {
+        *num = 0;
+        return(NULL);
+    }
+
+    *num = rooms[idx].num;
+
+    return(rooms[idx].mem);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static unsigned int room_hash(const char *name, size_t len)
+{
+    size_t cnt;
+    unsigned int hash = 2166136261U; /* FNV-1a */
+
+    for (cnt = 0; cnt < len; cnt++)
+    {
+        hash = (hash ^ (unsigned char)name[cnt]) * 16777619U;
+    }
+
+    return(hash & (room_cap - 1));
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned int room_find(const char *name, size_t len)
+{
+    unsigned int idx;
+
+    if (len >= ROOM_MAX_NAME)
+    {
+        return(ROOM_NIL);
+    }
+
+    for (idx = buckets[room_hash(name, len)]; idx != ROOM_NIL; idx = rooms[idx].next)
+    {
+        if (rooms[idx].nlen == len && memcmp(rooms[idx].name, name, len) == 0)
+        {
+            return(idx);
+        }
+    }
+
+    return(ROOM_NIL);
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned int room_create(const char *name, size_t len)
+{
+    unsigned int idx;
+    unsigned int hash;
+
+    if (room_vacant == ROOM_NIL && room_grow() < 0)
+    {
+        return(ROOM_NIL);
+    }
+
+    idx = room_vacant;
+    room_vacant = rooms[idx].next;
+
+    rooms[idx].used = 1;
+    rooms[idx].num  = 0;
+    rooms[idx].nlen = (unsigned int)len;
+    memcpy(rooms[idx].name, name, len);
+    rooms[idx].name[len] = '\0';
+
+    hash = room_hash(name, len);
+    rooms[idx].next = buckets[hash];
+    buckets[hash]   = idx;
+
+    return(idx);
+}
+
+/*----------------------------------------------------------------------*/
+static void room_free(unsigned int idx)
+{
+    unsigned int *link;
+
+    T_M(T_D1, 0x46040100, "room %s freed.\n", rooms[idx].name);
+
+    /* unlink from the hash chain */
+    for (link = &buckets[room_hash(rooms[idx].name, rooms[idx].nlen)];
+         *link != idx; link = &rooms[*link].next)
+    {
+        ;
+    }
+    *link = rooms[idx].next;
+
+    free(rooms[idx].mem);
+    rooms[idx].mem  = NULL;
+    rooms[idx].cap  = 0;
+    rooms[idx].used = 0;
+    rooms[idx].next = room_vacant;
+    room_vacant = idx;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int room_grow(void)
+{
+    unsigned int cnt;
+    unsigned int cap;
+    unsigned int hash;
+    room_t *new_rooms;
+    unsigned int *new_buckets;
+
+    cap = (room_cap > 0)? room_cap * 2 : ROOM_INIT_NUM;
+
+    new_rooms = realloc(rooms, sizeof(*rooms) * cap);
+    if (new_rooms == NULL)
+    {
+        T_M(T_W, 0xc6050100, "cannot grow room table to %u.\n", cap);
+        return(0xc6050100);
+    }
+    rooms = new_rooms;
+
+    new_buckets = realloc(buckets, sizeof(*buckets) * cap);
+    if (new_buckets == NULL)
+    {
+        T_M(T_W, 0xc6050200, "cannot grow room hash to %u.\n", cap);
+        return(0xc6050200);
+    }
+    buckets = new_buckets;
+
+    /* push new rooms to the free list keeping lower ones first */
+    memset(&rooms[room_cap], 0, sizeof(*rooms) * (cap - room_cap));
+    for (cnt = cap; cnt > room_cap; cnt--)
+    {
+        rooms[cnt-1].next = room_vacant;
+        room_vacant = cnt-1;
+    }
+    room_cap = cap;
+
+    /* rehash rooms in use */
+    memset(buckets, 0xFF, sizeof(*buckets) * cap);
+    for (cnt = 0; cnt < cap; cnt++)
+    {
+        if (rooms[cnt].used)
+        {
+            hash = room_hash(rooms[cnt].name, rooms[cnt].nlen);
+            rooms[cnt].next = buckets[hash];
+            buckets[hash]   = cnt;
+        }
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int room_add(unsigned int idx, unsigned int id)
+{
+    room_t *r = &rooms[idx];
+    unsigned int cap;
+    unsigned int *mem;
+
+    if (r->num == r->cap)
+    {
+        cap = (r->cap > 0)? r->cap * 2 : ROOM_INIT_MEMB;
+        mem = realloc(r->mem, sizeof(*mem) * cap);
+        if (mem == NULL)
+        {
+            T_M(T_W, 0xc6060100, "cannot grow members of room %s to %u.\n", r->name, cap);
+            return(0xc6060100);
+        }
+        r->mem = mem;
+        r->cap = cap;
+    }
+
+    memb[id].room = idx;
+    memb[id].pos  = r->num;
+    r->mem[r->num++] = id;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void room_remove(unsigned int idx, unsigned int pos)
+{
+    room_t *r;
+
+    if (idx == ROOM_NIL)
+    {
+        return;
+    }
+    r = &rooms[idx];
+
+    /* move the last member into the hole */
+    r->num--;
+    if (pos != r->num)
+    {
+        r->mem[pos] = r->mem[r->num];
+        memb[r->mem[pos]].pos = pos;
+    }
+
+    if (r->num == 0 && idx != ROOM_LOBBY)
+    {
+        room_free(idx);
+    }
+
+    return;
+}
+
+/* end of room.c */
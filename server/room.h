@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for chat room module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Each connection is a member of one room.  Connections which have not
+ * joined any room are members of the lobby whose name is empty, so the
+ * lobby works as the single global room.
+ * Rooms are kept per worker thread like connections.
+ */
+#ifndef __ROOM_H_
+#define __ROOM_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def ROOM_MAX_NAME
+ * @brief Max length of room names including terminating NUL.
+ */
+#define ROOM_MAX_NAME   32
+
+/**
+ * @def ROOM_INIT_NUM
+ * @brief Initial number of rooms (power of 2).
+ *
+ * The room table and the hash buckets are doubled when they run out.
+ */
+#define ROOM_INIT_NUM   16
+
+/**
+ * @def ROOM_INIT_MEMB
+ * @brief Initial size of a member array.
+ */
+#define ROOM_INIT_MEMB  8
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Room module init.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * This function creates the lobby.  Call this on each worker thread.
+ */
+int room_init(void);
+
+/**
+ * @brief       Room module de-init.
+ *
+ * Members are not notified, leave them before calling this.
+ */
+void room_deinit(void);
+
+/**
+ * @brief       Join a room.
+ * @param[in] id Connection ID.
+ * @param[in] name Room name, need not be NUL terminated.
+ * @param[in] len Length of name, 0 for the lobby.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * The room is created when nobody is in it.  The connection leaves its
+ * current room, which is freed when it becomes empty.
+ */
+int room_join(unsigned int id, const char *name, size_t len);
+
+/**
+ * @brief       Leave the current room and go back to the lobby.
+ * @param[in] id Connection ID.
+ * @return      Returns 0 on success, minus value on any error.
+ */
+int room_part(unsigned int id);
+
+/**
+ * @brief       Leave the current room on disconnection.
+ * @param[in] id Connection ID.
+ */
+void room_leave(unsigned int id);
+
+/**
+ * @brief       Get the room of a connection.
+ * @param[in] id Connection ID.
+ * @param[out] len Length of the name.
+ * @return      Returns room name (empty for the lobby), NULL when id is
+ *              not in any room.
+ */
+const char *room_name(unsigned int id, size_t *len);
+
+/**
+ * @brief       Get members of a room.
+ * @param[in] name Room name.
+ * @param[in] len Length of name.
+ * @param[out] num Number of members.
+ * @return      Returns dense array of connection IDs, NULL when nobody
+ *              on this worker is in the room.
+ *
+ * The array is valid until the next join or leave.
+ */
+const unsigned int *room_members(const char *name, size_t len, unsigned int *num);
+
+#endif  /* #ifndef __ROOM_H_ */
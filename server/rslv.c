@@ -0,0 +1,552 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Reverse DNS resolver module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * getnameinfo() may take seconds until DNS times out, so it is called
+ * on resolver threads.  Workers put lookups into a shared job queue and
+ * take results from their own channel woken by an eventfd.  Results are
+ * kept in an LRU cache keyed by address for reconnecting hosts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+
+#include "trace.h"
+#include "evl.h"
+#include "main.h"
+#include "wrk.h"
+#include "rslv.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define RSLV_NIL        ((unsigned int)-1)    /* end of lists */
+#define RSLV_BUCKETS    (RSLV_CACHE_SIZE * 2) /* hash buckets of the cache */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* address as a cache key (port is not included) */
+typedef struct rslv_key_strct {
+    unsigned short family;      /* AF_INET, AF_INET6 */
+    unsigned char  addr[16];    /* address, zero padded */
+} rslv_key_t;
+
+/* cached result */
+typedef struct rslv_ent_strct {
+    rslv_key_t   key;           /* address */
+    time_t       expire;        /* monotonic time to expire */
+    unsigned int hnext;         /* next entry in the hash chain */
+    unsigned int prev;          /* more recently used entry */
+    unsigned int next;          /* less recently used entry */
+    char         name[RSLV_MAX_NAME]; /* host name, empty when not found */
+} rslv_ent_t;
+
+/* lookup request */
+typedef struct rslv_job_strct {
+    struct rslv_job_strct *next; /* next job */
+    struct sockaddr_storage addr; /* address to look up */
+    socklen_t    addrlen;       /* length of addr */
+    rslv_key_t   key;           /* cache key */
+    int          cacheable;     /* key is valid */
+    int          wrk_id;        /* requesting worker */
+    rslv_cb_t    cb;            /* completion callback */
+    void        *arg;           /* callback argument */
+    char         name[RSLV_MAX_NAME]; /* result */
+} rslv_job_t;
+
+/* results to a worker */
+typedef struct rslv_chan_strct {
+    pthread_mutex_t lock;       /* lock of the list */
+    rslv_job_t  *head;          /* first result */
+    rslv_job_t  *tail;          /* last result */
+    int          efd;           /* eventfd to wake up the worker */
+} rslv_chan_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static pthread_t       ths[RSLV_THREADS]; /* resolver threads */
+static int             ths_num;           /* number of running threads */
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER; /* lock of jobs */
+static pthread_cond_t  jobs_cond = PTHREAD_COND_INITIALIZER;  /* jobs queued */
+static rslv_job_t     *jobs_head;         /* first job */
+static rslv_job_t     *jobs_tail;         /* last job */
+static unsigned int    jobs_num;          /* number of jobs */
+static int             stopping;          /* stop request */
+static rslv_chan_t     chans[WRK_MAX];    /* channels to workers */
+static int             chans_num;         /* number of channels */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER; /* lock of cache */
+static rslv_ent_t     *cache;             /* cache entries */
+static unsigned int    cache_num;         /* number of entries used */
+static unsigned int    buckets[RSLV_BUCKETS]; /* heads of hash chains */
+static unsigned int    lru_head;          /* most recently used entry */
+static unsigned int    lru_tail;          /* least recently used entry */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static void *rslv_thread(void *arg);
+static int rslv_done_cb(evl_t *evl, int fd, unsigned int events, void *arg);
+static int rslv_key(const struct sockaddr *addr, rslv_key_t *key);
+static unsigned int rslv_hash(const rslv_key_t *key);
+static unsigned int rslv_find(const rslv_key_t *key);
+static void rslv_lru_unlink(unsigned int idx);
+static void rslv_lru_push(unsigned int idx);
+static int rslv_cache_get(const rslv_key_t *key, char *name, size_t size);
+static void rslv_cache_put(const rslv_key_t *key, const char *name);
+static time_t rslv_now(void);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int rslv_init(opr_t *opr)
+{
+    int cnt;
+    int ret;
+
+    cache = calloc(RSLV_CACHE_SIZE, sizeof(*cache));
+    if (cache == NULL)
+    {
+        T_M(T_E, 0x85010100, "cannot allocate resolver cache.\n");
+        return(0x85010100);
+    }
+    cache_num = 0;
+    lru_head  = RSLV_NIL;
+    lru_tail  = RSLV_NIL;
+    for (cnt = 0; cnt < RSLV_BUCKETS; cnt++)
+    {
+        buckets[cnt] = RSLV_NIL;
+    }
+
+    /* a channel for each worker */
+    for (chans_num = 0; chans_num < opr->threads && chans_num < WRK_MAX; chans_num++)
+    {
+        pthread_mutex_init(&chans[chans_num].lock, NULL);
+        chans[chans_num].head = NULL;
+        chans[chans_num].tail = NULL;
+        chans[chans_num].efd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (chans[chans_num].efd < 0)
+        {
+            T_M(T_E, 0x85010200, "cannot create eventfd: %s.\n", strerror(errno));
+            pthread_mutex_destroy(&chans[chans_num].lock);
+            return(0x85010200);
+        }
+    }
+
+    stopping = 0;
+    for (ths_num = 0; ths_num < RSLV_THREADS; ths_num++)
+    {
+        ret = pthread_create(&ths[ths_num], NULL, rslv_thread, NULL);
+        if (ret != 0)
+        {
+            T_M(T_E, 0x85010300, "cannot create resolver thread: %s.\n", strerror(ret));
+            return(0x85010300);
+        }
+    }
+    T_M(T_D1, 0x05010400, "%d resolver threads started.\n", ths_num);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void rslv_deinit(opr_t *opr)
+{
+    int cnt;
+    rslv_job_t *job;
+
+    /* stop resolver threads */
+    pthread_mutex_lock(&jobs_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_lock);
+    for (cnt = 0; cnt < ths_num; cnt++)
+    {
+        pthread_join(ths[cnt], NULL);
+    }
+    ths_num = 0;
+
+    /* discard jobs and results */
+    while ((job = jobs_head) != NULL)
+    {
+        jobs_head = job->next;
+        free(job);
+    }
+    jobs_tail = NULL;
+    jobs_num  = 0;
+    for (cnt = 0; cnt < chans_num; cnt++)
+    {
+        while ((job = chans[cnt].head) != NULL)
+        {
+            chans[cnt].head = job->next;
+            free(job);
+        }
+        close(chans[cnt].efd);
+        pthread_mutex_destroy(&chans[cnt].lock);
+    }
+    chans_num = 0;
+
+    free(cache);
+    cache = NULL;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int rslv_attach(evl_t *evl, int wrk_id)
+{
+    if (wrk_id < 0 || wrk_id >= chans_num)
+    {
+        T_M(T_E, 0x85030100, "no resolver channel for worker %d.\n", wrk_id);
+        return(0x85030100);
+    }
+
+    return(evl_add(evl, chans[wrk_id].efd, EVL_IN, rslv_done_cb, &chans[wrk_id]));
+}
+
+/*----------------------------------------------------------------------*/
+int rslv_lookup(const struct sockaddr *addr, socklen_t addrlen, char *name, size_t size,
+                rslv_cb_t cb, void *arg)
+{
+    int wrk_id = wrk_self();
+    int cacheable;
+    rslv_key_t key;
+    rslv_job_t *job;
+
+    if (wrk_id < 0 || wrk_id >= chans_num || ths_num == 0 ||
+        addrlen > sizeof(job->addr))
+    {
+        T_M(T_W, 0x85040100, "cannot look up host name.\n");
+        return(0x85040100);
+    }
+
+    /* reconnecting hosts are found in the cache */
+    cacheable = rslv_key(addr, &key);
+    if (cacheable && rslv_cache_get(&key, name, size))
+    {
+        T_M(T_D2, 0x05040200, "cached name: %s.\n", name);
+        return(1);
+    }
+
+    job = malloc(sizeof(*job));
+    if (job == NULL)
+    {
+        T_M(T_W, 0x85040300, "cannot allocate lookup.\n");
+        return(0x85040300);
+    }
+    job->key       = key;
+    job->cacheable = cacheable;
+    memcpy(&job->addr, addr, addrlen);
+    job->addrlen = addrlen;
+    job->wrk_id  = wrk_id;
+    job->cb      = cb;
+    job->arg     = arg;
+    job->next    = NULL;
+
+    pthread_mutex_lock(&jobs_lock);
+    if (jobs_num >= RSLV_MAX_JOBS)
+    {
+        pthread_mutex_unlock(&jobs_lock);
+        free(job);
+        T_M(T_W, 0x85040400, "too many lookups waiting.\n");
+        return(0x85040400);
+    }
+    if (jobs_tail != NULL)
+    {
+        jobs_tail->next = job;
+    }
+    else
+    {
+        jobs_head = job;
+    }
+    jobs_tail = job;
+    jobs_num++;
+    pthread_cond_signal(&jobs_cond);
+    pthread_mutex_unlock(&jobs_lock);
+
+    return(0);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static void *rslv_thread(void *arg)
+{
+    int notify;
+    rslv_job_t *job;
+    rslv_chan_t *chan;
+
+    for (;;)
+    {
+        /* take a job */
+        pthread_mutex_lock(&jobs_lock);
+        while (!stopping && jobs_head == NULL)
+        {
+            pthread_cond_wait(&jobs_cond, &jobs_lock);
+        }
+        if (stopping)
+        {
+            pthread_mutex_unlock(&jobs_lock);
+            break;
+        }
+        job = jobs_head;
+        jobs_head = job->next;
+        if (jobs_head == NULL)
+        {
+            jobs_tail = NULL;
+        }
+        jobs_num--;
+        pthread_mutex_unlock(&jobs_lock);
+
+        /* another thread may have looked up the same address meanwhile */
+        if (!(job->cacheable && rslv_cache_get(&job->key, job->name, sizeof(job->name))))
+        {
+            if (getnameinfo((struct sockaddr*)&job->addr, job->addrlen,
+                            job->name, sizeof(job->name), NULL, 0, NI_NAMEREQD) != 0)
+            {
+                job->name[0] = '\0';
+            }
+            if (job->cacheable)
+            {
+                rslv_cache_put(&job->key, job->name);
+            }
+        }
+        T_M(T_D2, 0x45010100, "resolved: %s.\n", job->name);
+
+        /* pass to the worker, only the first result wakes it up */
+        chan = &chans[job->wrk_id];
+        job->next = NULL;
+        pthread_mutex_lock(&chan->lock);
+        notify = (chan->head == NULL);
+        if (chan->tail != NULL)
+        {
+            chan->tail->next = job;
+        }
+        else
+        {
+            chan->head = job;
+        }
+        chan->tail = job;
+        pthread_mutex_unlock(&chan->lock);
+        if (notify)
+        {
+            (void)eventfd_write(chan->efd, 1);
+        }
+    }
+
+    return(NULL);
+}
+
+/*----------------------------------------------------------------------*/
+static int rslv_done_cb(evl_t *evl, int fd, unsigned int events, void *arg)
+{
+    rslv_chan_t *chan = arg;
+    rslv_job_t *job;
+    rslv_job_t *next;
+    eventfd_t val;
+
+    (void)eventfd_read(fd, &val);
+
+    pthread_mutex_lock(&chan->lock);
+    job = chan->head;
+    chan->head = NULL;
+    chan->tail = NULL;
+    pthread_mutex_unlock(&chan->lock);
+
+    while (job != NULL)
+    {
+        next = job->next;
+        job->cb(job->name, job->arg);
+        free(job);
+        job = next;
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static int rslv_key(const struct sockaddr *addr, rslv_key_t *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->family = addr->sa_family;
+
+    switch (addr->sa_family)
+    {
+    case AF_INET:
+        memcpy(key->addr, &((const struct sockaddr_in*)addr)->sin_addr, 4);
+        return(1);
+    case AF_INET6:
+        memcpy(key->addr, &((const struct sockaddr_in6*)addr)->sin6_addr, 16);
+        return(1);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned int rslv_hash(const rslv_key_t *key)
+{
+    unsigned int cnt;
+    unsigned int hash = 2166136261U; /* FNV-1a */
+
+    hash = (hash ^ key->family) * 16777619U;
+    for (cnt = 0; cnt < sizeof(key->addr); cnt++)
+    {
+        hash = (hash ^ key->addr[cnt]) * 16777619U;
+    }
+
+    return(hash & (RSLV_BUCKETS - 1));
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned int rslv_find(const rslv_key_t *key)
+{
+    unsigned int idx;
+
+    for (idx = buckets[rslv_hash(key)]; idx != RSLV_NIL; idx = cache[idx].hnext)
+    {
+        if (cache[idx].key.family == key->family &&
+            memcmp(cache[idx].key.addr, key->addr, sizeof(key->addr)) == 0)
+        {
+            break;
+        }
+    }
+
+    return(idx);
+}
+
+/*----------------------------------------------------------------------*/
+static void rslv_lru_unlink(unsigned int idx)
+{
+    if (cache[idx].prev != RSLV_NIL)
+    {
+        cache[cache[idx].prev].next = cache[idx].next;
+    }
+    else
+    {
+        lru_head = cache[idx].next;
+    }
+    if (cache[idx].next != RSLV_NIL)
+    {
+        cache[cache[idx].next].prev = cache[idx].prev;
+    }
+    else
+    {
+        lru_tail = cache[idx].prev;
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void rslv_lru_push(unsigned int idx)
+{
+    cache[idx].prev = RSLV_NIL;
+    cache[idx].next = lru_head;
+    if (lru_head != RSLV_NIL)
+    {
+        cache[lru_head].prev = idx;
+    }
+    else
+    {
+        lru_tail = idx;
+    }
+    lru_head = idx;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int rslv_cache_get(const rslv_key_t *key, char *name, size_t size)
+{
+    int ret = 0;
+    unsigned int idx;
+
+    pthread_mutex_lock(&cache_lock);
+    idx = rslv_find(key);
+    if (idx != RSLV_NIL && cache[idx].expire > rslv_now())
+    {
+        rslv_lru_unlink(idx);
+        rslv_lru_push(idx);
+        snprintf(name, size, "%s", cache[idx].name);
+        ret = 1;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    return(ret);
+}
+
+/*----------------------------------------------------------------------*/
+static void rslv_cache_put(const rslv_key_t *key, const char *name)
+{
+    unsigned int idx;
+    unsigned int *link;
+
+    pthread_mutex_lock(&cache_lock);
+    idx = rslv_find(key);
+    if (idx != RSLV_NIL)
+    {
+        rslv_lru_unlink(idx);
+    }
+    else
+    {
+        if (cache_num < RSLV_CACHE_SIZE)
+        {
+            idx = cache_num++;
+        }
+        else
+        {
+            /* evict the least recently used one */
+            idx = lru_tail;
+            rslv_lru_unlink(idx);
+            for (link = &buckets[rslv_hash(&cache[idx].key)]; *link != idx;
+                 link = &cache[*link].hnext)
+            {
+                ;
+            }
+            *link = cache[idx].hnext;
+        }
+        cache[idx].key   = *key;
+        cache[idx].hnext = buckets[rslv_hash(key)];
+        buckets[rslv_hash(key)] = idx;
+    }
+    snprintf(cache[idx].name, sizeof(cache[idx].name), "%s", name);
+    cache[idx].expire = rslv_now() + RSLV_CACHE_TTL;
+    rslv_lru_push(idx);
+    pthread_mutex_unlock(&cache_lock);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static time_t rslv_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return(ts.tv_sec);
+}
+
+/* end of rslv.c */
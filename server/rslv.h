@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for reverse DNS resolver module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Host names are looked up by resolver threads not to block the event
+ * loops, and results are passed back to the requesting worker through
+ * its eventfd.  Recent results are cached by address.
+ */
+#ifndef __RSLV_H_
+#define __RSLV_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <sys/socket.h>
+
+#include "evl.h"
+#include "main.h"
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def RSLV_THREADS
+ * @brief Number of resolver threads.
+ */
+#define RSLV_THREADS    2
+
+/**
+ * @def RSLV_MAX_NAME
+ * @brief Max length of host names including terminating NUL.
+ */
+#define RSLV_MAX_NAME   256
+
+/**
+ * @def RSLV_MAX_JOBS
+ * @brief Max number of lookups waiting for resolver threads.
+ *
+ * Connections beyond this are not looked up.
+ */
+#define RSLV_MAX_JOBS   4096
+
+/**
+ * @def RSLV_CACHE_SIZE
+ * @brief Number of cached addresses (power of 2).
+ */
+#define RSLV_CACHE_SIZE 1024
+
+/**
+ * @def RSLV_CACHE_TTL
+ * @brief Seconds to keep a cached result.
+ */
+#define RSLV_CACHE_TTL  600
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/**
+ * @brief       Lookup completion callback.
+ * @param[in] name Host name, empty string when no name is found.
+ * @param[in] arg Argument given to rslv_lookup().
+ *
+ * Called on the worker which requested the lookup.
+ */
+typedef void (*rslv_cb_t)(const char *name, void *arg);
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Resolver module init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ * @return      Returns 0 on success.
+ *              Returns minus value on any error.
+ *
+ * This function starts resolver threads.
+ */
+int rslv_init(opr_t *opr);
+
+/**
+ * @brief       Resolver module de-init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ *
+ * This function waits for resolver threads to finish the current lookups.
+ * Pending results are discarded without calling callbacks.
+ */
+void rslv_deinit(opr_t *opr);
+
+/**
+ * @brief       Register the result eventfd of a worker.
+ * @param[in] evl Event loop of the worker.
+ * @param[in] wrk_id Worker ID.
+ * @return      Returns 0 on success, minus value on any error.
+ */
+int rslv_attach(evl_t *evl, int wrk_id);
+
+/**
+ * @brief       Look up host name of an address.
+ * @param[in] addr Address.
+ * @param[in] addrlen Length of addr.
+ * @param[out] name Buffer to store cached name.
+ * @param[in] size Size of name.
+ * @param[in] cb Callback called when the name is resolved later.
+ * @param[in] arg Argument passed to cb.
+ * @return      Returns 1 when name is found in the cache (may be empty),
+ *              0 when cb is called later, minus value when not looked up.
+ *
+ * Call this on a worker thread.
+ */
+int rslv_lookup(const struct sockaddr *addr, socklen_t addrlen, char *name, size_t size,
+                rslv_cb_t cb, void *arg);
+
+#endif  /* #ifndef __RSLV_H_ */
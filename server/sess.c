@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Session module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Sessions are shared by all workers in a hash table under a lock.
+ * They are touched only on handshakes and disconnections.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include "trace.h"
+#include "main.h"
+#include "room.h"
+#include "sess.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define SESS_NIL        ((unsigned int)-1) /* end of lists */
+#define SESS_BUCKETS    (SESS_MAX * 2)     /* hash buckets */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* session */
+typedef struct sess_strct {
+    unsigned long long token;   /* token, 0 when free */
+    unsigned int hnext;         /* next session in the hash chain,
+                                   next free session when free */
+    unsigned int attached;      /* used by a connection */
+    time_t       expire;        /* monotonic time to expire when detached */
+    char         room[ROOM_MAX_NAME]; /* room on detach */
+} sess_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* lock of sessions */
+static sess_t         *sess;                 /* session table */
+static unsigned int    buckets[SESS_BUCKETS]; /* heads of hash chains */
+static unsigned int    vacant;               /* head of free list */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static unsigned int sess_hash(unsigned long long token);
+static unsigned int sess_find(unsigned long long token);
+static void sess_drop(unsigned int idx);
+static time_t sess_now(void);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int sess_init(opr_t *opr)
+{
+    unsigned int cnt;
+
+    sess = calloc(SESS_MAX, sizeof(*sess));
+    if (sess == NULL)
+    {
+        T_M(T_E, 0x88010100, "cannot allocate sessions.\n");
+        return(0x88010100);
+    }
+    for (cnt = 0; cnt < SESS_BUCKETS; cnt++)
+    {
+        buckets[cnt] = SESS_NIL;
+    }
+    vacant = SESS_NIL;
+    for (cnt = SESS_MAX; cnt > 0; cnt--)
+    {
+        sess[cnt-1].hnext = vacant;
+        vacant = cnt-1;
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void sess_deinit(opr_t *opr)
+{
+    free(sess);
+    sess = NULL;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int sess_create(unsigned long long *token)
+{
+    unsigned int idx;
+    unsigned int cnt;
+    unsigned int hash;
+    time_t now;
+
+    /* unguessable token */
+    do
+    {
+        if (getrandom(token, sizeof(*token), 0) != sizeof(*token))
+        {
+            T_M(T_W, 0x88030100, "cannot get random token: %s.\n", strerror(errno));
+            return(0x88030100);
+        }
+    } while (*token == 0);
+
+    pthread_mutex_lock(&lock);
+    if (vacant == SESS_NIL)
+    {
+        /* drop the session which expires first */
+        now = sess_now();
+        idx = SESS_NIL;
+        for (cnt = 0; cnt < SESS_MAX; cnt++)
+        {
+            if (!sess[cnt].attached &&
+                (idx == SESS_NIL || sess[cnt].expire < sess[idx].expire))
+            {
+                idx = cnt;
+            }
+        }
+        if (idx == SESS_NIL)
+        {
+            pthread_mutex_unlock(&lock);
+            T_M(T_W, 0x88030200, "too many sessions.\n");
+            return(0x88030200);
+        }
+        T_M(T_D1, 0x08030280, "drop session which expires in %lds.\n",
+            (long)(sess[idx].expire - now));
+        sess_drop(idx);
+    }
+
+    idx = vacant;
+    vacant = sess[idx].hnext;
+    sess[idx].token    = *token;
+    sess[idx].attached = 1;
+    sess[idx].room[0]  = '\0';
+    hash = sess_hash(*token);
+    sess[idx].hnext = buckets[hash];
+    buckets[hash]   = idx;
+    pthread_mutex_unlock(&lock);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int sess_attach(unsigned long long token, char *room, size_t size)
+{
+    unsigned int idx;
+
+    pthread_mutex_lock(&lock);
+    idx = sess_find(token);
+    if (idx != SESS_NIL && !sess[idx].attached && sess[idx].expire <= sess_now())
+    {
+        sess_drop(idx);
+        idx = SESS_NIL;
+    }
+    if (idx == SESS_NIL || sess[idx].attached)
+    {
+        pthread_mutex_unlock(&lock);
+        return(0x88040100);
+    }
+
+    sess[idx].attached = 1;
+    snprintf(room, size, "%s", sess[idx].room);
+    pthread_mutex_unlock(&lock);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void sess_detach(unsigned long long token, const char *room, size_t rlen)
+{
+    unsigned int idx;
+
+    if (rlen >= ROOM_MAX_NAME)
+    {
+        rlen = 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    idx = sess_find(token);
+    if (idx != SESS_NIL)
+    {
+        sess[idx].attached = 0;
+        sess[idx].expire   = sess_now() + SESS_TTL;
+        memcpy(sess[idx].room, room, rlen);
+        sess[idx].room[rlen] = '\0';
+    }
+    pthread_mutex_unlock(&lock);
+
+    return;
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static unsigned int sess_hash(unsigned long long token)
+{
+    /* tokens are random */
+    return((unsigned int)(token ^ (token >> 32)) & (SESS_BUCKETS - 1));
+}
+
+/*----------------------------------------------------------------------*/
+static unsigned int sess_find(unsigned long long token)
+{
+    unsigned int idx;
+
+    for (idx = buckets[sess_hash(token)]; idx != SESS_NIL; idx = sess[idx].hnext)
+    {
+        if (sess[idx].token == token)
+        {
+            return(idx);
+        }
+    }
+
+    return(SESS_NIL);
+}
+
+/*----------------------------------------------------------------------*/
+static void sess_drop(unsigned int idx)
+{
+    unsigned int *link;
+
+    /* unlink from the hash chain */
+    for (link = &buckets[sess_hash(sess[idx].token)]; *link != idx; link = &sess[*link].hnext)
+    {
+        ;
+    }
+    *link = sess[idx].hnext;
+
+    sess[idx].token = 0;
+    sess[idx].hnext = vacant;
+    vacant = idx;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static time_t sess_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return(ts.tv_sec);
+}
+
+/* end of sess.c */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for session module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * A session keeps identity of a client across TCP connections.  Clients
+ * get a random token and present it to resume on a new connection,
+ * which may be taken by any worker.
+ */
+#ifndef __SESS_H_
+#define __SESS_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include <stddef.h>
+
+#include "main.h"
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def SESS_MAX
+ * @brief Max number of sessions.
+ *
+ * The longest detached session is dropped when a new one is needed.
+ */
+#define SESS_MAX        4096
+
+/**
+ * @def SESS_TTL
+ * @brief Seconds to keep a detached session.
+ */
+#define SESS_TTL        600
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Session module init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ * @return      Returns 0 on success, minus value on any error.
+ */
+int sess_init(opr_t *opr);
+
+/**
+ * @brief       Session module de-init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ */
+void sess_deinit(opr_t *opr);
+
+/**
+ * @brief       Create a session attached to the calling connection.
+ * @param[out] token Session token, never 0.
+ * @return      Returns 0 on success, minus value on any error.
+ */
+int sess_create(unsigned long long *token);
+
+/**
+ * @brief       Attach a detached session.
+ * @param[in] token Session token.
+ * @param[out] room Room name stored on detach, NUL terminated.
+ * @param[in] size Size of room.
+ * @return      Returns 0 on success, minus value when the session is not
+ *              found, expired or attached to another connection.
+ */
+int sess_attach(unsigned long long token, char *room, size_t size);
+
+/**
+ * @brief       Detach a session on disconnection.
+ * @param[in] token Session token.
+ * @param[in] room Room name of the connection.
+ * @param[in] rlen Length of room.
+ */
+void sess_detach(unsigned long long token, const char *room, size_t rlen);
+
+#endif  /* #ifndef __SESS_H_ */
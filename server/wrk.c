@@ -0,0 +1,819 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Worker module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Run an event loop per thread.  Each worker has a lock-free multiple
+ * producer single consumer inbound queue and an eventfd to wake it up.
+ *
+ * Sequence numbers are given by an atomic counter, so a worker may take
+ * #4 from its queue before #3.  It holds such messages until the gap is
+ * filled, and anything else taken meanwhile waits behind them, so every
+ * worker delivers in the order of sequence numbers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "trace.h"
+#include "evl.h"
+#include "main.h"
+#include "lisn.h"
+#include "conn.h"
+#include "rslv.h"
+#include "clog.h"
+#include "metr.h"
+#include "hist.h"
+#include "wrk.h"
+
+/*======================================================================
+ * constants and macros
+ *======================================================================*/
+#define WRK_HELD_INIT   64      /* initial size of held messages */
+#define WRK_CALL        ((unsigned int)-2) /* node calls a function */
+
+/*======================================================================
+ * typedefs, structures
+ *======================================================================*/
+/* inbound queue node */
+typedef struct wrk_node_strct {
+    struct wrk_node_strct *_Atomic next; /* next node, next waiting one */
+    msg_t *msg;                 /* message, NULL for WRK_CALL */
+    unsigned int  to;           /* connection ID, WRK_ALL for all */
+    unsigned int gen;           /* generation of the connection */
+    void (*fn)(void *arg);      /* function of WRK_CALL */
+    void *arg;                  /* argument of fn */
+    unsigned long long after;   /* largest seq taken before this one */
+    struct wrk_block_strct *blk; /* block of the node, NULL if alone */
+} wrk_node_t;
+
+/* nodes of a message for all workers, allocated at once */
+typedef struct wrk_block_strct {
+    atomic_int  refs;           /* nodes not released */
+    wrk_node_t  node[];         /* node per worker */
+} wrk_block_t;
+
+/* worker */
+typedef struct wrk_strct {
+    _Alignas(64)
+    wrk_node_t *_Atomic head;   /* last pushed node (producers) */
+    atomic_int notified;        /* efd has been written */
+
+    _Alignas(64)
+    wrk_node_t *tail;           /* next node to pop (consumer) */
+    wrk_node_t *stub;           /* stub node */
+    int         id;             /* worker ID */
+    int         efd;            /* eventfd to wake up */
+    evl_t      *evl;            /* event loop */
+    pthread_t   th;             /* thread */
+    int         ret;            /* result of the worker */
+    unsigned long long next;    /* seq to deliver next */
+    unsigned long long top;     /* largest seq taken */
+    wrk_node_t **held;          /* messages taken ahead of next by seq */
+    unsigned int hcap;          /* size of held (power of 2) */
+    wrk_node_t *later;          /* others taken while holding messages */
+    wrk_node_t *later_tail;     /* last one of later */
+} wrk_t;
+
+/*======================================================================
+ * global variables
+ *======================================================================*/
+
+/*------------------------------
+ * private
+ *------------------------------*/
+static opr_t *wrk_opr;          /* operation parameters */
+static wrk_t *wrks;             /* workers */
+static int    wrks_num;         /* number of workers */
+static atomic_int stopping;     /* stop request */
+static __thread int self = -1;  /* ID of the running worker */
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static void wrk_push(wrk_t *w, wrk_node_t *node);
+static wrk_node_t *wrk_pop(wrk_t *w);
+static void wrk_notify(wrk_t *w);
+static wrk_block_t *wrk_block(msg_t *msg);
+static void wrk_free(wrk_node_t *node);
+static void wrk_take(wrk_t *w, wrk_node_t *node);
+static int wrk_hold(wrk_t *w, unsigned long long seq);
+static void wrk_advance(wrk_t *w, unsigned long long upto);
+static void wrk_dispatch(wrk_node_t *node);
+static int wrk_notify_cb(evl_t *evl, int fd, unsigned int events, void *arg);
+static void wrk_drain(wrk_t *w);
+static int wrk_loop(wrk_t *w);
+static void *wrk_thread(void *arg);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int wrk_init(opr_t *opr)
+{
+    int cnt;
+
+    if (opr->threads < 1 || opr->threads > WRK_MAX)
+    {
+        T_M(T_E, 0x83010100, "invalid number of threads: %d.\n", opr->threads);
+        return(0x83010100);
+    }
+
+    wrks = calloc(opr->threads, sizeof(*wrks));
+    if (wrks == NULL)
+    {
+        T_M(T_E, 0x83010200, "cannot allocate workers.\n");
+        return(0x83010200);
+    }
+    wrk_opr  = opr;
+    wrks_num = opr->threads;
+    atomic_store(&stopping, 0);
+
+    for (cnt = 0; cnt < wrks_num; cnt++)
+    {
+        wrks[cnt].id  = cnt;
+        wrks[cnt].efd = -1;
+
+        wrks[cnt].stub = calloc(1, sizeof(wrk_node_t));
+        if (wrks[cnt].stub == NULL)
+        {
+            T_M(T_E, 0x83010300, "cannot allocate queue of worker %d.\n", cnt);
+            return(0x83010300);
+        }
+        atomic_store(&wrks[cnt].head, wrks[cnt].stub);
+        wrks[cnt].tail = wrks[cnt].stub;
+        wrks[cnt].next = hist_last() + 1;
+        wrks[cnt].top  = wrks[cnt].next - 1;
+
+        wrks[cnt].efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wrks[cnt].efd < 0)
+        {
+            T_M(T_E, 0x83010400, "cannot create eventfd: %s.\n", strerror(errno));
+            return(0x83010400);
+        }
+
+        wrks[cnt].evl = evl_create(opr->evl_backend);
+        if (wrks[cnt].evl == NULL)
+        {
+            return(0x83010500);
+        }
+    }
+    T_M(T_D1, 0x03010600, "%d workers initialized.\n", wrks_num);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void wrk_deinit(opr_t *opr)
+{
+    int cnt;
+    unsigned int idx;
+    wrk_node_t *node;
+
+    if (wrks == NULL)
+    {
+        return;
+    }
+
+    for (cnt = 0; cnt < wrks_num; cnt++)
+    {
+        /* discard undelivered messages */
+        if (wrks[cnt].stub != NULL)
+        {
+            while ((node = wrk_pop(&wrks[cnt])) != NULL)
+            {
+                wrk_free(node);
+            }
+            free(wrks[cnt].stub);
+        }
+        for (idx = 0; idx < wrks[cnt].hcap; idx++)
+        {
+            if (wrks[cnt].held[idx] != NULL)
+            {
+                wrk_free(wrks[cnt].held[idx]);
+            }
+        }
+        free(wrks[cnt].held);
+        while ((node = wrks[cnt].later) != NULL)
+        {
+            wrks[cnt].later = atomic_load_explicit(&node->next, memory_order_relaxed);
+            wrk_free(node);
+        }
+        if (wrks[cnt].efd >= 0)
+        {
+            close(wrks[cnt].efd);
+        }
+        evl_destroy(wrks[cnt].evl);
+    }
+
+    free(wrks);
+    wrks     = NULL;
+    wrks_num = 0;
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int wrk_run(opr_t *opr)
+{
+    int cnt;
+    int ret;
+    int err = 0;
+
+    /* start workers other than worker 0 */
+    for (cnt = 1; cnt < wrks_num; cnt++)
+    {
+        ret = pthread_create(&wrks[cnt].th, NULL, wrk_thread, &wrks[cnt]);
+        if (ret != 0)
+        {
+            T_M(T_E, 0x83030100, "cannot create worker %d: %s.\n", cnt, strerror(ret));
+            wrk_stop();
+            wrks_num = cnt;
+            err = 0x83030100;
+            break;
+        }
+    }
+
+    /* worker 0 runs on this thread */
+    if (err == 0)
+    {
+        (void)wrk_thread(&wrks[0]);
+    }
+
+    for (cnt = 1; cnt < wrks_num; cnt++)
+    {
+        pthread_join(wrks[cnt].th, NULL);
+    }
+
+    for (cnt = 0; cnt < wrks_num && err == 0; cnt++)
+    {
+        if (wrks[cnt].ret < 0)
+        {
+            err = wrks[cnt].ret;
+        }
+    }
+
+    return(err);
+}
+
+/*----------------------------------------------------------------------*/
+void wrk_stop(void)
+{
+    int cnt;
+
+    atomic_store(&stopping, 1);
+
+    /* wake up all workers */
+    for (cnt = 0; cnt < wrks_num; cnt++)
+    {
+        if (wrks[cnt].efd >= 0)
+        {
+            atomic_store(&wrks[cnt].notified, 1);
+            (void)eventfd_write(wrks[cnt].efd, 1);
+        }
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+int wrk_num(void)
+{
+    return(wrks_num);
+}
+
+/*----------------------------------------------------------------------*/
+int wrk_self(void)
+{
+    return(self);
+}
+
+/*----------------------------------------------------------------------*/
+int wrk_broadcast(msg_t *msg)
+{
+    int cnt;
+    wrk_block_t *blk;
+
+    blk = wrk_block(msg);
+    if (blk == NULL)
+    {
+        T_M(T_W, 0x83070100, "cannot allocate message for workers.\n");
+        return(0x83070100);
+    }
+
+    for (cnt = 0; cnt < wrks_num; cnt++)
+    {
+        if (cnt == self)
+        {
+            wrk_free(&blk->node[cnt]);
+            continue;
+        }
+        wrk_push(&wrks[cnt], &blk->node[cnt]);
+        wrk_notify(&wrks[cnt]);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int wrk_publish(msg_t *msg)
+{
+    int cnt;
+    wrk_t *w = &wrks[self];
+    wrk_block_t *blk = NULL;
+
+    /* every number given has to reach every worker, allocate before it */
+    if (wrks_num > 1)
+    {
+        blk = wrk_block(msg);
+        if (blk == NULL)
+        {
+            T_M(T_W, 0x830a0100, "cannot allocate message for workers.\n");
+            return(0x830a0100);
+        }
+    }
+    msg->seq = hist_stamp();
+
+    for (cnt = 0; blk != NULL && cnt < wrks_num; cnt++)
+    {
+        if (cnt != self)
+        {
+            wrk_push(&wrks[cnt], &blk->node[cnt]);
+            wrk_notify(&wrks[cnt]);
+        }
+    }
+
+    /* nothing before it is missing here */
+    if (w->next == msg->seq)
+    {
+        w->next++;
+        w->top = msg->seq;
+        (void)conn_deliver(msg);
+        if (blk != NULL)
+        {
+            wrk_free(&blk->node[self]);
+        }
+        return(0);
+    }
+
+    /* the others queue the earlier ones right after stamping them, wait
+       for them so that replies to the sender do not overtake its line */
+    wrk_take(w, &blk->node[self]);
+    while (w->next <= msg->seq)
+    {
+        sched_yield();
+        wrk_drain(w);
+    }
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int wrk_send(int id, unsigned int conn, unsigned int gen, msg_t *msg)
+{
+    wrk_node_t *node;
+
+    if (id < 0 || id >= wrks_num)
+    {
+        return(0x83080100);
+    }
+
+    node = malloc(sizeof(*node));
+    if (node == NULL)
+    {
+        T_M(T_W, 0x83080200, "cannot allocate message for worker %d.\n", id);
+        return(0x83080200);
+    }
+    node->msg = msg_ref(msg);
+    node->to  = conn;
+    node->gen = gen;
+    node->blk = NULL;
+
+    wrk_push(&wrks[id], node);
+    wrk_notify(&wrks[id]);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int wrk_call(int id, void (*fn)(void *arg), void *arg)
+{
+    wrk_node_t *node;
+
+    if (id < 0 || id >= wrks_num)
+    {
+        return(0x830d0100);
+    }
+
+    node = malloc(sizeof(*node));
+    if (node == NULL)
+    {
+        T_M(T_W, 0x830d0200, "cannot allocate call for worker %d.\n", id);
+        return(0x830d0200);
+    }
+    node->msg = NULL;
+    node->to  = WRK_CALL;
+    node->fn  = fn;
+    node->arg = arg;
+    node->blk = NULL;
+
+    wrk_push(&wrks[id], node);
+    wrk_notify(&wrks[id]);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+int wrk_poll(void)
+{
+    if (atomic_load(&stopping))
+    {
+        return(0x830e0100);
+    }
+    sched_yield();
+    wrk_drain(&wrks[self]);
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+void wrk_wake(int id)
+{
+    if (id >= 0 && id < wrks_num && wrks[id].efd >= 0)
+    {
+        wrk_notify(&wrks[id]);
+    }
+
+    return;
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static void wrk_push(wrk_t *w, wrk_node_t *node)
+{
+    wrk_node_t *prev;
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&w->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static wrk_node_t *wrk_pop(wrk_t *w)
+{
+    wrk_node_t *tail = w->tail;
+    wrk_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    /* skip the stub */
+    if (tail == w->stub)
+    {
+        if (next == NULL)
+        {
+            return(NULL);
+        }
+        w->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        w->tail = next;
+        return(tail);
+    }
+
+    /* a producer is in the middle of push, it notifies us later */
+    if (tail != atomic_load_explicit(&w->head, memory_order_acquire))
+    {
+        return(NULL);
+    }
+
+    /* put the stub back to pop the last node */
+    wrk_push(w, w->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL)
+    {
+        w->tail = next;
+        return(tail);
+    }
+
+    return(NULL);
+}
+
+/*----------------------------------------------------------------------*/
+static void wrk_notify(wrk_t *w)
+{
+    /* only the first producer after the last wake up writes efd */
+    if (atomic_exchange(&w->notified, 1) == 0)
+    {
+        (void)eventfd_write(w->efd, 1);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int wrk_notify_cb(evl_t *evl, int fd, unsigned int events, void *arg)
+{
+    wrk_t *w = arg;
+    eventfd_t val;
+    metr_buf_t buf;
+
+    (void)eventfd_read(fd, &val);
+    atomic_store(&w->notified, 0);
+
+    /* the admin thread asks for connections of this worker */
+    if (metr_wanted())
+    {
+        memset(&buf, 0, sizeof(buf));
+        conn_report(&buf);
+        metr_publish(&buf);
+    }
+
+    wrk_drain(w);
+    conn_commit();
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void wrk_drain(wrk_t *w)
+{
+    wrk_node_t *node;
+
+    while ((node = wrk_pop(w)) != NULL)
+    {
+        wrk_take(w, node);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static wrk_block_t *wrk_block(msg_t *msg)
+{
+    int cnt;
+    wrk_block_t *blk;
+
+    blk = malloc(sizeof(*blk) + sizeof(blk->node[0]) * wrks_num);
+    if (blk == NULL)
+    {
+        return(NULL);
+    }
+    atomic_init(&blk->refs, wrks_num);
+    for (cnt = 0; cnt < wrks_num; cnt++)
+    {
+        blk->node[cnt].msg = msg_ref(msg);
+        blk->node[cnt].to  = WRK_ALL;
+        blk->node[cnt].blk = blk;
+    }
+
+    return(blk);
+}
+
+/*----------------------------------------------------------------------*/
+static void wrk_free(wrk_node_t *node)
+{
+    wrk_block_t *blk = node->blk;
+
+    if (node->msg != NULL)
+    {
+        msg_unref(node->msg);
+    }
+    if (blk == NULL)
+    {
+        free(node);
+    }
+    else if (atomic_fetch_sub_explicit(&blk->refs, 1, memory_order_acq_rel) == 1)
+    {
+        free(blk);
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void wrk_take(wrk_t *w, wrk_node_t *node)
+{
+    unsigned long long seq = (node->to == WRK_ALL)? node->msg->seq : 0;
+
+    if (seq == 0)
+    {
+        /* behind the messages held when it is taken */
+        if (w->later == NULL && w->next > w->top)
+        {
+            wrk_dispatch(node);
+            return;
+        }
+        node->after = w->top;
+        atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+        if (w->later == NULL)
+        {
+            w->later = node;
+        }
+        else
+        {
+            atomic_store_explicit(&w->later_tail->next, node, memory_order_relaxed);
+        }
+        w->later_tail = node;
+        return;
+    }
+
+    if (seq < w->next)
+    {
+        /* given up waiting for it */
+        wrk_dispatch(node);
+        return;
+    }
+    if (seq - w->next >= w->hcap && wrk_hold(w, seq) < 0)
+    {
+        /* deliver what is held skipping gaps not to stall */
+        T_MR(T_W, 0xc30b0100, "cannot hold message #%llu, delivering out of order.\n", seq);
+        wrk_advance(w, w->top);
+        w->next = seq + 1;
+        w->top  = seq;
+        wrk_dispatch(node);
+        return;
+    }
+
+    w->held[seq & (w->hcap - 1)] = node;
+    if (seq > w->top)
+    {
+        w->top = seq;
+    }
+    wrk_advance(w, 0);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int wrk_hold(wrk_t *w, unsigned long long seq)
+{
+    unsigned int cap;
+    unsigned long long cnt;
+    wrk_node_t **held;
+
+    for (cap = (w->hcap > 0)? w->hcap * 2 : WRK_HELD_INIT; seq - w->next >= cap; cap *= 2)
+    {
+        ;
+    }
+    held = calloc(cap, sizeof(*held));
+    if (held == NULL)
+    {
+        return(0xc30c0100);
+    }
+
+    /* move held messages to the slots of the new size */
+    for (cnt = w->next; w->hcap > 0 && cnt <= w->top; cnt++)
+    {
+        held[cnt & (cap - 1)] = w->held[cnt & (w->hcap - 1)];
+    }
+    free(w->held);
+    w->held = held;
+    w->hcap = cap;
+
+    return(0);
+}
+
+/*----------------------------------------------------------------------*/
+static void wrk_advance(wrk_t *w, unsigned long long upto)
+{
+    wrk_node_t *node;
+
+    for (;;)
+    {
+        /* taken before the next one */
+        while (w->later != NULL && w->later->after < w->next)
+        {
+            node = w->later;
+            w->later = atomic_load_explicit(&node->next, memory_order_relaxed);
+            wrk_dispatch(node);
+        }
+        if (w->next > w->top)
+        {
+            break;
+        }
+
+        node = w->held[w->next & (w->hcap - 1)];
+        if (node == NULL && w->next > upto)
+        {
+            break;
+        }
+        w->held[w->next & (w->hcap - 1)] = NULL;
+        w->next++;
+        if (node != NULL)
+        {
+            wrk_dispatch(node);
+        }
+    }
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static void wrk_dispatch(wrk_node_t *node)
+{
+    if (node->to == WRK_ALL)
+    {
+        (void)conn_deliver(node->msg);
+    }
+    else if (node->to == WRK_CALL)
+    {
+        node->fn(node->arg);
+    }
+    else
+    {
+        (void)conn_deliver_to(node->to, node->gen, node->msg);
+    }
+    wrk_free(node);
+
+    return;
+}
+
+/*----------------------------------------------------------------------*/
+static int wrk_loop(wrk_t *w)
+{
+    int ret;
+
+    ret = evl_add(w->evl, w->efd, EVL_IN, wrk_notify_cb, w);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    /* host names of this worker's connections are passed back here */
+    ret = rslv_attach(w->evl, w->id);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    /* connection management module is per worker */
+    ret = conn_init(wrk_opr, w->evl);
+    if (ret < 0)
+    {
+        return(ret);
+    }
+
+    /* wait for connections on the listening sockets of this worker */
+    ret = lisn_attach(w->evl, w->id);
+    if (ret >= 0)
+    {
+        T_M(T_D2, 0x43050100, "worker %d started.\n", w->id);
+        while (!atomic_load(&stopping))
+        {
+            ret = evl_wait(w->evl, -1);
+
+            /* messages of this iteration are synced together */
+            clog_commit();
+            if (ret < 0)
+            {
+                break;
+            }
+            metr_hist(METR_LOOP, evl_now() - evl_woken(w->evl));
+        }
+    }
+
+    conn_deinit(wrk_opr);
+
+    return((ret < 0)? ret : 0);
+}
+
+/*----------------------------------------------------------------------*/
+static void *wrk_thread(void *arg)
+{
+    wrk_t *w = arg;
+
+    self = w->id;
+    metr_attach(w->id);
+    w->ret = wrk_loop(w);
+    metr_attach(-1);
+    if (w->ret < 0)
+    {
+        /* stop the others on error */
+        T_M(T_E, 0xc3060100, "worker %d stopped on error.\n", w->id);
+        wrk_stop();
+    }
+    T_M(T_D2, 0x43060200, "worker %d finished.\n", w->id);
+
+    return(NULL);
+}
+
+/* end of wrk.c */
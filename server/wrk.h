@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Header file for worker module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Each worker owns an event loop, its listening sockets and the
+ * connections accepted on them.  Messages for the connections of other
+ * workers are passed through lock-free inbound queues.
+ */
+#ifndef __WRK_H_
+#define __WRK_H_
+
+/*======================================================================
+ * includes
+ *======================================================================*/
+#include "main.h"
+#include "msg.h"
+
+/*======================================================================
+ * constants, macros
+ *======================================================================*/
+/**
+ * @def WRK_MAX
+ * @brief Max number of workers.
+ */
+#define WRK_MAX         64
+
+/**
+ * @def WRK_ALL
+ * @brief Connection ID to deliver to all connections of a worker.
+ */
+#define WRK_ALL         ((unsigned int)-1)
+
+/*======================================================================
+ * prototype declarations
+ *======================================================================*/
+
+/**
+ * @brief       Worker module init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ * @return      Returns 0 on success.
+ *              Returns minus value on any error.
+ *
+ * This function prepares opr->threads workers.
+ */
+int wrk_init(opr_t *opr);
+
+/**
+ * @brief       Worker module de-init.
+ * @param[in,out] opr Pointer to the operation parameters.
+ */
+void wrk_deinit(opr_t *opr);
+
+/**
+ * @brief       Run workers.
+ * @param[in] opr Pointer to the operation parameters.
+ * @return      Returns 0 when stopped by wrk_stop().
+ *              Returns minus value on any error.
+ *
+ * Worker 0 runs on the calling thread, the others on new threads.
+ * This function returns after all workers finished.
+ */
+int wrk_run(opr_t *opr);
+
+/**
+ * @brief       Stop all workers.
+ *
+ * This function is async-signal-safe.
+ */
+void wrk_stop(void);
+
+/**
+ * @brief       Number of workers.
+ * @return      Returns number of workers.
+ */
+int wrk_num(void);
+
+/**
+ * @brief       ID of the calling worker.
+ * @return      Returns worker ID, minus value when not called by a worker.
+ */
+int wrk_self(void);
+
+/**
+ * @brief       Broadcast message to the other workers.
+ * @param[in] msg Message to send.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Each of the other workers takes a reference to msg and delivers it
+ * to its connections.
+ */
+int wrk_broadcast(msg_t *msg);
+
+/**
+ * @brief       Stamp message and deliver it on all workers.
+ * @param[in,out] msg Message to send, msg->seq is set.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * Every worker delivers messages in the order of msg->seq.  The calling
+ * worker delivers msg before returning, waiting for the earlier numbers
+ * the other workers are queueing, so replies to the sender follow it.
+ */
+int wrk_publish(msg_t *msg);
+
+/**
+ * @brief       Send message to a connection of a worker.
+ * @param[in] id Worker ID.
+ * @param[in] conn Connection ID in the worker.
+ * @param[in] gen Generation of the connection.
+ * @param[in] msg Message to send.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * The worker takes a reference to msg and drops it when the connection
+ * has been closed.
+ */
+int wrk_send(int id, unsigned int conn, unsigned int gen, msg_t *msg);
+
+/**
+ * @brief       Call function on a worker.
+ * @param[in] id Worker ID.
+ * @param[in] fn Function called by the worker.
+ * @param[in] arg Argument of fn.
+ * @return      Returns 0 on success, minus value on any error.
+ *
+ * fn is called in the order of the other messages queued to the worker.
+ */
+int wrk_call(int id, void (*fn)(void *arg), void *arg);
+
+/**
+ * @brief       Take messages queued to the calling worker.
+ * @return      Returns 0 on success, minus value when workers are stopping.
+ *
+ * Call this repeatedly to wait for the other workers, which may be waiting
+ * for this worker in turn.
+ */
+int wrk_poll(void);
+
+/**
+ * @brief       Wake up a worker.
+ * @param[in] id Worker ID.
+ *
+ * The worker checks requests from the other threads such as metr_wanted().
+ */
+void wrk_wake(int id);
+
+#endif  /* #ifndef __WRK_H_ */
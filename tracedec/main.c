@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014 Fukuda Laboratory and Shigemi ISHIDA, Kyushu University
+ *
+ * This software is released under the MIT License.
+ * http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * @file
+ *      Flight recorder dump decoder main module.
+ * @author
+ *      Shigemi Ishida <ishida+devel@f.ait.kyushu-u.ac.jp>
+ *
+ * Print traces dumped by the flight recorder of the tracer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/*======================================================================
+ * prototype declarations for private functions
+ *======================================================================*/
+static void usage(void);
+
+/*======================================================================
+ * functions
+ *======================================================================*/
+int main(int argc, char *argv[])
+{
+    int ret;
+    int with_time = 0;
+
+    /* set a default trace level to ERROR */
+    T_init(T_E);
+
+    for (;;)
+    {
+        ret = getopt(argc, argv, "ht");
+
+        if (ret < 0)
+        {
+            break;
+        }
+        switch (ret)
+        {
+        case 'h':
+            usage();
+            return(0);
+        case 't':               /* show time and thread */
+            with_time = 1;
+            break;
+        default:                /* invalid option */
+            usage();
+            return(1);
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        T_M(T_E, 0xc0010100, "invalid arguments.\n");
+        usage();
+        return(1);
+    }
+
+    ret = T_decode(argv[optind], with_time);
+
+    return((ret < 0)? 1 : 0);
+}
+
+/*======================================================================
+ * private functions
+ *======================================================================*/
+static void usage(void)
+{
+    puts("Usage:");
+    puts("\ttracedec [-h] [-t] <dump_file>");
+    puts("");
+    puts("Options:");
+    puts("\t-h show this help and exit");
+    puts("\t-t show time and thread ID of each trace");
+
+    return;
+}
+
+/* end of main.c */